@@ -0,0 +1,160 @@
+/*
+ * Latency of batch GETs (MGET) against individual GETs.
+ *
+ * Start a ring of 16 nodes on the loopback interface, the first with a client port,
+ * e.g. (each node in its own terminal, or with -C and -D)
+ *     ./ring -c 58100 0 127.0.0.1 58000       (then "n")
+ *     ./ring 2 127.0.0.1 58002                (then "b 0 127.0.0.1 58000")
+ *     ...
+ *     ./ring 30 127.0.0.1 58030               (then "b 0 127.0.0.1 58000")
+ * and run
+ *     ./bench/batch_latency 127.0.0.1 58100 [rounds] [keys]
+ *
+ * Every round fetches the same distinct keys (0 to keys-1) three ways: one GET at a
+ * time, all the GETs pipelined, and a single MGET. The ring only has 32 keys, so that's
+ * as many as a round can fetch (an MGET asks for each key once).
+ */
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Read complete lines from the node until a number of them has arrived
+ *
+ * @param fd the connection
+ * @param lines how many lines to wait for
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int read_lines(int fd, int lines)
+{
+    static char buffer[1 << 16];
+    static size_t size = 0;
+    while (lines > 0) {
+        char *end;
+        while (lines > 0 && (end = memchr(buffer, '\n', size)) != NULL) {
+            if (strncmp(buffer, "ERR ", 4) == 0) {
+                printf("The node answered: %.*s\n", (int) (end - buffer), buffer);
+                return -1;
+            }
+            size -= end+1 - buffer;
+            memmove(buffer, end+1, size);
+            lines--;
+        }
+        if (lines == 0)
+            break;
+        ssize_t n = recv(fd, buffer+size, sizeof(buffer)-size, 0);
+        if (n <= 0)
+            return -1;
+        size += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Send all of a buffer to the node
+ *
+ * @param fd the connection
+ * @param line the buffer
+ * @param length its size
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_line(int fd, char *line, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = send(fd, line, length, 0);
+        if (n <= 0)
+            return -1;
+        line += n;
+        length -= n;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        printf("Usage: %s IP CLIENT_PORT [rounds] [keys]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int rounds = argc > 3 ? atoi(argv[3]) : 100;
+    int keys = argc > 4 ? atoi(argv[4]) : 32;
+    if (rounds < 1 || keys < 1 || keys > 32) {
+        puts("Invalid number of rounds or keys");
+        return EXIT_FAILURE;
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    int fd = -1;
+    if (getaddrinfo(argv[1], argv[2], &hints, &res) != 0 || (fd = socket(AF_INET, SOCK_STREAM, 0)) == -1
+            || connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+        puts("Couldn't connect to the node");
+        return EXIT_FAILURE;
+    }
+    freeaddrinfo(res);
+
+    // Give every key a value first
+    static char line[32768];
+    size_t length = sprintf(line, "MSET 0");
+    for (int k = 0; k < 32; k++)
+        length += sprintf(line+length, " %d value-of-%d", k, k);
+    line[length++] = '\n';
+    if (send_line(fd, line, length) != 0 || read_lines(fd, 1) != 0) {
+        puts("Couldn't store the values");
+        return EXIT_FAILURE;
+    }
+
+    double sequential = 0, pipelined = 0, batch = 0;
+    unsigned long id = 1;
+    for (int r = 0; r < rounds; r++) {
+        double start = now();
+        for (int k = 0; k < keys; k++) {
+            length = sprintf(line, "GET %lu %d\n", id++, k);
+            if (send_line(fd, line, length) != 0 || read_lines(fd, 1) != 0)
+                goto failed;
+        }
+        sequential += now() - start;
+
+        start = now();
+        length = 0;
+        for (int k = 0; k < keys; k++)
+            length += sprintf(line+length, "GET %lu %d\n", id++, k);
+        if (send_line(fd, line, length) != 0 || read_lines(fd, keys) != 0)
+            goto failed;
+        pipelined += now() - start;
+
+        start = now();
+        length = sprintf(line, "MGET %lu", id++);
+        for (int k = 0; k < keys; k++)
+            length += sprintf(line+length, " %d", k);
+        line[length++] = '\n';
+        if (send_line(fd, line, length) != 0 || read_lines(fd, keys) != 0)
+            goto failed;
+        batch += now() - start;
+    }
+
+    printf("%d keys, %d rounds (mean latency per round)\n", keys, rounds);
+    printf("  one GET at a time  %9.3f ms\n", sequential / rounds * 1000);
+    printf("  pipelined GETs     %9.3f ms\n", pipelined / rounds * 1000);
+    printf("  one MGET           %9.3f ms\n", batch / rounds * 1000);
+    close(fd);
+    return EXIT_SUCCESS;
+
+failed:
+    puts("Lost the connection to the node");
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,114 @@
+/*
+ * Space saved and CPU time spent by the value compression (-z), on a few kinds of values
+ * of different sizes. No ring is needed:
+ *     ./bench/compression [seconds per case]
+ *
+ * Every value is decompressed again and compared with the original, so this doubles as a
+ * check of the codec.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// JSON records like the ones a web application would store
+void make_json(char *dest, size_t size)
+{
+    static const char *names[] = { "alice", "bob", "carol", "dave", "erin", "frank", "grace", "heidi" };
+    size_t used = 0;
+    for (int i = 0; used < size; i++) {
+        char record[160];
+        int n = snprintf(record, sizeof(record), "{\"id\":%d,\"user\":\"%s\",\"score\":%d,\"active\":%s,\"tags\":[\"a%d\",\"b%d\"]},",
+            1000 + i, names[rand() % 8], rand() % 10000, rand() % 2 ? "true" : "false", rand() % 50, rand() % 50);
+        size_t copy = used + n > size ? size - used : (size_t) n;
+        memcpy(dest + used, record, copy);
+        used += copy;
+    }
+}
+
+// Log lines
+void make_log(char *dest, size_t size)
+{
+    static const char *levels[] = { "INFO", "WARN", "DEBUG", "ERROR" };
+    size_t used = 0;
+    for (int i = 0; used < size; i++) {
+        char line[160];
+        int n = snprintf(line, sizeof(line), "2024-05-%02d 12:%02d:%02d.%03d %s [worker-%d] handled request %d in %d ms\n",
+            1 + rand() % 28, rand() % 60, rand() % 60, rand() % 1000, levels[rand() % 4], rand() % 8, rand(), rand() % 500);
+        size_t copy = used + n > size ? size - used : (size_t) n;
+        memcpy(dest + used, line, copy);
+        used += copy;
+    }
+}
+
+// Random bytes, which can't be compressed
+void make_random(char *dest, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        dest[i] = (char) rand();
+}
+
+int main(int argc, char *argv[])
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 0.2;
+    if (seconds <= 0) {
+        puts("Invalid time");
+        return EXIT_FAILURE;
+    }
+    static const struct {
+        const char *name;
+        void (*make)(char*, size_t);
+    } kinds[] = { { "json", make_json }, { "log", make_log }, { "random", make_random } };
+    static const size_t sizes[] = { 256, 1024, 4096, 65536 };
+
+    char *value = (char*) malloc(65536), *packed = (char*) malloc(65536), *unpacked = (char*) malloc(65536);
+    if (value == NULL || packed == NULL || unpacked == NULL)
+        return EXIT_FAILURE;
+    printf("  kind       bytes    stored    saved   compress MB/s   decompress MB/s\n");
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(size_t); s++) {
+            size_t size = sizes[s];
+            srand(1);
+            kinds[k].make(value, size);
+
+            // Values that don't shrink are kept as they are
+            size_t length = 0;
+            int runs = 0;
+            double start = now(), elapsed;
+            do {
+                length = lz_compress(value, size, packed, size-1);
+                runs++;
+            } while ((elapsed = now() - start) < seconds);
+            double compress_speed = runs * size / elapsed / 1e6;
+
+            if (length == 0) {
+                printf("  %-6s %9zu %9zu %7.1f%% %15.0f %17s\n", kinds[k].name, size, size, 0.0, compress_speed, "-");
+                continue;
+            }
+            runs = 0;
+            start = now();
+            do {
+                if (lz_decompress(packed, length, unpacked, size) != 0 || memcmp(value, unpacked, size) != 0) {
+                    printf("  %-6s %9zu   the value didn't survive compression\n", kinds[k].name, size);
+                    return EXIT_FAILURE;
+                }
+                runs++;
+            } while ((elapsed = now() - start) < seconds);
+            printf("  %-6s %9zu %9zu %7.1f%% %15.0f %17.0f\n", kinds[k].name, size, length, 100.0 * (size - length) / size,
+                compress_speed, runs * size / elapsed / 1e6);
+        }
+    }
+    free(value);
+    free(packed);
+    free(unpacked);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/*
+ * Throughput and per-write latency of acknowledged SETs, pipelined through the client
+ * library with windows of different sizes.
+ *
+ * Start a ring of 16 nodes on the loopback interface, the first with a client port,
+ * e.g. (each node in its own terminal, or with -C and -D)
+ *     ./ring -c 58100 0 127.0.0.1 58000       (then "n")
+ *     ./ring 2 127.0.0.1 58002                (then "b 0 127.0.0.1 58000")
+ *     ...
+ *     ./ring 30 127.0.0.1 58030               (then "b 0 127.0.0.1 58000")
+ * and run
+ *     ./bench/set_pipeline 127.0.0.1:58100 [writes] [more client ports...]
+ *
+ * Every write is answered only once the key's owner has applied it, so a window of 1
+ * pays a whole trip around the ring per write, while wider windows overlap them.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Latencies of the writes of the current run, and how many failed
+double *latencies;
+int completed, failed;
+
+void write_done(const t_ring_result *result, void *arg)
+{
+    if (result->status != 0) {
+        if (failed++ == 0)
+            printf("  a write failed: %s\n", result->error);
+        return;
+    }
+    latencies[completed++] = result->latency;
+}
+
+int compare_latencies(const void *a, const void *b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        printf("Usage: %s IP:CLIENT_PORT [writes] [IP:CLIENT_PORT...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int writes = argc > 2 ? atoi(argv[2]) : 2000;
+    if (writes < 1) {
+        puts("Invalid number of writes");
+        return EXIT_FAILURE;
+    }
+    const char *endpoints[64] = { argv[1] };
+    int count = 1;
+    for (int i = 3; i < argc && count < 64; i++)
+        endpoints[count++] = argv[i];
+
+    t_ring *r = ring_open(endpoints, count);
+    latencies = (double*) malloc(writes * sizeof(double));
+    if (r == NULL || latencies == NULL) {
+        puts("Couldn't connect to the ring");
+        return EXIT_FAILURE;
+    }
+    // Learn which keys each node owns
+    while (ring_pending(r) > 0) {
+        if (ring_poll(r, 1000) < 0)
+            break;
+    }
+
+    static const int windows[] = { 1, 4, 16, 64 };
+    printf("%d writes per window\n", writes);
+    printf("  window   writes/s    mean ms     p50 ms     p99 ms\n");
+    char value[32];
+    for (size_t w = 0; w < sizeof(windows) / sizeof(int); w++) {
+        completed = failed = 0;
+        ring_set_window(r, windows[w]);
+        double start = now();
+        for (int i = 0; i < writes; i++) {
+            size_t length = sprintf(value, "w%d-%d", windows[w], i);
+            if (ring_set(r, i % 32, value, length, write_done, NULL) != 0)
+                failed++;
+        }
+        while (ring_pending(r) > 0) {
+            if (ring_poll(r, -1) < 0)
+                break;
+        }
+        double elapsed = now() - start;
+
+        if (completed == 0) {
+            printf("  %6d   all the writes failed\n", windows[w]);
+            continue;
+        }
+        double total = 0;
+        for (int i = 0; i < completed; i++)
+            total += latencies[i];
+        qsort(latencies, completed, sizeof(double), compare_latencies);
+        printf("  %6d %10.0f %10.3f %10.3f %10.3f", windows[w], completed / elapsed, total / completed * 1000,
+            latencies[completed / 2] * 1000, latencies[(int) (completed * 0.99)] * 1000);
+        if (failed > 0)
+            printf("   (%d failed)", failed);
+        putchar('\n');
+    }
+    ring_close(r);
+    free(latencies);
+    return EXIT_SUCCESS;
+}
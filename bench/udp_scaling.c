@@ -0,0 +1,113 @@
+/*
+ * UDP throughput benchmark for the worker threads (-w).
+ *
+ * Start a single-process ring, e.g.
+ *     ./ring -v 8 -w 4 0 127.0.0.1 58000 > /dev/null
+ *     (then "n" on its console)
+ * and run
+ *     ./bench/udp_scaling 127.0.0.1 58000 [seconds] [sockets] [window]
+ *
+ * Every socket keeps up to "window" SET requests in flight towards the shared
+ * port and counts the acknowledgements. The keys are spread over the 8 virtual
+ * nodes, so most requests are handed from the receiving worker thread to another.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#define MAX_SOCKETS 256
+
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int send_request(int fd, unsigned int seq, struct addrinfo *to)
+{
+    char message[64] = "";
+    int length = sprintf(message, "SET %u %u 0 v%u", seq % 32, seq % 100, seq);
+    return sendto(fd, message, length, 0, to->ai_addr, to->ai_addrlen) == length ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        printf("Usage: %s IP PORT [seconds] [sockets] [window]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    double seconds = argc > 3 ? atof(argv[3]) : 5.0;
+    int sockets = argc > 4 ? atoi(argv[4]) : 16;
+    int window = argc > 5 ? atoi(argv[5]) : 4;
+    if (sockets < 1 || sockets > MAX_SOCKETS || window < 1) {
+        puts("Invalid number of sockets or window size");
+        return EXIT_FAILURE;
+    }
+
+    struct addrinfo hints, *to;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(argv[1], argv[2], &hints, &to) != 0) {
+        puts("Couldn't resolve the node's address");
+        return EXIT_FAILURE;
+    }
+
+    // Each socket has its own source port, so SO_REUSEPORT spreads them over the workers
+    struct pollfd fds[MAX_SOCKETS];
+    int outstanding[MAX_SOCKETS];
+    double sent_at[MAX_SOCKETS];
+    unsigned int seq = 0;
+    for (int i = 0; i < sockets; i++) {
+        fds[i].fd = socket(AF_INET, SOCK_DGRAM, 0);
+        fds[i].events = POLLIN;
+        if (fds[i].fd == -1 || connect(fds[i].fd, to->ai_addr, to->ai_addrlen) != 0) {
+            puts("Couldn't create the sockets");
+            return EXIT_FAILURE;
+        }
+        outstanding[i] = 0;
+    }
+
+    long acked = 0, lost = 0;
+    double start = now(), end = start + seconds;
+    while (now() < end) {
+        for (int i = 0; i < sockets; i++) {
+            // Give up on requests that were dropped (e.g. full worker queues)
+            if (outstanding[i] > 0 && now() - sent_at[i] > 0.5) {
+                lost += outstanding[i];
+                outstanding[i] = 0;
+            }
+            while (outstanding[i] < window && send_request(fds[i].fd, seq++, to) == 0) {
+                outstanding[i]++;
+                sent_at[i] = now();
+            }
+        }
+        if (poll(fds, sockets, 100) <= 0)
+            continue;
+        char buffer[64];
+        for (int i = 0; i < sockets; i++) {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+            while (recv(fds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+                if (outstanding[i] > 0)
+                    outstanding[i]--;
+                acked++;
+            }
+        }
+    }
+    double elapsed = now() - start;
+
+    printf("%d socket(s), window %d: %ld request(s) in %.2f s, %.0f requests/s, %ld lost\n",
+        sockets, window, acked, elapsed, acked / elapsed, lost);
+    for (int i = 0; i < sockets; i++)
+        close(fds[i].fd);
+    freeaddrinfo(to);
+    return EXIT_SUCCESS;
+}
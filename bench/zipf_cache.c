@@ -0,0 +1,156 @@
+/*
+ * Hit ratio and throughput of the ring used as a cache (GET, and SET on a miss) under a
+ * Zipfian workload, with the data set taking more and more of the nodes' memory budget.
+ *
+ * Start a node with a memory budget and a client port, e.g.
+ *     ./ring -M 65536 -c 58100 0 127.0.0.1 58000       (then "n")
+ * (more nodes may join it, each with the same budget) and run
+ *     ./bench/zipf_cache 127.0.0.1:58100 65536 [operations] [IP:CLIENT_PORT...]
+ * giving the budget of all the nodes together.
+ *
+ * The budget is fixed, so each run grows the values instead: the 32 keys take 1x, 2x, 4x
+ * and 8x the budget, and the keys read least often are the ones that get evicted.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Skew of the key popularity (the i-th most popular key is read in proportion to 1/i^s)
+#define ZIPF_SKEW 0.99
+// How many requests each run keeps in flight
+#define WINDOW 16
+
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Cumulative probability of each key, most popular first
+double cdf[32];
+
+unsigned int zipf_key(void)
+{
+    double u = (double) rand() / RAND_MAX;
+    unsigned int key = 0;
+    while (key < 31 && cdf[key] < u)
+        key++;
+    return key;
+}
+
+// Size of the values of the current run, and what its GETs found
+size_t value_size;
+int hits, misses, failed;
+// Keys that missed and must be written back
+unsigned int refill[4096];
+int refills;
+
+void get_done(const t_ring_result *result, void *arg)
+{
+    if (result->status != 0) {
+        failed++;
+        return;
+    }
+    // A value left by a previous run is as good as none
+    if (result->value != NULL && result->length == value_size) {
+        hits++;
+        return;
+    }
+    misses++;
+    if (refills < (int) (sizeof(refill) / sizeof(refill[0])))
+        refill[refills++] = result->key;
+}
+
+void set_done(const t_ring_result *result, void *arg)
+{
+    if (result->status != 0)
+        failed++;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        printf("Usage: %s IP:CLIENT_PORT BUDGET [operations] [IP:CLIENT_PORT...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    long budget = atol(argv[2]);
+    int operations = argc > 3 ? atoi(argv[3]) : 20000;
+    if (budget < 256 || operations < 1) {
+        puts("Invalid budget or number of operations");
+        return EXIT_FAILURE;
+    }
+    const char *endpoints[64] = { argv[1] };
+    int count = 1;
+    for (int i = 4; i < argc && count < 64; i++)
+        endpoints[count++] = argv[i];
+
+    double total = 0;
+    for (int i = 0; i < 32; i++)
+        total += 1 / pow(i + 1, ZIPF_SKEW);
+    for (int i = 0; i < 32; i++)
+        cdf[i] = (i > 0 ? cdf[i-1] : 0) + 1 / pow(i + 1, ZIPF_SKEW) / total;
+
+    t_ring *r = ring_open(endpoints, count);
+    if (r == NULL) {
+        puts("Couldn't connect to the ring");
+        return EXIT_FAILURE;
+    }
+    // Learn which keys each node owns
+    while (ring_pending(r) > 0) {
+        if (ring_poll(r, 1000) < 0)
+            break;
+    }
+    ring_set_window(r, WINDOW);
+
+    static const int factors[] = { 1, 2, 4, 8 };
+    printf("%d operations per run, Zipf skew %.2f, budget %ld bytes\n", operations, ZIPF_SKEW, budget);
+    printf("  data/budget   value bytes   hit ratio      ops/s\n");
+    char *value = (char*) malloc(budget * 8 / 32 + 1);
+    if (value == NULL)
+        return EXIT_FAILURE;
+    for (size_t f = 0; f < sizeof(factors) / sizeof(int); f++) {
+        // Leave some room for rounding, so that the first run fits
+        value_size = budget * factors[f] / 32 - (factors[f] == 1 ? 8 : 0);
+        memset(value, 'a' + f, value_size);
+        hits = misses = failed = refills = 0;
+        srand(1);
+
+        // Warm up the cache, then measure
+        for (int phase = 0; phase < 2; phase++) {
+            if (phase == 1)
+                hits = misses = 0;
+            double start = now();
+            int done = 0;
+            while (done < operations) {
+                if (ring_get(r, zipf_key(), get_done, NULL) != 0)
+                    failed++;
+                done++;
+                for (int i = 0; i < refills; i++, done++) {
+                    if (ring_set(r, refill[i], value, value_size, set_done, NULL) != 0)
+                        failed++;
+                }
+                refills = 0;
+            }
+            while (ring_pending(r) > 0) {
+                if (ring_poll(r, -1) < 0)
+                    break;
+            }
+            double elapsed = now() - start;
+            if (phase == 1) {
+                printf("  %10dx %13zu %10.1f%% %10.0f", factors[f], value_size,
+                    hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0, done / elapsed);
+                if (failed > 0)
+                    printf("   (%d failed)", failed);
+                putchar('\n');
+            }
+        }
+    }
+    ring_close(r);
+    free(value);
+    return EXIT_SUCCESS;
+}
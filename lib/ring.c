@@ -0,0 +1,545 @@
+#define _POSIX_C_SOURCE 200112L
+#include "ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+// Most nodes a t_ring object can be connected to
+#define RING_MAX_NODES 64
+// Longest answer a node can send (a VALUE carries a whole value, and nodes keep values of
+// up to 16 MiB)
+#define RING_MAX_ANSWER ((16 << 20) + 4096)
+// How long a request waits for its answer by default (in milliseconds)
+#define RING_DEFAULT_TIMEOUT 5000
+
+typedef enum ring_request_type {
+    REQUEST_GET,
+    REQUEST_SET,
+    REQUEST_FIND,
+    REQUEST_OWNS
+} t_ring_request_type;
+
+typedef struct ring_request {
+    // Identifier sent with the request (0 if the slot is free)
+    unsigned long id;
+    t_ring_request_type type;
+    unsigned int key;
+    // Connection the request was sent through
+    int node;
+    t_ring_callback callback;
+    void *arg;
+    // When the request was sent
+    struct timeval sent;
+} t_ring_request;
+
+typedef struct ring_node {
+    // Socket file descriptor (-1 if the connection is closed)
+    int fd;
+    // Keys the node owns, as a bit mask
+    unsigned long owns;
+    // Bytes received that don't make a complete line yet
+    char *buffer;
+    size_t buffer_size, buffer_capacity;
+} t_ring_node;
+
+struct ring {
+    t_ring_node nodes[RING_MAX_NODES];
+    int node_count;
+    // Requests that haven't been answered, indexed by their identifier modulo the capacity
+    t_ring_request *requests;
+    size_t capacity;
+    int pending;
+    // Most requests in flight (0 for no limit)
+    int window;
+    // How long a request waits for its answer, in milliseconds (0 for ever)
+    int timeout;
+    unsigned long next_id;
+    // Where requests for keys no known node owns go next
+    int next_node;
+};
+
+/**
+ * @brief Connect to a node's client port
+ *
+ * @param endpoint the client port ("IP:PORT")
+ * @return [ @b int ] the socket file descriptor, or -1 in case of an error
+ */
+int ring_connect(const char *endpoint)
+{
+    char host[256];
+    const char *colon = strrchr(endpoint, ':');
+    if (colon == NULL || (size_t)(colon - endpoint) >= sizeof(host))
+        return -1;
+    memcpy(host, endpoint, colon - endpoint);
+    host[colon - endpoint] = '\0';
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon+1, &hints, &res) != 0)
+        return -1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd != -1 && connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+/**
+ * @brief Send all of a buffer
+ *
+ * @param fd the socket file descriptor
+ * @param data the buffer
+ * @param length its size
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int ring_send(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Find the slot of an unanswered request
+ *
+ * @param r the t_ring object
+ * @param id the request's identifier
+ * @return [ @b t_ring_request* ] the slot, or NULL if there is no such request
+ */
+t_ring_request *ring_find_request(t_ring *r, unsigned long id)
+{
+    t_ring_request *request = &r->requests[id & (r->capacity - 1)];
+    return request->id == id ? request : NULL;
+}
+
+/**
+ * @brief Get a free slot for a new request, making room if needed
+ *
+ * @param r the t_ring object
+ * @return [ @b t_ring_request* ] the slot (its id is set), or NULL in case of an error
+ */
+t_ring_request *ring_new_request(t_ring *r)
+{
+    unsigned long id = r->next_id;
+    while (r->requests[id & (r->capacity - 1)].id != 0) {
+        // An older request still holds the slot: double the table
+        t_ring_request *bigger = (t_ring_request*) calloc(r->capacity * 2, sizeof(t_ring_request));
+        if (bigger == NULL)
+            return NULL;
+        for (size_t i = 0; i < r->capacity; i++) {
+            if (r->requests[i].id != 0)
+                bigger[r->requests[i].id & (r->capacity * 2 - 1)] = r->requests[i];
+        }
+        free(r->requests);
+        r->requests = bigger;
+        r->capacity *= 2;
+    }
+    r->next_id++;
+    t_ring_request *request = &r->requests[id & (r->capacity - 1)];
+    memset(request, 0, sizeof(t_ring_request));
+    request->id = id;
+    return request;
+}
+
+/**
+ * @brief Call a request's callback and free its slot
+ *
+ * @param r the t_ring object
+ * @param request the request
+ * @param result what to pass to the callback (its key is filled in)
+ */
+void ring_finish(t_ring *r, t_ring_request *request, t_ring_result *result)
+{
+    t_ring_callback callback = request->callback;
+    void *arg = request->arg;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    result->key = request->key;
+    result->latency = (now.tv_sec - request->sent.tv_sec) + (now.tv_usec - request->sent.tv_usec) / 1e6;
+    request->id = 0;
+    r->pending--;
+    if (callback != NULL)
+        callback(result, arg);
+}
+
+/**
+ * @brief Close a connection, failing the requests that were sent through it
+ *
+ * @param r the t_ring object
+ * @param node index of the connection
+ */
+void ring_drop_node(t_ring *r, int node)
+{
+    t_ring_node *n = &r->nodes[node];
+    close(n->fd);
+    n->fd = -1;
+    n->owns = 0;
+    n->buffer_size = 0;
+    for (size_t i = 0; i < r->capacity; i++) {
+        if (r->requests[i].id != 0 && r->requests[i].node == node) {
+            t_ring_result result = { .status = -1, .error = "Connection to the node was lost" };
+            ring_finish(r, &r->requests[i], &result);
+        }
+    }
+}
+
+/**
+ * @brief Choose the connection a request for a key goes through: the key's owner if it
+ * is known, and the next connection in turn otherwise
+ *
+ * @param r the t_ring object
+ * @param key the key
+ * @return [ @b int ] index of the connection, or -1 if they are all closed
+ */
+int ring_route(t_ring *r, unsigned int key)
+{
+    for (int i = 0; i < r->node_count; i++) {
+        if (r->nodes[i].fd != -1 && (r->nodes[i].owns >> key & 1))
+            return i;
+    }
+    for (int tries = 0; tries < r->node_count; tries++) {
+        int i = r->next_node++ % r->node_count;
+        if (r->nodes[i].fd != -1)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Send a request
+ *
+ * @param r the t_ring object
+ * @param node index of the connection to send it through
+ * @param type the request's type
+ * @param key the key
+ * @param value the value (SET)
+ * @param length its size
+ * @param callback function called with the answer
+ * @param arg passed on to the callback
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int ring_request(t_ring *r, int node, t_ring_request_type type, unsigned int key, const char *value, size_t length, t_ring_callback callback, void *arg)
+{
+    if (node < 0 || key > 31)
+        return -1;
+    while (r->window > 0 && r->pending >= r->window) {
+        if (ring_poll(r, -1) < 0)
+            return -1;
+        // Waiting may have closed the connection
+        if (r->nodes[node].fd == -1)
+            return -1;
+    }
+    t_ring_request *request = ring_new_request(r);
+    if (request == NULL)
+        return -1;
+    unsigned long id = request->id;
+    char *line = (char*) malloc(length + 64);
+    if (line == NULL) {
+        request->id = 0;
+        return -1;
+    }
+    static const char *names[] = { "GET", "SET", "FIND", "OWNS" };
+    int size = type == REQUEST_OWNS ? sprintf(line, "OWNS %lu\n", id) : sprintf(line, "%s %lu %u", names[type], id, key);
+    if (type == REQUEST_SET && length > 0) {
+        line[size++] = ' ';
+        memcpy(line+size, value, length);
+        size += length;
+    }
+    if (type != REQUEST_OWNS)
+        line[size++] = '\n';
+
+    request->type = type;
+    request->key = key;
+    request->node = node;
+    request->callback = callback;
+    request->arg = arg;
+    gettimeofday(&request->sent, NULL);
+    r->pending++;
+    int result = ring_send(r->nodes[node].fd, line, size);
+    free(line);
+    if (result != 0) {
+        // The connection is gone: this request fails right away, the others sent
+        // through it get their callbacks called
+        request->id = 0;
+        r->pending--;
+        ring_drop_node(r, node);
+        return -1;
+    }
+    return 0;
+}
+
+t_ring *ring_open(const char *const *endpoints, int count)
+{
+    t_ring *r = (t_ring*) calloc(1, sizeof(t_ring));
+    if (r == NULL)
+        return NULL;
+    r->capacity = 64;
+    r->next_id = 1;
+    r->timeout = RING_DEFAULT_TIMEOUT;
+    r->requests = (t_ring_request*) calloc(r->capacity, sizeof(t_ring_request));
+    if (r->requests == NULL) {
+        free(r);
+        return NULL;
+    }
+    for (int i = 0; i < count && r->node_count < RING_MAX_NODES; i++) {
+        int fd = ring_connect(endpoints[i]);
+        if (fd == -1)
+            continue;
+        r->nodes[r->node_count].fd = fd;
+        r->node_count++;
+    }
+    if (r->node_count == 0 || ring_refresh(r) != 0) {
+        ring_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+int ring_refresh(t_ring *r)
+{
+    int sent = 0;
+    for (int i = 0; i < r->node_count; i++) {
+        if (r->nodes[i].fd != -1 && ring_request(r, i, REQUEST_OWNS, 0, NULL, 0, NULL, NULL) == 0)
+            sent++;
+    }
+    return sent > 0 ? 0 : -1;
+}
+
+int ring_get(t_ring *r, unsigned int key, t_ring_callback callback, void *arg)
+{
+    return ring_request(r, ring_route(r, key), REQUEST_GET, key, NULL, 0, callback, arg);
+}
+
+int ring_set(t_ring *r, unsigned int key, const char *value, size_t length, t_ring_callback callback, void *arg)
+{
+    if (length > 0 && memchr(value, '\n', length) != NULL)
+        return -1;
+    return ring_request(r, ring_route(r, key), REQUEST_SET, key, value, length, callback, arg);
+}
+
+void ring_set_window(t_ring *r, int window)
+{
+    r->window = window > 0 ? window : 0;
+}
+
+void ring_set_timeout(t_ring *r, int timeout_ms)
+{
+    r->timeout = timeout_ms > 0 ? timeout_ms : 0;
+}
+
+int ring_find(t_ring *r, unsigned int key, t_ring_callback callback, void *arg)
+{
+    return ring_request(r, ring_route(r, key), REQUEST_FIND, key, NULL, 0, callback, arg);
+}
+
+/**
+ * @brief Handle an answer
+ *
+ * @param r the t_ring object
+ * @param node index of the connection it came through
+ * @param line the answer (null terminated, without the '\n')
+ * @return [ @b int ] 1 if a request finished, 0 otherwise
+ */
+int ring_answer(t_ring *r, int node, char *line)
+{
+    char type[8] = "", ipaddr[64] = "";
+    unsigned long id = 0, mask = 0;
+    unsigned int key = 0;
+    int end = 0;
+    if (sscanf(line, "%7s %lu%n", type, &id, &end) != 2)
+        return 0;
+    t_ring_request *request = ring_find_request(r, id);
+    if (request == NULL)
+        return 0;
+
+    t_ring_result result = { 0 };
+    if (strcmp(type, "OWNS") == 0 && sscanf(line+end, "%lx", &mask) == 1) {
+        // A key has only one owner, so forget what the other nodes claimed
+        for (int i = 0; i < r->node_count; i++)
+            r->nodes[i].owns &= ~mask;
+        r->nodes[node].owns = mask;
+    }
+    else if (strcmp(type, "VALUE") == 0) {
+        // The value is everything after the key (it may contain spaces)
+        int value_start = 0;
+        sscanf(line+end, " %u%n", &key, &value_start);
+        result.value = line+end+value_start + (line[end+value_start] == ' ');
+        result.length = strlen(result.value);
+    }
+    else if (strcmp(type, "OWNER") == 0)
+        sscanf(line+end, " %u %u %63s %u", &key, &result.owner, ipaddr, &result.port);
+    else if (strcmp(type, "ERR") == 0) {
+        result.status = -1;
+        result.error = line+end + (line[end] == ' ');
+    }
+    result.ipaddr = ipaddr;
+    ring_finish(r, request, &result);
+    return 1;
+}
+
+/**
+ * @brief Read what a node sent and handle every complete answer
+ *
+ * @param r the t_ring object
+ * @param node index of the connection
+ * @return [ @b int ] how many requests finished
+ */
+int ring_read(t_ring *r, int node)
+{
+    t_ring_node *n = &r->nodes[node];
+    if (n->buffer_capacity - n->buffer_size < 4096) {
+        // Doubled, so that a large value isn't copied over and over as it arrives
+        size_t capacity = n->buffer_capacity < 4096 ? n->buffer_capacity + 4096 : 2 * n->buffer_capacity;
+        if (capacity > RING_MAX_ANSWER)
+            capacity = RING_MAX_ANSWER;
+        char *bigger = n->buffer_capacity < RING_MAX_ANSWER ? (char*) realloc(n->buffer, capacity) : NULL;
+        if (bigger == NULL) {
+            ring_drop_node(r, node);
+            return 0;
+        }
+        n->buffer = bigger;
+        n->buffer_capacity = capacity;
+    }
+    ssize_t received = recv(n->fd, n->buffer+n->buffer_size, n->buffer_capacity-n->buffer_size, 0);
+    if (received < 0 && errno == EINTR)
+        return 0;
+    if (received <= 0) {
+        ring_drop_node(r, node);
+        return 0;
+    }
+    n->buffer_size += received;
+
+    // The callbacks may submit requests, which may wait for (and read) more answers, so
+    // the complete lines are taken out of the buffer before any of them is handled
+    size_t length = n->buffer_size;
+    while (length > 0 && n->buffer[length-1] != '\n')
+        length--;
+    if (length == 0)
+        return 0;
+    char *lines = (char*) malloc(length);
+    if (lines == NULL) {
+        ring_drop_node(r, node);
+        return 0;
+    }
+    memcpy(lines, n->buffer, length);
+    n->buffer_size -= length;
+    memmove(n->buffer, n->buffer+length, n->buffer_size);
+
+    int finished = 0;
+    char *start = lines, *end;
+    while ((end = memchr(start, '\n', length - (start - lines))) != NULL) {
+        *end = '\0';
+        finished += ring_answer(r, node, start);
+        start = end+1;
+    }
+    free(lines);
+    return finished;
+}
+
+void ring_fds(t_ring *r, fd_set *fds, int *fdmax)
+{
+    for (int i = 0; i < r->node_count; i++) {
+        if (r->nodes[i].fd == -1)
+            continue;
+        FD_SET(r->nodes[i].fd, fds);
+        *fdmax = *fdmax > r->nodes[i].fd ? *fdmax : r->nodes[i].fd;
+    }
+}
+
+/**
+ * @brief Fail the requests that have waited too long for their answers (their answers
+ * are ignored if they still arrive)
+ *
+ * @param r the t_ring object
+ * @param wait_ms where to store how long until the next request times out, in
+ * milliseconds (-1 if none of them can)
+ * @return [ @b int ] how many requests failed
+ */
+int ring_expire(t_ring *r, int *wait_ms)
+{
+    *wait_ms = -1;
+    if (r->timeout == 0)
+        return 0;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int expired = 0;
+    for (size_t i = 0; i < r->capacity; i++) {
+        t_ring_request *request = &r->requests[i];
+        if (request->id == 0)
+            continue;
+        long waited = (now.tv_sec - request->sent.tv_sec) * 1000 + (now.tv_usec - request->sent.tv_usec) / 1000;
+        if (waited >= r->timeout) {
+            t_ring_result result = { .status = -1, .error = "Timed out" };
+            ring_finish(r, request, &result);
+            expired++;
+        }
+        else if (*wait_ms == -1 || r->timeout - waited < *wait_ms)
+            *wait_ms = r->timeout - waited;
+    }
+    return expired;
+}
+
+int ring_poll(t_ring *r, int timeout_ms)
+{
+    fd_set fds;
+    FD_ZERO(&fds);
+    int fdmax = -1;
+    ring_fds(r, &fds, &fdmax);
+    if (fdmax == -1)
+        return -1;
+
+    // Don't wait past the moment the oldest request times out
+    int wait_ms;
+    int finished = ring_expire(r, &wait_ms);
+    if (finished > 0)
+        timeout_ms = 0;
+    else if (wait_ms >= 0 && (timeout_ms < 0 || wait_ms < timeout_ms))
+        timeout_ms = wait_ms;
+
+    struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    int ready = select(fdmax+1, &fds, NULL, NULL, timeout_ms < 0 ? NULL : &timeout);
+    if (ready < 0)
+        return errno == EINTR ? finished : -1;
+
+    for (int i = 0; i < r->node_count && ready > 0; i++) {
+        if (r->nodes[i].fd != -1 && FD_ISSET(r->nodes[i].fd, &fds)) {
+            finished += ring_read(r, i);
+            ready--;
+        }
+    }
+    return finished + ring_expire(r, &wait_ms);
+}
+
+int ring_pending(t_ring *r)
+{
+    return r->pending;
+}
+
+void ring_close(t_ring *r)
+{
+    if (r == NULL)
+        return;
+    for (int i = 0; i < r->node_count; i++) {
+        if (r->nodes[i].fd != -1)
+            close(r->nodes[i].fd);
+        free(r->nodes[i].buffer);
+    }
+    free(r->requests);
+    free(r);
+}
@@ -0,0 +1,147 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <sys/select.h>
+
+/**
+ * @brief A connection to a ring, through the client ports (-c) of some of its nodes.
+ * It remembers which keys each node owns and sends every request straight to the
+ * owner, so the request doesn't have to travel around the ring
+ *
+ */
+typedef struct ring t_ring;
+
+typedef struct ring_result {
+    // 0 if the request succeeded, -1 if it failed (error says why)
+    int status;
+    unsigned int key;
+    // Value of the object (GET; NULL if it doesn't exist)
+    const char *value;
+    size_t length;
+    // Node the key belongs to (FIND)
+    unsigned int owner;
+    const char *ipaddr;
+    unsigned int port;
+    const char *error;
+    // Seconds between sending the request and getting its answer
+    double latency;
+} t_ring_result;
+
+/**
+ * @brief Function called when a request finishes. The result only lives until it returns
+ *
+ */
+typedef void (*t_ring_callback)(const t_ring_result *result, void *arg);
+
+/**
+ * @brief Connect to a ring and ask its nodes which keys they own
+ *
+ * @param endpoints the nodes' client ports ("IP:PORT"); the ones that can't be reached
+ * are skipped
+ * @param count how many there are
+ * @return [ @b t_ring* ] the t_ring object, or NULL if no node could be reached
+ */
+t_ring *ring_open(const char *const *endpoints, int count);
+
+/**
+ * @brief Ask the nodes which keys they own again (after nodes have joined or left the
+ * ring). Requests keep working meanwhile, they just may take a detour
+ *
+ * @param r the t_ring object
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int ring_refresh(t_ring *r);
+
+/**
+ * @brief Get an object's value
+ *
+ * @param r the t_ring object
+ * @param key the object's key
+ * @param callback function called with the value
+ * @param arg passed on to the callback
+ * @return [ @b int ] 0 if the request was sent, -1 otherwise
+ */
+int ring_get(t_ring *r, unsigned int key, t_ring_callback callback, void *arg);
+
+/**
+ * @brief Set an object's value
+ *
+ * @param r the t_ring object
+ * @param key the object's key
+ * @param value the value (it can't contain a '\n')
+ * @param length its size (0 deletes the object)
+ * @param callback function called once the value has been sent to its owner (may be NULL)
+ * @param arg passed on to the callback
+ * @return [ @b int ] 0 if the request was sent, -1 otherwise
+ */
+int ring_set(t_ring *r, unsigned int key, const char *value, size_t length, t_ring_callback callback, void *arg);
+
+/**
+ * @brief Limit how many requests may be in flight at once. Once the limit is reached,
+ * ring_get(), ring_set() and ring_find() wait for answers (calling their callbacks) until
+ * a request finishes, so a loop of writes stays pipelined without flooding the nodes
+ * (callbacks may submit requests too)
+ *
+ * @param r the t_ring object
+ * @param window most requests in flight (0 for no limit, the default)
+ */
+void ring_set_window(t_ring *r, int window);
+
+/**
+ * @brief Set how long requests wait for their answers. A request that waits longer (e.g.
+ * because a node never answered) fails with the error "Timed out"
+ *
+ * @param r the t_ring object
+ * @param timeout_ms the timeout in milliseconds (0 waits for ever; 5000 by default)
+ */
+void ring_set_timeout(t_ring *r, int timeout_ms);
+
+/**
+ * @brief Look for the node a key belongs to
+ *
+ * @param r the t_ring object
+ * @param key the key
+ * @param callback function called with the owner
+ * @param arg passed on to the callback
+ * @return [ @b int ] 0 if the request was sent, -1 otherwise
+ */
+int ring_find(t_ring *r, unsigned int key, t_ring_callback callback, void *arg);
+
+/**
+ * @brief Add the connections' sockets to a set of file descriptors, to wait for answers
+ * in an application's own select() loop (and call ring_poll() with a timeout of 0 then)
+ *
+ * @param r the t_ring object
+ * @param fds the set
+ * @param fdmax highest file descriptor in the set (updated)
+ */
+void ring_fds(t_ring *r, fd_set *fds, int *fdmax);
+
+/**
+ * @brief Wait for answers and call the requests' callbacks
+ *
+ * @param r the t_ring object
+ * @param timeout_ms how long to wait at most (0 doesn't wait, -1 waits until something
+ * arrives or a request times out)
+ * @return [ @b int ] how many requests finished (or timed out), or -1 in case of an error
+ */
+int ring_poll(t_ring *r, int timeout_ms);
+
+/**
+ * @brief Get the number of requests that haven't finished yet
+ *
+ * @param r the t_ring object
+ * @return [ @b int ] the number of requests
+ */
+int ring_pending(t_ring *r);
+
+/**
+ * @brief Close the connections and free the t_ring object. The requests that haven't
+ * finished are dropped without calling their callbacks
+ *
+ * @param r the t_ring object
+ */
+void ring_close(t_ring *r);
+
+#endif
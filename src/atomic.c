@@ -0,0 +1,229 @@
+#include "atomic.h"
+#include "server.h"
+#include "lease.h"
+#include "expiry.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+char *operation_name(t_operation op)
+{
+    static char names[][8] = {
+        "CAS",
+        "INCR",
+        "APPEND",
+        "VERSION",
+        "SETEX",
+        "EXPIRE",
+        "TTL",
+        "DEL",
+        "INVALID"
+    };
+    return names[op];
+}
+
+t_operation operation_by_name(char *name)
+{
+    for (t_operation op = OP_CAS; op < OP_INVALID; op++) {
+        if (strcmp(name, operation_name(op)) == 0)
+            return op;
+    }
+    return OP_INVALID;
+}
+
+int parse_delta(char *operand, size_t length, long long *delta)
+{
+    char number[OPERATION_TEXT_SIZE] = "";
+    if (operand == NULL || length == 0 || length >= sizeof(number))
+        return 0;
+    memcpy(number, operand, length);
+    char *end;
+    errno = 0;
+    long long value = strtoll(number, &end, 10);
+    if (errno != 0 || *end != '\0' || end == number)
+        return 0;
+    if (delta != NULL)
+        *delta = value;
+    return 1;
+}
+
+t_operation_result execute_operation(t_operation op, unsigned int key, unsigned long version, char *operand, size_t length, t_object *result, char *text, t_nodeinfo *ni)
+{
+    t_object *current = latest_object(key, ni);
+    result->value = NULL;
+    result->length = 0;
+    result->version = current->version;
+
+    if (op == OP_VERSION) {
+        result->value = current->value;
+        result->length = current->length;
+        return OPR_DONE;
+    }
+    if (op == OP_TTL) {
+        long long unit = 1, left = current->value == NULL ? -2 : -1;
+        if (length > 0 && (!parse_delta(operand, length, &unit) || unit <= 0))
+            return OPR_NOT_A_NUMBER;
+        if (left == -1 && ttl_ms(key, ni) > 0)
+            left = (ttl_ms(key, ni) + unit / 2) / unit;
+        result->value = text;
+        result->length = sprintf(text, "%lld", left);
+        return OPR_DONE;
+    }
+    if (op == OP_CAS || op == OP_SETEX) {
+        if (op == OP_CAS && version != current->version)
+            return OPR_MISMATCH;
+        // Like a SET, this replaces the object's time to live (set before storing it, so
+        // that the replicas get it too)
+        if (op == OP_SETEX && length > 0)
+            schedule_expiry(key, version / 1000.0, ni);
+        else
+            cancel_expiry(key, ni);
+        if (store_object(key, length ? operand : NULL, length, ni) != 0)
+            return OPR_ERROR;
+    }
+    else if (op == OP_EXPIRE) {
+        result->value = text;
+        result->length = sprintf(text, "%d", current->value != NULL);
+        if (current->value == NULL)
+            return OPR_DONE;
+        if (version > 0)
+            schedule_expiry(key, version / 1000.0, ni);
+        else
+            cancel_expiry(key, ni);
+        // The replicas learn the new time to live (a write held back by leases brings it
+        // along once it's applied)
+        if (get_stored_object(key, ni) != NULL)
+            replicate_object(key, ni);
+    }
+    else if (op == OP_DEL) {
+        result->value = text;
+        result->length = sprintf(text, "%d", current->value != NULL);
+        if (current->value == NULL)
+            return OPR_DONE;
+        // Like a SET with an empty value
+        cancel_expiry(key, ni);
+        if (store_object(key, NULL, 0, ni) != 0)
+            return OPR_ERROR;
+    }
+    else if (op == OP_INCR) {
+        long long value = 0, delta;
+        if ((current->value != NULL && !parse_delta(current->value, current->length, &value)) || !parse_delta(operand, length, &delta)
+                || (delta > 0 && value > LLONG_MAX - delta) || (delta < 0 && value < LLONG_MIN - delta))
+            return OPR_NOT_A_NUMBER;
+        sprintf(text, "%lld", value + delta);
+        if (store_object(key, text, strlen(text), ni) != 0)
+            return OPR_ERROR;
+        result->value = text;
+        result->length = strlen(text);
+    }
+    else if (op == OP_APPEND) {
+        size_t total = current->length + length;
+        // The other nodes wouldn't accept a larger value
+        if (total > MAX_VALUE_SIZE)
+            return OPR_ERROR;
+        char *value = (char*) malloc(total + 1);
+        if (value == NULL)
+            return OPR_ERROR;
+        memcpy(value, current->value != NULL ? current->value : "", current->length);
+        memcpy(value + current->length, operand, length);
+        int stored = store_object(key, total ? value : NULL, total, ni);
+        free(value);
+        if (stored != 0)
+            return OPR_ERROR;
+        result->value = text;
+        result->length = sprintf(text, "%zu", total);
+    }
+    else
+        return OPR_ERROR;
+
+    result->version = latest_object(key, ni)->version;
+    return OPR_DONE;
+}
+
+/**
+ * @brief Get the entry of the operations an owner remembers that a request goes in
+ *
+ * @param requester the node that asked for the operation
+ * @param n the request's sequence number
+ * @param ni necessary information about the node
+ * @return [ @b t_applied_operation* ] the entry
+ */
+t_applied_operation *applied_operation_entry(unsigned int requester, unsigned int n, t_nodeinfo *ni)
+{
+    return &ni->applied_operations[(requester * MAX_REQUESTS + n) % RECENT_OPERATIONS];
+}
+
+int recall_operation(t_operation op, unsigned int requester, unsigned int n, unsigned int key, t_operation_result *code, t_object *result, t_nodeinfo *ni)
+{
+    t_applied_operation *applied = applied_operation_entry(requester, n, ni);
+    if (applied->requester != requester || applied->n != n || applied->key != key || applied->op != (int) op)
+        return 0;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    // Sequence numbers are reused, so an old entry is probably about another request
+    if (now.tv_sec - applied->timestamp.tv_sec + 1e-6 * (now.tv_usec - applied->timestamp.tv_usec) > OPERATION_MEMORY)
+        return 0;
+    *code = applied->code;
+    result->value = applied->answered ? applied->text : NULL;
+    result->length = applied->length;
+    result->version = applied->version;
+    result->size = 0;
+    return 1;
+}
+
+void remember_operation(t_operation op, unsigned int requester, unsigned int n, unsigned int key, t_operation_result code, t_object *result, t_nodeinfo *ni)
+{
+    // The other operations give the same result when executed again
+    if (op != OP_CAS && op != OP_INCR && op != OP_APPEND && op != OP_DEL)
+        return;
+    t_applied_operation *applied = applied_operation_entry(requester, n, ni);
+    applied->requester = requester;
+    applied->n = n;
+    applied->key = key;
+    applied->op = op;
+    applied->code = code;
+    applied->version = result->version;
+    // Their answers always fit (a number)
+    applied->answered = result->value != NULL && result->length < sizeof(applied->text);
+    applied->length = applied->answered ? result->length : 0;
+    if (applied->answered)
+        memcpy(applied->text, result->value, result->length);
+    gettimeofday(&applied->timestamp, NULL);
+}
+
+int send_operation(t_operation op, unsigned int key, unsigned int n, unsigned long version, char *operand, size_t length, t_nodeinfo *ni)
+{
+    char message[64] = "";
+    if (operand == NULL || fits_inline(operand, length)) {
+        sprintf(message, "OP %u %u %u %s %lu %.*s\n", key, n, ni->key, operation_name(op), version, (int) length, operand != NULL ? operand : "");
+        return send_to_closest(message, key, ni) < 0 ? -1 : 0;
+    }
+
+    // Bodies never go through UDP
+    sprintf(message, "BOP %u %u %u %s %lu %zu\n", key, n, ni->key, operation_name(op), version, length);
+    if (sendall(ni->succ_fd, message, strlen(message)) != 0 || sendall(ni->succ_fd, operand, length) != 0) {
+        puts("\x1b[31m[!] Couldn't send the request\033[m");
+        return -1;
+    }
+    return 0;
+}
+
+int send_operation_answer(t_operation op, unsigned int requester, unsigned int n, unsigned int key, t_operation_result code, t_object *result, t_nodeinfo *ni)
+{
+    char message[64] = "";
+    if (result->value == NULL || fits_inline(result->value, result->length)) {
+        sprintf(message, "ROP %u %u %u %s %d %lu %.*s\n", requester, n, key, operation_name(op), code, result->version,
+            (int) result->length, result->value != NULL ? result->value : "");
+        return send_to_closest(message, requester, ni) < 0 ? -1 : 0;
+    }
+
+    sprintf(message, "BROP %u %u %u %s %d %lu %zu\n", requester, n, key, operation_name(op), code, result->version, result->length);
+    if (sendall(ni->succ_fd, message, strlen(message)) != 0 || sendall(ni->succ_fd, result->value, result->length) != 0) {
+        puts("\x1b[31m[!] Couldn't send the answer\033[m");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include "common.h"
+
+typedef enum operation {
+    // Store a value only if the object is still at a given version
+    OP_CAS,
+    // Add a number to an object whose value is an integer (a missing object counts as 0)
+    OP_INCR,
+    // Add bytes to the end of an object's value
+    OP_APPEND,
+    // Get an object's value along with its version
+    OP_VERSION,
+    // Store a value that expires after some time
+    OP_SETEX,
+    // Change how long an object has left to live (or make it live until it is deleted)
+    OP_EXPIRE,
+    // Get how long an object has left to live
+    OP_TTL,
+    // Delete an object, telling whether it existed
+    OP_DEL,
+    OP_INVALID
+} t_operation;
+
+typedef enum operation_result {
+    OPR_DONE,
+    // CAS with the wrong version
+    OPR_MISMATCH,
+    // INCR on a value that isn't an integer (or that would overflow)
+    OPR_NOT_A_NUMBER,
+    OPR_ERROR
+} t_operation_result;
+
+/**
+ * @brief Get an operation's name, as messages and clients spell it
+ *
+ * @param op the operation
+ * @return [ @b char* ] the name
+ */
+char *operation_name(t_operation op);
+
+/**
+ * @brief Get an operation from its name
+ *
+ * @param name the name
+ * @return [ @b t_operation ] the operation (OP_INVALID if there is none with that name)
+ */
+t_operation operation_by_name(char *name);
+
+/**
+ * @brief Check that an INCR's operand is an integer
+ *
+ * @param operand the operand
+ * @param length its size
+ * @param delta where to store its value (may be NULL)
+ * @return [ @b int ] 1 if it is, 0 otherwise
+ */
+int parse_delta(char *operand, size_t length, long long *delta);
+
+/**
+ * @brief Execute an operation on an object this node owns, as a single step (the writes
+ * held back by leases count as already done)
+ *
+ * @param op the operation
+ * @param key the object's key
+ * @param version the version CAS expects, or the time to live in milliseconds SETEX and
+ * EXPIRE give the object (0 makes EXPIRE remove it)
+ * @param operand CAS's and SETEX's new value (NULL or empty to delete the object), INCR's
+ * number, the bytes APPEND adds, or the unit of TTL's answer in milliseconds (1 if empty)
+ * @param length the operand's size
+ * @param result where to store the answer: the object's value for VERSION, the new value
+ * for INCR, the new length for APPEND, 1 (or 0 if the object doesn't exist) for EXPIRE and DEL,
+ * the time left in the requested unit for TTL (-1 if the object doesn't expire, -2 if it
+ * doesn't exist), nothing for CAS and SETEX, and the object's version after the operation
+ * (or its current one if it failed)
+ * @param text buffer for the answers that aren't the object's value, of at least
+ * OPERATION_TEXT_SIZE bytes
+ * @param ni necessary information about the node
+ * @return [ @b t_operation_result ] whether the operation was done
+ */
+t_operation_result execute_operation(t_operation op, unsigned int key, unsigned long version, char *operand, size_t length, t_object *result, char *text, t_nodeinfo *ni);
+
+/**
+ * @brief Find the answer of an operation this node already executed for a request (which
+ * arrived again, e.g. because its acknowledgement was lost)
+ *
+ * @param op the operation
+ * @param requester the node that asked for it
+ * @param n the request's sequence number
+ * @param key the object's key
+ * @param code where to store whether the operation was done
+ * @param result where to store the answer (its value points into the node's memory)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if it was executed in the last OPERATION_MEMORY seconds (the
+ * answer is stored in @b result), 0 otherwise
+ */
+int recall_operation(t_operation op, unsigned int requester, unsigned int n, unsigned int key, t_operation_result *code, t_object *result, t_nodeinfo *ni);
+
+/**
+ * @brief Remember the answer of an operation that changes the object (CAS, INCR, APPEND or DEL),
+ * so that a copy of the request that arrives again isn't executed twice
+ *
+ * @param op the operation
+ * @param requester the node that asked for it
+ * @param n the request's sequence number
+ * @param key the object's key
+ * @param code whether the operation was done
+ * @param result the answer (see execute_operation())
+ * @param ni necessary information about the node
+ */
+void remember_operation(t_operation op, unsigned int requester, unsigned int n, unsigned int key, t_operation_result code, t_object *result, t_nodeinfo *ni);
+
+/**
+ * @brief Ask a key's owner to execute an operation (OP or BOP), as request @b n
+ *
+ * @param op the operation
+ * @param key the object's key
+ * @param n the request's sequence number
+ * @param version the version CAS expects, or the time to live (see execute_operation())
+ * @param operand the operand (see execute_operation())
+ * @param length its size
+ * @param ni the virtual node that sends the request
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_operation(t_operation op, unsigned int key, unsigned int n, unsigned long version, char *operand, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Send the answer of an operation to the node that asked for it (ROP or BROP)
+ *
+ * @param op the operation
+ * @param requester the node that asked
+ * @param n the request's sequence number
+ * @param key the object's key
+ * @param code whether the operation was done
+ * @param result the answer (see execute_operation())
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_operation_answer(t_operation op, unsigned int requester, unsigned int n, unsigned int key, t_operation_result code, t_object *result, t_nodeinfo *ni);
+
+#endif
@@ -1,6 +1,13 @@
 #define _POSIX_C_SOURCE 200112L
+// MSG_DONTWAIT
+#define _DEFAULT_SOURCE
 #include "common.h"
 #include "utils.h"
+#include "storage.h"
+#include "watch.h"
+#include "expiry.h"
+#include "compress.h"
+#include "erasure.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdio.h>
@@ -9,11 +16,26 @@
 #include <unistd.h>
 #include <sys/time.h>
 #define MAX(x, y) (x > y ? x : y)
+// Most bytes of a body that only passes through a node read (and sent on) at a time
+#define RELAY_CHUNK_SIZE 4096
 
 struct conn_info {
     char *buffer;
     size_t buffer_size;
     int block_size;
+    // Size of the buffer (more than block_size while it holds a message body)
+    size_t capacity;
+    // Size of the body the buffer must hold before the message it follows is handled (0
+    // if no message is waiting for its body)
+    size_t body_size;
+    // Bytes of a message body that only passes through this node still to be relayed as
+    // they arrive, the socket they go to (-1 to drop them), and when the last ones came
+    size_t relay_size;
+    int relay_fd;
+    struct timeval relay_timestamp;
+    // Sequence number of the handoff being received through the connection, and how many
+    // of its objects arrived so far
+    unsigned int handoff_n, handoff_count;
 };
 
 t_conn_info *new_conn_info(int block_size)
@@ -26,6 +48,12 @@ t_conn_info *new_conn_info(int block_size)
         return NULL;
     result->buffer_size = 0;
     result->block_size = block_size;
+    result->capacity = block_size;
+    result->body_size = 0;
+    result->relay_size = 0;
+    result->relay_fd = -1;
+    result->handoff_n = 0;
+    result->handoff_count = 0;
     return result;
 }
 
@@ -39,7 +67,7 @@ void free_conn_info(t_conn_info *ci)
 
 int set_conn_info(t_conn_info *ci, int block_size)
 {
-    if (ci->block_size != block_size) {
+    if (ci->capacity != (size_t) block_size) {
         free(ci->buffer);
         ci->buffer = (char*) calloc(block_size, sizeof(char));
         if (ci->buffer == NULL)
@@ -48,13 +76,23 @@ int set_conn_info(t_conn_info *ci, int block_size)
 
     ci->buffer_size = 0;
     ci->block_size = block_size;
+    ci->capacity = block_size;
+    ci->body_size = 0;
+    ci->relay_size = 0;
+    ci->relay_fd = -1;
+    ci->handoff_n = 0;
+    ci->handoff_count = 0;
 
     return 0;
 }
 
 int has_available_data(t_conn_info *ci)
 {
-    return ci->buffer_size > 0;
+    // The bytes of a relayed body can go on as soon as they're here
+    if (ci->relay_size > 0)
+        return ci->buffer_size > 0;
+    // A message body that hasn't fully arrived has to wait for the socket
+    return ci->buffer_size > 0 && ci->buffer_size >= ci->body_size;
 }
 
 int copy_conn_info(t_conn_info **dest, t_conn_info *src)
@@ -65,16 +103,21 @@ int copy_conn_info(t_conn_info **dest, t_conn_info *src)
         if (*dest == NULL)
             return -1;
     }
-    else {
-        if ((*dest)->block_size != src->block_size) {
-            // If both objects have different block_sizes, allocate a new buffer to match
-            free((*dest)->buffer);
-            (*dest)->buffer = (char*) calloc(src->block_size, sizeof(char));
-            if ((*dest)->buffer == NULL)
-                return -1;
-        }
-        (*dest)->block_size = src->block_size;
+    if ((*dest)->capacity != src->capacity) {
+        // If both objects have different buffer sizes, allocate a new buffer to match
+        free((*dest)->buffer);
+        (*dest)->buffer = (char*) calloc(src->capacity, sizeof(char));
+        if ((*dest)->buffer == NULL)
+            return -1;
     }
+    (*dest)->block_size = src->block_size;
+    (*dest)->capacity = src->capacity;
+    (*dest)->body_size = src->body_size;
+    (*dest)->relay_size = src->relay_size;
+    (*dest)->relay_fd = src->relay_fd;
+    (*dest)->relay_timestamp = src->relay_timestamp;
+    (*dest)->handoff_n = src->handoff_n;
+    (*dest)->handoff_count = src->handoff_count;
 
     (*dest)->buffer_size = src->buffer_size;
     if (src->buffer_size)
@@ -82,9 +125,29 @@ int copy_conn_info(t_conn_info **dest, t_conn_info *src)
     return 0;
 }
 
+void count_handoff_object(t_conn_info *ci, unsigned int n)
+{
+    if (n != ci->handoff_n) {
+        // A new handoff has started
+        ci->handoff_n = n;
+        ci->handoff_count = 0;
+    }
+    ci->handoff_count++;
+}
+
+unsigned int take_handoff_count(t_conn_info *ci, unsigned int n)
+{
+    unsigned int count = n == ci->handoff_n ? ci->handoff_count : 0;
+    ci->handoff_count = 0;
+    return count;
+}
+
 void reset_conn_buffer(t_conn_info* ci)
 {
     ci->buffer_size = 0;
+    ci->body_size = 0;
+    ci->relay_size = 0;
+    ci->relay_fd = -1;
 }
 
 t_nodeinfo *new_nodeinfo(int id, char *ipaddr, char *port)
@@ -113,12 +176,60 @@ t_nodeinfo *new_nodeinfo(int id, char *ipaddr, char *port)
     ni->succ_id = 0;
     ni->shcut_id = 0;
     ni->find_n = 0;
-    for (size_t i = 0; i < sizeof(ni->requests) / sizeof(int); i++)
+    for (size_t i = 0; i < sizeof(ni->requests) / sizeof(int); i++) {
         ni->requests[i] = -1;
+        ni->request_client[i] = -1;
+        ni->request_tag[i] = 0;
+        ni->request_batch[i] = NULL;
+        ni->request_waiters[i] = NULL;
+    }
+    for (unsigned int key = 0; key < 32; key++)
+        ni->pending_get[key] = -1;
+    ni->gets_forwarded = 0;
+    ni->gets_coalesced = 0;
+    ni->hot_answers = 0;
     memset(ni->request_addr, 0, sizeof(ni->request_addr));
+    memset(ni->request_deadline, 0, sizeof(ni->request_deadline));
+    ni->sets_acknowledged = 0;
+    ni->sets_timed_out = 0;
+    // No object has a TTL yet
+    memset(ni->expiry.slots, -1, sizeof(ni->expiry.slots));
+    memset(ni->expiry.level, -1, sizeof(ni->expiry.level));
+    gettimeofday(&ni->expiry.start, NULL);
     memset(ni->request_addr_len, 0, sizeof(ni->request_addr_len));
     ni->shcut_info = NULL;
     ni->udp_message_list = NULL;
+    ni->replication = 0;
+    ni->strong_reads = 0;
+    ni->storage = NULL;
+    ni->object_bytes = 0;
+    ni->memory_budget = 0;
+    ni->object_referenced = 0;
+    ni->object_hand = 0;
+    ni->object_evictions = 0;
+    ni->compress_threshold = 0;
+    ni->values_compressed = 0;
+    ni->values_decompressed = 0;
+    ni->compress_seconds = 0;
+    ni->decompress_seconds = 0;
+    ni->ec_k = 0;
+    ni->ec_m = 0;
+    ni->fragmented = 0;
+    ni->ec_fallback = 0;
+    ni->objects_rebuilt = 0;
+    ni->handoff_n = 0;
+    ni->handoff_keys = 0;
+    ni->pred_buffer_size = 0;
+    ni->succ_buffer_size = 0;
+    ni->temp_buffer_size = 0;
+    ni->first_vnode = ni;
+    ni->next_vnode = NULL;
+    ni->pending_join = 0;
+    ni->routable = 0;
+    ni->workers = NULL;
+    ni->worker = 0;
+    ni->console = NULL;
+    ni->control = NULL;
     return ni;
 }
 
@@ -131,7 +242,7 @@ int register_request(unsigned int n, unsigned int key, struct addrinfo *info, t_
 
     ni->requests[n] = key;
     if (info) {
-        memcpy(&ni->request_addr[n], info->ai_addr, sizeof(struct addrinfo));
+        memcpy(&ni->request_addr[n], info->ai_addr, sizeof(struct sockaddr));
         ni->request_addr_len[n] = info->ai_addrlen;
     }
     return 0;
@@ -153,11 +264,60 @@ int get_associated_addrinfo(unsigned int n, struct sockaddr *dest, socklen_t *de
     return 0;
 }
 
+int add_waiter(unsigned int n, int client, unsigned long tag, t_nodeinfo *ni)
+{
+    if (n >= MAX_REQUESTS)
+        return -1;
+    t_waiter *waiter = (t_waiter*) malloc(sizeof(t_waiter));
+    if (waiter == NULL)
+        return -1;
+    waiter->client = client;
+    waiter->tag = tag;
+    waiter->next = NULL;
+    t_waiter **last = &ni->request_waiters[n];
+    while (*last != NULL)
+        last = &(*last)->next;
+    *last = waiter;
+    return 0;
+}
+
+/**
+ * @brief Free a list of waiters
+ * 
+ * @param waiter the first one
+ */
+void free_waiters(t_waiter *waiter)
+{
+    while (waiter != NULL) {
+        t_waiter *next = waiter->next;
+        free(waiter);
+        waiter = next;
+    }
+}
+
+void free_batch(t_batch *batch)
+{
+    if (batch == NULL)
+        return;
+    for (unsigned int i = 0; i < 32; i++)
+        free(batch->values[i].value);
+    free(batch);
+}
+
 void drop_request(unsigned int n, t_nodeinfo *ni)
 {
     if (n < sizeof(ni->requests) / sizeof(int)) {
+        if (ni->requests[n] >= 0 && ni->requests[n] < 32 && ni->pending_get[ni->requests[n]] == (int) n)
+            ni->pending_get[ni->requests[n]] = -1;
         ni->requests[n] = -1;
         ni->request_addr_len[n] = 0;
+        ni->request_client[n] = -1;
+        free_batch(ni->request_batch[n]);
+        ni->request_batch[n] = NULL;
+        free_waiters(ni->request_waiters[n]);
+        ni->request_waiters[n] = NULL;
+        ni->request_deadline[n].tv_sec = 0;
+        ni->request_deadline[n].tv_usec = 0;
     }
 }
 
@@ -218,30 +378,205 @@ t_ongoing_udp_message *pop_udp_message_from(t_nodeinfo *ni, struct sockaddr *rec
     return NULL;
 }
 
-char *get_object(unsigned int key, t_nodeinfo* ni)
+/**
+ * @brief Compress a value, keeping count of the time it takes
+ *
+ * @param value the value
+ * @param length its size in bytes
+ * @param packed_length where to put the size of the compressed value (left alone if it
+ * isn't compressed)
+ * @param ni necessary information about the node
+ * @return [ @b char* ] the compressed value (to be freed), or NULL if compressing it
+ * doesn't save space (or there is no memory)
+ */
+char *pack_value(char *value, size_t length, size_t *packed_length, t_nodeinfo *ni)
+{
+    char *packed = (char*) malloc(length);
+    if (packed == NULL)
+        return NULL;
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    size_t result = lz_compress(value, length, packed, length-1);
+    ni->compress_seconds -= seconds_until(start);
+    ni->values_compressed++;
+    if (result == 0) {
+        free(packed);
+        return NULL;
+    }
+    *packed_length = result;
+    return packed;
+}
+
+/**
+ * @brief Decompress a value, keeping count of the time it takes
+ *
+ * @param packed the compressed value
+ * @param length its size in bytes
+ * @param size the value's size once decompressed
+ * @param ni necessary information about the node
+ * @return [ @b char* ] the value, followed by a NUL byte (to be freed), or NULL if it is
+ * corrupt (or there is no memory)
+ */
+char *unpack_value(char *packed, size_t length, size_t size, t_nodeinfo *ni)
+{
+    // Nodes never accept anything that would decompress to more than that
+    if (size > MAX_VALUE_SIZE || length > size) {
+        puts("\x1b[31m[!] Found a corrupt compressed value\033[m");
+        return NULL;
+    }
+    char *value = (char*) malloc(size+1);
+    if (value == NULL)
+        return NULL;
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    int result = lz_decompress(packed, length, value, size);
+    ni->decompress_seconds -= seconds_until(start);
+    ni->values_decompressed++;
+    if (result != 0) {
+        puts("\x1b[31m[!] Found a corrupt compressed value\033[m");
+        free(value);
+        return NULL;
+    }
+    value[size] = '\0';
+    return value;
+}
+
+/**
+ * @brief Get a stored object as it was given to the node, decompressing it if needed
+ *
+ * @param stored the object as it is stored
+ * @param unpacked where to keep its decompressed copy until the next event
+ * @param ni necessary information about the node
+ * @return [ @b t_object* ] the object, or NULL if it couldn't be decompressed
+ */
+t_object *unpack_object(t_object *stored, t_object *unpacked, t_nodeinfo *ni)
+{
+    if (stored->size == 0)
+        return stored;
+    if (unpacked->value == NULL) {
+        unpacked->value = unpack_value(stored->value, stored->length, stored->size, ni);
+        if (unpacked->value == NULL)
+            return NULL;
+        unpacked->length = stored->size;
+    }
+    unpacked->version = stored->version;
+    return unpacked;
+}
+
+void release_unpacked(t_nodeinfo *ni)
+{
+    for (unsigned int key = 0; key < 32; key++) {
+        assign_object(&ni->unpacked_objects[key], NULL, 0);
+        assign_object(&ni->unpacked_replicas[key], NULL, 0);
+    }
+}
+
+t_object *get_object(unsigned int key, t_nodeinfo* ni)
+{
+    if (key < 32 && ni->objects[key].value != NULL)
+        return unpack_object(&ni->objects[key], &ni->unpacked_objects[key], ni);
+    return NULL;
+}
+
+t_object *get_stored_object(unsigned int key, t_nodeinfo* ni)
 {
-    if (key < 32)
-        return ni->objects[key];
+    if (key < 32 && ni->objects[key].value != NULL)
+        return &ni->objects[key];
     return NULL;
 }
 
-int set_object(unsigned int key, char *value, t_nodeinfo *ni)
+int assign_object(t_object *object, char *value, size_t length)
+{
+    free(object->value);
+    object->value = NULL;
+    object->length = 0;
+
+    if (value != NULL) {
+        // Keep a trailing NUL so the value can still be used as a string
+        object->value = (char*) malloc(length+1);
+        if (object->value == NULL)
+            return -1;
+        memcpy(object->value, value, length);
+        object->value[length] = '\0';
+        object->length = length;
+    }
+    return 0;
+}
+
+int set_object(unsigned int key, char *value, size_t length, t_nodeinfo *ni)
+{
+    return set_stored_object(key, value, length, 0, ni);
+}
+
+int set_stored_object(unsigned int key, char *value, size_t length, size_t size, t_nodeinfo *ni)
 {
     if (key >= 32)
         return 1;
 
-    if (ni->objects[key] != NULL)
-        free(ni->objects[key]);
-
-    if (value == NULL)
-        ni->objects[key] = NULL;
-    else {
-        ni->objects[key] = (char*) calloc(strlen(value)+1, sizeof(char));
-        if (ni->objects[key] == NULL)
+    if (value == NULL) {
+        cancel_expiry(key, ni);
+        ni->object_referenced &= ~(1u << key);
+    }
+    if (value == NULL && ni->objects[key].value == NULL)
+        return 0;  // Nothing to delete
+
+    // Large values are kept compressed, if that makes them smaller
+    char *packed = NULL, *plain = value;
+    size_t packed_length = length, plain_length = size != 0 ? size : length;
+    if (value != NULL && size == 0 && ni->compress_threshold > 0 && length >= ni->compress_threshold)
+        packed = pack_value(value, length, &packed_length, ni);
+    else if (value != NULL && size != 0 && ni->storage != NULL) {
+        // The log keeps the values as they are
+        plain = unpack_value(value, length, size, ni);
+        if (plain == NULL)
             return -1;
-        strcpy(ni->objects[key], value);
     }
+    if (packed != NULL)
+        size = length;
+
+    assign_object(&ni->unpacked_objects[key], NULL, 0);
+    ni->object_bytes -= ni->objects[key].length;
+    int result = assign_object(&ni->objects[key], packed != NULL ? packed : value, packed_length);
+    ni->objects[key].size = value != NULL ? size : 0;
+    ni->object_bytes += ni->objects[key].length;
+    if (result == 0)
+        update_merkle(&ni->object_tree, key, ni->objects[key].value, ni->objects[key].length);
+
+    if (result == 0 && ni->storage != NULL && log_object(ni->storage, key, plain, plain_length) != 0)
+        result = -1;
+    free(packed);
+    if (plain != value)
+        free(plain);
+    return result != 0 ? -1 : 0;
+}
+
+t_object *get_replica(unsigned int key, t_nodeinfo* ni)
+{
+    t_object *replica = get_stored_replica(key, ni);
+    return replica != NULL ? unpack_object(replica, &ni->unpacked_replicas[key], ni) : NULL;
+}
+
+t_object *get_stored_replica(unsigned int key, t_nodeinfo* ni)
+{
+    if (key < 32 && ni->replicas[key].value != NULL && (ni->replica_expires[key].tv_sec == 0 || seconds_until(ni->replica_expires[key]) > 0))
+        return &ni->replicas[key];
+    return NULL;
+}
 
+int set_replica(unsigned int key, char *value, size_t length, size_t size, t_nodeinfo *ni)
+{
+    if (key >= 32)
+        return 1;
+    if (value == NULL)
+        memset(&ni->replica_expires[key], 0, sizeof(struct timeval));
+    if (value == NULL && ni->replicas[key].value == NULL)
+        return 0;  // Nothing to delete
+
+    assign_object(&ni->unpacked_replicas[key], NULL, 0);
+    if (assign_object(&ni->replicas[key], value, length) != 0)
+        return -1;
+    ni->replicas[key].size = value != NULL ? size : 0;
+    update_merkle(&ni->replica_tree, key, value, length);
     return 0;
 }
 
@@ -263,8 +598,28 @@ void free_nodeinfo(t_nodeinfo *ni)
         if (ni->shcut_info != NULL)
             freeaddrinfo(ni->shcut_info);
         free_udp_message_list(ni->udp_message_list);
-        for (unsigned int i = 0; i < 32; i++) 
-            free(ni->objects[i]);
+        free_storage(ni->storage);
+        free_watches(ni);
+        for (unsigned int i = 0; i < MAX_REQUESTS; i++) {
+            free_batch(ni->request_batch[i]);
+            free_waiters(ni->request_waiters[i]);
+        }
+        for (unsigned int i = 0; i < 32; i++) {
+            free(ni->objects[i].value);
+            free(ni->replicas[i].value);
+            free(ni->unpacked_objects[i].value);
+            free(ni->unpacked_replicas[i].value);
+            free(ni->hot_copies[i].object.value);
+            free(ni->cache.entries[i].value);
+            free(ni->leased_values[i].value);
+            while (ni->leased_acks[i] != NULL) {
+                t_pending_ack *next = ni->leased_acks[i]->next;
+                free(ni->leased_acks[i]);
+                ni->leased_acks[i] = next;
+            }
+            free(ni->fragments[i].data);
+            free_rebuild(i, ni);
+        }
         free(ni);
     }
 }
@@ -347,7 +702,7 @@ t_read_out recv_message(int sd, char *buffer, char delim, size_t max_size, t_con
     }
     else {
         // Full message, possibly more
-        if (delim_pos - buffer > 0) {
+        if ((size_t)(delim_pos-buffer) + 1 < (size_t) recvd) {
             // There's more data after the message, copy it to the buffer
             result.read_bytes = (size_t)(delim_pos-buffer) + 1;
             memcpy(ci->buffer, delim_pos+1, recvd-result.read_bytes);
@@ -364,6 +719,158 @@ t_read_out recv_message(int sd, char *buffer, char delim, size_t max_size, t_con
     return result;
 }
 
+char *buffered_body(t_conn_info *ci, size_t length)
+{
+    return ci->buffer_size >= length ? ci->buffer : NULL;
+}
+
+void consume_body(t_conn_info *ci, size_t length)
+{
+    size_t size = ci->buffer_size > length ? length : ci->buffer_size;
+    if (size < ci->buffer_size)
+        memmove(ci->buffer, ci->buffer+size, ci->buffer_size-size);
+    ci->buffer_size -= size;
+    if (ci->capacity > (size_t) ci->block_size && ci->buffer_size <= (size_t) ci->block_size) {
+        // Go back to the usual buffer once a large body is gone
+        char *smaller = (char*) realloc(ci->buffer, ci->block_size);
+        if (smaller != NULL) {
+            ci->buffer = smaller;
+            ci->capacity = ci->block_size;
+        }
+    }
+}
+
+t_read_out recv_body(int sd, size_t length, t_conn_info *ci)
+{
+    t_read_out result;
+    memset(&result, 0, sizeof(result));
+    result.read_type = RO_SUCCESS;
+    if (ci->buffer_size >= length) {
+        ci->body_size = 0;
+        result.read_bytes = length;
+        return result;
+    }
+
+    ci->body_size = length;
+    if (ci->capacity < length) {
+        char *bigger = (char*) realloc(ci->buffer, length);
+        if (bigger == NULL) {
+            result.read_type = RO_ERROR;
+            result.error_code = ENOMEM;
+            return result;
+        }
+        ci->buffer = bigger;
+        ci->capacity = length;
+    }
+
+    // Take whatever has arrived, without waiting for the rest
+    ssize_t recvd = recv(sd, ci->buffer + ci->buffer_size, length - ci->buffer_size, MSG_DONTWAIT);
+    if (recvd == 0) {
+        // Client disconnected
+        result.read_type = RO_DISCONNECT;
+        return result;
+    }
+    else if (recvd < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        // An error occurred while reading
+        result.read_type = RO_ERROR;
+        result.error_code = errno;
+        return result;
+    }
+    if (recvd > 0)
+        ci->buffer_size += recvd;
+
+    if (ci->buffer_size < length) {
+        result.read_type = RO_PARTIAL;
+        return result;
+    }
+    ci->body_size = 0;
+    result.read_bytes = length;
+    return result;
+}
+
+void start_relay(t_conn_info *ci, size_t length, int to_fd)
+{
+    ci->relay_size = length;
+    ci->relay_fd = to_fd;
+    gettimeofday(&ci->relay_timestamp, NULL);
+}
+
+t_read_out recv_relay(int sd, t_conn_info *ci)
+{
+    t_read_out result;
+    memset(&result, 0, sizeof(result));
+    result.read_type = RO_PARTIAL;
+
+    char chunk[RELAY_CHUNK_SIZE];
+    char *data = chunk;
+    size_t size;
+    if (ci->buffer_size > 0) {
+        // The bytes that arrived along with the header go first
+        data = ci->buffer;
+        size = ci->buffer_size < ci->relay_size ? ci->buffer_size : ci->relay_size;
+    }
+    else {
+        // Take whatever has arrived, without waiting for the rest
+        ssize_t recvd = recv(sd, chunk, ci->relay_size < sizeof(chunk) ? ci->relay_size : sizeof(chunk), MSG_DONTWAIT);
+        if (recvd == 0) {
+            // Client disconnected
+            result.read_type = RO_DISCONNECT;
+            return result;
+        }
+        else if (recvd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // An error occurred while reading
+                result.read_type = RO_ERROR;
+                result.error_code = errno;
+            }
+            return result;
+        }
+        size = recvd;
+    }
+
+    if (ci->relay_fd >= 0 && sendall(ci->relay_fd, data, size) != 0) {
+        // Whoever was getting the body won't get the rest of it: cut the link short so it
+        // doesn't take the next messages for it. The rest is still read (and dropped) so
+        // the incoming stream stays in sync
+        puts("\x1b[31m[!] Couldn't resend the message\033[m");
+        shutdown(ci->relay_fd, SHUT_RDWR);
+        ci->relay_fd = -1;
+    }
+    if (data == ci->buffer) {
+        if (size < ci->buffer_size)
+            memmove(ci->buffer, ci->buffer+size, ci->buffer_size-size);
+        ci->buffer_size -= size;
+    }
+    ci->relay_size -= size;
+    gettimeofday(&ci->relay_timestamp, NULL);
+    if (ci->relay_size == 0)
+        result.read_type = RO_SUCCESS;
+    result.read_bytes = size;
+    return result;
+}
+
+int relaying_body(t_conn_info *ci)
+{
+    return ci->relay_size > 0;
+}
+
+double relay_idle_time(t_conn_info *ci)
+{
+    if (ci->relay_size == 0)
+        return 0;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec - ci->relay_timestamp.tv_sec + 1e-6*(now.tv_usec - ci->relay_timestamp.tv_usec);
+}
+
+int stop_relay(t_conn_info *ci)
+{
+    int to_fd = ci->relay_size > 0 ? ci->relay_fd : -1;
+    ci->relay_size = 0;
+    ci->relay_fd = -1;
+    return to_fd;
+}
+
 void close_sockets(t_nodeinfo *ni)
 {
     if (ni->main_fd >= 0)
@@ -376,6 +883,13 @@ void close_sockets(t_nodeinfo *ni)
         close(ni->temp_fd);
     if (ni->udp_fd >= 0)
         close(ni->udp_fd);
+    ni->main_fd = ni->pred_fd = ni->succ_fd = ni->temp_fd = ni->udp_fd = -1;
+    publish_routing(ni);
+}
+
+void publish_routing(t_nodeinfo *ni)
+{
+    __atomic_store_n(&ni->routable, ni->main_fd != -1 && !ni->pending_join, __ATOMIC_RELEASE);
 }
 
 void free_udp_message_list(t_ongoing_udp_message *oum)
@@ -6,6 +6,30 @@
 #include <arpa/inet.h>
 #include <time.h>
 #include <sys/time.h>
+#include "merkle.h"
+
+// How many search requests each node can have in flight
+#define MAX_REQUESTS 1000
+// How long (in seconds) a SET waits for its owner's acknowledgement before failing
+#define SET_TIMEOUT 3.0
+// Levels of the timer wheel that expires objects, and slots per level
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOTS 64
+// Most fragments (data and parity) a value may be split into
+#define EC_MAX_FRAGMENTS 16
+// Largest value a node accepts from another one
+#define MAX_VALUE_SIZE (16 * 1024 * 1024)
+// Largest message body a node accepts from another one (a batch carries up to 32 values)
+#define MAX_BODY_SIZE (32 * (MAX_VALUE_SIZE + 64))
+// Size of the buffer that holds the answer of an INCR or an APPEND
+#define OPERATION_TEXT_SIZE 24
+// Longest message a datagram can carry
+#define MAX_DATAGRAM_SIZE 62
+// How many of the latest operations an owner remembers the answers of, and for how long
+// (in seconds), to answer the copies of their requests that arrive again (e.g. resent
+// after a lost acknowledgement) without executing them twice
+#define RECENT_OPERATIONS 256
+#define OPERATION_MEMORY 10.0
 
 /**
  * @brief An object that holds information about a network connection
@@ -13,6 +37,42 @@
  */
 typedef struct conn_info t_conn_info;
 
+/**
+ * @brief An object that holds the state of the on-disk copy of the DB
+ * 
+ */
+typedef struct storage t_storage;
+
+/**
+ * @brief An object that holds the worker threads running the virtual nodes
+ * 
+ */
+typedef struct workers t_workers;
+
+/**
+ * @brief An object that holds the thread running the interactive console
+ * 
+ */
+typedef struct console t_console;
+
+/**
+ * @brief An object that holds the local control socket and its clients
+ * 
+ */
+typedef struct control t_control;
+
+/**
+ * @brief A node that asked to be told about the changes of a key this node owns
+ * 
+ */
+typedef struct watcher t_watcher;
+
+/**
+ * @brief A watch this node registered on behalf of one of its clients
+ * 
+ */
+typedef struct watch t_watch;
+
 typedef enum {
     UDPMSG_CHORD,
     UDPMSG_ENTERING
@@ -28,6 +88,134 @@ typedef struct ongoing_udp_message {
     t_udp_message_type type;
 } t_ongoing_udp_message;
 
+typedef struct datagram {
+    // Message body (with room for the newline appended before parsing it)
+    char body[66];
+    size_t length;
+    struct sockaddr_in sender;
+    socklen_t sender_len;
+    // Whether the message was already acknowledged by the socket that received it
+    int acked;
+} t_datagram;
+
+typedef struct object {
+    // Object value (always followed by a NUL byte, but may contain others)
+    char *value;
+    // Size of the value in bytes
+    size_t length;
+    // How many times the object's owners have changed it (objects stored by this node)
+    unsigned long version;
+    // Size of the value once decompressed (0 if it isn't compressed; only the objects and
+    // replicas stored by the node are)
+    size_t size;
+} t_object;
+
+typedef struct hot_copy {
+    // Copy of an object owned by another node (a NULL value if it doesn't exist), with
+    // the owner's version of it
+    t_object object;
+    // Whether there is a copy, and until when it may be used
+    int valid;
+    struct timeval expires;
+} t_hot_copy;
+
+typedef struct lease_cache {
+    // Values relayed for other nodes (a NULL value if the object doesn't exist), with the
+    // owner's version of each
+    t_object entries[32];
+    // Keys that have an entry, and the ones used since the clock hand last passed them (bitmasks)
+    unsigned int valid, referenced;
+    // Until when each entry may be used (its owner's lease)
+    struct timeval expires[32];
+    // Lowest version of each key that may still be cached (the older ones were revoked)
+    unsigned long revoked[32];
+    // Key the clock hand points at
+    unsigned int hand;
+    // How many bytes the values take, and how many they may take (0 disables the cache)
+    size_t bytes, budget;
+    // How many GETs were answered from the cache, and how many entries were evicted
+    unsigned long hits, evictions;
+} t_lease_cache;
+
+typedef struct timer_wheel {
+    // First key in each slot of each level (-1 if the slot is empty). A slot of level l
+    // spans WHEEL_SLOTS^l ticks
+    int slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    // Keys before and after each one in its slot (-1 at the ends), and the level and
+    // slot it is in (a level of -1 if the key has no TTL)
+    int prev[32], next[32], level[32], slot[32];
+    // Tick at which each key expires
+    unsigned long expires[32];
+    // Last tick processed, and when tick 0 was
+    unsigned long now;
+    struct timeval start;
+    // How many keys have a TTL
+    unsigned int count;
+} t_timer_wheel;
+
+typedef struct fragment {
+    // Bytes of the fragment (NULL if the node holds none for the key)
+    char *data;
+    // Which fragment it is (the first k are pieces of the value, the other m parity), out
+    // of how many
+    unsigned int index, k, m;
+    // Size of the value as its owner stores it, and once decompressed (0 if it isn't
+    // compressed)
+    size_t length, size;
+    // Hash of the value, which all of its fragments carry
+    uint64_t hash;
+    // When the object expires (zero if it has no TTL)
+    struct timeval expires;
+} t_fragment;
+
+typedef struct rebuild {
+    // The value being rebuilt, as described by the fragment the node holds
+    t_fragment value;
+    // Fragments gathered so far (NULL for the ones still missing), and how many there are
+    char *fragments[EC_MAX_FRAGMENTS];
+    unsigned int count;
+    // When to give up waiting for more
+    struct timeval deadline;
+} t_rebuild;
+
+typedef struct batch {
+    // Keys that were asked for, and the ones whose values haven't arrived yet (bitmasks)
+    unsigned int keys, missing;
+    // Values gathered so far, indexed by key
+    t_object values[32];
+    // Whether the values are passed on as they arrive instead (range scans)
+    int streaming;
+} t_batch;
+
+typedef struct applied_operation {
+    // Node that asked for the operation, and the request's sequence number
+    unsigned int requester, n;
+    // The object's key and the operation (a t_operation)
+    unsigned int key;
+    int op;
+    // Whether it was done, the object's version afterwards, and the answer (if it has one)
+    int code;
+    unsigned long version;
+    char text[OPERATION_TEXT_SIZE];
+    size_t length;
+    int answered;
+    // When it was executed (zero if the entry is unused)
+    struct timeval timestamp;
+} t_applied_operation;
+
+typedef struct pending_ack {
+    // Node that sent a SET held back by leases, and the request's sequence number
+    unsigned int requester, n;
+    struct pending_ack *next;
+} t_pending_ack;
+
+typedef struct waiter {
+    // Client waiting for the answer of a request, and the identifier it gave its own
+    int client;
+    unsigned long tag;
+    struct waiter *next;
+} t_waiter;
+
 typedef struct nodeinfo {
     // Node key
     unsigned int key;
@@ -64,10 +252,55 @@ typedef struct nodeinfo {
     // Search sequence number
     unsigned int find_n;
     // Search requests
-    int requests[100];
+    int requests[MAX_REQUESTS];
     // Search request info
-    struct sockaddr request_addr[100];
-    socklen_t request_addr_len[100];
+    struct sockaddr request_addr[MAX_REQUESTS];
+    socklen_t request_addr_len[MAX_REQUESTS];
+    // Client that made each search request (NO_CLIENT if it was the console)
+    int request_client[MAX_REQUESTS];
+    // Identifier the client gave each search request
+    unsigned long request_tag[MAX_REQUESTS];
+    // Keys and values of each batch request (NULL for the other requests)
+    t_batch *request_batch[MAX_REQUESTS];
+    // Other clients waiting for the answer of each GET request, in the order they asked
+    t_waiter *request_waiters[MAX_REQUESTS];
+    // When each SET request gives up on its acknowledgement (zero for the other requests)
+    struct timeval request_deadline[MAX_REQUESTS];
+    // How many SETs sent to other nodes were acknowledged, and how many gave up waiting
+    unsigned long sets_acknowledged, sets_timed_out;
+    // GET request in flight for each key (-1 if there is none), and when it was sent
+    int pending_get[32];
+    struct timeval pending_get_timestamp[32];
+    // How many GETs were sent towards the owners, and how many waited for one of those instead
+    unsigned long gets_forwarded, gets_coalesced;
+    // Read-only copies of frequently read objects owned by the successors
+    t_hot_copy hot_copies[32];
+    // How many GETs from other nodes this node answered for each key lately (halved every
+    // window), and when the current window started
+    unsigned int hot_hits[32];
+    struct timeval hot_window_timestamp;
+    // Until when the predecessor may answer GETs with a copy this node gave it, per key
+    struct timeval hot_pushed_until[32];
+    // How many GETs from other nodes were answered with a copy
+    unsigned long hot_answers;
+    // Values relayed for other nodes, which may be used while their owners' leases last
+    t_lease_cache cache;
+    // Until when other nodes may have a leased copy of each object this node owns
+    struct timeval lease_until[32];
+    // Writes waiting for the leases on their keys to be revoked or to run out (bitmask), and
+    // their values
+    unsigned int leased_writes;
+    t_object leased_values[32];
+    // SETs to acknowledge once the write held back for each key is applied, in the order
+    // they arrived
+    t_pending_ack *leased_acks[32];
+    // Answers of the latest operations executed on the objects this node owns, indexed by
+    // requester and sequence number
+    t_applied_operation applied_operations[RECENT_OPERATIONS];
+    // When each object this node owns expires
+    t_timer_wheel expiry;
+    // How many objects expired
+    unsigned long objects_expired;
     // Socket file descriptor for UDP server
     int udp_fd;
     // Shortcut key
@@ -81,13 +314,93 @@ typedef struct nodeinfo {
     // List of ongoing UDP messages
     t_ongoing_udp_message *udp_message_list;
     // Object storage
-    char *objects[32];
+    t_object objects[32];
+    // How many bytes the objects' values take, and how many they may take (0 for no limit)
+    size_t object_bytes, memory_budget;
+    // Objects read or written since the clock hand last passed them (bitmask), and the key
+    // the hand points at
+    unsigned int object_referenced, object_hand;
+    // How many objects were evicted to stay within the memory budget
+    unsigned long object_evictions;
+    // Smallest value that is compressed (0 disables compression)
+    size_t compress_threshold;
+    // Decompressed copies of the compressed objects and replicas read since the last event
+    t_object unpacked_objects[32], unpacked_replicas[32];
+    // How many values were compressed (or tried to be) and decompressed, and how long it took
+    unsigned long values_compressed, values_decompressed;
+    double compress_seconds, decompress_seconds;
+    // Copies of objects owned by the predecessors (replicas)
+    t_object replicas[32];
+    // How many data and parity fragments the large objects are split into (0 data fragments
+    // if they are replicated whole)
+    unsigned int ec_k, ec_m;
+    // Fragments of the objects owned by the predecessors
+    t_fragment fragments[32];
+    // Objects this node owns whose fragments were sent to the successors (bitmask)
+    unsigned int fragmented;
+    // Whether a fragment came back around the ring, which has too few nodes to hold them
+    // all (objects are copied whole instead, until the successor changes)
+    int ec_fallback;
+    // Objects of a failed predecessor being rebuilt from their fragments (NULL if not)
+    t_rebuild *rebuilds[32];
+    // How many objects were rebuilt
+    unsigned long objects_rebuilt;
+    // When each replica expires (zero if its object has no TTL)
+    struct timeval replica_expires[32];
+    // Merkle tree over the object storage
+    t_merkle object_tree;
+    // Merkle tree over the replicas
+    t_merkle replica_tree;
+    // When the objects were last compared with the successor's replicas
+    struct timeval sync_timestamp;
+    // How many successors hold a copy of each object this node owns
+    unsigned int replication;
+    // Whether GETs can only be answered by the object's owner
+    int strong_reads;
+    // On-disk log of the object storage (NULL if persistence is disabled)
+    t_storage *storage;
+    // Sequence number of the latest handoff of objects to a neighbour
+    unsigned int handoff_n;
+    // Bitmask of the keys handed off to a neighbour that still weren't acknowledged
+    unsigned int handoff_keys;
+    // When the latest handoff started
+    struct timeval handoff_timestamp;
+    // Partial messages received through the predecessor, successor and temporary connections
+    char pred_buffer[64], succ_buffer[64], temp_buffer[64];
+    // Current size of each of those buffers
+    size_t pred_buffer_size, succ_buffer_size, temp_buffer_size;
+    // First virtual node hosted by the same process (this node itself if it is the first)
+    struct nodeinfo *first_vnode;
+    // Next virtual node hosted by the same process (NULL if this is the last one)
+    struct nodeinfo *next_vnode;
+    // Whether this virtual node should join the ring once the previous ones are in it
+    int pending_join;
+    // Whether this virtual node is in the ring and takes requests (see publish_routing()).
+    // Other threads read it to route requests, so it is only accessed atomically
+    int routable;
+    // When this virtual node started joining the ring
+    struct timeval join_timestamp;
+    // Worker threads of the process (NULL if everything runs on the main thread)
+    t_workers *workers;
+    // Index of the worker thread that runs this virtual node
+    unsigned int worker;
+    // Thread reading the user's commands (NULL if there is none)
+    t_console *console;
+    // Local control socket (NULL if there is none)
+    t_control *control;
+    // Nodes watching each key this node owns
+    t_watcher *watchers[32];
+    // Watches this node registered for its clients, and the next one's identifier
+    t_watch *watches;
+    unsigned int watch_n;
 } t_nodeinfo;
 
 enum type {
     RO_SUCCESS,
     RO_ERROR,
-    RO_DISCONNECT
+    RO_DISCONNECT,
+    // Only part of a message body has arrived so far (or been relayed)
+    RO_PARTIAL
 };
 
 typedef struct read_out {
@@ -120,6 +433,23 @@ int copy_conn_info(t_conn_info **dest, t_conn_info *src);
  */
 void reset_conn_buffer(t_conn_info* ci);
 
+/**
+ * @brief Count an object received through a handoff a neighbour is sending over a connection
+ * 
+ * @param ci the t_conn_info object
+ * @param n the handoff's sequence number (a new one starts the count over)
+ */
+void count_handoff_object(t_conn_info *ci, unsigned int n);
+
+/**
+ * @brief Get how many objects of a handoff arrived over a connection, and start counting over
+ * 
+ * @param ci the t_conn_info object
+ * @param n the handoff's sequence number
+ * @return [ @b unsigned @b int ] how many of its objects arrived (0 if it isn't the latest one)
+ */
+unsigned int take_handoff_count(t_conn_info *ci, unsigned int n);
+
 /**
  * @brief Frees a t_conn_info object
  * 
@@ -193,23 +523,98 @@ t_ongoing_udp_message *find_udp_message_from(t_nodeinfo *ni, struct sockaddr *re
 t_ongoing_udp_message *pop_udp_message_from(t_nodeinfo *ni, struct sockaddr *recipient);
 
 /**
- * @brief Get an object stored in the DB by its key
+ * @brief Get an object stored in the DB by its key, decompressing it if it's compressed
+ * (the decompressed copy lasts until the next event)
  * 
  * @param key object's key
  * @param ni necessary information about the node 
- * @return [ @b char* ] the stored object 
+ * @return [ @b t_object* ] the stored object, or NULL if there is none
  */
-char *get_object(unsigned int key, t_nodeinfo* ni);
+t_object *get_object(unsigned int key, t_nodeinfo* ni);
 
 /**
- * @brief Store a value associated with a key in the DB
+ * @brief Get an object stored in the DB by its key, as it is stored (maybe compressed)
  * 
  * @param key object's key
- * @param value object's value
+ * @param ni necessary information about the node 
+ * @return [ @b t_object* ] the stored object, or NULL if there is none
+ */
+t_object *get_stored_object(unsigned int key, t_nodeinfo* ni);
+
+/**
+ * @brief Store a value associated with a key in the DB (compressed if it is at least as
+ * large as the node's threshold and compressing it saves space)
+ * 
+ * @param key object's key
+ * @param value object's value (NULL to delete the object)
+ * @param length size of the value in bytes
  * @param ni necessary information about the node
  * @return [ @b int ] 0 if successfull, 1 if the key is invalid and -1 in case of an error
  */
-int set_object(unsigned int key, char *value, t_nodeinfo *ni);
+int set_object(unsigned int key, char *value, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Store a value associated with a key in the DB, in the form another node stored it
+ * 
+ * @param key object's key
+ * @param value object's value, maybe compressed (NULL to delete the object)
+ * @param length size of the value in bytes
+ * @param size size of the value once decompressed (0 if it isn't compressed, in which
+ * case it is compressed here if it's worth it)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, 1 if the key is invalid and -1 in case of an error
+ */
+int set_stored_object(unsigned int key, char *value, size_t length, size_t size, t_nodeinfo *ni);
+
+/**
+ * @brief Replace an object's value
+ * 
+ * @param object the object
+ * @param value the new value (NULL to delete it)
+ * @param length size of the value in bytes
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int assign_object(t_object *object, char *value, size_t length);
+
+/**
+ * @brief Get a copy of an object owned by another node (replica) by its key, decompressing
+ * it if it's compressed (the decompressed copy lasts until the next event)
+ * 
+ * @param key object's key
+ * @param ni necessary information about the node 
+ * @return [ @b t_object* ] the replica, or NULL if there is none
+ */
+t_object *get_replica(unsigned int key, t_nodeinfo* ni);
+
+/**
+ * @brief Get a copy of an object owned by another node (replica) by its key, as it is
+ * stored (maybe compressed)
+ * 
+ * @param key object's key
+ * @param ni necessary information about the node 
+ * @return [ @b t_object* ] the replica, or NULL if there is none
+ */
+t_object *get_stored_replica(unsigned int key, t_nodeinfo* ni);
+
+/**
+ * @brief Store a copy of an object owned by another node (replica), in the form its owner
+ * stored it
+ * 
+ * @param key object's key
+ * @param value object's value, maybe compressed (NULL to delete the replica)
+ * @param length size of the value in bytes
+ * @param size size of the value once decompressed (0 if it isn't compressed)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, 1 if the key is invalid and -1 in case of an error
+ */
+int set_replica(unsigned int key, char *value, size_t length, size_t size, t_nodeinfo *ni);
+
+/**
+ * @brief Free the decompressed copies of the objects and replicas read so far
+ * 
+ * @param ni necessary information about the node
+ */
+void release_unpacked(t_nodeinfo *ni);
 
 /**
  * @brief Frees a t_nodeinfo object
@@ -253,6 +658,83 @@ int udpsend(int sd, char *message, size_t size, struct addrinfo *to);
  */
 t_read_out recv_message(int sd, char *buffer, char delim, size_t max_size, t_conn_info *ci);
 
+/**
+ * @brief Buffer the body that follows a message in the connection's internal buffer,
+ * taking only the bytes that have already arrived (so that it never blocks)
+ * 
+ * @param sd socket file descriptor
+ * @param length size of the body in bytes
+ * @param ci necessary information about the connection
+ * @return [ @b t_read_out ] structure describing the result (RO_PARTIAL until the whole
+ * body is buffered)
+ */
+t_read_out recv_body(int sd, size_t length, t_conn_info *ci);
+
+/**
+ * @brief Start relaying the body that follows a message as it arrives, instead of
+ * buffering it (recv_relay then moves it along a chunk at a time)
+ * 
+ * @param ci necessary information about the connection the body is arriving through
+ * @param length size of the body in bytes
+ * @param to_fd socket to relay the body to (-1 to drop it)
+ */
+void start_relay(t_conn_info *ci, size_t length, int to_fd);
+
+/**
+ * @brief Relay the next chunk of a body (of at most a few KiB) that only passes through
+ * this node, taking only the bytes that have already arrived (so that it never blocks)
+ * 
+ * @param sd socket file descriptor the body is arriving through
+ * @param ci necessary information about the connection
+ * @return [ @b t_read_out ] structure describing the result (RO_PARTIAL until the whole
+ * body is relayed)
+ */
+t_read_out recv_relay(int sd, t_conn_info *ci);
+
+/**
+ * @brief Checks whether a body that only passes through this node is being relayed
+ * through a connection
+ * 
+ * @param ci necessary information about the connection
+ * @return [ @b int ] 1 if true, 0 if false 
+ */
+int relaying_body(t_conn_info *ci);
+
+/**
+ * @brief Get how long a body relayed through a connection has gone without any of it
+ * arriving
+ * 
+ * @param ci necessary information about the connection
+ * @return [ @b double ] the time in seconds (0 if the connection isn't relaying a body)
+ */
+double relay_idle_time(t_conn_info *ci);
+
+/**
+ * @brief Give up on the body relayed through a connection (e.g. because the connection
+ * broke)
+ * 
+ * @param ci necessary information about the connection
+ * @return [ @b int ] the socket the body was going to, or -1 if there was none
+ */
+int stop_relay(t_conn_info *ci);
+
+/**
+ * @brief Get the message body buffered by recv_body
+ * 
+ * @param ci necessary information about the connection
+ * @param length size of the body in bytes
+ * @return [ @b char* ] the body (until it is consumed), or NULL if it isn't all buffered
+ */
+char *buffered_body(t_conn_info *ci, size_t length);
+
+/**
+ * @brief Drop a message body from the connection's internal buffer once it's been handled
+ * 
+ * @param ci necessary information about the connection
+ * @param length size of the body in bytes
+ */
+void consume_body(t_conn_info *ci, size_t length);
+
 /**
  * @brief Register a new "find" request
  * 
@@ -284,6 +766,24 @@ int get_associated_key(unsigned int n, t_nodeinfo *ni);
  */
 int get_associated_addrinfo(unsigned int n, struct sockaddr *dest, socklen_t *dest_len, t_nodeinfo *ni);
 
+/**
+ * @brief Make a client wait for the answer of a request another client made
+ * 
+ * @param n request sequence number
+ * @param client the client
+ * @param tag the identifier the client gave its request
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int add_waiter(unsigned int n, int client, unsigned long tag, t_nodeinfo *ni);
+
+/**
+ * @brief Free a batch request's keys and values
+ * 
+ * @param batch the t_batch object (nothing happens if it is NULL)
+ */
+void free_batch(t_batch *batch);
+
 /**
  * @brief Drop a "find" request
  * 
@@ -298,6 +798,15 @@ void drop_request(unsigned int n, t_nodeinfo *ni);
  * @param ni necessary information about the node */
 void close_sockets(t_nodeinfo *ni);
 
+/**
+ * @brief Let the other threads know whether this virtual node can take requests (it
+ * has a listening socket and isn't still joining the ring). Called whenever either
+ * changes, so that they never read the fields themselves
+ * 
+ * @param ni necessary information about the node
+ */
+void publish_routing(t_nodeinfo *ni);
+
 /**
  * @brief Frees the memory associated with a t_ongoing_udp_message 
  * 
@@ -0,0 +1,175 @@
+#include "compress.h"
+#include <stdint.h>
+#include <string.h>
+
+// Bits of the hash of 4 bytes used to find earlier occurrences of them
+#define HASH_BITS 12
+// Shortest back-reference worth encoding
+#define MIN_MATCH 4
+// Furthest back a reference may point
+#define MAX_OFFSET 65535
+
+/**
+ * @brief Read 4 bytes of a value as a number (in whatever byte order the machine uses,
+ * since it is only compared and hashed)
+ *
+ * @param p the bytes
+ * @return [ @b uint32_t ] the number
+ */
+uint32_t read32(const char *p)
+{
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+/**
+ * @brief Write a length that didn't fit in its 4 bits of a token as a run of bytes (255
+ * for each whole 255, then the rest)
+ *
+ * @param dest where to write it
+ * @param end where @b dest ends
+ * @param length what is left of the length
+ * @return [ @b char* ] the position after the length, or NULL if it doesn't fit
+ */
+char *write_length(char *dest, char *end, size_t length)
+{
+    for (; length >= 255; length -= 255) {
+        if (dest >= end)
+            return NULL;
+        *dest++ = (char) 255;
+    }
+    if (dest >= end)
+        return NULL;
+    *dest++ = (char) length;
+    return dest;
+}
+
+/**
+ * @brief Write a run of literals followed by a back-reference (a sequence): a token with
+ * both lengths (15 meaning that more bytes of it follow), the literals, and the reference's
+ * offset and length
+ *
+ * @param dest where to write it
+ * @param end where @b dest ends
+ * @param literals the literals
+ * @param count how many there are
+ * @param offset how far back the reference points (0 if there is none, which ends the value)
+ * @param match how many bytes the reference copies
+ * @return [ @b char* ] the position after the sequence, or NULL if it doesn't fit
+ */
+char *write_sequence(char *dest, char *end, const char *literals, size_t count, size_t offset, size_t match)
+{
+    if (dest >= end)
+        return NULL;
+    char *token = dest++;
+    size_t extra = offset != 0 ? match - MIN_MATCH : 0;
+    *token = (char) ((count < 15 ? count : 15) << 4 | (extra < 15 ? extra : 15));
+    if (count >= 15 && (dest = write_length(dest, end, count - 15)) == NULL)
+        return NULL;
+    if ((size_t) (end - dest) < count)
+        return NULL;
+    memcpy(dest, literals, count);
+    dest += count;
+    if (offset == 0)
+        return dest;
+
+    if (end - dest < 2)
+        return NULL;
+    *dest++ = (char) (offset & 0xff);
+    *dest++ = (char) (offset >> 8);
+    if (extra >= 15)
+        dest = write_length(dest, end, extra - 15);
+    return dest;
+}
+
+size_t lz_compress(const char *src, size_t length, char *dest, size_t capacity)
+{
+    // Where each hash of 4 bytes was last seen (plus one, so that 0 means never)
+    uint32_t seen[1 << HASH_BITS];
+    memset(seen, 0, sizeof(seen));
+
+    char *out = dest, *end = dest + capacity;
+    size_t anchor = 0, pos = 0;
+    while (length >= MIN_MATCH && pos <= length - MIN_MATCH) {
+        uint32_t sequence = read32(src + pos);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        size_t candidate = seen[hash];
+        seen[hash] = pos + 1;
+        if (candidate == 0 || pos - (candidate - 1) > MAX_OFFSET || read32(src + candidate - 1) != sequence) {
+            pos++;
+            continue;
+        }
+
+        size_t ref = candidate - 1, match = MIN_MATCH;
+        while (pos + match < length && src[ref + match] == src[pos + match])
+            match++;
+        out = write_sequence(out, end, src + anchor, pos - anchor, pos - ref, match);
+        if (out == NULL)
+            return 0;
+        pos += match;
+        anchor = pos;
+    }
+    // The value ends with a run of literals (maybe empty)
+    out = write_sequence(out, end, src + anchor, length - anchor, 0, 0);
+    return out != NULL ? (size_t) (out - dest) : 0;
+}
+
+/**
+ * @brief Read a length that didn't fit in its 4 bits of a token
+ *
+ * @param src where the rest of the length starts (moved past it)
+ * @param end where the compressed value ends
+ * @param length the length so far (15)
+ * @return [ @b int ] 0 if successfull, -1 if the value ends before it does
+ */
+int read_length(const unsigned char **src, const unsigned char *end, size_t *length)
+{
+    unsigned char byte;
+    do {
+        if (*src >= end)
+            return -1;
+        byte = *(*src)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+int lz_decompress(const char *src, size_t length, char *dest, size_t size)
+{
+    const unsigned char *in = (const unsigned char*) src, *end = in + length;
+    size_t out = 0;
+    while (in < end) {
+        unsigned char token = *in++;
+        size_t count = token >> 4;
+        if (count == 15 && read_length(&in, end, &count) != 0)
+            return -1;
+        if ((size_t) (end - in) < count || size - out < count)
+            return -1;
+        memcpy(dest + out, in, count);
+        in += count;
+        out += count;
+        if (in == end)
+            break;  // The last sequence has no back-reference
+
+        if (end - in < 2)
+            return -1;
+        size_t offset = in[0] | (size_t) in[1] << 8;
+        in += 2;
+        size_t match = token & 15;
+        if (match == 15 && read_length(&in, end, &match) != 0)
+            return -1;
+        match += MIN_MATCH;
+        if (offset == 0 || offset > out || size - out < match)
+            return -1;
+        if (offset >= match)
+            memcpy(dest + out, dest + out - offset, match);
+        else {
+            // The reference overlaps what it copies (a repeated pattern), so byte by byte
+            for (size_t i = 0; i < match; i++)
+                dest[out + i] = dest[out + i - offset];
+        }
+        out += match;
+    }
+    return out == size ? 0 : -1;
+}
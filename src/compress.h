@@ -0,0 +1,30 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+
+/**
+ * @brief Compress a value with a fast LZ77 codec (literal runs and back-references
+ * of up to 64KiB, in the spirit of LZ4)
+ *
+ * @param src the value
+ * @param length its size in bytes
+ * @param dest where to write the compressed value
+ * @param capacity how many bytes may be written to @b dest
+ * @return [ @b size_t ] the size of the compressed value, or 0 if it doesn't fit in
+ * @b capacity bytes (the value isn't worth compressing)
+ */
+size_t lz_compress(const char *src, size_t length, char *dest, size_t capacity);
+
+/**
+ * @brief Decompress a value compressed with lz_compress
+ *
+ * @param src the compressed value
+ * @param length its size in bytes
+ * @param dest where to write the value, which must be able to hold @b size bytes
+ * @param size the value's size once decompressed
+ * @return [ @b int ] 0 if successfull, -1 if the compressed value is corrupt
+ */
+int lz_decompress(const char *src, size_t length, char *dest, size_t size);
+
+#endif
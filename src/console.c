@@ -0,0 +1,396 @@
+#define _GNU_SOURCE
+#include "console.h"
+#include "queue.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/select.h>
+
+// How many commands can be waiting for the network loop
+#define COMMAND_QUEUE_SIZE 64
+// How many chunks of output (of up to BUFSIZ bytes) can be waiting for the terminal
+// before the rest is dropped
+#define OUTPUT_QUEUE_SIZE 4096
+
+typedef struct command {
+    // The line typed by the user (including the '\n')
+    char *line;
+    // What processing it returned (only for finished commands)
+    int result;
+} t_command;
+
+typedef struct output {
+    char *data;
+    size_t length;
+} t_output;
+
+struct console {
+    pthread_t thread;
+    // Commands typed by the user (t_command, from the console thread to the network loop)
+    t_spsc_queue *commands;
+    // Finished commands (t_command, from the network loop to the console thread)
+    t_spsc_queue *results;
+    // What the process printed (t_output, from whichever thread is flushing the
+    // standard output to the console thread)
+    t_spsc_queue *output;
+    // Written to whenever a command is queued (read end, write end)
+    int command_wakeup[2];
+    // Written to whenever a command has finished (read end, write end)
+    int result_wakeup[2];
+    // Written to whenever output is queued (read end, write end)
+    int output_wakeup[2];
+    // The original standard output (the terminal)
+    FILE *terminal;
+    // How many bytes of output were dropped because the terminal fell behind
+    size_t dropped;
+    // Set when the user's input was closed (after queueing its last command)
+    int closed;
+    // Set when the standard output was restored (after queueing the last output)
+    int finished;
+};
+
+/**
+ * @brief Write a whole buffer to the terminal (errors are ignored)
+ *
+ * @param c the t_console object
+ * @param data the buffer
+ * @param length its size
+ */
+void write_terminal(t_console *c, char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, length);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        data += written;
+        length -= written;
+    }
+}
+
+/**
+ * @brief Checks whether the input buffer holds a complete line
+ *
+ * @param input the input buffer
+ * @param input_size how much of it is filled
+ * @return [ @b int ] 1 if true, 0 if false
+ */
+int has_line(char *input, size_t input_size)
+{
+    return input_size > 0 && memchr(input, '\n', input_size) != NULL;
+}
+
+/**
+ * @brief Queue every complete line in the input buffer (as long as there is room)
+ *
+ * @param c the t_console object
+ * @param input the input buffer
+ * @param input_size how much of it is filled (updated)
+ * @return [ @b int ] how many lines were queued
+ */
+int queue_lines(t_console *c, char *input, size_t *input_size)
+{
+    int queued = 0;
+    char *end;
+    while (has_line(input, *input_size)) {
+        end = memchr(input, '\n', *input_size);
+        size_t length = end - input + 1;
+        t_command command = { .line = (char*) malloc(length+1), .result = 0 };
+        if (command.line == NULL)
+            break;
+        memcpy(command.line, input, length);
+        command.line[length] = '\0';
+        if (queue_push(c->commands, &command) != 0) {
+            // Try again once the network loop has caught up
+            free(command.line);
+            break;
+        }
+        memmove(input, input+length, *input_size-length);
+        *input_size -= length;
+        queued++;
+    }
+    if (queued > 0 && write(c->command_wakeup[1], "", 1) == -1) {
+        // The pipe is full, so the network loop will wake up anyway
+    }
+    return queued;
+}
+
+/**
+ * @brief Write function of the stream that replaces the standard output: the output is
+ * handed to the console thread, so printing never waits for the terminal (the stream's
+ * lock makes whichever thread flushes it the queue's only producer)
+ *
+ * @param cookie the t_console object
+ * @param data the output
+ * @param length its size
+ * @return [ @b ssize_t ] how many bytes were written (always all of them)
+ */
+ssize_t pass_output(void *cookie, const char *data, size_t length)
+{
+    t_console *c = (t_console*) cookie;
+    t_output chunk = { .data = (char*) malloc(length), .length = length };
+    if (chunk.data != NULL)
+        memcpy(chunk.data, data, length);
+    if (chunk.data == NULL || queue_push(c->output, &chunk) != 0) {
+        free(chunk.data);
+        __atomic_add_fetch(&c->dropped, length, __ATOMIC_RELAXED);
+    }
+    if (write(c->output_wakeup[1], "", 1) == -1) {
+        // The pipe is full, so the console thread will wake up anyway
+    }
+    return length;
+}
+
+/**
+ * @brief Close function of the stream that replaces the standard output: the console
+ * thread exits once it has written the rest of the output
+ *
+ * @param cookie the t_console object
+ * @return [ @b int ] 0
+ */
+int finish_output(void *cookie)
+{
+    t_console *c = (t_console*) cookie;
+    __atomic_store_n(&c->finished, 1, __ATOMIC_RELEASE);
+    if (write(c->output_wakeup[1], "", 1) == -1) {
+        // The pipe is full, so the console thread will wake up anyway
+    }
+    return 0;
+}
+
+/**
+ * @brief Body of the console thread
+ *
+ * @param arg the t_console object
+ */
+void *run_console(void *arg)
+{
+    t_console *c = (t_console*) arg;
+    char *input = NULL;
+    size_t input_size = 0, input_capacity = 0;
+    int input_open = 1;
+
+    // Whether the prompt is the last thing on the terminal
+    int prompt = 1;
+    write_terminal(c, ">>> ", 4);
+
+    while (1) {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(c->output_wakeup[0], &read_fds);
+        FD_SET(c->result_wakeup[0], &read_fds);
+        int fdmax = c->output_wakeup[0] > c->result_wakeup[0] ? c->output_wakeup[0] : c->result_wakeup[0];
+        // Leave the rest of the input in stdin while the queue is full
+        if (input_open && !has_line(input, input_size))
+            FD_SET(STDIN_FILENO, &read_fds);
+
+        if (select(fdmax+1, &read_fds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (FD_ISSET(c->output_wakeup[0], &read_fds) || FD_ISSET(c->result_wakeup[0], &read_fds)) {
+            char discard[64];
+            while (read(c->output_wakeup[0], discard, sizeof(discard)) > 0)
+                continue;
+            while (read(c->result_wakeup[0], discard, sizeof(discard)) > 0)
+                continue;
+            // Take the finished commands before the output, which was queued before they
+            // were reported, so it's all written before the prompt comes back
+            int stopping = __atomic_load_n(&c->finished, __ATOMIC_ACQUIRE);
+            t_command command;
+            int finished = 0;
+            while (queue_pop(c->results, &command)) {
+                free(command.line);
+                finished = 1;
+            }
+
+            // Write whatever has been printed
+            t_output chunk;
+            int printed = 0;
+            while (queue_pop(c->output, &chunk)) {
+                if (prompt && !printed)
+                    write_terminal(c, "\x08\x08\x08\x08", 4);
+                write_terminal(c, chunk.data, chunk.length);
+                free(chunk.data);
+                printed = 1;
+            }
+            size_t dropped = __atomic_exchange_n(&c->dropped, 0, __ATOMIC_RELAXED);
+            if (dropped > 0) {
+                char note[128];
+                int length = snprintf(note, sizeof(note), "\x1b[33m[!] %zu byte(s) of output were dropped (the terminal fell behind)\033[m\n", dropped);
+                if (prompt && !printed)
+                    write_terminal(c, "\x08\x08\x08\x08", 4);
+                write_terminal(c, note, length);
+                printed = 1;
+            }
+            if (stopping)
+                // The standard output was restored, so nothing else will be printed
+                break;
+            if (printed && prompt)
+                write_terminal(c, ">>> ", 4);
+
+            queue_lines(c, input, &input_size);
+            if (finished && !prompt && !has_line(input, input_size) && queue_drained(c->commands)) {
+                // Every command typed so far has finished
+                write_terminal(c, ">>> ", 4);
+                prompt = 1;
+            }
+        }
+
+        if (input_open && FD_ISSET(STDIN_FILENO, &read_fds)) {
+            if (input_capacity - input_size < 4096) {
+                char *bigger = (char*) realloc(input, input_capacity + 4096);
+                if (bigger == NULL)
+                    break;
+                input = bigger;
+                input_capacity += 4096;
+            }
+            ssize_t n = read(STDIN_FILENO, input+input_size, input_capacity-input_size-1);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                // The last line may not end in '\n'
+                input_open = 0;
+                if (input_size > 0)
+                    input[input_size++] = '\n';
+            }
+            else
+                input_size += n;
+
+            // The user pressed enter, so the prompt is gone
+            if (queue_lines(c, input, &input_size) > 0)
+                prompt = 0;
+            if (!input_open) {
+                __atomic_store_n(&c->closed, 1, __ATOMIC_RELEASE);
+                if (write(c->command_wakeup[1], "", 1) == -1) {
+                    // The pipe is full, so the network loop will wake up anyway
+                }
+            }
+        }
+    }
+    free(input);
+    return NULL;
+}
+
+/**
+ * @brief Close the file descriptors of a t_console object and free it
+ *
+ * @param c the t_console object
+ */
+void free_console(t_console *c)
+{
+    int *fds[] = { &c->command_wakeup[0], &c->command_wakeup[1], &c->result_wakeup[0],
+        &c->result_wakeup[1], &c->output_wakeup[0], &c->output_wakeup[1] };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+    }
+    t_command command;
+    while (c->commands != NULL && queue_pop(c->commands, &command))
+        free(command.line);
+    while (c->results != NULL && queue_pop(c->results, &command))
+        free(command.line);
+    t_output chunk;
+    while (c->output != NULL && queue_pop(c->output, &chunk))
+        free(chunk.data);
+    free_queue(c->commands);
+    free_queue(c->results);
+    free_queue(c->output);
+    free(c);
+}
+
+t_console *start_console(t_nodeinfo *ni)
+{
+    t_console *c = (t_console*) calloc(1, sizeof(t_console));
+    if (c == NULL)
+        return NULL;
+    c->command_wakeup[0] = c->command_wakeup[1] = -1;
+    c->result_wakeup[0] = c->result_wakeup[1] = -1;
+    c->output_wakeup[0] = c->output_wakeup[1] = -1;
+
+    c->commands = new_queue(COMMAND_QUEUE_SIZE, sizeof(t_command));
+    c->results = new_queue(COMMAND_QUEUE_SIZE, sizeof(t_command));
+    c->output = new_queue(OUTPUT_QUEUE_SIZE, sizeof(t_output));
+    if (c->commands == NULL || c->results == NULL || c->output == NULL
+            || pipe(c->command_wakeup) != 0 || pipe(c->result_wakeup) != 0 || pipe(c->output_wakeup) != 0) {
+        free_console(c);
+        return NULL;
+    }
+    int *fds[] = { &c->command_wakeup[0], &c->command_wakeup[1], &c->result_wakeup[0],
+        &c->result_wakeup[1], &c->output_wakeup[0], &c->output_wakeup[1] };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+        fcntl(*fds[i], F_SETFL, O_NONBLOCK);
+
+    // From now on, the standard output is a stream that hands what is printed to the
+    // console thread
+    cookie_io_functions_t functions = { .read = NULL, .write = pass_output, .seek = NULL, .close = finish_output };
+    FILE *stream = fopencookie(c, "w", functions);
+    if (stream == NULL) {
+        free_console(c);
+        return NULL;
+    }
+    fflush(stdout);
+    c->terminal = stdout;
+    stdout = stream;
+
+    if (pthread_create(&c->thread, NULL, run_console, c) != 0) {
+        stdout = c->terminal;
+        fclose(stream);
+        free_console(c);
+        return NULL;
+    }
+    ni->console = c;
+    return c;
+}
+
+int console_fd(t_console *c)
+{
+    return c->command_wakeup[0];
+}
+
+int next_command(t_console *c, char **line)
+{
+    // Read this first, so no command queued before the input was closed is missed
+    int closed = __atomic_load_n(&c->closed, __ATOMIC_ACQUIRE);
+    t_command command;
+    if (!queue_pop(c->commands, &command)) {
+        // Nothing left, so the next select() only returns once something is queued
+        char discard[64];
+        while (read(c->command_wakeup[0], discard, sizeof(discard)) > 0)
+            continue;
+        if (!queue_pop(c->commands, &command))
+            return closed ? -1 : 0;
+    }
+    *line = command.line;
+    return 1;
+}
+
+void command_done(t_console *c, char *line, int result)
+{
+    t_command command = { .line = line, .result = result };
+    if (queue_push(c->results, &command) != 0) {
+        // The console thread is behind; it only needs the latest one to show the prompt
+        free(line);
+    }
+    if (write(c->result_wakeup[1], "", 1) == -1) {
+        // The pipe is full, so the console thread will wake up anyway
+    }
+}
+
+void stop_console(t_console *c)
+{
+    if (c == NULL)
+        return;
+    // Closing the stream tells the thread to exit once it has written everything
+    FILE *stream = stdout;
+    stdout = c->terminal;
+    fclose(stream);
+    pthread_join(c->thread, NULL);
+    free_console(c);
+}
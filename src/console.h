@@ -0,0 +1,52 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "common.h"
+
+/**
+ * @brief Start the thread that owns the terminal: it reads the user's commands and
+ * queues them for the network loop, and it writes everything the process prints
+ * (which goes through a pipe from now on) to the terminal, repainting the prompt
+ *
+ * @param ni necessary information about the node (the first virtual node)
+ * @return [ @b t_console* ] the t_console object, or NULL in case of an error
+ */
+t_console *start_console(t_nodeinfo *ni);
+
+/**
+ * @brief Get the file descriptor that becomes readable when a command is queued
+ *
+ * @param c the t_console object
+ * @return [ @b int ] the file descriptor
+ */
+int console_fd(t_console *c);
+
+/**
+ * @brief Take the oldest queued command
+ *
+ * @param c the t_console object
+ * @param line where to store the command (a line ending in '\n'), which must be handed
+ * back with command_done()
+ * @return [ @b int ] 1 if a command was taken, 0 if there is none and -1 if the user's
+ * input was closed
+ */
+int next_command(t_console *c, char **line);
+
+/**
+ * @brief Tell the console a command has finished (after flushing its output)
+ *
+ * @param c the t_console object
+ * @param line the command, as returned by next_command()
+ * @param result what processing it returned
+ */
+void command_done(t_console *c, char *line, int result);
+
+/**
+ * @brief Write the remaining output to the terminal, stop the console thread and free
+ * the t_console object
+ *
+ * @param c the t_console object (nothing happens if it is NULL)
+ */
+void stop_console(t_console *c);
+
+#endif
@@ -0,0 +1,1304 @@
+#define _POSIX_C_SOURCE 200809L
+#include "control.h"
+#include "user.h"
+#include "utils.h"
+#include "resp.h"
+#include "watch.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+// How many clients (of both kinds) can be connected at once
+#define MAX_CLIENTS 64
+// Longest request a client can send (a SET carries a whole value, of up to MAX_VALUE_SIZE
+// bytes)
+#define MAX_REQUEST_SIZE (MAX_VALUE_SIZE + 4096)
+// How much output a client can have waiting before its requests stop being read
+#define MAX_PENDING_OUTPUT (1 << 20)
+// How much output a client can have waiting at all (it is disconnected past that)
+#define MAX_OUTPUT_SIZE (64 << 20)
+
+// Values of control_ready()'s choice besides a client
+#define READY_CONTROL -1
+#define READY_CLIENT_PORT -2
+#define READY_RESP_PORT -3
+
+typedef enum client_protocol {
+    // Same commands and output as the console
+    PROTOCOL_CONTROL,
+    // Requests with identifiers and one-line answers
+    PROTOCOL_APPLICATION,
+    // Redis' RESP, answered in order
+    PROTOCOL_RESP
+} t_client_protocol;
+
+typedef struct client {
+    // Socket file descriptor (-1 if the slot is free)
+    int fd;
+    // Identifies the client in search requests (never reused)
+    int id;
+    t_client_protocol protocol;
+    // Bytes received that don't make a complete line yet
+    char *buffer;
+    size_t buffer_size, buffer_capacity;
+    // Answers a RESP client is waiting for (NULL for the other protocols)
+    t_resp_queue *replies;
+    // Set while a RESP client's commands are processed, so that the answers that are
+    // ready at once are sent together afterwards
+    int holding;
+    // Answers the client's socket hasn't taken yet (it is never written to blocking)
+    char *output;
+    size_t output_size, output_capacity;
+    // Set when the client couldn't be answered (it is disconnected as soon as possible)
+    int broken;
+} t_client;
+
+struct control {
+    // Listening sockets (-1 if they aren't used)
+    int control_fd, client_port_fd, resp_port_fd;
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    t_client clients[MAX_CLIENTS];
+    int next_id;
+    // Client whose request is being processed (NO_CLIENT if there is none) and the
+    // request's identifier
+    int current;
+    unsigned long current_tag;
+    // Socket that control_ready() found (index of a client or one of the READY_* values)
+    int ready;
+    // Held while answers are sent, since they may come from several worker threads
+    pthread_mutex_t lock;
+    // Where the standard output pointed before a control client's command started
+    // collecting its output (NULL while no command runs)
+    FILE *log;
+};
+
+/**
+ * @brief Get the node's t_control object, creating it if it doesn't exist yet
+ *
+ * @param ni necessary information about the node (the first virtual node)
+ * @return [ @b t_control* ] the t_control object, or NULL in case of an error
+ */
+t_control *get_control(t_nodeinfo *ni)
+{
+    if (ni->control != NULL)
+        return ni->control;
+    t_control *c = (t_control*) calloc(1, sizeof(t_control));
+    if (c == NULL)
+        return NULL;
+    c->control_fd = c->client_port_fd = c->resp_port_fd = -1;
+    for (int i = 0; i < MAX_CLIENTS; i++)
+        c->clients[i].fd = -1;
+    c->current = NO_CLIENT;
+    pthread_mutex_init(&c->lock, NULL);
+    ni->control = c;
+    return c;
+}
+
+t_control *start_control(char *path, t_nodeinfo *ni)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("\x1b[31m[!] Control socket path is too long: '%s'\033[m\n", path);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    // Replace the socket left behind by a previous run, but nothing else
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    t_control *c = get_control(ni);
+    if (c == NULL)
+        return NULL;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        printf("\x1b[31m[!] Couldn't create the control socket '%s' (%d)\033[m\n", path, errno);
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+    c->control_fd = fd;
+    strcpy(c->path, path);
+    return c;
+}
+
+/**
+ * @brief Listen for clients on a TCP port
+ *
+ * @param port the TCP port
+ * @param ni necessary information about the node
+ * @return [ @b int ] the listening socket, or -1 in case of an error
+ */
+int listen_tcp(char *port, t_nodeinfo *ni)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(ni->ipaddr, port, &hints, &res) != 0)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    // Answers are often several small writes in a row (pipelined requests, MGET), which
+    // Nagle's algorithm would hold back until the client acknowledges the first one
+    // (accepted connections inherit the option)
+    if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1
+            || setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) == -1
+            || bind(fd, res->ai_addr, res->ai_addrlen) == -1 || listen(fd, 16) == -1) {
+        printf("\x1b[31m[!] Couldn't listen for clients on port %s (%d)\033[m\n", port, errno);
+        if (fd != -1)
+            close(fd);
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+t_control *start_client_port(char *port, t_nodeinfo *ni)
+{
+    t_control *c = get_control(ni);
+    if (c == NULL || (c->client_port_fd = listen_tcp(port, ni)) == -1)
+        return NULL;
+    return c;
+}
+
+t_control *start_resp_port(char *port, t_nodeinfo *ni)
+{
+    t_control *c = get_control(ni);
+    if (c == NULL || (c->resp_port_fd = listen_tcp(port, ni)) == -1)
+        return NULL;
+    return c;
+}
+
+void add_control_fds(t_control *c, fd_set *fds, fd_set *write_fds, int *fdmax)
+{
+    int listening[] = { c->control_fd, c->client_port_fd, c->resp_port_fd };
+    for (int i = 0; i < 3; i++) {
+        if (listening[i] == -1)
+            continue;
+        FD_SET(listening[i], fds);
+        *fdmax = *fdmax > listening[i] ? *fdmax : listening[i];
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (c->clients[i].fd == -1)
+            continue;
+        pthread_mutex_lock(&c->lock);
+        size_t pending = c->clients[i].output_size;
+        int broken = c->clients[i].broken;
+        pthread_mutex_unlock(&c->lock);
+        // A client that doesn't read its answers can't send more requests meanwhile
+        if (pending < MAX_PENDING_OUTPUT || broken)
+            FD_SET(c->clients[i].fd, fds);
+        if (pending > 0 && !broken)
+            FD_SET(c->clients[i].fd, write_fds);
+        *fdmax = *fdmax > c->clients[i].fd ? *fdmax : c->clients[i].fd;
+    }
+}
+
+int control_ready(t_control *c, fd_set *fds, fd_set *write_fds)
+{
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (c->clients[i].fd != -1 && (FD_ISSET(c->clients[i].fd, fds) || FD_ISSET(c->clients[i].fd, write_fds))) {
+            c->ready = i;
+            return 1;
+        }
+    }
+    if (c->control_fd != -1 && FD_ISSET(c->control_fd, fds)) {
+        c->ready = READY_CONTROL;
+        return 1;
+    }
+    if (c->client_port_fd != -1 && FD_ISSET(c->client_port_fd, fds)) {
+        c->ready = READY_CLIENT_PORT;
+        return 1;
+    }
+    if (c->resp_port_fd != -1 && FD_ISSET(c->resp_port_fd, fds)) {
+        c->ready = READY_RESP_PORT;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Find a client
+ *
+ * @param c the t_control object
+ * @param id the client's identifier
+ * @return [ @b t_client* ] the client, or NULL if it has disconnected
+ */
+t_client *find_client(t_control *c, int id)
+{
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (c->clients[i].fd != -1 && c->clients[i].id == id)
+            return &c->clients[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Disconnect a client
+ *
+ * @param cl the client
+ * @param ni necessary information about the node (NULL if the node is stopping, which
+ * makes the client's watches pointless to cancel)
+ */
+void close_client(t_client *cl, t_nodeinfo *ni)
+{
+    if (ni != NULL)
+        remove_watches(cl->id, -1, ni);
+    close(cl->fd);
+    free(cl->buffer);
+    free(cl->output);
+    free_resp_queue(cl->replies);
+    memset(cl, 0, sizeof(t_client));
+    cl->fd = -1;
+}
+
+/**
+ * @brief Accept a new client
+ *
+ * @param c the t_control object
+ * @param listening_fd the listening socket
+ * @param protocol what the client will speak
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int accept_client(t_control *c, int listening_fd, t_client_protocol protocol)
+{
+    int fd = accept(listening_fd, NULL, NULL);
+    if (fd == -1)
+        return errno == EINTR || errno == ECONNABORTED ? 0 : -1;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (c->clients[i].fd == -1) {
+            if (protocol == PROTOCOL_RESP && (c->clients[i].replies = new_resp_queue()) == NULL)
+                break;
+            // Answers are written as the client takes them, never waiting for it
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            c->clients[i].fd = fd;
+            c->clients[i].id = c->next_id++;
+            c->clients[i].protocol = protocol;
+            return 0;
+        }
+    }
+    char *message = protocol == PROTOCOL_RESP ? "-ERR too many clients\r\n" : "Too many clients, try again later\n";
+    sendall(fd, message, strlen(message));
+    close(fd);
+    return 0;
+}
+
+/**
+ * @brief Write as much of a client's waiting output as its socket takes without
+ * blocking (the t_control object's lock must be held)
+ *
+ * @param cl the client
+ * @return [ @b int ] 0 if successfull, -1 if the client can't be answered
+ */
+int flush_output(t_client *cl)
+{
+    size_t sent = 0;
+    while (sent < cl->output_size) {
+        ssize_t n = send(cl->fd, cl->output+sent, cl->output_size-sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+            return -1;
+        sent += n;
+    }
+    cl->output_size -= sent;
+    memmove(cl->output, cl->output+sent, cl->output_size);
+    return 0;
+}
+
+/**
+ * @brief Queue some output for a client and write whatever its socket takes right away
+ * (the t_control object's lock must be held). A client that can't be answered, or
+ * lets too much output pile up, is shut down, and disconnected next time it is read from
+ *
+ * @param cl the client
+ * @param data the output
+ * @param length its size
+ */
+void queue_output(t_client *cl, char *data, size_t length)
+{
+    if (cl->broken || length == 0)
+        return;
+    if (cl->output_size + length > MAX_OUTPUT_SIZE)
+        cl->broken = 1;
+    else if (cl->output_size + length > cl->output_capacity) {
+        size_t capacity = cl->output_capacity > 0 ? cl->output_capacity : 4096;
+        while (capacity < cl->output_size + length)
+            capacity *= 2;
+        char *bigger = (char*) realloc(cl->output, capacity);
+        if (bigger == NULL)
+            cl->broken = 1;
+        else {
+            cl->output = bigger;
+            cl->output_capacity = capacity;
+        }
+    }
+    if (!cl->broken) {
+        memcpy(cl->output+cl->output_size, data, length);
+        cl->output_size += length;
+        cl->broken = flush_output(cl) != 0;
+    }
+    if (cl->broken) {
+        puts("\x1b[33m[!] Couldn't answer a client, disconnecting it\033[m");
+        shutdown(cl->fd, SHUT_RDWR);
+    }
+}
+
+/**
+ * @brief Send some data to a client (it is dropped if the client has gone)
+ *
+ * @param c the t_control object
+ * @param client the client
+ * @param data the data
+ * @param length its size
+ */
+void send_to_client(t_control *c, int client, char *data, size_t length)
+{
+    pthread_mutex_lock(&c->lock);
+    t_client *cl = find_client(c, client);
+    if (cl != NULL)
+        queue_output(cl, data, length);
+    pthread_mutex_unlock(&c->lock);
+}
+
+/**
+ * @brief Checks whether a client speaks a given protocol
+ *
+ * @param client the client
+ * @param protocol the protocol
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if true, 0 if false (or if it is the console or has gone)
+ */
+int speaks(int client, t_client_protocol protocol, t_nodeinfo *ni)
+{
+    t_control *c = ni->first_vnode->control;
+    if (client == NO_CLIENT || c == NULL)
+        return 0;
+    // Clients only come and go while the worker threads are paused, so there's no need for the lock
+    t_client *cl = find_client(c, client);
+    return cl != NULL && cl->protocol == protocol;
+}
+
+/**
+ * @brief Checks whether a client speaks the application protocol
+ *
+ * @param client the client
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if true, 0 if false (or if it is the console or has gone)
+ */
+int is_application(int client, t_nodeinfo *ni)
+{
+    return speaks(client, PROTOCOL_APPLICATION, ni);
+}
+
+/**
+ * @brief Send a RESP client the answers that are next in line (the t_control object's
+ * lock must be held)
+ *
+ * @param cl the client
+ */
+void flush_resp_client(t_client *cl)
+{
+    size_t size;
+    char *out = resp_take(cl->replies, &size);
+    if (out != NULL)
+        queue_output(cl, out, size);
+    free(out);
+}
+
+/**
+ * @brief Store one of the answers a RESP client is waiting for, and send whatever
+ * became ready (unless the client's commands are still being processed)
+ *
+ * @param client the client
+ * @param tag the request's identifier (the reply's sequence number and the part)
+ * @param key the ring key the answer is about (-1 if it is about every part)
+ * @param value the value (NULL if it doesn't exist)
+ * @param length its size
+ * @param error why the request failed (NULL if it didn't)
+ * @param ni necessary information about the node
+ */
+void reply_resp(int client, unsigned long tag, int key, char *value, size_t length, char *error, t_nodeinfo *ni)
+{
+    t_control *c = ni->first_vnode->control;
+    pthread_mutex_lock(&c->lock);
+    t_client *cl = find_client(c, client);
+    if (cl != NULL && cl->replies != NULL) {
+        resp_fill(cl->replies, tag >> 16, tag & 0xffff, key, value, length, error);
+        if (!cl->holding)
+            flush_resp_client(cl);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+void expire_resp_replies(t_nodeinfo *ni)
+{
+    t_control *c = ni->first_vnode->control;
+    if (c == NULL)
+        return;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        t_client *cl = &c->clients[i];
+        if (cl->fd == -1 || cl->replies == NULL)
+            continue;
+        pthread_mutex_lock(&c->lock);
+        if (resp_expire(cl->replies) > 0 && !cl->holding)
+            flush_resp_client(cl);
+        pthread_mutex_unlock(&c->lock);
+    }
+}
+
+/**
+ * @brief Send a line to a client, or print it if the client is the console or a control
+ * client whose command is running (its output goes through the standard output then)
+ *
+ * @param client the client
+ * @param ni necessary information about the node
+ * @param format printf-style format of the line
+ */
+void print_reply(int client, t_nodeinfo *ni, char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    t_control *c = ni->first_vnode->control;
+    if (client == NO_CLIENT || c == NULL || (client == c->current && !is_application(client, ni)))
+        vprintf(format, args);
+    else {
+        char line[256];
+        int length = vsnprintf(line, sizeof(line), format, args);
+        if (length > 0)
+            send_to_client(c, client, line, (size_t) length < sizeof(line) ? (size_t) length : sizeof(line)-1);
+    }
+    va_end(args);
+}
+
+void reply_object(int client, unsigned long tag, unsigned int key, char *value, size_t length, t_nodeinfo *ni)
+{
+    t_control *c = ni->first_vnode->control;
+    if (speaks(client, PROTOCOL_RESP, ni)) {
+        reply_resp(client, tag, key, value, length, NULL, ni);
+        return;
+    }
+    int application = is_application(client, ni);
+    if (!application && (client == NO_CLIENT || c == NULL || client == c->current)) {
+        print_object(key, value, length);
+        return;
+    }
+    if (value == NULL) {
+        if (application)
+            print_reply(client, ni, "NONE %lu %u\n", tag, key);
+        else
+            print_reply(client, ni, "%u -> NULL\n", key);
+        return;
+    }
+
+    // Values can be large, so build the line in one go
+    char *line = (char*) malloc(length + 64);
+    if (line == NULL)
+        return;
+    int prefix = application ? sprintf(line, "VALUE %lu %u ", tag, key) : sprintf(line, "%u -> \"", key);
+    memcpy(line+prefix, value, length);
+    size_t size = prefix + length;
+    if (!application)
+        line[size++] = '"';
+    line[size++] = '\n';
+    send_to_client(c, client, line, size);
+    free(line);
+}
+
+void reply_objects(int client, unsigned long tag, unsigned int keys, t_object *values, t_nodeinfo *ni)
+{
+    for (unsigned int key = 0; key < 32; key++) {
+        if (keys & (1u << key))
+            reply_object(client, tag, key, values[key].value, values[key].length, ni);
+    }
+}
+
+void reply_owner(int client, unsigned long tag, unsigned int key, unsigned int owner, char *ipaddr, unsigned int port, t_nodeinfo *ni)
+{
+    if (speaks(client, PROTOCOL_RESP, ni))
+        reply_resp(client, tag, key, NULL, 0, NULL, ni);
+    else if (is_application(client, ni))
+        print_reply(client, ni, "OWNER %lu %u %u %s %u\n", tag, key, owner, ipaddr, port);
+    else
+        print_reply(client, ni, "Key %u belongs to node %u (%s:%u)\n", key, owner, ipaddr, port);
+}
+
+void reply_owners(int client, unsigned long tag, unsigned int keys, unsigned int owner, char *ipaddr, unsigned int port, t_nodeinfo *ni)
+{
+    char list[32*3+1] = "";
+    size_t length = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if (keys & (1u << key))
+            length += sprintf(list+length, " %u", key);
+    }
+    if (speaks(client, PROTOCOL_RESP, ni))
+        reply_resp(client, tag, -1, NULL, 0, NULL, ni);
+    else if (is_application(client, ni))
+        print_reply(client, ni, "OWNERS %lu %u %s %u%s\n", tag, owner, ipaddr, port, list);
+    else
+        print_reply(client, ni, "%s%s %s to node %u (%s:%u)\n", strchr(list+1, ' ') != NULL ? "Keys" : "Key", list,
+            strchr(list+1, ' ') != NULL ? "belong" : "belongs", owner, ipaddr, port);
+}
+
+void reply_cursor(int client, unsigned long tag, unsigned int cursor, t_nodeinfo *ni)
+{
+    if (speaks(client, PROTOCOL_RESP, ni))
+        reply_resp(client, tag, -1, NULL, 0, NULL, ni);
+    else if (is_application(client, ni)) {
+        if (cursor > 31)
+            print_reply(client, ni, "SCANNED %lu -\n", tag);
+        else
+            print_reply(client, ni, "SCANNED %lu %u\n", tag, cursor);
+    }
+    else if (cursor > 31)
+        print_reply(client, ni, "Scan finished\n");
+    else
+        print_reply(client, ni, "Scan stopped, continue from key %u\n", cursor);
+}
+
+void reply_change(int client, unsigned long tag, unsigned int key, unsigned long version, char *value, size_t length, t_nodeinfo *ni)
+{
+    t_control *c = ni->first_vnode->control;
+    if (speaks(client, PROTOCOL_RESP, ni))
+        return;
+    int application = is_application(client, ni);
+    if (value == NULL) {
+        if (application)
+            print_reply(client, ni, "DELETED %lu %u %lu\n", tag, key, version);
+        else
+            print_reply(client, ni, "Key %u was deleted (version %lu)\n", key, version);
+        return;
+    }
+    if (!application && (client == NO_CLIENT || c == NULL || client == c->current)) {
+        printf("Key %u changed (version %lu): ", key, version);
+        print_object(key, value, length);
+        return;
+    }
+
+    // Values can be large, so build the line in one go
+    char *line = (char*) malloc(length + 96);
+    if (line == NULL)
+        return;
+    int prefix = application ? sprintf(line, "CHANGED %lu %u %lu ", tag, key, version)
+        : sprintf(line, "Key %u changed (version %lu): %u -> \"", key, version, key);
+    memcpy(line+prefix, value, length);
+    size_t size = prefix + length;
+    if (!application)
+        line[size++] = '"';
+    line[size++] = '\n';
+    send_to_client(c, client, line, size);
+    free(line);
+}
+
+void reply_operation(int client, unsigned long tag, unsigned int key, t_operation op, int code, unsigned long version, char *value, size_t length, t_nodeinfo *ni)
+{
+    t_control *c = ni->first_vnode->control;
+    int application = is_application(client, ni);
+    if (code != OPR_DONE) {
+        char error[64] = "Couldn't execute the operation";
+        if (code == OPR_MISMATCH)
+            sprintf(error, speaks(client, PROTOCOL_RESP, ni) ? "version mismatch" : "Version mismatch (now %lu)", version);
+        else if (code == OPR_NOT_A_NUMBER)
+            strcpy(error, speaks(client, PROTOCOL_RESP, ni) ? "value is not an integer or out of range" : "Value is not an integer");
+        reply_status(client, tag, error, ni);
+        return;
+    }
+    if (speaks(client, PROTOCOL_RESP, ni)) {
+        reply_resp(client, tag, key, value, length, NULL, ni);
+        return;
+    }
+    if (op == OP_CAS || op == OP_SETEX || (op == OP_VERSION && value == NULL)) {
+        if (application)
+            print_reply(client, ni, "VERSION %lu %u %lu\n", tag, key, version);
+        else if (op != OP_VERSION)
+            print_reply(client, ni, "Key %u is now at version %lu\n", key, version);
+        else
+            print_reply(client, ni, "Key %u doesn't exist (version %lu)\n", key, version);
+        return;
+    }
+    if (!application && (op == OP_EXPIRE || op == OP_TTL)) {
+        long long left = value != NULL ? atoll(value) : -2;
+        if (left == -2 || (op == OP_EXPIRE && left == 0))
+            print_reply(client, ni, "Key %u doesn't exist\n", key);
+        else if (op == OP_EXPIRE)
+            print_reply(client, ni, "Key %u's time to live was changed\n", key);
+        else if (left == -1)
+            print_reply(client, ni, "Key %u doesn't expire\n", key);
+        else
+            print_reply(client, ni, "Key %u expires in %.3f seconds\n", key, left / 1000.0);
+        return;
+    }
+    if (!application && op == OP_DEL) {
+        print_reply(client, ni, value != NULL && atoll(value) == 1 ? "Key %u was deleted\n" : "Key %u doesn't exist\n", key);
+        return;
+    }
+    if (!application && op == OP_APPEND) {
+        print_reply(client, ni, "Key %u is now %.*s byte(s) long (version %lu)\n", key, (int) length, value, version);
+        return;
+    }
+    if (!application && (client == NO_CLIENT || c == NULL || client == c->current)) {
+        printf("Version %lu: ", version);
+        print_object(key, value, length);
+        return;
+    }
+
+    // Values can be large, so build the line in one go
+    char *line = (char*) malloc(length + 96);
+    if (line == NULL)
+        return;
+    int prefix = application ? sprintf(line, "VERSION %lu %u %lu ", tag, key, version)
+        : sprintf(line, "Version %lu: %u -> \"", version, key);
+    memcpy(line+prefix, value, length);
+    size_t size = prefix + length;
+    if (!application)
+        line[size++] = '"';
+    line[size++] = '\n';
+    send_to_client(c, client, line, size);
+    free(line);
+}
+
+void reply_status(int client, unsigned long tag, char *error, t_nodeinfo *ni)
+{
+    if (speaks(client, PROTOCOL_RESP, ni))
+        reply_resp(client, tag, -1, NULL, 0, error, ni);
+    else if (is_application(client, ni)) {
+        if (error == NULL)
+            print_reply(client, ni, "OK %lu\n", tag);
+        else
+            print_reply(client, ni, "ERR %lu %s\n", tag, error);
+    }
+    else if (error != NULL)
+        print_reply(client, ni, "%s\n", error);
+}
+
+/**
+ * @brief Process a command sent by a control client, sending its output to the client
+ *
+ * @param c the t_control object
+ * @param cl the client
+ * @param line the command (a line ending in '\n')
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, 1 if the application should exit and -1 otherwise
+ */
+int process_client_command(t_control *c, t_client *cl, char *line, t_nodeinfo *ni)
+{
+    // The commands print their output, so collect what goes to the standard output
+    // while they run (the worker threads are paused, so nothing else prints meanwhile)
+    // and queue it for the client afterwards
+    char *output = NULL;
+    size_t size = 0;
+    FILE *capture = open_memstream(&output, &size);
+    if (capture == NULL)
+        return -1;
+    fflush(stdout);
+    c->log = stdout;
+    stdout = capture;
+    c->current = cl->id;
+    int result = process_command_line(line, ni);
+    c->current = NO_CLIENT;
+    stdout = c->log;
+    c->log = NULL;
+    fclose(capture);
+
+    pthread_mutex_lock(&c->lock);
+    queue_output(cl, output, size);
+    pthread_mutex_unlock(&c->lock);
+    free(output);
+    return result;
+}
+
+int process_background_event(t_event e, t_nodeinfo *ni)
+{
+    t_control *c = ni->first_vnode->control;
+    if (c == NULL || c->log == NULL)
+        return process_event(e, ni);
+
+    // Leave the output of the command that is waiting alone: this event's goes to the
+    // log, and its client's answers are queued as if no command was running
+    FILE *capture = stdout;
+    int current = c->current;
+    stdout = c->log;
+    c->current = NO_CLIENT;
+    int result = process_event(e, ni);
+    fflush(stdout);
+    stdout = capture;
+    c->current = current;
+    return result;
+}
+
+/**
+ * @brief Get, store or find the owners of several objects at once on behalf of a client
+ *
+ * @param c the t_control object
+ * @param cl the client
+ * @param tag the request's identifier
+ * @param type the request ("MGET", "MSET" or "MFIND")
+ * @param keys the objects' keys (a bitmask)
+ * @param values the values to store, indexed by key (MSET only)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int batch_request(t_control *c, t_client *cl, unsigned long tag, char *type, unsigned int keys, t_object *values, t_nodeinfo *ni)
+{
+    t_nodeinfo *vn = closest_vnode(first_key(keys), ni);
+    if (vn == NULL) {
+        reply_status(cl->id, tag, cl->protocol == PROTOCOL_RESP ? "node is not in a ring" : "Node is not in a ring", ni);
+        return 0;
+    }
+
+    c->current = cl->id;
+    c->current_tag = tag;
+    int result;
+    if (strcmp(type, "MSET") == 0)
+        result = process_command_mset(keys, values, vn);
+    else if (strcmp(type, "MFIND") == 0)
+        result = process_command_mfind(keys, vn);
+    else
+        result = process_command_mget(keys, vn);
+    c->current = NO_CLIENT;
+    c->current_tag = 0;
+    return result;
+}
+
+/**
+ * @brief Process a request sent by an application. It is answered right away if this
+ * node has what it needs, and once the answer arrives otherwise
+ *
+ * @param c the t_control object
+ * @param cl the client
+ * @param line the request (a line ending in '\n')
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int process_client_request(t_control *c, t_client *cl, char *line, t_nodeinfo *ni)
+{
+    char type[8] = "";
+    unsigned long tag = 0;
+    unsigned int key = 0;
+    int end = 0;
+    if (sscanf(line, "%7s %lu", type, &tag) == 2 && strcmp(type, "OWNS") == 0) {
+        // Which keys this node's virtual nodes own, so that clients can send their
+        // requests straight to the owner
+        unsigned long mask = 0;
+        for (key = 0; key < 32; key++) {
+            t_nodeinfo *vn = closest_vnode(key, ni);
+            if (vn != NULL && is_owner(key, vn))
+                mask |= 1UL << key;
+        }
+        print_reply(cl->id, ni, "OWNS %lu %08lx\n", tag, mask);
+        return 0;
+    }
+    if (sscanf(line, "%7s %lu%n", type, &tag, &end) == 2 && (strcmp(type, "MGET") == 0 || strcmp(type, "MSET") == 0
+            || strcmp(type, "MFIND") == 0)) {
+        int set = strcmp(type, "MSET") == 0;
+        unsigned int keys = 0;
+        t_object values[32];
+        int result = parse_batch(line+end, set, &keys, values);
+        if (result != 0) {
+            reply_status(cl->id, tag, result > 0 ? "Invalid key (maximum is 31)" : "Invalid format", ni);
+            return 0;
+        }
+        return batch_request(c, cl, tag, type, keys, values, ni);
+    }
+    unsigned int to = 0, count = 32;
+    int fields = sscanf(line, "%7s %lu %u %u %u", type, &tag, &key, &to, &count);
+    if (fields >= 2 && strcmp(type, "SCAN") == 0) {
+        t_nodeinfo *vn = closest_vnode(key, ni);
+        if (fields < 4)
+            reply_status(cl->id, tag, "Invalid format", ni);
+        else if (key > 31 || to > 31 || count == 0)
+            reply_status(cl->id, tag, "Invalid range", ni);
+        else if (vn == NULL)
+            reply_status(cl->id, tag, "Node is not in a ring", ni);
+        else {
+            c->current = cl->id;
+            c->current_tag = tag;
+            int result = process_command_scan(key, to, count, vn);
+            c->current = NO_CLIENT;
+            c->current_tag = 0;
+            return result;
+        }
+        return 0;
+    }
+    if (sscanf(line, "%7s %lu %u%n", type, &tag, &key, &end) != 3) {
+        reply_status(cl->id, tag, "Invalid format", ni);
+        return 0;
+    }
+    if (key > 31) {
+        reply_status(cl->id, tag, "Invalid key (maximum is 31)", ni);
+        return 0;
+    }
+    t_nodeinfo *vn = closest_vnode(key, ni);
+    if (vn == NULL) {
+        reply_status(cl->id, tag, "Node is not in a ring", ni);
+        return 0;
+    }
+
+    c->current = cl->id;
+    c->current_tag = tag;
+    int result = 0;
+    if (strcmp(type, "GET") == 0)
+        result = process_command_get(key, vn);
+    else if (strcmp(type, "FIND") == 0)
+        result = process_command_find(key, vn);
+    else if (strcmp(type, "WATCH") == 0)
+        result = process_command_watch(key, vn);
+    else if (strcmp(type, "UNWATCH") == 0)
+        result = process_command_unwatch(key, vn);
+    else if (strcmp(type, "SET") == 0) {
+        // The value is everything after the key (up to the end of the line)
+        char *value = line+end;
+        if (*value == ' ')
+            value++;
+        result = process_command_set(key, value, strcspn(value, "\n"), vn);
+    }
+    else if (operation_by_name(type) != OP_INVALID) {
+        // The operand is everything after the key (after the version for CAS, and after
+        // the time to live in seconds for SETEX and EXPIRE), and INCR adds 1 without one
+        t_operation op = operation_by_name(type);
+        char *operand = line+end;
+        unsigned long version = 0;
+        double seconds = 0;
+        int skip = 0;
+        if ((op == OP_CAS && sscanf(operand, "%lu%n", &version, &skip) != 1)
+                || ((op == OP_SETEX || op == OP_EXPIRE) && sscanf(operand, "%lf%n", &seconds, &skip) != 1))
+            reply_status(cl->id, tag, "Invalid format", ni);
+        else if (seconds < 0 || seconds > 1e9 || (op == OP_SETEX && seconds * 1000 < 0.5))
+            reply_status(cl->id, tag, "Invalid time to live", ni);
+        else {
+            if (op == OP_SETEX || op == OP_EXPIRE)
+                version = (unsigned long) (seconds * 1000 + 0.5);
+            operand += skip;
+            if (*operand == ' ')
+                operand++;
+            size_t length = strcspn(operand, "\n");
+            if (op == OP_INCR && length == 0) {
+                operand = "1";
+                length = 1;
+            }
+            result = process_command_operation(op, key, version, operand, length, vn);
+        }
+    }
+    else
+        reply_status(cl->id, tag, "Unknown request", ni);
+    c->current = NO_CLIENT;
+    c->current_tag = 0;
+    return result;
+}
+
+/**
+ * @brief Checks whether a RESP argument is a given command name (ignoring case)
+ *
+ * @param arg the argument
+ * @param length its length
+ * @param name the command name
+ * @return [ @b int ] 1 if true, 0 if false
+ */
+int is_resp_command(char *arg, size_t length, char *name)
+{
+    return length == strlen(name) && strncasecmp(arg, name, length) == 0;
+}
+
+/**
+ * @brief Reserve a RESP client's next reply
+ *
+ * @param c the t_control object
+ * @param cl the client
+ * @param type what the reply is made of
+ * @param parts how many answers it needs
+ * @param keys the ring key of each part, for answers that come by key (NULL otherwise)
+ * @param text the whole reply for RESP_RAW (NULL otherwise)
+ * @return [ @b unsigned long ] its sequence number, or 0 in case of an error
+ */
+unsigned long expect_resp_reply(t_control *c, t_client *cl, t_resp_type type, int parts, unsigned int *keys, char *text)
+{
+    pthread_mutex_lock(&c->lock);
+    unsigned long seq = resp_expect(cl->replies, type, parts, keys, text);
+    pthread_mutex_unlock(&c->lock);
+    return seq;
+}
+
+/**
+ * @brief Get or store an object on behalf of a RESP client
+ *
+ * @param c the t_control object
+ * @param cl the client
+ * @param seq the reply's sequence number
+ * @param part which of the reply's answers this is
+ * @param name the object's key, as the client named it
+ * @param name_length its length
+ * @param value the value to store (NULL to get the object instead)
+ * @param length size of the value (0 deletes the object)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int resp_object_request(t_control *c, t_client *cl, unsigned long seq, int part, char *name, size_t name_length, char *value, size_t length, t_nodeinfo *ni)
+{
+    unsigned int key = resp_key(name, name_length);
+    unsigned long tag = seq << 16 | part;
+    t_nodeinfo *vn = closest_vnode(key, ni);
+    if (vn == NULL) {
+        reply_status(cl->id, tag, "node is not in a ring", ni);
+        return 0;
+    }
+
+    c->current = cl->id;
+    c->current_tag = tag;
+    int result = value != NULL ? process_command_set(key, value, length, vn) : process_command_get(key, vn);
+    c->current = NO_CLIENT;
+    c->current_tag = 0;
+    return result;
+}
+
+/**
+ * @brief Execute an operation at a key's owner on behalf of a RESP client
+ *
+ * @param c the t_control object
+ * @param cl the client
+ * @param seq the reply's sequence number
+ * @param name the object's key, as the client named it
+ * @param name_length its length
+ * @param op the operation
+ * @param version the time to live in milliseconds (SETEX and EXPIRE)
+ * @param operand its operand
+ * @param length the operand's size
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int resp_operation_request(t_control *c, t_client *cl, unsigned long seq, char *name, size_t name_length, t_operation op, unsigned long version, char *operand, size_t length, t_nodeinfo *ni)
+{
+    unsigned int key = resp_key(name, name_length);
+    unsigned long tag = seq << 16;
+    t_nodeinfo *vn = closest_vnode(key, ni);
+    if (vn == NULL) {
+        reply_status(cl->id, tag, "node is not in a ring", ni);
+        return 0;
+    }
+
+    c->current = cl->id;
+    c->current_tag = tag;
+    int result = process_command_operation(op, key, version, operand, length, vn);
+    c->current = NO_CLIENT;
+    c->current_tag = 0;
+    return result;
+}
+
+/**
+ * @brief Process a command sent by a RESP client: GET, SET (with no option but EX or PX),
+ * MGET and MSET work on the ring's objects, INCR, INCRBY, DECR, DECRBY, APPEND, SETEX,
+ * PSETEX, EXPIRE, PEXPIRE, TTL, PTTL and DEL are executed by the objects' owners, and
+ * PING, CONFIG, COMMAND and QUIT are there for the tools that expect them. MGET and MSET
+ * are batch requests. DEL answers with the number of objects that existed (names that
+ * share a ring key name the same object, so they count once)
+ *
+ * @param c the t_control object
+ * @param cl the client
+ * @param argc how many arguments there are
+ * @param argv the arguments (the command name first)
+ * @param argl their lengths
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, 1 if the client should be disconnected and -1 otherwise
+ */
+int process_resp_command(t_control *c, t_client *cl, int argc, char **argv, size_t *argl, t_nodeinfo *ni)
+{
+    if (argc == 0)
+        return 0;
+    char *name = argv[0];
+    size_t length = argl[0];
+    unsigned long seq;
+    int result = 0;
+
+    if (is_resp_command(name, length, "GET") && argc == 2) {
+        if ((seq = expect_resp_reply(c, cl, RESP_BULK, 1, NULL, NULL)) == 0)
+            return -1;
+        return resp_object_request(c, cl, seq, 0, argv[1], argl[1], NULL, 0, ni);
+    }
+    if ((is_resp_command(name, length, "SET") && argc == 5 && (is_resp_command(argv[3], argl[3], "EX") || is_resp_command(argv[3], argl[3], "PX")))
+            || ((is_resp_command(name, length, "SETEX") || is_resp_command(name, length, "PSETEX")) && argc == 4)) {
+        // The time to live is in seconds for SET ... EX and SETEX, in milliseconds otherwise
+        int set = is_resp_command(name, length, "SET");
+        char *ttl = set ? argv[4] : argv[2], *value = set ? argv[2] : argv[3];
+        size_t ttl_length = set ? argl[4] : argl[2], value_length = set ? argl[2] : argl[3];
+        long long amount;
+        if (!parse_delta(ttl, ttl_length, &amount) || amount <= 0 || amount > 1000000000)
+            return expect_resp_reply(c, cl, RESP_RAW, 0, NULL, "-ERR invalid expire time\r\n") == 0 ? -1 : 0;
+        int seconds = set ? toupper((unsigned char) argv[3][0]) == 'E' : toupper((unsigned char) name[0]) == 'S';
+        if ((seq = expect_resp_reply(c, cl, RESP_STATUS, 1, NULL, NULL)) == 0)
+            return -1;
+        return resp_operation_request(c, cl, seq, argv[1], argl[1], OP_SETEX, amount * (seconds ? 1000 : 1), value, value_length, ni);
+    }
+    if (is_resp_command(name, length, "SET") && argc == 3) {
+        if ((seq = expect_resp_reply(c, cl, RESP_STATUS, 1, NULL, NULL)) == 0)
+            return -1;
+        return resp_object_request(c, cl, seq, 0, argv[1], argl[1], argv[2], argl[2], ni);
+    }
+    // NX, XX, KEEPTTL and the like can't be ignored without breaking their callers
+    if (is_resp_command(name, length, "SET") && argc > 3)
+        return expect_resp_reply(c, cl, RESP_RAW, 0, NULL, "-ERR syntax error\r\n") == 0 ? -1 : 0;
+    if (is_resp_command(name, length, "MGET") && argc >= 2) {
+        // The answers come by key, since several names may share one
+        unsigned int ring_keys[RESP_MAX_ARGS], keys = 0;
+        t_object values[32];
+        memset(values, 0, sizeof(values));
+        for (int i = 1; i < argc; i++) {
+            ring_keys[i-1] = resp_key(argv[i], argl[i]);
+            keys |= 1u << ring_keys[i-1];
+        }
+        if ((seq = expect_resp_reply(c, cl, RESP_ARRAY, argc-1, ring_keys, NULL)) == 0)
+            return -1;
+        return batch_request(c, cl, seq << 16 | RESP_KEYED, "MGET", keys, values, ni);
+    }
+    if (is_resp_command(name, length, "DEL") && argc >= 2) {
+        // Each owner answers for its own key whether the object existed
+        unsigned int ring_keys[RESP_MAX_ARGS], keys = 0;
+        int parts = 0;
+        for (int i = 1; i < argc; i++) {
+            unsigned int key = resp_key(argv[i], argl[i]);
+            if (!(keys & (1u << key)))
+                ring_keys[parts++] = key;
+            keys |= 1u << key;
+        }
+        if ((seq = expect_resp_reply(c, cl, RESP_INTEGER, parts, ring_keys, NULL)) == 0)
+            return -1;
+        unsigned long tag = seq << 16 | RESP_KEYED;
+        c->current = cl->id;
+        c->current_tag = tag;
+        for (int i = 0; i < parts && result == 0; i++) {
+            t_nodeinfo *vn = closest_vnode(ring_keys[i], ni);
+            if (vn == NULL) {
+                reply_status(cl->id, tag, "node is not in a ring", ni);
+                break;
+            }
+            result = process_command_operation(OP_DEL, ring_keys[i], 0, NULL, 0, vn);
+        }
+        c->current = NO_CLIENT;
+        c->current_tag = 0;
+        return result;
+    }
+    if (((is_resp_command(name, length, "INCR") || is_resp_command(name, length, "DECR")) && argc == 2)
+            || ((is_resp_command(name, length, "INCRBY") || is_resp_command(name, length, "DECRBY")) && argc == 3)) {
+        long long delta = 1;
+        char operand[OPERATION_TEXT_SIZE] = "";
+        if ((argc == 3 && !parse_delta(argv[2], argl[2], &delta)) || (toupper((unsigned char) name[0]) == 'D' && delta == LLONG_MIN))
+            return expect_resp_reply(c, cl, RESP_RAW, 0, NULL, "-ERR value is not an integer or out of range\r\n") == 0 ? -1 : 0;
+        sprintf(operand, "%lld", toupper((unsigned char) name[0]) == 'D' ? -delta : delta);
+        if ((seq = expect_resp_reply(c, cl, RESP_NUMBER, 1, NULL, NULL)) == 0)
+            return -1;
+        return resp_operation_request(c, cl, seq, argv[1], argl[1], OP_INCR, 0, operand, strlen(operand), ni);
+    }
+    if (is_resp_command(name, length, "APPEND") && argc == 3) {
+        if ((seq = expect_resp_reply(c, cl, RESP_NUMBER, 1, NULL, NULL)) == 0)
+            return -1;
+        return resp_operation_request(c, cl, seq, argv[1], argl[1], OP_APPEND, 0, argv[2], argl[2], ni);
+    }
+    if ((is_resp_command(name, length, "EXPIRE") || is_resp_command(name, length, "PEXPIRE")) && argc == 3) {
+        long long amount;
+        if (!parse_delta(argv[2], argl[2], &amount) || amount > 1000000000)
+            return expect_resp_reply(c, cl, RESP_RAW, 0, NULL, "-ERR value is not an integer or out of range\r\n") == 0 ? -1 : 0;
+        if ((seq = expect_resp_reply(c, cl, RESP_NUMBER, 1, NULL, NULL)) == 0)
+            return -1;
+        // A time to live that ran out already deletes the object right away
+        amount = amount > 0 ? amount * (toupper((unsigned char) name[0]) == 'E' ? 1000 : 1) : 1;
+        return resp_operation_request(c, cl, seq, argv[1], argl[1], OP_EXPIRE, amount, NULL, 0, ni);
+    }
+    if ((is_resp_command(name, length, "TTL") || is_resp_command(name, length, "PTTL")) && argc == 2) {
+        char *unit = toupper((unsigned char) name[0]) == 'T' ? "1000" : "1";
+        if ((seq = expect_resp_reply(c, cl, RESP_NUMBER, 1, NULL, NULL)) == 0)
+            return -1;
+        return resp_operation_request(c, cl, seq, argv[1], argl[1], OP_TTL, 0, unit, strlen(unit), ni);
+    }
+    if (is_resp_command(name, length, "MSET") && argc >= 3 && argc % 2 == 1) {
+        unsigned int keys = 0;
+        t_object values[32];
+        for (int i = 1; i < argc; i += 2) {
+            unsigned int key = resp_key(argv[i], argl[i]);
+            keys |= 1u << key;
+            values[key].value = argv[i+1];
+            values[key].length = argl[i+1];
+        }
+        if ((seq = expect_resp_reply(c, cl, RESP_STATUS, 1, NULL, NULL)) == 0)
+            return -1;
+        return batch_request(c, cl, seq << 16, "MSET", keys, values, ni);
+    }
+
+    char *text = "-ERR unknown command\r\n";
+    if (is_resp_command(name, length, "PING"))
+        text = "+PONG\r\n";
+    else if (is_resp_command(name, length, "CONFIG") || is_resp_command(name, length, "COMMAND"))
+        text = "*0\r\n";
+    else if (is_resp_command(name, length, "QUIT")) {
+        text = "+OK\r\n";
+        result = 1;
+    }
+    else if (is_resp_command(name, length, "GET") || is_resp_command(name, length, "SET")
+            || is_resp_command(name, length, "MGET") || is_resp_command(name, length, "MSET")
+            || is_resp_command(name, length, "DEL") || is_resp_command(name, length, "INCR")
+            || is_resp_command(name, length, "INCRBY") || is_resp_command(name, length, "DECR")
+            || is_resp_command(name, length, "DECRBY") || is_resp_command(name, length, "APPEND")
+            || is_resp_command(name, length, "SETEX") || is_resp_command(name, length, "PSETEX")
+            || is_resp_command(name, length, "EXPIRE") || is_resp_command(name, length, "PEXPIRE")
+            || is_resp_command(name, length, "TTL") || is_resp_command(name, length, "PTTL"))
+        text = "-ERR wrong number of arguments\r\n";
+    if (expect_resp_reply(c, cl, RESP_RAW, 0, NULL, text) == 0)
+        return -1;
+    return result;
+}
+
+/**
+ * @brief Process every complete command in a RESP client's buffer, in order, and send
+ * the answers that are ready together
+ *
+ * @param c the t_control object
+ * @param cl the client
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, 1 if the application should exit and -1 otherwise
+ */
+int process_resp_commands(t_control *c, t_client *cl, t_nodeinfo *ni)
+{
+    char *argv[RESP_MAX_ARGS];
+    size_t argl[RESP_MAX_ARGS];
+    int argc = 0, result = 0;
+    size_t offset = 0;
+    long length;
+
+    cl->holding = 1;
+    while (result == 0 && offset < cl->buffer_size
+            && (length = resp_parse(cl->buffer+offset, cl->buffer_size-offset, argv, argl, &argc)) != 0) {
+        if (length < 0) {
+            expect_resp_reply(c, cl, RESP_RAW, 0, NULL, "-ERR protocol error\r\n");
+            result = 1;
+            break;
+        }
+        result = process_resp_command(c, cl, argc, argv, argl, ni);
+        offset += length;
+    }
+    cl->holding = 0;
+
+    pthread_mutex_lock(&c->lock);
+    flush_resp_client(cl);
+    pthread_mutex_unlock(&c->lock);
+    if (result != 0) {
+        // QUIT or a malformed command: the client goes, but the node keeps running
+        close_client(cl, ni);
+        return result < 0 ? -1 : 0;
+    }
+    cl->buffer_size -= offset;
+    memmove(cl->buffer, cl->buffer+offset, cl->buffer_size);
+    return 0;
+}
+
+int process_control_message(t_nodeinfo *ni)
+{
+    t_control *c = ni->first_vnode->control;
+    if (c->ready == READY_CONTROL)
+        return accept_client(c, c->control_fd, PROTOCOL_CONTROL);
+    if (c->ready == READY_CLIENT_PORT)
+        return accept_client(c, c->client_port_fd, PROTOCOL_APPLICATION);
+    if (c->ready == READY_RESP_PORT)
+        return accept_client(c, c->resp_port_fd, PROTOCOL_RESP);
+
+    t_client *cl = &c->clients[c->ready];
+    pthread_mutex_lock(&c->lock);
+    if (!cl->broken && cl->output_size > 0)
+        cl->broken = flush_output(cl) != 0;
+    int broken = cl->broken;
+    size_t pending = cl->output_size;
+    pthread_mutex_unlock(&c->lock);
+    if (broken) {
+        close_client(cl, ni);
+        return 0;
+    }
+    if (pending >= MAX_PENDING_OUTPUT)
+        return 0;  // Only its socket was ready for writing
+
+    if (cl->buffer_capacity - cl->buffer_size < 4096) {
+        // Doubled, so that a large value isn't copied over and over as it arrives
+        size_t capacity = cl->buffer_capacity < 4096 ? cl->buffer_capacity + 4096 : 2 * cl->buffer_capacity;
+        if (capacity > MAX_REQUEST_SIZE)
+            capacity = MAX_REQUEST_SIZE;
+        char *bigger = cl->buffer_capacity < MAX_REQUEST_SIZE ? (char*) realloc(cl->buffer, capacity) : NULL;
+        if (bigger == NULL) {
+            close_client(cl, ni);
+            return 0;
+        }
+        cl->buffer = bigger;
+        cl->buffer_capacity = capacity;
+    }
+    ssize_t n = read(cl->fd, cl->buffer+cl->buffer_size, cl->buffer_capacity-cl->buffer_size-1);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (n <= 0) {
+        close_client(cl, ni);
+        return 0;
+    }
+    cl->buffer_size += n;
+    if (cl->protocol == PROTOCOL_RESP)
+        return process_resp_commands(c, cl, ni);
+
+    // Handle every complete line, in order
+    char *start = cl->buffer, *end;
+    int result = 0;
+    while (result == 0 && (end = memchr(start, '\n', cl->buffer_size - (start - cl->buffer))) != NULL) {
+        char saved = end[1];
+        end[1] = '\0';
+        if (cl->protocol == PROTOCOL_CONTROL)
+            result = process_client_command(c, cl, start, ni);
+        else
+            result = process_client_request(c, cl, start, ni);
+        end[1] = saved;
+        start = end+1;
+    }
+    cl->buffer_size -= start - cl->buffer;
+    memmove(cl->buffer, start, cl->buffer_size);
+    return result;
+}
+
+int current_client(t_control *c)
+{
+    return c != NULL ? c->current : NO_CLIENT;
+}
+
+unsigned long current_tag(t_control *c)
+{
+    return c != NULL ? c->current_tag : 0;
+}
+
+void stop_control(t_control *c)
+{
+    if (c == NULL)
+        return;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (c->clients[i].fd != -1)
+            close_client(&c->clients[i], NULL);
+    }
+    if (c->control_fd != -1) {
+        close(c->control_fd);
+        unlink(c->path);
+    }
+    if (c->client_port_fd != -1)
+        close(c->client_port_fd);
+    if (c->resp_port_fd != -1)
+        close(c->resp_port_fd);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
@@ -0,0 +1,234 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "common.h"
+#include "atomic.h"
+#include "event.h"
+#include <sys/select.h>
+
+// The request came from the console rather than from a client
+#define NO_CLIENT -1
+
+/**
+ * @brief Start listening for control clients on a Unix-domain socket. They can send
+ * the same commands as the console, one per line and without waiting for each other
+ *
+ * @param path where to create the socket (a stale socket there is replaced)
+ * @param ni necessary information about the node (the first virtual node)
+ * @return [ @b t_control* ] the t_control object, or NULL in case of an error
+ */
+t_control *start_control(char *path, t_nodeinfo *ni);
+
+/**
+ * @brief Start listening for applications on a TCP port. They send requests, one per
+ * line and each with an identifier of their choice:
+ *     GET id k / SET id k [value] / FIND id k / OWNS id /
+ *     MGET id k1 k2 ... / MSET id k1 value1 k2 value2 ... (values without spaces) /
+ *     MFIND id k1 k2 ... / SCAN id a b [count] / WATCH id k / UNWATCH id k
+ * and get the answers as soon as they are ready (not necessarily in order):
+ *     VALUE id k value / NONE id k / OWNER id k node IP port / OK id / ERR id message /
+ *     OWNS id mask (the keys this node owns, as a hexadecimal bit mask) /
+ *     OWNERS id node IP port k1 k2 ... (some of the keys of an MFIND, and their owner) /
+ *     SCANNED id cursor (the key a SCAN stopped at, or - if it reached b) /
+ *     CHANGED id k version value / DELETED id k version (notifications of a WATCH)
+ * MGET gets one VALUE or NONE line per distinct key, all sent together, and MFIND one
+ * OWNERS line per node that owns some of the keys. SCAN gets a VALUE line for each
+ * object from key a to key b (clockwise), in order and up to count of them, and then
+ * a SCANNED line. WATCH gets the key's current value and version right away, and again
+ * whenever the key changes (until UNWATCH or until the client disconnects); versions
+ * tell notifications that arrive out of order apart
+ *
+ * @param port the TCP port
+ * @param ni necessary information about the node (the first virtual node)
+ * @return [ @b t_control* ] the t_control object, or NULL in case of an error
+ */
+t_control *start_client_port(char *port, t_nodeinfo *ni);
+
+/**
+ * @brief Start listening for Redis clients (RESP) on a TCP port. GET, SET, DEL, MGET
+ * and MSET are supported, pipelined commands are answered in order, and key names are
+ * mapped to the ring's keys (names from 0 to 31 are used as they are, others are
+ * hashed, so several names may share an object). Storing an empty value deletes the
+ * object
+ *
+ * @param port the TCP port
+ * @param ni necessary information about the node (the first virtual node)
+ * @return [ @b t_control* ] the t_control object, or NULL in case of an error
+ */
+t_control *start_resp_port(char *port, t_nodeinfo *ni);
+
+/**
+ * @brief Add the listening sockets and the clients' sockets to the sets of file
+ * descriptors to read from and (for clients with answers waiting) to write to
+ *
+ * @param c the t_control object
+ * @param fds the set to read from
+ * @param write_fds the set to write to
+ * @param fdmax highest file descriptor in the sets (updated)
+ */
+void add_control_fds(t_control *c, fd_set *fds, fd_set *write_fds, int *fdmax);
+
+/**
+ * @brief Checks whether any of the listening or clients' sockets is ready, and remembers
+ * which one
+ *
+ * @param c the t_control object
+ * @param fds the set to read from returned by select()
+ * @param write_fds the set to write to returned by select()
+ * @return [ @b int ] 1 if true, 0 if false
+ */
+int control_ready(t_control *c, fd_set *fds, fd_set *write_fds);
+
+/**
+ * @brief Accept a new client or process the requests sent by one (whichever
+ * control_ready() found)
+ *
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, 1 if the application should exit and -1 otherwise
+ */
+int process_control_message(t_nodeinfo *ni);
+
+/**
+ * @brief Answer the RESP clients' requests that didn't get an answer in time (the
+ * messages may have been lost) with a timeout error, so the replies behind them can go
+ *
+ * @param ni necessary information about the node
+ */
+void expire_resp_replies(t_nodeinfo *ni);
+
+/**
+ * @brief Handle an event that happens while a command waits for something (e.g. for a
+ * handoff to be acknowledged), like process_event(). What it prints goes to the log even
+ * if the command came from a control client, whose output is collected apart
+ *
+ * @param e the event
+ * @param ni necessary information about the node (the virtual node it happened in)
+ * @return [ @b int ] 0 if successfull, 1 if the application should exit and -1 otherwise
+ */
+int process_background_event(t_event e, t_nodeinfo *ni);
+
+/**
+ * @brief Get the client whose request is being processed
+ *
+ * @param c the t_control object (may be NULL)
+ * @return [ @b int ] the client, or NO_CLIENT if the request came from the console
+ */
+int current_client(t_control *c);
+
+/**
+ * @brief Get the identifier the client gave the request being processed
+ *
+ * @param c the t_control object (may be NULL)
+ * @return [ @b unsigned long ] the identifier (0 for the console and control clients)
+ */
+unsigned long current_tag(t_control *c);
+
+/**
+ * @brief Answer a request for an object (the console gets print_object()'s output)
+ *
+ * @param client the client that made the request (NO_CLIENT for the console)
+ * @param tag the request's identifier
+ * @param key the object's key
+ * @param value the object's value (NULL if it doesn't exist)
+ * @param length size of the value
+ * @param ni necessary information about the node
+ */
+void reply_object(int client, unsigned long tag, unsigned int key, char *value, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Answer a request for several objects (one answer per key, in order)
+ *
+ * @param client the client that made the request (NO_CLIENT for the console)
+ * @param tag the request's identifier
+ * @param keys the objects' keys (a bitmask)
+ * @param values their values, indexed by key (NULL if the object doesn't exist)
+ * @param ni necessary information about the node
+ */
+void reply_objects(int client, unsigned long tag, unsigned int keys, t_object *values, t_nodeinfo *ni);
+
+/**
+ * @brief Answer part of a request for the nodes several keys belong to: the keys one
+ * of the nodes owns
+ *
+ * @param client the client that made the request (NO_CLIENT for the console)
+ * @param tag the request's identifier
+ * @param keys the keys (a bitmask)
+ * @param owner the node they belong to
+ * @param ipaddr the node's IP address
+ * @param port the node's port
+ * @param ni necessary information about the node
+ */
+void reply_owners(int client, unsigned long tag, unsigned int keys, unsigned int owner, char *ipaddr, unsigned int port, t_nodeinfo *ni);
+
+/**
+ * @brief Tell a client that a key it watches has changed
+ *
+ * @param client the client that made the request (NO_CLIENT for the console)
+ * @param tag the request's identifier
+ * @param key the key
+ * @param version the key's version
+ * @param value its value (NULL if it was deleted)
+ * @param length its size
+ * @param ni necessary information about the node
+ */
+void reply_change(int client, unsigned long tag, unsigned int key, unsigned long version, char *value, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Finish answering a range scan (after its objects)
+ *
+ * @param client the client that made the request (NO_CLIENT for the console)
+ * @param tag the request's identifier
+ * @param cursor the key to continue from (32 if the whole range was scanned)
+ * @param ni necessary information about the node
+ */
+void reply_cursor(int client, unsigned long tag, unsigned int cursor, t_nodeinfo *ni);
+
+/**
+ * @brief Answer a request for the node a key belongs to
+ *
+ * @param client the client that made the request (NO_CLIENT for the console)
+ * @param tag the request's identifier
+ * @param key the key
+ * @param owner the node it belongs to
+ * @param ipaddr the node's IP address
+ * @param port the node's port
+ * @param ni necessary information about the node
+ */
+void reply_owner(int client, unsigned long tag, unsigned int key, unsigned int owner, char *ipaddr, unsigned int port, t_nodeinfo *ni);
+
+/**
+ * @brief Answer an operation executed at a key's owner (CAS, INCR, APPEND or VERSION),
+ * or report that it failed
+ *
+ * @param client the client that made the request (NO_CLIENT for the console)
+ * @param tag the request's identifier
+ * @param key the key
+ * @param op the operation
+ * @param code whether it was done (a t_operation_result)
+ * @param version the key's version after the operation
+ * @param value the answer (see execute_operation(), NULL if there is none)
+ * @param length its size
+ * @param ni necessary information about the node
+ */
+void reply_operation(int client, unsigned long tag, unsigned int key, t_operation op, int code, unsigned long version, char *value, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Answer a request that doesn't return anything, or report that it failed
+ *
+ * @param client the client that made the request (NO_CLIENT for the console)
+ * @param tag the request's identifier
+ * @param error why the request failed (NULL if it succeeded; nothing is printed on the
+ * console then)
+ * @param ni necessary information about the node
+ */
+void reply_status(int client, unsigned long tag, char *error, t_nodeinfo *ni);
+
+/**
+ * @brief Close the listening sockets and the clients, remove the control socket and
+ * free the t_control object
+ *
+ * @param c the t_control object (nothing happens if it is NULL)
+ */
+void stop_control(t_control *c);
+
+#endif
@@ -0,0 +1,379 @@
+#include "erasure.h"
+#include "server.h"
+#include "expiry.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+// Smallest value split into fragments (the smaller ones are replicated whole)
+#define EC_MIN_SIZE 1024
+// How long (in seconds) a rebuild waits for the fragments it is missing
+#define EC_REBUILD_TIMEOUT 3.0
+// Polynomial that defines GF(256) (x^8 + x^4 + x^3 + x^2 + 1)
+#define GF_POLYNOMIAL 0x11d
+
+// Powers of the generator of GF(256) (twice over, so that sums of logarithms need no
+// modulo) and the logarithm of each element
+unsigned char gf_exp[512], gf_log[256];
+pthread_once_t gf_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Fill the tables of powers and logarithms of GF(256)
+ */
+void gf_init(void)
+{
+    unsigned int x = 1;
+    for (unsigned int i = 0; i < 255; i++) {
+        gf_exp[i] = gf_exp[i + 255] = (unsigned char) x;
+        gf_log[x] = (unsigned char) i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= GF_POLYNOMIAL;
+    }
+}
+
+/**
+ * @brief Multiply two elements of GF(256)
+ *
+ * @param a the first one
+ * @param b the second one
+ * @return [ @b unsigned @b char ] the product
+ */
+unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+    return a == 0 || b == 0 ? 0 : gf_exp[gf_log[a] + gf_log[b]];
+}
+
+/**
+ * @brief Get the inverse of an element of GF(256)
+ *
+ * @param a the element (not 0)
+ * @return [ @b unsigned @b char ] its inverse
+ */
+unsigned char gf_inv(unsigned char a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+/**
+ * @brief Get the coefficient a parity fragment gives a data fragment: the parity rows form
+ * a Cauchy matrix, so any k rows of the generator matrix (the identity over it) can be
+ * inverted
+ *
+ * @param k how many data fragments there are
+ * @param parity which parity fragment it is
+ * @param data which data fragment it is
+ * @return [ @b unsigned @b char ] the coefficient
+ */
+unsigned char cauchy(unsigned int k, unsigned int parity, unsigned int data)
+{
+    return gf_inv((unsigned char) ((k + parity) ^ data));
+}
+
+/**
+ * @brief Add a fragment times a coefficient to another one
+ *
+ * @param dest the fragment added to
+ * @param src the fragment added
+ * @param c the coefficient
+ * @param size the fragments' size
+ */
+void mul_add(unsigned char *dest, const unsigned char *src, unsigned char c, size_t size)
+{
+    if (c == 0)
+        return;
+    unsigned char product[256];
+    for (unsigned int x = 0; x < 256; x++)
+        product[x] = gf_mul(c, x);
+    for (size_t i = 0; i < size; i++)
+        dest[i] ^= product[src[i]];
+}
+
+size_t fragment_size(size_t length, unsigned int k)
+{
+    return length > 0 ? (length + k - 1) / k : 1;
+}
+
+void ec_encode(const char *value, size_t length, unsigned int k, unsigned int m, char *fragments)
+{
+    pthread_once(&gf_once, gf_init);
+    size_t size = fragment_size(length, k);
+    // The data fragments are the value itself
+    memset(fragments, 0, (k + m) * size);
+    memcpy(fragments, value, length);
+    for (unsigned int p = 0; p < m; p++) {
+        unsigned char *parity = (unsigned char*) fragments + (k + p) * size;
+        for (unsigned int j = 0; j < k; j++)
+            mul_add(parity, (unsigned char*) fragments + j * size, cauchy(k, p, j), size);
+    }
+}
+
+int ec_decode(char *const *fragments, unsigned int k, unsigned int m, size_t length, char *value)
+{
+    pthread_once(&gf_once, gf_init);
+    size_t size = fragment_size(length, k);
+
+    // Rows of the generator matrix of the first k fragments available
+    unsigned int rows[EC_MAX_FRAGMENTS], count = 0;
+    for (unsigned int i = 0; i < k + m && count < k; i++) {
+        if (fragments[i] != NULL)
+            rows[count++] = i;
+    }
+    if (count < k)
+        return -1;
+    unsigned char a[EC_MAX_FRAGMENTS][EC_MAX_FRAGMENTS], inv[EC_MAX_FRAGMENTS][EC_MAX_FRAGMENTS];
+    for (unsigned int r = 0; r < k; r++) {
+        for (unsigned int j = 0; j < k; j++) {
+            a[r][j] = rows[r] < k ? rows[r] == j : cauchy(k, rows[r] - k, j);
+            inv[r][j] = r == j;
+        }
+    }
+
+    // Invert it (Gauss-Jordan elimination, where adding is XOR)
+    for (unsigned int col = 0; col < k; col++) {
+        unsigned int pivot = col;
+        while (pivot < k && a[pivot][col] == 0)
+            pivot++;
+        if (pivot == k)
+            return -1;  // Can't happen with a Cauchy matrix
+        for (unsigned int j = 0; j < k; j++) {
+            unsigned char t = a[col][j]; a[col][j] = a[pivot][j]; a[pivot][j] = t;
+            t = inv[col][j]; inv[col][j] = inv[pivot][j]; inv[pivot][j] = t;
+        }
+        unsigned char scale = gf_inv(a[col][col]);
+        for (unsigned int j = 0; j < k; j++) {
+            a[col][j] = gf_mul(a[col][j], scale);
+            inv[col][j] = gf_mul(inv[col][j], scale);
+        }
+        for (unsigned int r = 0; r < k; r++) {
+            unsigned char factor = a[r][col];
+            if (r == col || factor == 0)
+                continue;
+            for (unsigned int j = 0; j < k; j++) {
+                a[r][j] ^= gf_mul(factor, a[col][j]);
+                inv[r][j] ^= gf_mul(factor, inv[col][j]);
+            }
+        }
+    }
+
+    // Each data fragment is a combination of the ones available
+    unsigned char *data = (unsigned char*) malloc(size);
+    if (data == NULL)
+        return -1;
+    for (unsigned int j = 0; j < k && j * size < length; j++) {
+        size_t part = length - j * size < size ? length - j * size : size;
+        if (fragments[j] != NULL) {
+            memcpy(value + j * size, fragments[j], part);
+            continue;
+        }
+        memset(data, 0, size);
+        for (unsigned int r = 0; r < k; r++)
+            mul_add(data, (unsigned char*) fragments[rows[r]], inv[j][r], size);
+        memcpy(value + j * size, data, part);
+    }
+    free(data);
+    return 0;
+}
+
+int should_fragment(size_t length, t_nodeinfo *ni)
+{
+    return ni->ec_k > 0 && !ni->ec_fallback && length >= EC_MIN_SIZE;
+}
+
+unsigned int whole_replicas(t_nodeinfo *ni)
+{
+    // Without room for the fragments, the objects still survive as many failures as their
+    // parity fragments would have let them
+    return ni->ec_fallback && ni->replication == 0 ? ni->ec_m : ni->replication;
+}
+
+int fragments_wrapped(unsigned int key, t_nodeinfo *ni)
+{
+    if (!ni->ec_fallback)
+        printf("\x1b[33m[!] The ring has fewer than %u other nodes, replicating large objects whole instead of in fragments\033[m\n",
+            ni->ec_k + ni->ec_m);
+    ni->ec_fallback = 1;
+    // Only once per object: the successors drop their fragments (FDROP) for a whole copy
+    if (key > 31 || !(ni->fragmented & (1u << key)))
+        return 0;
+    return replicate_object(key, ni);
+}
+
+int send_fragment(unsigned int owner, unsigned int hops, unsigned int key, t_fragment *fragment, unsigned long ttl, t_nodeinfo *ni)
+{
+    if (ni->succ_fd == -1 || ni->succ_id == owner)
+        return 0;  // The chain ends here
+
+    char message[96] = "";
+    sprintf(message, "FRAG %u %u %u %u %u %u %zu %zu %016" PRIx64 " %lu\n", owner, hops, key, fragment->index, fragment->k, fragment->m,
+        fragment->length, fragment->size, fragment->hash, ttl);
+    if (sendall(ni->succ_fd, message, strlen(message)) != 0 || sendall(ni->succ_fd, fragment->data, fragment_size(fragment->length, fragment->k)) != 0) {
+        puts("\x1b[31m[!] Couldn't send fragments to successor\033[m");
+        return -1;
+    }
+    return 0;
+}
+
+int send_fragments(unsigned int key, t_nodeinfo *ni)
+{
+    t_object *object = get_stored_object(key, ni);
+    if (object == NULL)
+        return 0;
+    unsigned int k = ni->ec_k, m = ni->ec_m;
+    char *data = (char*) malloc((k + m) * fragment_size(object->length, k));
+    if (data == NULL)
+        return -1;
+    ec_encode(object->value, object->length, k, m, data);
+
+    // The successors keep fragments instead of whole replicas now
+    if (ni->replication > 0)
+        send_replica(ni->key, ni->replication, key, NULL, 0, 0, 0, ni);
+    // Each successor only gets its own fragment (the i-th one goes i+1 hops away)
+    int result = 0;
+    size_t size = fragment_size(object->length, k);
+    for (unsigned int i = 0; i < k + m && result == 0; i++) {
+        t_fragment fragment = { data + i * size, i, k, m, object->length, object->size, ni->object_tree.nodes[32 + key], { 0, 0 } };
+        result = send_fragment(ni->key, i + 1, key, &fragment, ttl_ms(key, ni), ni);
+    }
+    free(data);
+    ni->fragmented |= 1u << key;
+    return result;
+}
+
+int drop_fragments(unsigned int key, t_nodeinfo *ni)
+{
+    if (key > 31 || !(ni->fragmented & (1u << key)))
+        return 0;
+    ni->fragmented &= ~(1u << key);
+    if (ni->succ_fd == -1 || ni->succ_id == ni->key)
+        return 0;
+
+    char message[64] = "";
+    sprintf(message, "FDROP %u %u %u\n", ni->key, ni->ec_k + ni->ec_m, key);
+    if (sendall(ni->succ_fd, message, strlen(message)) != 0) {
+        puts("\x1b[31m[!] Couldn't drop the successors' fragments\033[m");
+        return -1;
+    }
+    return 0;
+}
+
+int keep_fragment(unsigned int key, t_fragment *fragment, t_nodeinfo *ni)
+{
+    if (key > 31)
+        return -1;
+    set_replica(key, NULL, 0, 0, ni);
+    drop_fragment(key, ni);
+
+    size_t size = fragment_size(fragment->length, fragment->k);
+    char *data = (char*) malloc(size);
+    if (data == NULL)
+        return -1;
+    memcpy(data, fragment->data, size);
+    ni->fragments[key] = *fragment;
+    ni->fragments[key].data = data;
+    // Anti-entropy compares this with the owner's hash of the whole object
+    set_merkle_leaf(&ni->replica_tree, key, fragment->hash);
+    return 0;
+}
+
+void drop_fragment(unsigned int key, t_nodeinfo *ni)
+{
+    if (key > 31 || ni->fragments[key].data == NULL)
+        return;
+    free(ni->fragments[key].data);
+    ni->fragments[key].data = NULL;
+    if (ni->replicas[key].value == NULL)
+        set_merkle_leaf(&ni->replica_tree, key, 0);
+}
+
+int start_rebuild(unsigned int key, t_nodeinfo *ni)
+{
+    t_fragment *own = &ni->fragments[key];
+    if (key > 31 || own->data == NULL || ni->rebuilds[key] != NULL)
+        return 0;
+    if (own->expires.tv_sec != 0 && seconds_until(own->expires) <= 0) {
+        drop_fragment(key, ni);  // The object expired anyway
+        return 0;
+    }
+    t_rebuild *rebuild = (t_rebuild*) calloc(1, sizeof(t_rebuild));
+    if (rebuild == NULL)
+        return -1;
+    rebuild->value = *own;
+    rebuild->value.data = NULL;
+    rebuild->deadline = seconds_from_now(EC_REBUILD_TIMEOUT);
+    ni->rebuilds[key] = rebuild;
+    printf("\x1b[33m[*] Rebuilding the object of key %u from its fragments\033[m\n", key);
+
+    // This node's own fragment counts as one of them
+    if (add_fragment(key, own->index, own->hash, own->data, fragment_size(own->length, own->k), ni) != 0)
+        return 0;
+
+    // Every other holder (the next successors) sends its fragment back at once
+    unsigned int hops = own->k + own->m - 1 - own->index;
+    if (hops == 0 || ni->succ_fd == -1 || ni->succ_id == ni->key)
+        return 0;
+    char message[64] = "";
+    sprintf(message, "FGET %u %u %u %016" PRIx64 "\n", ni->key, hops, key, own->hash);
+    if (sendall(ni->succ_fd, message, strlen(message)) != 0) {
+        puts("\x1b[31m[!] Couldn't ask the successors for fragments\033[m");
+        return -1;
+    }
+    return 0;
+}
+
+int add_fragment(unsigned int key, unsigned int index, uint64_t hash, char *data, size_t length, t_nodeinfo *ni)
+{
+    t_rebuild *rebuild = key <= 31 ? ni->rebuilds[key] : NULL;
+    if (rebuild == NULL || hash != rebuild->value.hash || index >= rebuild->value.k + rebuild->value.m
+            || rebuild->fragments[index] != NULL || length != fragment_size(rebuild->value.length, rebuild->value.k))
+        return 0;
+    if ((rebuild->fragments[index] = (char*) malloc(length)) == NULL)
+        return -1;
+    memcpy(rebuild->fragments[index], data, length);
+    if (++rebuild->count < rebuild->value.k)
+        return 0;
+
+    // Enough of them
+    t_fragment value = rebuild->value;
+    char *stored = (char*) malloc(value.length + 1);
+    int result = stored != NULL ? ec_decode(rebuild->fragments, value.k, value.m, value.length, stored) : -1;
+    if (result == 0) {
+        // The object lives as long as it would have at its previous owner
+        if (value.expires.tv_sec != 0)
+            schedule_expiry(key, seconds_until(value.expires), ni);
+        result = store_received_object(key, stored, value.length, value.size, ni);
+    }
+    free(stored);
+    free_rebuild(key, ni);
+    if (result != 0) {
+        printf("\x1b[31m[!] Couldn't rebuild the object of key %u\033[m\n", key);
+        return -1;
+    }
+    printf("\x1b[32m[*] Rebuilt the object of key %u from %u of its %u fragments\033[m\n", key, value.k, value.k + value.m);
+    ni->objects_rebuilt++;
+    return 1;
+}
+
+void expire_rebuilds(t_nodeinfo *ni)
+{
+    for (unsigned int key = 0; key < 32; key++) {
+        t_rebuild *rebuild = ni->rebuilds[key];
+        if (rebuild == NULL || seconds_until(rebuild->deadline) > 0)
+            continue;
+        printf("\x1b[31m[!] Couldn't rebuild the object of key %u: only %u of the %u fragments needed arrived\033[m\n", key,
+            rebuild->count, rebuild->value.k);
+        free_rebuild(key, ni);
+    }
+}
+
+void free_rebuild(unsigned int key, t_nodeinfo *ni)
+{
+    if (key > 31 || ni->rebuilds[key] == NULL)
+        return;
+    for (unsigned int i = 0; i < EC_MAX_FRAGMENTS; i++)
+        free(ni->rebuilds[key]->fragments[i]);
+    free(ni->rebuilds[key]);
+    ni->rebuilds[key] = NULL;
+}
@@ -0,0 +1,162 @@
+#ifndef ERASURE_H
+#define ERASURE_H
+
+#include "common.h"
+
+/**
+ * @brief Get the size of each fragment of a value
+ *
+ * @param length the value's size in bytes
+ * @param k how many data fragments it is split into
+ * @return [ @b size_t ] the fragments' size (the last data fragment is padded with zeros)
+ */
+size_t fragment_size(size_t length, unsigned int k);
+
+/**
+ * @brief Split a value into k data fragments and compute m parity fragments (Reed-Solomon
+ * over GF(256)), any k of which are enough to get the value back
+ *
+ * @param value the value
+ * @param length its size in bytes
+ * @param k how many data fragments to split it into
+ * @param m how many parity fragments to add
+ * @param fragments where to write the k+m fragments, one after the other (each of
+ * fragment_size bytes)
+ */
+void ec_encode(const char *value, size_t length, unsigned int k, unsigned int m, char *fragments);
+
+/**
+ * @brief Get a value back from any k of its fragments
+ *
+ * @param fragments the k+m fragments (NULL for the missing ones)
+ * @param k how many data fragments the value was split into
+ * @param m how many parity fragments were added
+ * @param length the value's size in bytes
+ * @param value where to write the value
+ * @return [ @b int ] 0 if successfull, -1 if there are less than k fragments
+ */
+int ec_decode(char *const *fragments, unsigned int k, unsigned int m, size_t length, char *value);
+
+/**
+ * @brief Check whether an object this node owns should be spread over the successors as
+ * fragments instead of being replicated whole (large objects, if erasure coding is enabled)
+ *
+ * @param length size of the object's value as it is stored
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if it should, 0 otherwise
+ */
+int should_fragment(size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Get how many successors hold a whole copy of each object this node owns (the
+ * replication factor, or m if the ring turned out too small for erasure coding)
+ *
+ * @param ni necessary information about the node
+ * @return [ @b unsigned @b int ] how many successors
+ */
+unsigned int whole_replicas(t_nodeinfo *ni);
+
+/**
+ * @brief Handle a fragment of an object this node owns that went all the way around the
+ * ring: there are fewer than k+m successors, so the object (and every large object from
+ * now on) is replicated whole instead
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int fragments_wrapped(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Split an object this node owns into fragments and send them to the next k+m
+ * successors (FRAG), replacing the replicas they had of it
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_fragments(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Send a fragment of an object to one of the successors (FRAG). The ones before it
+ * pass it on without keeping it
+ *
+ * @param owner key of the object's owner
+ * @param hops which successor gets it (1 for the successor itself)
+ * @param key the object's key
+ * @param fragment the fragment
+ * @param ttl how many milliseconds the object has left to live (0 if it has no TTL)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_fragment(unsigned int owner, unsigned int hops, unsigned int key, t_fragment *fragment, unsigned long ttl, t_nodeinfo *ni);
+
+/**
+ * @brief Make the successors that hold fragments of an object this node owns drop them
+ * (FDROP), if they were sent any
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int drop_fragments(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Keep a fragment of an object owned by a predecessor, instead of any replica of it
+ *
+ * @param key the object's key
+ * @param fragment the fragment (its data is copied)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int keep_fragment(unsigned int key, t_fragment *fragment, t_nodeinfo *ni);
+
+/**
+ * @brief Forget the fragment held of an object
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ */
+void drop_fragment(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Start rebuilding an object of a failed predecessor from the fragment held of it
+ * and the ones its other holders (the next successors) send back (FGET)
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull (or there is nothing to rebuild), -1 otherwise
+ */
+int start_rebuild(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Add a fragment sent back by a successor to an object being rebuilt, and store the
+ * object once there are enough
+ *
+ * @param key the object's key
+ * @param index which fragment it is
+ * @param hash hash of the value it is a fragment of
+ * @param data the fragment
+ * @param length its size
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if the object was rebuilt, 0 if more fragments are needed (or this
+ * one doesn't belong to it), -1 in case of an error
+ */
+int add_fragment(unsigned int key, unsigned int index, uint64_t hash, char *data, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Give up rebuilding the objects whose fragments didn't arrive in time
+ *
+ * @param ni necessary information about the node
+ */
+void expire_rebuilds(t_nodeinfo *ni);
+
+/**
+ * @brief Forget an object being rebuilt
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ */
+void free_rebuild(unsigned int key, t_nodeinfo *ni);
+
+#endif
@@ -1,4 +1,9 @@
 #include "event.h"
+#include "server.h"
+#include "user.h"
+#include "worker.h"
+#include "console.h"
+#include "control.h"
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/time.h>
@@ -6,75 +11,174 @@
 #include <errno.h>
 
 
-t_event select_event(t_nodeinfo* ni)
+/**
+ * @brief Checks whether select_event() should wait for events in a virtual node
+ * 
+ * @param vn the virtual node
+ * @param worker the worker thread, or EVERY_WORKER/NO_WORKER
+ * @return [ @b int ] 1 if true, 0 if false 
+ */
+int is_selected(t_nodeinfo *vn, int worker)
+{
+    return worker == EVERY_WORKER || (worker >= 0 && vn->worker == (unsigned int) worker);
+}
+
+t_event select_event(t_nodeinfo *ni, int worker, int user_input, t_nodeinfo **source)
 {
     struct timeval SELECT_TIMEOUT = { .tv_sec = 0, .tv_usec = 1000 };
+    t_nodeinfo *vn;
+
+    // While a body only passes through a virtual node, just the connections relaying one
+    // are served, so that nothing else gets written into the middle of it
+    int relaying = 0;
+    for (vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        if (is_selected(vn, worker) && is_relaying(vn))
+            relaying = 1;
+    }
 
     // If there's pending reads in any of the connections, do them first
-    if (ni->succ_fd > 0 && has_available_data(ni->successor))
-        return E_MESSAGE_SUCCESSOR;
-    if (ni->pred_fd > 0 && has_available_data(ni->predecessor))
-        return E_MESSAGE_PREDECESSOR;
-    if (ni->temp_fd > 0 && has_available_data(ni->temp))
-        return E_MESSAGE_TEMP;
+    for (vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        if (!is_selected(vn, worker))
+            continue;
+        *source = vn;
+        if (vn->succ_fd > 0 && has_available_data(vn->successor) && (!relaying || relaying_body(vn->successor)))
+            return E_MESSAGE_SUCCESSOR;
+        if (vn->pred_fd > 0 && has_available_data(vn->predecessor) && (!relaying || relaying_body(vn->predecessor)))
+            return E_MESSAGE_PREDECESSOR;
+        if (vn->temp_fd > 0 && has_available_data(vn->temp) && !relaying)
+            return E_MESSAGE_TEMP;
+    }
 
     // Initialize file descriptor set
     fd_set read_fds;
     FD_ZERO(&read_fds); 
-    int fdmax = maxfd(ni);
-    fdmax = fdmax > STDIN_FILENO ? fdmax : STDIN_FILENO;
-
-    // Add currently in-use file descriptors to the set
-    FD_SET(STDIN_FILENO, &read_fds);
-    if (ni->main_fd > 0)
-        FD_SET(ni->main_fd, &read_fds);
-    if (ni->succ_fd > 0)
-        FD_SET(ni->succ_fd, &read_fds);
-    if (ni->pred_fd > 0)
-        FD_SET(ni->pred_fd, &read_fds);
-    if (ni->temp_fd > 0)
-        FD_SET(ni->temp_fd, &read_fds);
-    if (ni->udp_fd > 0)
-        FD_SET(ni->udp_fd, &read_fds);
-
-    int count = select(fdmax+1, &read_fds, NULL, NULL, &SELECT_TIMEOUT);
+    int fdmax = 0;
+
+    // Add currently in-use file descriptors (of the selected virtual nodes) to the set
+    int user_fd = -1;
+    if (user_input && !relaying && ni->first_vnode->console != NULL) {
+        // Commands queued by the console thread
+        user_fd = console_fd(ni->first_vnode->console);
+        FD_SET(user_fd, &read_fds);
+        fdmax = user_fd;
+    }
+    t_control *control = user_input && !relaying ? ni->first_vnode->control : NULL;
+    fd_set write_fds;
+    FD_ZERO(&write_fds);
+    if (control != NULL)
+        add_control_fds(control, &read_fds, &write_fds, &fdmax);
+    int shared_fd = -1, queue_fd = -1;
+    if (worker >= 0 && ni->workers != NULL && !relaying) {
+        get_worker_fds(ni->workers, worker, &shared_fd, &queue_fd);
+        if (shared_fd > 0)
+            FD_SET(shared_fd, &read_fds);
+        FD_SET(queue_fd, &read_fds);
+        fdmax = fdmax > shared_fd ? fdmax : shared_fd;
+        fdmax = fdmax > queue_fd ? fdmax : queue_fd;
+    }
+    for (vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        if (!is_selected(vn, worker))
+            continue;
+        fdmax = fdmax > maxfd(vn) ? fdmax : maxfd(vn);
+        if (vn->succ_fd > 0 && (!relaying || relaying_body(vn->successor)))
+            FD_SET(vn->succ_fd, &read_fds);
+        if (vn->pred_fd > 0 && (!relaying || relaying_body(vn->predecessor)))
+            FD_SET(vn->pred_fd, &read_fds);
+        if (relaying)
+            continue;
+        if (vn->main_fd > 0)
+            FD_SET(vn->main_fd, &read_fds);
+        if (vn->temp_fd > 0)
+            FD_SET(vn->temp_fd, &read_fds);
+        if (vn->udp_fd > 0)
+            FD_SET(vn->udp_fd, &read_fds);
+    }
+
+    int count = select(fdmax+1, &read_fds, &write_fds, NULL, &SELECT_TIMEOUT);
     if (count < 0) {
         printf("\x1b[31m[!] Select error (%d)!\033[m\n", errno);
         exit(1);
     }
 
-    while (count--) {
-        // Check for ready fd's with FD_ISSET
-        if (ni->main_fd != -1 && FD_ISSET(ni->main_fd, &read_fds)) {
+    *source = ni->first_vnode;
+    if (count == 0)
+        return E_TIMEOUT;
+
+    // Check for ready fd's with FD_ISSET
+    if (queue_fd != -1 && FD_ISSET(queue_fd, &read_fds)) {
+        // Messages handed over by other worker threads
+        return E_MESSAGE_QUEUE;
+    }
+    if (shared_fd != -1 && FD_ISSET(shared_fd, &read_fds)) {
+        // Incoming message from the port shared by every worker thread
+        return E_MESSAGE_SHARED;
+    }
+    for (vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        if (!is_selected(vn, worker))
+            continue;
+        *source = vn;
+        if (vn->main_fd != -1 && FD_ISSET(vn->main_fd, &read_fds)) {
             // Incoming connection
-            FD_CLR(ni->main_fd, &read_fds);
             return E_INCOMING_CONNECTION;
         }
-        else if (ni->udp_fd != -1 && FD_ISSET(ni->udp_fd, &read_fds)) {
+        else if (vn->udp_fd != -1 && FD_ISSET(vn->udp_fd, &read_fds)) {
             // Incoming message from UDP socket
-            FD_CLR(ni->udp_fd, &read_fds);
             return E_MESSAGE_UDP;
         }
-        else if (ni->succ_fd != -1 && FD_ISSET(ni->succ_fd, &read_fds)) {
+        else if (vn->succ_fd != -1 && FD_ISSET(vn->succ_fd, &read_fds) && (!relaying || relaying_body(vn->successor))) {
             // Incoming message from successor
-            FD_CLR(ni->succ_fd, &read_fds);
             return E_MESSAGE_SUCCESSOR;
         }
-        else if (ni->pred_fd != -1 && FD_ISSET(ni->pred_fd, &read_fds)) {
+        else if (vn->pred_fd != -1 && FD_ISSET(vn->pred_fd, &read_fds) && (!relaying || relaying_body(vn->predecessor))) {
             // Incoming message from predecessor
-            FD_CLR(ni->pred_fd, &read_fds);
             return E_MESSAGE_PREDECESSOR;
         }
-        else if (ni->temp_fd != -1 && FD_ISSET(ni->temp_fd, &read_fds)) {
+        else if (vn->temp_fd != -1 && FD_ISSET(vn->temp_fd, &read_fds)) {
             // Incoming message from somewhere else
-            FD_CLR(ni->temp_fd, &read_fds);
             return E_MESSAGE_TEMP;
         }
-        else if (FD_ISSET(STDIN_FILENO, &read_fds)) {
-            FD_CLR(STDIN_FILENO, &read_fds);
-            return E_MESSAGE_USER;
-        }
     }
 
+    *source = ni->first_vnode;
+    if (user_fd != -1 && FD_ISSET(user_fd, &read_fds))
+        return E_MESSAGE_USER;
+    if (control != NULL && control_ready(control, &read_fds, &write_fds))
+        return E_MESSAGE_CONTROL;
+
     return E_TIMEOUT;
 }
+
+int process_event(t_event e, t_nodeinfo *ni)
+{
+    // Act based on what event just occurred
+    switch (e) {
+        case E_INCOMING_CONNECTION:
+            // A client is trying to connect to us
+            return process_incoming_connection(ni);
+
+        case E_MESSAGE_UDP:
+            return process_message_udp(ni);
+
+        case E_MESSAGE_TEMP:
+            // A new connection has sent a message
+            return process_message_temp(ni);
+
+        case E_MESSAGE_SUCCESSOR:
+            // This node's successor sent a message
+            return process_message_successor(ni);
+
+        case E_MESSAGE_PREDECESSOR:
+            // This node's predecessor sent a message
+            return process_message_predecessor(ni);
+
+        case E_MESSAGE_USER:
+            return process_user_message(ni);
+
+        case E_MESSAGE_CONTROL:
+            // A control client has connected or sent commands
+            return process_control_message(ni);
+
+        default:
+            return 0;
+    }
+}
@@ -10,16 +10,38 @@ typedef enum event {
     E_MESSAGE_TEMP,
     E_MESSAGE_USER,
     E_MESSAGE_UDP,
+    E_MESSAGE_SHARED,
+    E_MESSAGE_QUEUE,
+    E_MESSAGE_CONTROL,
     E_TIMEOUT,
     E_ERROR
 } t_event;
 
+// Wait for events in every virtual node
+#define EVERY_WORKER -1
+// Don't wait for events in any virtual node (they are handled by the worker threads)
+#define NO_WORKER -2
+
 /**
- * @brief Blocks until an event occurrs, then returns it
+ * @brief Blocks until an event occurrs in the process' virtual nodes, then returns it
  * 
- * @param ni necessary information about the node 
+ * @param ni necessary information about the node (any of the virtual nodes)
+ * @param worker only wait for events in the virtual nodes run by this worker thread (and in its
+ * socket bound to the shared port and its queues), or EVERY_WORKER/NO_WORKER
+ * @param user_input whether to also wait for commands (queued by the console or sent
+ * by control clients)
+ * @param source where to store the virtual node the event happened in
  * @return [ @b t_event ] what event has occurred
  */
-t_event select_event(t_nodeinfo *ni);
+t_event select_event(t_nodeinfo *ni, int worker, int user_input, t_nodeinfo **source);
+
+/**
+ * @brief Handle an event returned by select_event()
+ * 
+ * @param e the event
+ * @param ni the virtual node the event happened in
+ * @return [ @b int ] 0 if successfull, 1 if the application should exit and -1 in case of an error
+ */
+int process_event(t_event e, t_nodeinfo *ni);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,184 @@
+#include "expiry.h"
+#include "server.h"
+#include "lease.h"
+#include "utils.h"
+#include "storage.h"
+#include <stdio.h>
+#include <sys/time.h>
+
+// Length of a tick of the timer wheel in seconds (how precise the TTLs are)
+#define WHEEL_TICK 0.01
+// Bits of a tick number each level of the wheel covers (WHEEL_SLOTS is 2 to this power)
+#define WHEEL_BITS 6
+
+/**
+ * @brief Get the tick of the timer wheel a moment falls in
+ *
+ * @param wheel the timer wheel
+ * @param from_now how many seconds from now the moment is
+ * @return [ @b unsigned long ] the tick
+ */
+unsigned long wheel_tick(t_timer_wheel *wheel, double from_now)
+{
+    double elapsed = from_now - seconds_until(wheel->start);
+    return elapsed > 0 ? (unsigned long) (elapsed / WHEEL_TICK) : 0;
+}
+
+/**
+ * @brief Put a key in the slot its tick falls in: the closer the tick, the lower the
+ * level (the ticks beyond the last level wait in its furthest slot)
+ *
+ * @param wheel the timer wheel
+ * @param key the key (it must not be in the wheel)
+ * @param tick when the key expires (not before the last tick processed)
+ */
+void place_key(t_timer_wheel *wheel, unsigned int key, unsigned long tick)
+{
+    unsigned long delta = tick - wheel->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS-1 && delta >> (WHEEL_BITS * (level+1)) != 0)
+        level++;
+    if (delta >> (WHEEL_BITS * WHEEL_LEVELS) != 0)
+        tick = wheel->now + (1ul << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+    int slot = (tick >> (WHEEL_BITS * level)) % WHEEL_SLOTS;
+    wheel->level[key] = level;
+    wheel->slot[key] = slot;
+    wheel->prev[key] = -1;
+    wheel->next[key] = wheel->slots[level][slot];
+    if (wheel->next[key] >= 0)
+        wheel->prev[wheel->next[key]] = key;
+    wheel->slots[level][slot] = key;
+    wheel->count++;
+}
+
+/**
+ * @brief Take a key out of the wheel
+ *
+ * @param wheel the timer wheel
+ * @param key the key
+ */
+void unlink_key(t_timer_wheel *wheel, unsigned int key)
+{
+    if (wheel->level[key] < 0)
+        return;
+    if (wheel->prev[key] >= 0)
+        wheel->next[wheel->prev[key]] = wheel->next[key];
+    else
+        wheel->slots[wheel->level[key]][wheel->slot[key]] = wheel->next[key];
+    if (wheel->next[key] >= 0)
+        wheel->prev[wheel->next[key]] = wheel->prev[key];
+    wheel->level[key] = -1;
+    wheel->count--;
+}
+
+/**
+ * @brief Take every key out of a slot
+ *
+ * @param wheel the timer wheel
+ * @param level the slot's level
+ * @param slot the slot
+ * @return [ @b int ] the first key of the slot (-1 if it was empty); the rest follow it
+ * through @b next
+ */
+int empty_slot(t_timer_wheel *wheel, int level, int slot)
+{
+    int first = wheel->slots[level][slot];
+    wheel->slots[level][slot] = -1;
+    for (int key = first; key >= 0; key = wheel->next[key]) {
+        wheel->level[key] = -1;
+        wheel->count--;
+    }
+    return first;
+}
+
+void schedule_expiry(unsigned int key, double ttl, t_nodeinfo *ni)
+{
+    t_timer_wheel *wheel = &ni->expiry;
+    if (key > 31)
+        return;
+    unlink_key(wheel, key);
+    // An empty wheel has nothing to catch up on
+    if (wheel->count == 0)
+        wheel->now = wheel_tick(wheel, 0);
+
+    // A key never expires early, but may expire up to a tick late
+    wheel->expires[key] = wheel_tick(wheel, ttl) + 1;
+    place_key(wheel, key, wheel->expires[key] > wheel->now ? wheel->expires[key] : wheel->now + 1);
+    if (ni->storage != NULL && log_expiry(ni->storage, key, ttl) != 0)
+        printf("\x1b[31m[!] Couldn't log the time to live of key %u\033[m\n", key);
+}
+
+void cancel_expiry(unsigned int key, t_nodeinfo *ni)
+{
+    if (key > 31 || ni->expiry.level[key] < 0)
+        return;
+    unlink_key(&ni->expiry, key);
+    if (ni->storage != NULL && log_expiry(ni->storage, key, -1) != 0)
+        printf("\x1b[31m[!] Couldn't log the time to live of key %u\033[m\n", key);
+}
+
+double time_to_live(unsigned int key, t_nodeinfo *ni)
+{
+    t_timer_wheel *wheel = &ni->expiry;
+    if (key > 31 || wheel->level[key] < 0)
+        return -1;
+    double left = wheel->expires[key] * WHEEL_TICK + seconds_until(wheel->start);
+    return left > 0 ? left : 0;
+}
+
+unsigned long ttl_ms(unsigned int key, t_nodeinfo *ni)
+{
+    double left = time_to_live(key, ni);
+    if (left < 0)
+        return 0;
+    unsigned long ms = (unsigned long) (left * 1000);
+    return ms > 0 ? ms : 1;
+}
+
+void expire_objects(t_nodeinfo *ni)
+{
+    t_timer_wheel *wheel = &ni->expiry;
+    unsigned long target = wheel_tick(wheel, 0);
+    unsigned int expired = 0;
+    while (wheel->now < target) {
+        if (wheel->count == 0) {
+            wheel->now = target;
+            break;
+        }
+        wheel->now++;
+
+        // The slots of the upper levels that start at this tick are spread over the
+        // levels below
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            if ((wheel->now & ((1ul << (WHEEL_BITS * level)) - 1)) != 0)
+                break;
+            int key = empty_slot(wheel, level, (wheel->now >> (WHEEL_BITS * level)) % WHEEL_SLOTS);
+            while (key >= 0) {
+                int next = wheel->next[key];
+                place_key(wheel, key, wheel->expires[key] > wheel->now ? wheel->expires[key] : wheel->now);
+                key = next;
+            }
+        }
+
+        // The keys in this tick's slot of the first level are due
+        int key = empty_slot(wheel, 0, wheel->now % WHEEL_SLOTS);
+        while (key >= 0) {
+            int next = wheel->next[key];
+            if (wheel->expires[key] <= wheel->now)
+                expired |= 1u << key;
+            else
+                place_key(wheel, key, wheel->expires[key]);
+            key = next;
+        }
+    }
+
+    for (unsigned int key = 0; expired != 0 && key < 32; key++) {
+        if (!(expired & (1u << key)) || !is_owner(key, ni) || latest_object(key, ni)->value == NULL)
+            continue;
+        printf("\x1b[33m[*] Object of key %u expired\033[m\n", key);
+        ni->objects_expired++;
+        if (store_object(key, NULL, 0, ni) != 0)
+            printf("\x1b[31m[!] Couldn't delete the expired object of key %u\033[m\n", key);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef EXPIRY_H
+#define EXPIRY_H
+
+#include "common.h"
+
+/**
+ * @brief Make an object this node owns expire after some time, replacing the TTL it had
+ *
+ * @param key the object's key
+ * @param ttl its time to live in seconds
+ * @param ni necessary information about the node
+ */
+void schedule_expiry(unsigned int key, double ttl, t_nodeinfo *ni);
+
+/**
+ * @brief Make an object live until it is deleted (nothing happens if it has no TTL)
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ */
+void cancel_expiry(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Get how long an object this node owns has left to live
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b double ] the time in seconds, or a negative number if it has no TTL
+ */
+double time_to_live(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Get how long an object this node owns has left to live, as messages carry it
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b unsigned long ] the time in milliseconds (at least 1), or 0 if it has no TTL
+ */
+unsigned long ttl_ms(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Delete the objects whose time to live has run out, turning the timer wheel up to
+ * the current tick (only the keys due in each tick are looked at)
+ *
+ * @param ni necessary information about the node
+ */
+void expire_objects(t_nodeinfo *ni);
+
+#endif
@@ -0,0 +1,118 @@
+#include "hot.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+// How many GETs from other nodes make a key hot within a window
+#define HOT_THRESHOLD 64
+// Length of the window in seconds (the counts are halved at the end of each one)
+#define HOT_WINDOW 1.0
+// For how many seconds a copy given to the predecessor may be used, which bounds how long
+// it can go stale if its invalidation gets lost (e.g. when the predecessor changes)
+#define HOT_COPY_LIFETIME 5.0
+
+t_object *get_hot_copy(unsigned int key, t_nodeinfo *ni)
+{
+    if (key > 31 || ni->strong_reads || !ni->hot_copies[key].valid)
+        return NULL;
+    if (seconds_until(ni->hot_copies[key].expires) <= 0) {
+        drop_hot_copy(key, ni);
+        return NULL;
+    }
+    return &ni->hot_copies[key].object;
+}
+
+int set_hot_copy(unsigned int key, char *value, size_t length, unsigned long version, double lifetime, t_nodeinfo *ni)
+{
+    if (key > 31)
+        return -1;
+    t_hot_copy *copy = &ni->hot_copies[key];
+    if (copy->valid && copy->object.version > version)
+        return 0;  // Older than the one this node has
+    if (assign_object(&copy->object, value, length) != 0) {
+        copy->valid = 0;
+        return -1;
+    }
+    copy->object.version = version;
+    copy->expires = seconds_from_now(lifetime);
+    copy->valid = 1;
+    return 0;
+}
+
+void drop_hot_copy(unsigned int key, t_nodeinfo *ni)
+{
+    if (key > 31 || !ni->hot_copies[key].valid)
+        return;
+    assign_object(&ni->hot_copies[key].object, NULL, 0);
+    ni->hot_copies[key].valid = 0;
+}
+
+void count_hit(unsigned int key, t_nodeinfo *ni)
+{
+    if (key > 31 || ni->strong_reads)
+        return;
+    if (seconds_until(ni->hot_window_timestamp) <= -HOT_WINDOW) {
+        // Older GETs count less and less
+        for (unsigned int k = 0; k < 32; k++)
+            ni->hot_hits[k] /= 2;
+        gettimeofday(&ni->hot_window_timestamp, NULL);
+    }
+    if (++ni->hot_hits[key] >= HOT_THRESHOLD && seconds_until(ni->hot_pushed_until[key]) <= 0)
+        push_hot_copy(key, ni);
+}
+
+int push_hot_copy(unsigned int key, t_nodeinfo *ni)
+{
+    if (ni->pred_fd == -1 || ni->pred_id == ni->key)
+        return 0;
+    // The predecessor owns the key, it has no use for a copy
+    if (ring_distance(ni->pred_id, key) < ring_distance(ni->pred_id, ni->key))
+        return 0;
+
+    t_object *object;
+    unsigned long version;
+    double lifetime;
+    if (is_owner(key, ni)) {
+        object = get_object(key, ni);
+        version = ni->objects[key].version;
+        lifetime = HOT_COPY_LIFETIME;
+    }
+    else {
+        // The predecessor's copy can't outlive this one, since this node stops passing
+        // the invalidations on once its own copy has expired
+        object = get_hot_copy(key, ni);
+        if (object == NULL)
+            return 0;
+        version = object->version;
+        lifetime = seconds_until(ni->hot_copies[key].expires);
+        if (object->value == NULL)
+            object = NULL;
+    }
+
+    char message[64] = "";
+    size_t length = object != NULL ? object->length : 0;
+    sprintf(message, "HCOPY %u %lu %lu %zu\n", key, version, (unsigned long) (lifetime * 1000), length);
+    if (sendall(ni->pred_fd, message, strlen(message)) != 0 || (object != NULL && sendall(ni->pred_fd, object->value, length) != 0)) {
+        puts("\x1b[31m[!] Couldn't send a copy of a hot object to predecessor\033[m");
+        return -1;
+    }
+    ni->hot_pushed_until[key] = seconds_from_now(lifetime);
+    printf("\x1b[33m[*] Key %u is hot, its object was copied to the predecessor\033[m\n", key);
+    return 0;
+}
+
+void invalidate_hot_copies(unsigned int key, unsigned long version, t_nodeinfo *ni)
+{
+    if (key > 31 || seconds_until(ni->hot_pushed_until[key]) <= 0)
+        return;
+    ni->hot_pushed_until[key].tv_sec = 0;
+    ni->hot_pushed_until[key].tv_usec = 0;
+    if (ni->pred_fd == -1)
+        return;
+
+    char message[64] = "";
+    sprintf(message, "HINV %u %lu\n", key, version);
+    if (sendall(ni->pred_fd, message, strlen(message)) != 0)
+        puts("\x1b[31m[!] Couldn't invalidate the predecessor's copy of an object\033[m");
+}
@@ -0,0 +1,67 @@
+#ifndef HOT_H
+#define HOT_H
+
+#include "common.h"
+
+/**
+ * @brief Get a usable copy of a frequently read object owned by another node (hot copy)
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b t_object* ] the copy (its value is NULL if the object doesn't exist), or
+ * NULL if there is none, it has expired or GETs can only be answered by the owner
+ */
+t_object *get_hot_copy(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Store a hot copy given by the successor (unless the one this node has is newer)
+ *
+ * @param key the object's key
+ * @param value its value (NULL if it doesn't exist)
+ * @param length its size
+ * @param version the owner's version of the object
+ * @param lifetime for how many seconds the copy may be used
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int set_hot_copy(unsigned int key, char *value, size_t length, unsigned long version, double lifetime, t_nodeinfo *ni);
+
+/**
+ * @brief Forget the hot copy of a key
+ *
+ * @param key the key
+ * @param ni necessary information about the node
+ */
+void drop_hot_copy(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Count a GET from another node that this node answered (as the owner or with a
+ * hot copy). Once a key gets HOT_THRESHOLD of them within a window, the predecessor,
+ * which forwards the GETs that travel around the ring, gets a copy of it
+ *
+ * @param key the key
+ * @param ni necessary information about the node
+ */
+void count_hit(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Give the predecessor a copy of an object this node owns or has a hot copy of
+ * (HCOPY), which it may use until the copy this node has expires
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int push_hot_copy(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Tell the predecessor that its copy of an object is out of date (HINV), if it
+ * may still have one from this node
+ *
+ * @param key the object's key
+ * @param version the object's new version
+ * @param ni necessary information about the node
+ */
+void invalidate_hot_copies(unsigned int key, unsigned long version, t_nodeinfo *ni);
+
+#endif
@@ -0,0 +1,192 @@
+#include "lease.h"
+#include "server.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// For how many seconds the nodes that relay an answer may use its value
+#define LEASE_TIME 1.0
+// How long an answer may take to reach the last node that relays it (leases are relative,
+// so the owner counts them from when the answer left plus this)
+#define LEASE_MARGIN 0.25
+// How many nodes a revocation visits at most before giving up on coming back
+#define LEASE_REVOCATION_HOPS 32
+
+t_object *get_cached(unsigned int key, t_nodeinfo *ni)
+{
+    t_lease_cache *cache = &ni->cache;
+    if (key > 31 || ni->strong_reads || !(cache->valid & (1u << key)))
+        return NULL;
+    if (seconds_until(cache->expires[key]) <= 0) {
+        uncache(key, ni);
+        return NULL;
+    }
+    cache->referenced |= 1u << key;
+    return &cache->entries[key];
+}
+
+/**
+ * @brief Evict the first entry the clock hand finds that wasn't used since its last
+ * turn (there must be at least one entry)
+ *
+ * @param ni necessary information about the node
+ */
+void evict_cached(t_nodeinfo *ni)
+{
+    t_lease_cache *cache = &ni->cache;
+    while (1) {
+        unsigned int key = cache->hand;
+        cache->hand = (cache->hand + 1) % 32;
+        if (!(cache->valid & (1u << key)))
+            continue;
+        if (cache->referenced & (1u << key)) {
+            // Second chance
+            cache->referenced &= ~(1u << key);
+            continue;
+        }
+        uncache(key, ni);
+        cache->evictions++;
+        return;
+    }
+}
+
+int cache_object(unsigned int key, char *value, size_t length, unsigned long version, double lease, t_nodeinfo *ni)
+{
+    t_lease_cache *cache = &ni->cache;
+    if (key > 31 || cache->budget == 0 || lease <= 0 || length > cache->budget || version < cache->revoked[key] || is_owner(key, ni))
+        return 0;
+
+    uncache(key, ni);
+    while (cache->bytes + length > cache->budget)
+        evict_cached(ni);
+    if (assign_object(&cache->entries[key], value, length) != 0)
+        return -1;
+    cache->entries[key].version = version;
+    cache->expires[key] = seconds_from_now(lease);
+    cache->valid |= 1u << key;
+    cache->referenced |= 1u << key;
+    cache->bytes += cache->entries[key].length;
+    return 0;
+}
+
+void uncache(unsigned int key, t_nodeinfo *ni)
+{
+    t_lease_cache *cache = &ni->cache;
+    if (key > 31 || !(cache->valid & (1u << key)))
+        return;
+    cache->bytes -= cache->entries[key].length;
+    assign_object(&cache->entries[key], NULL, 0);
+    cache->valid &= ~(1u << key);
+    cache->referenced &= ~(1u << key);
+}
+
+void revoke_cached(unsigned int key, unsigned long version, t_nodeinfo *ni)
+{
+    if (key > 31)
+        return;
+    uncache(key, ni);
+    if (version > ni->cache.revoked[key])
+        ni->cache.revoked[key] = version;
+}
+
+int send_leased_object(unsigned int requester, unsigned int n, unsigned int key, t_nodeinfo *ni)
+{
+    t_object *object = get_object(key, ni);
+    char *value = object != NULL ? object->value : NULL;
+    size_t length = object != NULL ? object->length : 0;
+    if (ni->cache.budget == 0 || ni->strong_reads || (ni->leased_writes & (1u << key)))
+        return send_object_message(-1, "RGET", requester, n, key, value, length, requester, ni);
+
+    ni->lease_until[key] = seconds_from_now(LEASE_TIME + LEASE_MARGIN);
+    unsigned long version = ni->objects[key].version, lease = (unsigned long) (LEASE_TIME * 1000);
+    char message[64] = "";
+    if (value == NULL || fits_inline(value, length)) {
+        sprintf(message, "LRGET %u %u %u %lu %lu %.*s\n", requester, n, key, version, lease, (int) length, value != NULL ? value : "");
+        return send_to_closest(message, requester, ni) < 0 ? -1 : 0;
+    }
+
+    // Bodies never go through UDP
+    sprintf(message, "BLRGET %u %u %u %lu %lu %zu\n", requester, n, key, version, lease, length);
+    if (sendall(ni->succ_fd, message, strlen(message)) != 0 || sendall(ni->succ_fd, value, length) != 0) {
+        puts("\x1b[31m[!] Couldn't resend the message\033[m");
+        return -1;
+    }
+    return 0;
+}
+
+int is_write_held(unsigned int key, t_nodeinfo *ni)
+{
+    return key <= 31 && ((ni->leased_writes & (1u << key)) || seconds_until(ni->lease_until[key]) > 0);
+}
+
+int defer_write(unsigned int key, char *value, size_t length, t_nodeinfo *ni)
+{
+    if (!is_write_held(key, ni))
+        return 0;
+    int pending = (ni->leased_writes & (1u << key)) != 0;
+
+    // Only the latest write matters, but each one counts as a new version (so that a CAS
+    // can't apply twice against the same one)
+    unsigned long version = (pending ? ni->leased_values[key].version : ni->objects[key].version) + 1;
+    if (assign_object(&ni->leased_values[key], value, length) != 0)
+        return -1;
+    ni->leased_values[key].version = version;
+    ni->leased_writes |= 1u << key;
+    if (pending)
+        return 1;  // Its leases are being revoked already
+
+    if (ni->succ_fd != -1) {
+        char message[64] = "";
+        sprintf(message, "LREV %u %u %lu %u\n", ni->key, key, ni->objects[key].version + 1, LEASE_REVOCATION_HOPS);
+        if (sendall(ni->succ_fd, message, strlen(message)) != 0)
+            puts("\x1b[31m[!] Couldn't revoke the leases, the write waits for them to run out\033[m");
+    }
+    printf("\x1b[33m[*] Write to key %u held back until the leases on it are revoked\033[m\n", key);
+    return 1;
+}
+
+int apply_leased_write(unsigned int key, t_nodeinfo *ni)
+{
+    if (key > 31 || !(ni->leased_writes & (1u << key)))
+        return 0;
+    ni->leased_writes &= ~(1u << key);
+    ni->lease_until[key].tv_sec = 0;
+    ni->lease_until[key].tv_usec = 0;
+
+    t_object *write = &ni->leased_values[key];
+    // Storing it brings the object to the version the write was given
+    ni->objects[key].version = write->version - 1;
+    int result = store_object(key, write->value, write->length, ni);
+    assign_object(write, NULL, 0);
+
+    // The SETs that were held back can be acknowledged now (the ones whose write failed
+    // time out instead)
+    t_pending_ack *ack = ni->leased_acks[key];
+    ni->leased_acks[key] = NULL;
+    while (ack != NULL) {
+        t_pending_ack *next = ack->next;
+        if (result == 0)
+            acknowledge_set(ack->requester, ack->n, key, ni);
+        free(ack);
+        ack = next;
+    }
+    return result;
+}
+
+t_object *latest_object(unsigned int key, t_nodeinfo *ni)
+{
+    if (ni->leased_writes & (1u << key))
+        return &ni->leased_values[key];
+    t_object *object = get_object(key, ni);
+    return object != NULL ? object : &ni->objects[key];
+}
+
+void expire_leases(t_nodeinfo *ni)
+{
+    for (unsigned int key = 0; ni->leased_writes != 0 && key < 32; key++) {
+        if ((ni->leased_writes & (1u << key)) && seconds_until(ni->lease_until[key]) <= 0)
+            apply_leased_write(key, ni);
+    }
+}
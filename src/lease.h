@@ -0,0 +1,113 @@
+#ifndef LEASE_H
+#define LEASE_H
+
+#include "common.h"
+
+/**
+ * @brief Get a value this node relayed for another node, if its owner's lease on it
+ * hasn't run out
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b t_object* ] the cached object (its value is NULL if the object doesn't
+ * exist), or NULL if there is none or GETs can only be answered by the owner
+ */
+t_object *get_cached(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Keep a value this node relayed for another node, evicting the entries the clock
+ * hand finds unused until it fits within the cache's budget
+ *
+ * @param key the object's key
+ * @param value its value (NULL if it doesn't exist)
+ * @param length its size
+ * @param version the owner's version of the object
+ * @param lease for how many seconds the owner lets the value be used
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull (even if the value wasn't kept), -1 otherwise
+ */
+int cache_object(unsigned int key, char *value, size_t length, unsigned long version, double lease, t_nodeinfo *ni);
+
+/**
+ * @brief Forget the cached value of a key
+ *
+ * @param key the key
+ * @param ni necessary information about the node
+ */
+void uncache(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Forget the cached value of a key, and refuse the values older than a version
+ * that are still on their way
+ *
+ * @param key the key
+ * @param version the lowest version that may still be cached
+ * @param ni necessary information about the node
+ */
+void revoke_cached(unsigned int key, unsigned long version, t_nodeinfo *ni);
+
+/**
+ * @brief Answer a GET for an object this node owns, granting the requester and the nodes
+ * that relay the answer a lease on it (LRGET or BLRGET) if this node caches values itself
+ * and no write to the object is waiting (a regular RGET otherwise)
+ *
+ * @param requester the node that made the request
+ * @param n the request's sequence number
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_leased_object(unsigned int requester, unsigned int n, unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Check whether the writes to an object are being held back, because other nodes
+ * may have a leased copy of it
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if they are, 0 otherwise
+ */
+int is_write_held(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Hold a write back while other nodes may have a leased copy of the object, and
+ * start revoking the leases (LREV, which goes around the ring and back)
+ *
+ * @param key the object's key
+ * @param value its new value (NULL to delete it)
+ * @param length its size
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if the write was held back, 0 if it may be applied now, -1 in case
+ * of an error
+ */
+int defer_write(unsigned int key, char *value, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Apply the latest write held back for a key, and acknowledge the SETs that were
+ * waiting for it
+ *
+ * @param key the key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int apply_leased_write(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Get the latest value and version of an object this node owns, counting the
+ * write held back for it (if there is one) as done
+ *
+ * @param key the object's key (at most 31)
+ * @param ni necessary information about the node
+ * @return [ @b t_object* ] the object (its value is NULL if it doesn't exist)
+ */
+t_object *latest_object(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Apply the writes held back whose leases have run out even though their
+ * revocation hasn't come back (e.g. because the ring broke)
+ *
+ * @param ni necessary information about the node
+ */
+void expire_leases(t_nodeinfo *ni);
+
+#endif
@@ -13,6 +13,17 @@
 #include "client.h"
 #include "server.h"
 #include "event.h"
+#include "storage.h"
+#include "worker.h"
+#include "console.h"
+#include "control.h"
+#include "lease.h"
+#include "expiry.h"
+#include "erasure.h"
+#include <fcntl.h>
+
+// Maximum number of worker threads
+#define MAX_WORKERS 16
 
 char* get_event_string(t_event e)
 {
@@ -23,6 +34,9 @@ char* get_event_string(t_event e)
         "E_MESSAGE_TEMP", 
         "E_MESSAGE_USER", 
         "E_MESSAGE_UDP",
+        "E_MESSAGE_SHARED",
+        "E_MESSAGE_QUEUE",
+        "E_MESSAGE_CONTROL",
         "E_TIMEOUT", 
         "E_ERROR"
     };
@@ -30,71 +44,28 @@ char* get_event_string(t_event e)
 }
 
 void usage(char *name) {
-    printf("Usage: %s ID IPADDR PORT\n", name);
-}
-
-void check_for_lost_udp_messages(t_nodeinfo *ni)
-{
-    struct timeval now;
-    gettimeofday(&now, NULL);
-
-    t_ongoing_udp_message *aux = ni->udp_message_list, *prev = NULL;
-    while (aux != NULL) {
-        double time_taken = now.tv_sec - aux->timestamp.tv_sec + 1e-6 * (now.tv_usec - aux->timestamp.tv_usec);
-        if (time_taken > 0.025) {
-            // Timeout
-            if (aux->nretries) {
-                aux->nretries--;
-                // Resend
-                // We can ignore the result of udpsend() since aux->nretries will eventually reach 0 
-                printf("\x1b[33m[*] Retrying to send message after %.3fms (%lu attempt(s) remaining)\033[m\n", time_taken * 1000, aux->nretries);
-                struct addrinfo sender;
-                sender.ai_addr = &aux->recipient;
-                sender.ai_addrlen = aux->recipient_size;
-                gettimeofday(&aux->timestamp, NULL);
-                udpsend(ni->udp_fd, aux->body, aux->length, &sender);
-            }
-            else {
-                // Expire
-
-                if (aux->type == UDPMSG_CHORD) {
-                    // Send message through successor instead
-                    puts("\x1b[33m[!] Failed to send UDP message through chord, trying the successor\033[m");
-                    aux->body[aux->length] = '\n';
-                    int result = sendall(ni->succ_fd, aux->body, aux->length+1);
-                    if (result < 0) {
-                        close(ni->succ_fd);
-                        ni->succ_fd = -1;
-                    }
-                    else if (result > 0) {
-                        // An error occurred
-                        close(ni->succ_fd);
-                        ni->succ_fd = -1;
-                    }
-                }
-                else {
-                    // Nothing to do, drop the message
-                    puts("\x1b[33m[!] Failed to send UDP message to new node\033[m");
-                }
-
-                t_ongoing_udp_message *temp = aux->next;
-                if (prev != NULL)
-                    prev->next = aux->next;
-                else
-                    ni->udp_message_list = aux->next;
-
-                aux->next = NULL;
-                free_udp_message_list(aux);
-                aux = prev;
-                if (aux == NULL) {
-                    aux = temp;
-                    continue;
-                }
-            }
-        }
-        prev = aux;
-        aux = aux->next;
-    }
+    printf("Usage: %s [-C PATH] [-c PORT] [-D] [-d DIR] [-e K,M] [-L BYTES] [-M BYTES] [-R PORT] [-r K] [-S] [-v N] [-w N] [-z BYTES] ID IPADDR PORT\n", name);
+    puts("  -C PATH  accept the console's commands through a Unix-domain socket at PATH");
+    puts("  -c PORT  accept GET/SET/FIND requests from applications on the TCP port PORT");
+    puts("  -D       run as a daemon: no console and no output (requires -C)");
+    puts("  -d DIR   keep a log of the stored objects in DIR and recover them on start");
+    puts("  -e K,M   instead of whole replicas, send the successors K+M erasure-coded fragments");
+    puts("           of each large object, any K of which rebuild it once its owner fails (and");
+    puts("           survive M failures). The owner keeps its whole copy and serves every read");
+    puts("           from it, so an object takes 1+(K+M)/K times its size (1+M for -r M)");
+    puts("  -L BYTES cache up to BYTES of the values relayed for other nodes, for as long as");
+    puts("           their owners' leases last (and grant leases on the objects owned)");
+    puts("  -M BYTES keep up to BYTES of the values of the objects owned, evicting the ones");
+    puts("           not read or written lately (approximate LRU) to make room for new ones");
+    puts("           (split evenly among the virtual nodes)");
+    puts("  -R PORT  accept Redis clients (GET/SET/DEL/MGET/MSET over RESP) on the TCP port PORT");
+    puts("  -r K     keep a copy of each object in its owner's next K successors");
+    puts("  -S       only let owners answer GETs (strong reads)");
+    puts("  -v N     host N virtual nodes, spread evenly over the ring starting at ID and");
+    puts("           listening on ports PORT to PORT+N-1");
+    puts("  -w N     run the virtual nodes on N worker threads, which share the UDP port PORT");
+    puts("  -z BYTES keep the values of at least BYTES compressed (and send them compressed to");
+    puts("           the other nodes when handing them off or replicating them)");
 }
 
 int main(int argc, char *argv[])
@@ -106,6 +77,100 @@ int main(int argc, char *argv[])
     if (sigaction(SIGPIPE, &act, NULL) == -1)
         return -1;
 
+    char *storage_dir = NULL, *control_path = NULL, *client_port = NULL, *resp_port = NULL;
+    int daemon_mode = 0;
+    unsigned int replication = 0;
+    int strong_reads = 0;
+    size_t cache_budget = 0, memory_budget = 0, compress_threshold = 0;
+    unsigned int ec_k = 0, ec_m = 0;
+    unsigned int vnodes = 1, workers = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "C:c:Dd:e:L:M:R:r:Sv:w:z:")) != -1) {
+        switch (opt) {
+            case 'C':
+                control_path = optarg;
+                break;
+            case 'c':
+                if (!strisui(optarg) || strtoui(optarg) > 65535) {
+                    fprintf(stderr, "PORT must be a number (was '%s')\n", optarg);
+                    exit(1);
+                }
+                client_port = optarg;
+                break;
+            case 'D':
+                daemon_mode = 1;
+                break;
+            case 'd':
+                storage_dir = optarg;
+                break;
+            case 'e':
+                if (sscanf(optarg, "%u,%u", &ec_k, &ec_m) != 2 || ec_k < 1 || ec_m < 1 || ec_k + ec_m > EC_MAX_FRAGMENTS) {
+                    fprintf(stderr, "K,M must be two numbers of at least 1 adding up to at most %d (was '%s')\n", EC_MAX_FRAGMENTS, optarg);
+                    exit(1);
+                }
+                break;
+            case 'L':
+                if (!strisui(optarg)) {
+                    fprintf(stderr, "BYTES must be a number (was '%s')\n", optarg);
+                    exit(1);
+                }
+                cache_budget = strtoui(optarg);
+                break;
+            case 'M':
+                if (!strisui(optarg)) {
+                    fprintf(stderr, "BYTES must be a number (was '%s')\n", optarg);
+                    exit(1);
+                }
+                memory_budget = strtoui(optarg);
+                break;
+            case 'R':
+                if (!strisui(optarg) || strtoui(optarg) > 65535) {
+                    fprintf(stderr, "PORT must be a number (was '%s')\n", optarg);
+                    exit(1);
+                }
+                resp_port = optarg;
+                break;
+            case 'r':
+                if (!strisui(optarg) || strtoui(optarg) > 31) {
+                    fprintf(stderr, "K must be a number between 0 and 31 (was '%s')\n", optarg);
+                    exit(1);
+                }
+                replication = strtoui(optarg);
+                break;
+            case 'S':
+                strong_reads = 1;
+                break;
+            case 'v':
+                if (!strisui(optarg) || strtoui(optarg) < 1 || strtoui(optarg) > 32) {
+                    fprintf(stderr, "N must be a number between 1 and 32 (was '%s')\n", optarg);
+                    exit(1);
+                }
+                vnodes = strtoui(optarg);
+                break;
+            case 'w':
+                if (!strisui(optarg) || strtoui(optarg) < 1 || strtoui(optarg) > MAX_WORKERS) {
+                    fprintf(stderr, "N must be a number between 1 and %d (was '%s')\n", MAX_WORKERS, optarg);
+                    exit(1);
+                }
+                workers = strtoui(optarg);
+                break;
+            case 'z':
+                if (!strisui(optarg)) {
+                    fprintf(stderr, "BYTES must be a number (was '%s')\n", optarg);
+                    exit(1);
+                }
+                compress_threshold = strtoui(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    // Leave only the positional arguments (after the program's name)
+    argv[optind-1] = argv[0];
+    argc -= optind-1;
+    argv += optind-1;
+
     if (argc != 4) {
         usage(argv[0]);
         exit(1);
@@ -129,62 +194,165 @@ int main(int argc, char *argv[])
         exit(1);
     }    
 
-    // Initialize node
-    t_nodeinfo *ni = new_nodeinfo(strtoui(argv[1]), argv[2], argv[3]);
+    if (daemon_mode && control_path == NULL) {
+        fprintf(stderr, "A daemon must have a control socket (-C)\n");
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if (strtoui(argv[3]) + vnodes - 1 > 65535) {
+        fprintf(stderr, "PORT must leave room for %u virtual node(s) (was '%s')\n", vnodes, argv[3]);
+        exit(1);
+    }
+
+    // Initialize the virtual nodes (the first one is the one the user interacts with)
+    // Each one listens on a port of its own: the other nodes know a node only by its
+    // address (SELF/PRED/RSP carry it, and UDP acknowledgements are matched by sender),
+    // so virtual nodes sharing a port couldn't tell which of them a message was for
+    t_nodeinfo *ni = NULL, *last = NULL;
+    for (unsigned int i = 0; i < vnodes; i++) {
+        char port[6] = "";
+        snprintf(port, sizeof(port), "%u", strtoui(argv[3]) + i);
+        t_nodeinfo *vn = new_nodeinfo((strtoui(argv[1]) + i * 32 / vnodes) % 32, argv[2], port);
+        if (vn == NULL) {
+            printf("Error initializing server!\n");
+            exit(1);
+        }
+        if (last != NULL)
+            last->next_vnode = vn;
+        else
+            ni = vn;
+        vn->first_vnode = ni;
+        last = vn;
+
+        vn->replication = replication;
+        vn->strong_reads = strong_reads;
+        vn->cache.budget = cache_budget;
+        // The budget is the process's, so the virtual nodes (which own as many keys each)
+        // share it evenly
+        vn->memory_budget = memory_budget / vnodes + (i < memory_budget % vnodes);
+        if (memory_budget > 0 && vn->memory_budget == 0)
+            vn->memory_budget = 1;
+        vn->compress_threshold = compress_threshold;
+        vn->ec_k = ec_k;
+        vn->ec_m = ec_m;
+
+        if (storage_dir != NULL) {
+            // Recover objects from a previous run
+            vn->storage = new_storage(storage_dir, vn);
+            if (vn->storage == NULL) {
+                printf("Error initializing storage!\n");
+                exit(1);
+            }
+        }
+    }
+    if (vnodes > 1) {
+        printf("\x1b[32m[*] Hosting %u virtual nodes:", vnodes);
+        for (t_nodeinfo *vn = ni; vn != NULL; vn = vn->next_vnode)
+            printf(" %u (port %s)", vn->key, vn->self_port);
+        puts("\033[m");
+    }
+
+    if (workers > 0) {
+        // From now on, only the worker threads handle network events
+        if (new_workers(workers, ni) == NULL || start_workers(ni->workers) != 0) {
+            printf("Error starting worker threads!\n");
+            exit(1);
+        }
+        printf("\x1b[32m[*] Running on %u worker thread(s)\033[m\n", workers);
+    }
+
+    if (control_path != NULL && start_control(control_path, ni) == NULL) {
+        printf("Error starting the control socket!\n");
+        exit(1);
+    }
 
-    if (ni == NULL) {
-        printf("Error initializing server!\n");
+    if (client_port != NULL && start_client_port(client_port, ni) == NULL) {
+        printf("Error starting the client port!\n");
+        exit(1);
+    }
+
+    if (resp_port != NULL && start_resp_port(resp_port, ni) == NULL) {
+        printf("Error starting the RESP port!\n");
+        exit(1);
+    }
+
+    if (daemon_mode) {
+        // Nothing is printed from now on (commands answer through the control socket)
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd == -1 || dup2(null_fd, STDOUT_FILENO) == -1 || dup2(null_fd, STDIN_FILENO) == -1) {
+            printf("Error detaching from the terminal!\n");
+            exit(1);
+        }
+        close(null_fd);
+    }
+    else if (start_console(ni) == NULL) {
+        // The terminal is handled by its own thread from now on
+        printf("Error starting the console!\n");
         exit(1);
     }
 
     // Main loop
-    printf(">>> ");
-    fflush(stdout);
     while (1) {
         // This calls select() and may block
-        // Returns after an event happens
-        t_event e = select_event(ni);
-
-        // Clear user prompt
-        if (e != E_MESSAGE_USER && e != E_TIMEOUT)
-            printf("\x08\x08\x08\x08");
+        // Returns after an event happens in any of the virtual nodes (or only
+        // after user input, if they are run by the worker threads)
+        t_nodeinfo *source;
+        t_event e = select_event(ni, ni->workers != NULL ? NO_WORKER : EVERY_WORKER, 1, &source);
 
-        // First of all, check for lost UDP messages
-        check_for_lost_udp_messages(ni);
+        // Fail the RESP replies that are still waiting for lost answers
+        expire_resp_replies(ni);
 
         int result = 0;
-        // Act based on what event just occurred
-        switch (e) {
-            case E_INCOMING_CONNECTION:
-                // A client is trying to connect to us
-                result = process_incoming_connection(ni);
-                break;
+        if (ni->workers != NULL) {
+            if (workers_failed(ni->workers))
+                result = -1;
+        }
+        else {
+            for (t_nodeinfo *vn = ni; vn != NULL && result == 0; vn = vn->next_vnode) {
+                // Nothing else may be written into the links while a body is relayed
+                // through them (unless it stopped arriving)
+                expire_relays(vn);
+                if (is_relaying(vn))
+                    continue;
 
-            case E_MESSAGE_UDP:
-                result = process_message_udp(ni);
-                break;
+                // First of all, check for lost UDP messages
+                check_for_lost_udp_messages(vn);
 
-            case E_MESSAGE_TEMP:
-                // A new connection has sent a message
-                result = process_message_temp(ni);
-                break;
+                // Look for differences between the objects and the successor's replicas
+                run_anti_entropy(vn);
 
-            case E_MESSAGE_SUCCESSOR:
-                // This node's successor sent a message
-                result = process_message_successor(ni);
-                break;
+                // Apply the writes whose leases have run out
+                expire_leases(vn);
 
-            case E_MESSAGE_PREDECESSOR:
-                // This node's predecessor sent a message
-                result = process_message_predecessor(ni);
-                break;
+                // Give up on the SETs that weren't acknowledged
+                expire_set_requests(vn);
 
-            case E_MESSAGE_USER:
-                result = process_user_message(ni);
-                break;
+                // Delete the objects whose time to live has run out
+                expire_objects(vn);
 
-            default:
-                break;
+                // Give up on the objects whose fragments didn't all come back
+                expire_rebuilds(vn);
+
+                // Drop the values decompressed while handling the previous event
+                release_unpacked(vn);
+
+                // Commit the latest batch of logged objects
+                if (vn->storage != NULL && sync_storage(vn->storage, 0, vn) != 0)
+                    result = -1;
+            }
+        }
+
+        // Act based on what event just occurred (the worker threads can't touch
+        // the virtual nodes meanwhile)
+        if (result == 0 && e != E_TIMEOUT) {
+            pause_workers(ni->workers);
+            // A worker thread may have left a body half relayed through a virtual node
+            if (ni->workers != NULL)
+                result = finish_relays(ni);
+            if (result == 0)
+                result = process_event(e, source);
+            resume_workers(ni->workers);
         }
         if (result < 0) {
             puts("\x1b[31m[!] An error has occurred!\033[m");
@@ -192,14 +360,30 @@ int main(int argc, char *argv[])
         }
         if (result > 0)
             break;
-                    
-        if (e != E_TIMEOUT) {
-            printf(">>> ");
-            fflush(stdout);
+
+        // Let the remaining virtual nodes join the ring, one by one
+        for (t_nodeinfo *vn = ni->next_vnode; vn != NULL; vn = vn->next_vnode) {
+            if (vn->pending_join) {
+                pause_workers(ni->workers);
+                if (finish_relays(ni) == 0)
+                    join_pending_vnodes(ni);
+                resume_workers(ni->workers);
+                break;
+            }
         }
+
+        // Hand what was printed to the console thread
+        fflush(stdout);
     }
 
-    close_sockets(ni);
-    free_nodeinfo(ni);
+    stop_control(ni->control);
+    free_workers(ni->workers);
+    stop_console(ni->console);
+    while (ni != NULL) {
+        t_nodeinfo *next = ni->next_vnode;
+        close_sockets(ni);
+        free_nodeinfo(ni);
+        ni = next;
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include "memory.h"
+#include "server.h"
+#include "utils.h"
+#include <stdio.h>
+
+void touch_object(unsigned int key, t_nodeinfo *ni)
+{
+    if (key <= 31)
+        ni->object_referenced |= 1u << key;
+}
+
+/**
+ * @brief Check whether an object this node owns may be evicted: the ones being handed off,
+ * held back by leases or leased to other nodes can't be deleted right away
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if it may be evicted, 0 otherwise
+ */
+int is_evictable(unsigned int key, t_nodeinfo *ni)
+{
+    unsigned int bit = 1u << key;
+    return get_stored_object(key, ni) != NULL && is_owner(key, ni) && !(ni->handoff_keys & bit) && !(ni->leased_writes & bit)
+        && seconds_until(ni->lease_until[key]) <= 0;
+}
+
+void enforce_memory_budget(unsigned int key, t_nodeinfo *ni)
+{
+    if (key > 31 || ni->memory_budget == 0)
+        return;
+    // A new object starts as used
+    ni->object_referenced |= 1u << key;
+
+    // Two turns of the hand without an eviction mean that nothing else can go
+    unsigned int idle = 0;
+    while (ni->object_bytes > ni->memory_budget && idle < 64) {
+        unsigned int victim = ni->object_hand;
+        ni->object_hand = (ni->object_hand + 1) % 32;
+        idle++;
+        if (victim == key || !is_evictable(victim, ni))
+            continue;
+        if (ni->object_referenced & (1u << victim)) {
+            // Second chance
+            ni->object_referenced &= ~(1u << victim);
+            continue;
+        }
+        if (store_object(victim, NULL, 0, ni) != 0) {
+            printf("\x1b[31m[!] Couldn't evict the object of key %u\033[m\n", victim);
+            continue;
+        }
+        ni->object_evictions++;
+        idle = 0;
+    }
+}
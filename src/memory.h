@@ -0,0 +1,24 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "common.h"
+
+/**
+ * @brief Note that an object this node owns was read, so that the clock hand gives it a
+ * second chance
+ *
+ * @param key the object's key
+ * @param ni necessary information about the node
+ */
+void touch_object(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Evict the objects this node owns that the clock hand finds unused until they fit
+ * within the node's memory budget (nothing happens if it has none)
+ *
+ * @param key the key of the object just stored, which is never evicted
+ * @param ni necessary information about the node
+ */
+void enforce_memory_budget(unsigned int key, t_nodeinfo *ni);
+
+#endif
@@ -0,0 +1,63 @@
+#include "merkle.h"
+
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+/**
+ * @brief Feed bytes into a 64-bit FNV-1a hash
+ * 
+ * @param hash current hash
+ * @param data bytes to add
+ * @param size number of bytes
+ * @return [ @b uint64_t ] the new hash
+ */
+uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    return hash;
+}
+
+void update_merkle(t_merkle *mt, unsigned int key, char *value, size_t length)
+{
+    if (value == NULL)
+        set_merkle_leaf(mt, key, 0);
+    else {
+        uint64_t hash = fnv1a(FNV_OFFSET, &key, sizeof(key));
+        hash = fnv1a(hash, value, length);
+        // 0 is reserved for empty subtrees
+        set_merkle_leaf(mt, key, hash ? hash : 1);
+    }
+}
+
+void set_merkle_leaf(t_merkle *mt, unsigned int key, uint64_t leaf)
+{
+    unsigned int node = 32 + key;
+    mt->nodes[node] = leaf;
+    for (node /= 2; node >= 1; node /= 2) {
+        uint64_t left = mt->nodes[2*node], right = mt->nodes[2*node+1];
+        if (left == 0 && right == 0)
+            mt->nodes[node] = 0;
+        else {
+            uint64_t hash = fnv1a(FNV_OFFSET, &left, sizeof(left));
+            hash = fnv1a(hash, &right, sizeof(right));
+            mt->nodes[node] = hash ? hash : 1;
+        }
+    }
+}
+
+unsigned int merkle_key_count(unsigned int node)
+{
+    unsigned int count = 32;
+    for (; node > 1; node /= 2)
+        count /= 2;
+    return count;
+}
+
+unsigned int merkle_first_key(unsigned int node)
+{
+    unsigned int count = merkle_key_count(node);
+    // Nodes at a given depth start at index 32/count
+    return (node - 32 / count) * count;
+}
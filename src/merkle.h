@@ -0,0 +1,52 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Merkle tree over the 32 keys of the ring. Nodes are stored as a heap:
+ * the root is node 1, node i has children 2i and 2i+1, and the leaf of key k is
+ * node 32+k. A node's hash is 0 if there are no objects under it
+ * 
+ */
+typedef struct merkle {
+    uint64_t nodes[64];
+} t_merkle;
+
+/**
+ * @brief Update the leaf of a key (and every node above it) after its value changes
+ * 
+ * @param mt the t_merkle object
+ * @param key object's key
+ * @param value object's value (NULL if there is none)
+ * @param length size of the value in bytes
+ */
+void update_merkle(t_merkle *mt, unsigned int key, char *value, size_t length);
+
+/**
+ * @brief Set the leaf of a key to a hash computed elsewhere (and update every node above it)
+ * 
+ * @param mt the t_merkle object
+ * @param key object's key
+ * @param leaf the leaf's new hash (0 if there is no object)
+ */
+void set_merkle_leaf(t_merkle *mt, unsigned int key, uint64_t leaf);
+
+/**
+ * @brief Get the first key covered by a node of the tree
+ * 
+ * @param node the node's index
+ * @return [ @b unsigned @b int ] the key
+ */
+unsigned int merkle_first_key(unsigned int node);
+
+/**
+ * @brief Get the number of keys covered by a node of the tree
+ * 
+ * @param node the node's index
+ * @return [ @b unsigned @b int ] the number of keys
+ */
+unsigned int merkle_key_count(unsigned int node);
+
+#endif
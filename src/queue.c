@@ -0,0 +1,67 @@
+#include "queue.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct spsc_queue {
+    size_t capacity, item_size;
+    // Index of the next item to be read (only written by the consumer)
+    size_t head;
+    // Keep head and tail in different cache lines
+    char padding[64];
+    // Index of the next item to be written (only written by the producer)
+    size_t tail;
+    char padding_tail[64];
+    // The items themselves follow the structure
+};
+
+/**
+ * @brief Get one of the slots of a queue
+ *
+ * @param q the queue
+ * @param index the slot's index (it wraps around the capacity)
+ * @return [ @b char* ] the slot
+ */
+char *queue_slot(t_spsc_queue *q, size_t index)
+{
+    return (char*) (q+1) + (index % q->capacity) * q->item_size;
+}
+
+t_spsc_queue *new_queue(size_t capacity, size_t item_size)
+{
+    t_spsc_queue *q = (t_spsc_queue*) calloc(1, sizeof(t_spsc_queue) + capacity * item_size);
+    if (q == NULL)
+        return NULL;
+    q->capacity = capacity;
+    q->item_size = item_size;
+    return q;
+}
+
+int queue_push(t_spsc_queue *q, void *item)
+{
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == q->capacity)
+        return -1;
+    memcpy(queue_slot(q, tail), item, q->item_size);
+    __atomic_store_n(&q->tail, tail+1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int queue_pop(t_spsc_queue *q, void *item)
+{
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+        return 0;
+    memcpy(item, queue_slot(q, head), q->item_size);
+    __atomic_store_n(&q->head, head+1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int queue_drained(t_spsc_queue *q)
+{
+    return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+}
+
+void free_queue(t_spsc_queue *q)
+{
+    free(q);
+}
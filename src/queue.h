@@ -0,0 +1,52 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stddef.h>
+
+// Lock-free queue of fixed-size items with a single producer and a single consumer
+typedef struct spsc_queue t_spsc_queue;
+
+/**
+ * @brief Create an empty queue
+ *
+ * @param capacity how many items it can hold
+ * @param item_size size of each item in bytes
+ * @return [ @b t_spsc_queue* ] the queue, or NULL in case of an error
+ */
+t_spsc_queue *new_queue(size_t capacity, size_t item_size);
+
+/**
+ * @brief Add an item to a queue (only called by the queue's producer)
+ *
+ * @param q the queue
+ * @param item the item (copied into the queue)
+ * @return [ @b int ] 0 if successfull, -1 if the queue is full
+ */
+int queue_push(t_spsc_queue *q, void *item);
+
+/**
+ * @brief Remove the oldest item from a queue (only called by the queue's consumer)
+ *
+ * @param q the queue
+ * @param item where to store the item
+ * @return [ @b int ] 1 if an item was removed, 0 if the queue is empty
+ */
+int queue_pop(t_spsc_queue *q, void *item);
+
+/**
+ * @brief Checks whether the consumer has removed every item pushed so far (only called
+ * by the queue's producer)
+ *
+ * @param q the queue
+ * @return [ @b int ] 1 if true, 0 if false
+ */
+int queue_drained(t_spsc_queue *q);
+
+/**
+ * @brief Free a queue (the items left in it aren't looked at)
+ *
+ * @param q the queue (nothing happens if it is NULL)
+ */
+void free_queue(t_spsc_queue *q);
+
+#endif
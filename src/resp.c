@@ -0,0 +1,348 @@
+#define _POSIX_C_SOURCE 200809L
+#include "resp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+typedef struct resp_reply {
+    unsigned long seq;
+    t_resp_type type;
+    // How many answers the reply needs, and how many have arrived
+    int parts, filled;
+    // The answers (a NULL value doesn't exist)
+    char **values;
+    size_t *lengths;
+    // The ring key of each part (NULL if the answers don't come by key)
+    unsigned int *keys;
+    // The first error (or the whole reply for RESP_RAW)
+    char *text;
+    // When the command was received
+    struct timeval timestamp;
+    struct resp_reply *next;
+} t_resp_reply;
+
+struct resp_queue {
+    // Oldest and newest replies
+    t_resp_reply *head, *tail;
+    unsigned long next_seq;
+};
+
+/**
+ * @brief Find the end of the line that starts at a given position
+ *
+ * @param buffer the line
+ * @param size how many bytes there are
+ * @return [ @b char* ] the '\n', or NULL if the line isn't complete
+ */
+char *resp_line_end(char *buffer, size_t size)
+{
+    return (char*) memchr(buffer, '\n', size);
+}
+
+long resp_parse(char *buffer, size_t size, char **argv, size_t *argl, int *argc)
+{
+    char *end = resp_line_end(buffer, size);
+    if (end == NULL)
+        return size > 65536 ? -1 : 0;
+
+    if (buffer[0] != '*') {
+        // Inline command
+        *argc = 0;
+        char *p = buffer;
+        while (p < end) {
+            while (p < end && (*p == ' ' || *p == '\r'))
+                p++;
+            if (p == end)
+                break;
+            if (*argc == RESP_MAX_ARGS)
+                return -1;
+            argv[*argc] = p;
+            while (p < end && *p != ' ' && *p != '\r')
+                p++;
+            argl[*argc] = p - argv[*argc];
+            (*argc)++;
+        }
+        return end - buffer + 1;
+    }
+
+    // Array of bulk strings
+    long count = strtol(buffer+1, NULL, 10);
+    if (count < 0 || count > RESP_MAX_ARGS)
+        return -1;
+    char *p = end+1;
+    for (long i = 0; i < count; i++) {
+        size_t left = size - (p - buffer);
+        end = resp_line_end(p, left);
+        if (end == NULL)
+            return 0;
+        if (p[0] != '$')
+            return -1;
+        long length = strtol(p+1, NULL, 10);
+        if (length < 0 || length > (1 << 20))
+            return -1;
+        p = end+1;
+        left = size - (p - buffer);
+        if ((size_t) length + 2 > left)
+            return 0;
+        argv[i] = p;
+        argl[i] = length;
+        p += length + 2;
+    }
+    *argc = count;
+    return p - buffer;
+}
+
+unsigned int resp_key(char *name, size_t length)
+{
+    unsigned int key = 0;
+    size_t i;
+    for (i = 0; i < length && i < 2 && name[i] >= '0' && name[i] <= '9'; i++)
+        key = key * 10 + (name[i] - '0');
+    if (length > 0 && i == length && key < 32)
+        return key;
+
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash % 32;
+}
+
+t_resp_queue *new_resp_queue(void)
+{
+    t_resp_queue *q = (t_resp_queue*) calloc(1, sizeof(t_resp_queue));
+    if (q != NULL)
+        q->next_seq = 1;
+    return q;
+}
+
+/**
+ * @brief Free a reply
+ *
+ * @param r the reply
+ */
+void free_resp_reply(t_resp_reply *r)
+{
+    for (int i = 0; r->values != NULL && i < r->parts; i++)
+        free(r->values[i]);
+    free(r->values);
+    free(r->lengths);
+    free(r->keys);
+    free(r->text);
+    free(r);
+}
+
+unsigned long resp_expect(t_resp_queue *q, t_resp_type type, int parts, unsigned int *keys, char *text)
+{
+    t_resp_reply *r = (t_resp_reply*) calloc(1, sizeof(t_resp_reply));
+    if (r == NULL)
+        return 0;
+    r->type = type;
+    r->parts = parts;
+    if (text != NULL && (r->text = strdup(text)) == NULL) {
+        free(r);
+        return 0;
+    }
+    if (parts > 0 && (type == RESP_BULK || type == RESP_ARRAY || type == RESP_NUMBER || type == RESP_INTEGER)) {
+        r->values = (char**) calloc(parts, sizeof(char*));
+        r->lengths = (size_t*) calloc(parts, sizeof(size_t));
+        if (r->values == NULL || r->lengths == NULL) {
+            free_resp_reply(r);
+            return 0;
+        }
+    }
+    if (keys != NULL) {
+        r->keys = (unsigned int*) malloc(parts * sizeof(unsigned int));
+        if (r->keys == NULL) {
+            free_resp_reply(r);
+            return 0;
+        }
+        memcpy(r->keys, keys, parts * sizeof(unsigned int));
+    }
+    gettimeofday(&r->timestamp, NULL);
+    r->seq = q->next_seq++;
+    if (q->tail != NULL)
+        q->tail->next = r;
+    else
+        q->head = r;
+    q->tail = r;
+    return r->seq;
+}
+
+/**
+ * @brief Store the answer of one part of a reply
+ *
+ * @param r the reply
+ * @param part which part it is
+ * @param value the value (NULL if it doesn't exist)
+ * @param length its size
+ * @param error why the request failed (NULL if it didn't)
+ */
+void resp_fill_part(t_resp_reply *r, int part, char *value, size_t length, char *error)
+{
+    if (error != NULL && r->text == NULL)
+        r->text = strdup(error);
+    if (error == NULL && value != NULL && r->values != NULL && r->values[part] == NULL) {
+        // Values are stored with their length, since they may hold any byte
+        r->values[part] = (char*) malloc(length ? length : 1);
+        if (r->values[part] != NULL) {
+            memcpy(r->values[part], value, length);
+            r->lengths[part] = length;
+        }
+    }
+    r->filled++;
+}
+
+void resp_fill(t_resp_queue *q, unsigned long seq, int part, int key, char *value, size_t length, char *error)
+{
+    t_resp_reply *r = q->head;
+    while (r != NULL && r->seq != seq)
+        r = r->next;
+    if (r == NULL)
+        return;
+
+    if (part != RESP_KEYED) {
+        if (part >= 0 && part < r->parts)
+            resp_fill_part(r, part, value, length, error);
+        return;
+    }
+    for (int i = 0; i < r->parts; i++) {
+        if (key == -1 || (r->keys != NULL && r->keys[i] == (unsigned int) key))
+            resp_fill_part(r, i, value, length, error);
+    }
+}
+
+int resp_expire(t_resp_queue *q)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int expired = 0;
+    for (t_resp_reply *r = q->head; r != NULL; r = r->next) {
+        double time_taken = now.tv_sec - r->timestamp.tv_sec + 1e-6 * (now.tv_usec - r->timestamp.tv_usec);
+        if (r->filled >= r->parts || time_taken < RESP_TIMEOUT)
+            continue;
+        // The answers that arrive later are ignored
+        if (r->text == NULL)
+            r->text = strdup("timeout");
+        r->filled = r->parts;
+        expired++;
+    }
+    return expired;
+}
+
+/**
+ * @brief Append some bytes to a growing buffer
+ *
+ * @param out the buffer (updated)
+ * @param size how much of it is filled (updated)
+ * @param capacity its capacity (updated)
+ * @param data the bytes
+ * @param length how many there are
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int resp_append(char **out, size_t *size, size_t *capacity, char *data, size_t length)
+{
+    if (*size + length > *capacity) {
+        size_t new_capacity = (*size + length) * 2;
+        char *bigger = (char*) realloc(*out, new_capacity);
+        if (bigger == NULL)
+            return -1;
+        *out = bigger;
+        *capacity = new_capacity;
+    }
+    memcpy(*out + *size, data, length);
+    *size += length;
+    return 0;
+}
+
+/**
+ * @brief Append a bulk string (or a null bulk string) to a growing buffer
+ *
+ * @param out the buffer (updated)
+ * @param size how much of it is filled (updated)
+ * @param capacity its capacity (updated)
+ * @param value the string (NULL for a null bulk string)
+ * @param length its length
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int resp_append_bulk(char **out, size_t *size, size_t *capacity, char *value, size_t length)
+{
+    char header[32];
+    if (value == NULL)
+        return resp_append(out, size, capacity, "$-1\r\n", 5);
+    int header_length = sprintf(header, "$%zu\r\n", length);
+    if (resp_append(out, size, capacity, header, header_length) != 0
+            || resp_append(out, size, capacity, value, length) != 0)
+        return -1;
+    return resp_append(out, size, capacity, "\r\n", 2);
+}
+
+char *resp_take(t_resp_queue *q, size_t *size)
+{
+    char *out = NULL;
+    size_t capacity = 0;
+    *size = 0;
+    while (q->head != NULL && q->head->filled >= q->head->parts) {
+        t_resp_reply *r = q->head;
+        char line[64];
+        int result = 0;
+        if (r->type == RESP_RAW)
+            result = resp_append(&out, size, &capacity, r->text, strlen(r->text));
+        else if (r->text != NULL) {
+            result = resp_append(&out, size, &capacity, "-ERR ", 5);
+            if (result == 0)
+                result = resp_append(&out, size, &capacity, r->text, strlen(r->text));
+            if (result == 0)
+                result = resp_append(&out, size, &capacity, "\r\n", 2);
+        }
+        else if (r->type == RESP_BULK)
+            result = resp_append_bulk(&out, size, &capacity, r->values[0], r->lengths[0]);
+        else if (r->type == RESP_ARRAY) {
+            result = resp_append(&out, size, &capacity, line, sprintf(line, "*%d\r\n", r->parts));
+            for (int i = 0; i < r->parts && result == 0; i++)
+                result = resp_append_bulk(&out, size, &capacity, r->values[i], r->lengths[i]);
+        }
+        else if (r->type == RESP_NUMBER) {
+            result = resp_append(&out, size, &capacity, ":", 1);
+            if (result == 0)
+                result = resp_append(&out, size, &capacity, r->values[0] != NULL ? r->values[0] : "0", r->values[0] != NULL ? r->lengths[0] : 1);
+            if (result == 0)
+                result = resp_append(&out, size, &capacity, "\r\n", 2);
+        }
+        else if (r->type == RESP_INTEGER) {
+            int count = 0;
+            for (int i = 0; i < r->parts; i++)
+                count += r->values[i] != NULL && r->lengths[i] == 1 && r->values[i][0] == '1';
+            result = resp_append(&out, size, &capacity, line, sprintf(line, ":%d\r\n", count));
+        }
+        else
+            result = resp_append(&out, size, &capacity, "+OK\r\n", 5);
+        if (result != 0)
+            break;
+
+        q->head = r->next;
+        if (q->head == NULL)
+            q->tail = NULL;
+        free_resp_reply(r);
+    }
+    if (*size == 0) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+void free_resp_queue(t_resp_queue *q)
+{
+    if (q == NULL)
+        return;
+    while (q->head != NULL) {
+        t_resp_reply *next = q->head->next;
+        free_resp_reply(q->head);
+        q->head = next;
+    }
+    free(q);
+}
@@ -0,0 +1,117 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <stddef.h>
+
+// Most arguments a RESP command can have (MSET with 64 keys)
+#define RESP_MAX_ARGS 129
+// Part number of an answer that goes to every part with the same key (see resp_fill())
+#define RESP_KEYED 0xffff
+// How many seconds a reply waits for its answers before it fails with a timeout (longer
+// than SET_TIMEOUT, so that SETs report their own failures)
+#define RESP_TIMEOUT 5.0
+
+typedef enum resp_type {
+    // A single value (GET)
+    RESP_BULK,
+    // One value per part (MGET)
+    RESP_ARRAY,
+    // +OK once every part has finished (SET, MSET)
+    RESP_STATUS,
+    // How many parts were answered with 1 (DEL)
+    RESP_INTEGER,
+    // An integer that comes in the answer (INCR, APPEND)
+    RESP_NUMBER,
+    // A reply that was ready from the start
+    RESP_RAW
+} t_resp_type;
+
+/**
+ * @brief An object that holds the replies a RESP client is waiting for, which
+ * must be sent in the order of the commands even if they finish out of order
+ *
+ */
+typedef struct resp_queue t_resp_queue;
+
+/**
+ * @brief Parse the next command in a buffer, either a RESP array of bulk strings
+ * or an inline command (words separated by spaces)
+ *
+ * @param buffer the buffer
+ * @param size how much of it is filled
+ * @param argv where to store the arguments (they point into the buffer)
+ * @param argl where to store their lengths
+ * @param argc where to store how many there are (at most RESP_MAX_ARGS)
+ * @return [ @b long ] how many bytes the command takes, 0 if it isn't complete yet
+ * and -1 if it is malformed
+ */
+long resp_parse(char *buffer, size_t size, char **argv, size_t *argl, int *argc);
+
+/**
+ * @brief Map a RESP key to one of the ring's keys: numbers from 0 to 31 are used as
+ * they are, anything else is hashed (so different names can share a key)
+ *
+ * @param name the key
+ * @param length its length
+ * @return [ @b unsigned int ] the ring key
+ */
+unsigned int resp_key(char *name, size_t length);
+
+/**
+ * @brief Create an empty reply queue
+ *
+ * @return [ @b t_resp_queue* ] the t_resp_queue object, or NULL in case of an error
+ */
+t_resp_queue *new_resp_queue(void);
+
+/**
+ * @brief Reserve the next reply
+ *
+ * @param q the reply queue
+ * @param type what the reply is made of
+ * @param parts how many answers it needs
+ * @param keys the ring key of each part, for answers that come by key (NULL otherwise)
+ * @param text the whole reply for RESP_RAW (NULL otherwise)
+ * @return [ @b unsigned long ] its sequence number, or 0 in case of an error
+ */
+unsigned long resp_expect(t_resp_queue *q, t_resp_type type, int parts, unsigned int *keys, char *text);
+
+/**
+ * @brief Store one of the answers a reply needs
+ *
+ * @param q the reply queue
+ * @param seq the reply's sequence number
+ * @param part which answer it is, or RESP_KEYED for every part with the key @b key
+ * @param key the ring key of the answer (-1 answers every part at once)
+ * @param value the value (NULL if it doesn't exist)
+ * @param length its size
+ * @param error why the request failed (NULL if it didn't)
+ */
+void resp_fill(t_resp_queue *q, unsigned long seq, int part, int key, char *value, size_t length, char *error);
+
+/**
+ * @brief Fail the replies whose answers haven't all arrived within RESP_TIMEOUT seconds
+ * (e.g. because a message was lost), so the ones behind them aren't held up forever
+ *
+ * @param q the reply queue
+ * @return [ @b int ] how many replies failed
+ */
+int resp_expire(t_resp_queue *q);
+
+/**
+ * @brief Encode every finished reply that is next in line and remove it from the queue
+ *
+ * @param q the reply queue
+ * @param size where to store the size of the encoded replies
+ * @return [ @b char* ] the encoded replies (to be freed), or NULL if there are none
+ */
+char *resp_take(t_resp_queue *q, size_t *size);
+
+/**
+ * @brief Free a reply queue
+ *
+ * @param q the reply queue
+ */
+void free_resp_queue(t_resp_queue *q);
+
+#endif
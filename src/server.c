@@ -1,7 +1,20 @@
 #define _POSIX_C_SOURCE 200112L
+// SO_REUSEPORT
+#define _DEFAULT_SOURCE
 #include "server.h"
 #include "client.h"
 #include "utils.h"
+#include "event.h"
+#include "worker.h"
+#include "control.h"
+#include "watch.h"
+#include "hot.h"
+#include "lease.h"
+#include "atomic.h"
+#include "expiry.h"
+#include "memory.h"
+#include "compress.h"
+#include "erasure.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/time.h>
@@ -10,8 +23,58 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <string.h>
+#include <errno.h>
 #include <limits.h>
 #include <time.h>
+#include <inttypes.h>
+
+// How many bytes of objects are sent at a time when handing them off
+#define HANDOFF_BATCH_SIZE (64 * 1024)
+// How long (in seconds) to wait for a handoff to be acknowledged when leaving
+#define HANDOFF_TIMEOUT 2.0
+// How often (in seconds) the objects are compared with the successor's replicas
+#define ANTI_ENTROPY_INTERVAL 2.0
+// How long (in seconds) a body relayed through this node may stop arriving before the
+// links it comes and goes through are dropped
+#define RELAY_TIMEOUT 5.0
+
+int open_udp_socket(char *port, int reuse_port)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    // Get address info
+    if (getaddrinfo(NULL, port, &hints, &res) != 0) {
+        return -1;
+    }
+
+    int udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp_fd == -1) {
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    // Let several sockets receive through the same port (the kernel spreads the messages among them)
+    int enable = 1;
+    if (reuse_port && setsockopt(udp_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1) {
+        close(udp_fd);
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    // Bind this address
+    if (bind(udp_fd, res->ai_addr, res->ai_addrlen) == -1) {
+        close(udp_fd);
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    freeaddrinfo(res);
+    return udp_fd;
+}
 
 int init_server(t_nodeinfo *ni)
 {
@@ -22,6 +85,11 @@ int init_server(t_nodeinfo *ni)
     }
     ni->main_fd = main_fd;
 
+    // Allow re-joining right after leaving (the old connections may still be in TIME_WAIT)
+    int enable = 1;
+    if (setsockopt(main_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1)
+        return -1;
+
     struct addrinfo hints, *res;
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;
@@ -46,40 +114,37 @@ int init_server(t_nodeinfo *ni)
     }
 
     freeaddrinfo(res);
-    hints.ai_socktype = SOCK_STREAM;
-
-    // Get address info
-    if (getaddrinfo(NULL, ni->self_port, &hints, &res) != 0) {
-        return -1;
-    }
 
-    // Create UDP socket
-    int udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    // Create UDP socket (the first virtual node's port is shared with the worker threads)
+    int udp_fd = open_udp_socket(ni->self_port, ni->workers != NULL && ni == ni->first_vnode);
     if (udp_fd == -1) {
         close(main_fd);
-        freeaddrinfo(res);
-        return -1;
-    }
-
-    // Bind this address
-    if (bind(udp_fd, res->ai_addr, res->ai_addrlen) == -1) {
-        close(main_fd);
-        freeaddrinfo(res);
         return -1;
     }
 
     ni->udp_fd = udp_fd;
-
-    freeaddrinfo(res);
+    publish_routing(ni);
 
     return 0;
 }
 
-int send_to_closest(char *message, unsigned int key, t_nodeinfo *ni)
+/**
+ * @brief Checks whether the shortcut is closer to a key than the successor
+ * 
+ * @param key the key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if true, 0 if false
+ */
+int closer_to_shortcut(unsigned int key, t_nodeinfo *ni)
 {
     unsigned int distance_succ = ring_distance(ni->succ_id, key);
     unsigned int distance_shcut = ni->shcut_info != NULL ? ring_distance(ni->shcut_id, key) : UINT_MAX;
-    if (distance_shcut < distance_succ && !find_udp_message_from(ni, ni->shcut_info->ai_addr)) {
+    return distance_shcut < distance_succ;
+}
+
+int send_to_closest(char *message, unsigned int key, t_nodeinfo *ni)
+{
+    if (closer_to_shortcut(key, ni) && !find_udp_message_from(ni, ni->shcut_info->ai_addr)) {
         // Search key is closer to shortcut than to successor
         puts("Trying to send message through shortcut");
         int result = udpsend(ni->udp_fd, message, strlen(message)-1, ni->shcut_info);
@@ -103,302 +168,2326 @@ int send_to_closest(char *message, unsigned int key, t_nodeinfo *ni)
     return 0;
 }
 
-int process_found_key(unsigned int search_key, unsigned int n, char *ipaddr, unsigned int port, t_nodeinfo* ni)
+int send_object_message(int fd, char *type, unsigned int a, unsigned int b, unsigned int c, char *value, size_t length, unsigned int dest, t_nodeinfo *ni)
 {
-    int request_key = get_associated_key(n, ni);
-    if (request_key == -1) {
-        puts("\x1b[33m[!] Received \"RSP\" message without requesting it\033[m");
+    char message[64] = "";
+    if (value == NULL || fits_inline(value, length)) {
+        // Regular message
+        sprintf(message, "%s %u %u %u %.*s\n", type, a, b, c, (int) length, value != NULL ? value : "");
+        if (fd < 0)
+            return send_to_closest(message, dest, ni);
+        return sendall(fd, message, strlen(message)) != 0 ? -1 : 0;
     }
-    else {
-        struct sockaddr sa;
-        socklen_t sa_len;
-        if (get_associated_addrinfo(n, &sa, &sa_len, ni) == 0) {
-            // Find request was initiated by an EFND message
-            char message[64] = "";
-            sprintf(message, "EPRED %u %s %u", search_key, ipaddr, port);
-
-            struct addrinfo ai;
-            ai.ai_addr = &sa;
-            ai.ai_addrlen = sa_len;
-            if (udpsend(ni->udp_fd, message, strlen(message), &ai) != 0) {
-                puts("\x1b[31m[!] Error sending EPRED message\033[m");
-            }
-            else {
-                if (register_udp_message(ni, message, strlen(message), &sa, sa_len, UDPMSG_ENTERING) == -1)
-                    return -1; 
-            }
-        }
-        else  // Find request was initiated by the user
-            printf("Key %u belongs to node %u (%s:%u)\n", request_key, search_key, ipaddr, port);
 
-        drop_request(n, ni);
+    // Length-prefixed message, bodies never go through UDP
+    if (fd < 0)
+        fd = ni->succ_fd;
+    sprintf(message, "B%s %u %u %u %zu\n", type, a, b, c, length);
+    if (sendall(fd, message, strlen(message)) != 0 || sendall(fd, value, length) != 0) {
+        puts("\x1b[31m[!] Couldn't resend the message\033[m");
+        return -1;
     }
-
     return 0;
 }
 
-int process_incoming_connection(t_nodeinfo *ni)
+int send_replica(unsigned int owner, unsigned int hops, unsigned int key, char *value, size_t length, size_t size, unsigned long ttl, t_nodeinfo *ni)
 {
-    struct sockaddr addr;
-    socklen_t addrlen = sizeof(addr);
-    char ipaddr[INET_ADDRSTRLEN] = "";
+    if (hops == 0 || ni->succ_fd == -1 || ni->succ_id == owner)
+        return 0;  // The chain ends here
 
-    // Accept the connection
-    int newfd = accept(ni->main_fd, &addr, &addrlen);
-    if (newfd == -1)
+    char message[64] = "";
+    sprintf(message, "REPL %u %u %u %zu %lu %zu\n", owner, hops, key, value != NULL ? length : 0, ttl, value != NULL ? size : 0);
+    if (sendall(ni->succ_fd, message, strlen(message)) != 0 || (value != NULL && sendall(ni->succ_fd, value, length) != 0)) {
+        puts("\x1b[31m[!] Couldn't send replica to successor\033[m");
         return -1;
-
-    ipaddr_from_sockaddr(&addr, ipaddr);    
-
-    if (ni->temp_fd >= 0) {
-        // We already have a connection being established, reject this one
-        printf("\x1b[33m[!] Rejected connection from %s\033[m\n", ipaddr);
-        close(newfd);
-        return 0;
     }
+    return 0;
+}
 
-    printf("\x1b[32m[*] Accepted connection from %s\033[m\n", ipaddr);
+int replicate_object(unsigned int key, t_nodeinfo *ni)
+{
+    // The successors get the value as it is stored, compressed or not
+    t_object *stored = get_stored_object(key, ni);
+    if (stored != NULL && should_fragment(stored->length, ni))
+        return send_fragments(key, ni);
+    drop_fragments(key, ni);
+    return send_replica(ni->key, whole_replicas(ni), key, stored != NULL ? stored->value : NULL, stored != NULL ? stored->length : 0,
+        stored != NULL ? stored->size : 0, ttl_ms(key, ni), ni);
+}
 
-    // Save connection information in ni->temp and the socket fd in ni->temp_fd
-    ni->temp_fd = newfd;
-    if (ni->temp == NULL) {
-        ni->temp = new_conn_info(2048);
-        if (ni->temp == NULL)
+int store_object(unsigned int key, char *value, size_t length, t_nodeinfo *ni)
+{
+    return store_received_object(key, value, length, 0, ni);
+}
+
+int store_received_object(unsigned int key, char *value, size_t length, size_t size, t_nodeinfo *ni)
+{
+    if (value != NULL && size != 0 && is_write_held(key, ni)) {
+        // The writes held back are kept as plain values
+        char *plain = size <= MAX_VALUE_SIZE && length <= size ? (char*) malloc(size) : NULL;
+        if (plain == NULL || lz_decompress(value, length, plain, size) != 0) {
+            free(plain);
             return -1;
+        }
+        int result = store_object(key, plain, size, ni);
+        free(plain);
+        return result;
     }
-    else {
-        if (set_conn_info(ni->temp, 2048) != 0)
-            return -1;
+    // Other nodes may still be answering GETs with the current value
+    int deferred = defer_write(key, value, length, ni);
+    if (deferred != 0)
+        return deferred < 0 ? -1 : 0;
+
+    int changed = value != NULL || get_stored_object(key, ni) != NULL;
+    int result = set_stored_object(key, value, length, size, ni);
+    if (result != 0)
+        return result;
+    // An older copy (or fragment) from a previous owner is now useless
+    set_replica(key, NULL, 0, 0, ni);
+    drop_fragment(key, ni);
+
+    // A failure to replicate doesn't make the write itself fail
+    replicate_object(key, ni);
+
+    if (changed) {
+        ni->objects[key].version++;
+        notify_watchers(key, ni);
+        invalidate_hot_copies(key, ni->objects[key].version, ni);
     }
+    // Make room for the new value by evicting the objects not used lately
+    if (value != NULL)
+        enforce_memory_budget(key, ni);
     return 0;
 }
 
 /**
- * @brief Reset buffer size, close and set fd to -1
+ * @brief Take a message body out of a connection (into memory, or just dropping it), once
+ * process_incoming has buffered all of it. Bodies that only pass through this node are
+ * never buffered: route_body relays them as they arrive
  * 
- * @param buffer_size 
- * @param fd 
+ * @param ci necessary information about the connection the body arrived through
+ * @param length size of the body in bytes
+ * @param dest where to store the body (NULL to not store it), must be able to hold @b length bytes
+ * @return [ @b int ] 0 if successfull, -1 otherwise
  */
-void reset_pmt(size_t *buffer_size, int *fd)
+int take_body(t_conn_info *ci, size_t length, char *dest)
 {
-    if (*fd >= 0)
-        close(*fd);
-    *fd = -1;
-    *buffer_size = 0;
+    char *body = buffered_body(ci, length);
+    if (body == NULL)
+        return -1;
+    if (dest != NULL)
+        memcpy(dest, body, length);
+    consume_body(ci, length);
+    return 0;
 }
 
 /**
- * @brief Process an incoming message and update internal buffers
+ * @brief Read a whole message body into memory
  * 
- * @param sfd socket file descriptor
- * @param buffer buffer to store the received message in
- * @param buffer_size current size of buffer
- * @param max_buffer_size maximum possible buffer size
- * @param ci necessary information about the connection
- * @return [ @b t_read_out ] structure describing the result 
+ * @param ci necessary information about the connection the body arrived through
+ * @param length size of the body in bytes
+ * @return [ @b char* ] the body (NUL terminated), or NULL in case of an error 
  */
-t_read_out process_incoming(int *sfd, char *buffer, size_t *buffer_size, size_t max_buffer_size, t_conn_info *ci)
+char *read_body(t_conn_info *ci, size_t length)
+{
+    if (length > MAX_BODY_SIZE)
+        return NULL;
+    char *body = (char*) malloc(length+1);
+    if (body == NULL)
+        return NULL;
+    if (take_body(ci, length, body) != 0) {
+        free(body);
+        return NULL;
+    }
+    body[length] = '\0';
+    return body;
+}
+
+void answer_get(unsigned int n, unsigned int key, char *value, size_t length, t_nodeinfo *ni)
+{
+    reply_object(ni->request_client[n], ni->request_tag[n], key, value, length, ni);
+    for (t_waiter *waiter = ni->request_waiters[n]; waiter != NULL; waiter = waiter->next)
+        reply_object(waiter->client, waiter->tag, key, value, length, ni);
+    drop_request(n, ni);
+}
+
+unsigned int serve_batch(unsigned int keys, t_object *values, t_nodeinfo *ni)
 {
-    // Receive message (either from socket or internal buffers)
-    t_read_out ro = recv_message(*sfd, buffer+(*buffer_size), '\n', max_buffer_size-(*buffer_size)-1, ci);
-    if (ro.read_type == RO_SUCCESS) {
-        // Successfully read, update buffer
-        *buffer_size += ro.read_bytes;
-        if (*buffer_size >= max_buffer_size-1 && buffer[max_buffer_size-1] != '\n') {
-            // This is already an invalid message (too big)
-            reset_pmt(buffer_size, sfd);
-            printf("-> %s\n", buffer);
-            puts("\x1b[31m[!] Received a message with invalid size\033[m");
-            ro.read_type = RO_DISCONNECT;
-            return ro;
+    unsigned int served = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if (!(keys & (1u << key)))
+            continue;
+        t_object *object = ni->strong_reads ? NULL : get_replica(key, ni);
+        if (object == NULL && is_owner(key, ni)) {
+            object = get_object(key, ni);
+            touch_object(key, ni);
         }
+        else if (object == NULL && (object = get_hot_copy(key, ni)) == NULL && (object = get_cached(key, ni)) == NULL)
+            continue;
+        values[key].value = object != NULL ? object->value : NULL;
+        values[key].length = object != NULL ? object->length : 0;
+        served |= 1u << key;
     }
-    else if (ro.read_type == RO_ERROR) {
-        // An error occurred while receiving
-        reset_pmt(buffer_size, sfd);
-        return ro;
+    return served;
+}
+
+int send_batch_get(unsigned int keys, unsigned int n, unsigned int requester, t_nodeinfo *ni)
+{
+    // Keys that go through the same neighbour share a message
+    unsigned int via_shortcut = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if ((keys & (1u << key)) && closer_to_shortcut(key, ni))
+            via_shortcut |= 1u << key;
     }
-    else if (ro.read_type == RO_DISCONNECT) {
-        // Client closed the connection
-        puts("[*] Client disconnected");
-        return ro;
+    unsigned int groups[2] = { via_shortcut, keys & ~via_shortcut };
+    for (int i = 0; i < 2; i++) {
+        if (groups[i] == 0)
+            continue;
+        char message[64] = "";
+        sprintf(message, "MGET %x %u %u\n", groups[i], n, requester);
+        if (send_to_closest(message, first_key(groups[i]), ni) != 0)
+            return -1;
     }
+    return 0;
+}
 
-    // Make sure the buffer is a null terminated string
-    buffer[*buffer_size] = '\0';
+/**
+ * @brief Encode the values of some keys as a message body: each value, in the order
+ * of the keys, is preceded by its size and a newline (a size of 0 means the object
+ * doesn't exist)
+ * 
+ * @param keys the keys (a bitmask)
+ * @param values the values, indexed by key
+ * @param length where to store the size of the body
+ * @return [ @b char* ] the body (to be freed), or NULL in case of an error
+ */
+char *encode_batch(unsigned int keys, t_object *values, size_t *length)
+{
+    size_t size = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if (keys & (1u << key))
+            size += 24 + (values[key].value != NULL ? values[key].length : 0);
+    }
+    char *body = (char*) malloc(size+1);
+    if (body == NULL)
+        return NULL;
+    *length = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if (!(keys & (1u << key)))
+            continue;
+        size_t value_length = values[key].value != NULL ? values[key].length : 0;
+        *length += sprintf(body + *length, "%zu\n", value_length);
+        memcpy(body + *length, values[key].value, value_length);
+        *length += value_length;
+    }
+    return body;
+}
 
-    return ro;
+/**
+ * @brief Answer a batch request (MGET or SCAN) with the values of some keys: a single
+ * MRGET message, which carries a body and so always goes through the successor
+ * 
+ * @param keys the keys (a bitmask)
+ * @param values their values, indexed by key
+ * @param n request sequence number
+ * @param requester the node that made the request
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_batch_answer(unsigned int keys, t_object *values, unsigned int n, unsigned int requester, t_nodeinfo *ni)
+{
+    size_t length;
+    char *body = encode_batch(keys, values, &length);
+    if (body == NULL)
+        return -1;
+    char message[64] = "";
+    sprintf(message, "MRGET %u %u %x %zu\n", requester, n, keys, length);
+    int result = sendall(ni->succ_fd, message, strlen(message)) != 0 || sendall(ni->succ_fd, body, length) != 0 ? -1 : 0;
+    free(body);
+    if (result != 0)
+        puts("\x1b[31m[!] Couldn't resend the message\033[m");
+    return result;
 }
 
-int process_fnd_message(char *buffer, size_t buffer_size, t_nodeinfo *ni)
+/**
+ * @brief Decode a body made by encode_batch()
+ * 
+ * @param body the body
+ * @param length its size
+ * @param keys the keys it holds the values of (a bitmask)
+ * @param values where to store the values, indexed by key (they point into the body)
+ * @return [ @b int ] 0 if successfull, -1 if the body is malformed
+ */
+int decode_batch(char *body, size_t length, unsigned int keys, t_object *values)
 {
-    unsigned int search_key, n, key, port;
-    char ipaddr[INET_ADDRSTRLEN] = "";
-    t_msginfotype mi = get_fnd_or_rsp_or_get_message_info(buffer, &search_key, &n, &key, ipaddr, &port);
-    if (mi != MI_SUCCESS) {
-        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+    size_t offset = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if (!(keys & (1u << key)))
+            continue;
+        char *end = memchr(body+offset, '\n', length-offset);
+        size_t value_length;
+        if (end == NULL || sscanf(body+offset, "%zu", &value_length) != 1)
+            return -1;
+        offset = end+1 - body;
+        if (value_length > length-offset)
+            return -1;
+        values[key].value = value_length > 0 ? body+offset : NULL;
+        values[key].length = value_length;
+        offset += value_length;
+    }
+    return offset == length ? 0 : -1;
+}
+
+void gather_batch(unsigned int n, unsigned int keys, t_object *values, t_nodeinfo *ni)
+{
+    t_batch *batch = n < MAX_REQUESTS ? ni->request_batch[n] : NULL;
+    if (batch == NULL) {
+        puts("\x1b[33m[!] Received \"MRGET\" message without requesting it\033[m");
+        return;
+    }
+    if (batch->streaming) {
+        // Nothing is kept, the values go to whoever asked right away
+        reply_objects(ni->request_client[n], ni->request_tag[n], keys, values, ni);
+        return;
+    }
+    for (unsigned int key = 0; key < 32; key++) {
+        if (!(keys & batch->missing & (1u << key)))
+            continue;
+        if (values[key].value != NULL) {
+            batch->values[key].value = (char*) malloc(values[key].length+1);
+            if (batch->values[key].value == NULL)
+                continue;  // Reported as missing
+            memcpy(batch->values[key].value, values[key].value, values[key].length);
+            batch->values[key].value[values[key].length] = '\0';
+            batch->values[key].length = values[key].length;
+        }
+        batch->missing &= ~(1u << key);
+    }
+    if (batch->missing == 0) {
+        reply_objects(ni->request_client[n], ni->request_tag[n], batch->keys, batch->values, ni);
+        drop_request(n, ni);
+    }
+}
+
+int process_mget_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int keys, n, requester;
+    if (sscanf(buffer+5, "%x %u %u", &keys, &n, &requester) != 3 || keys == 0 || requester > 31 || n >= MAX_REQUESTS) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
         return -1;
     }
-    // Calculate distance to self, successor, and shortcut
-    unsigned int distance_self = ring_distance(ni->key, search_key);
-    unsigned int distance_succ = ring_distance(ni->succ_id, search_key);
-    if (distance_self <= distance_succ) {
-        // Search key belongs to this node
-        puts("\x1b[33m[*] Found the key!\033[m");
-        char message[64] = "";
-        sprintf(message, "RSP %u %u %u %s %s\n", key, n, ni->key, ni->ipaddr, ni->self_port);
-        int result = send_to_closest(message, key, ni);
-        if (result != 0)
+    t_object values[32];
+    unsigned int served = serve_batch(keys, values, ni);
+    if (served != 0) {
+        puts("\x1b[33m[*] Found some of the objects!\033[m");
+        for (unsigned int key = 0; key < 32; key++) {
+            if (served & (1u << key))
+                count_hit(key, ni);
+        }
+        if (requester == ni->key)
+            gather_batch(n, served, values, ni);
+        else if (send_batch_answer(served, values, n, requester, ni) != 0)
             return -1;
     }
-    else {
-        int result = send_to_closest(buffer, search_key, ni);
-        if (result < 0)
+    // The other keys go on towards their owners
+    if ((keys & ~served) != 0 && send_batch_get(keys & ~served, n, requester, ni) != 0)
+        return -1;
+    return 0;
+}
+
+int process_mrget_message(char *buffer, int from_fd, t_conn_info *ci, t_nodeinfo *ni)
+{
+    unsigned int requester, n, keys;
+    size_t length;
+    if (sscanf(buffer+6, "%u %u %x %zu", &requester, &n, &keys, &length) != 4) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    // Answers meant for other nodes were relayed by route_body as they arrived
+    char *body = read_body(ci, length);
+    if (body == NULL)
+        return -1;
+    t_object values[32];
+    int result = decode_batch(body, length, keys, values);
+    if (result == 0)
+        gather_batch(n, keys, values, ni);
+    else
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+    free(body);
+    return result;
+}
+
+/**
+ * @brief Send several objects through the shortcut in a single MSET datagram, body
+ * included, if the whole message fits in one
+ * 
+ * @param keys the objects' keys (a bitmask)
+ * @param values their values, indexed by key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if it was sent, 1 if it doesn't fit (or a datagram is already
+ * waiting for the shortcut's acknowledgement) and -1 otherwise
+ */
+int send_batch_datagram(unsigned int keys, t_object *values, t_nodeinfo *ni)
+{
+    if (ni->shcut_info == NULL || find_udp_message_from(ni, ni->shcut_info->ai_addr))
+        return 1;
+    size_t length;
+    char *body = encode_batch(keys, values, &length);
+    if (body == NULL)
+        return -1;
+    char message[64] = "";
+    int header = sprintf(message, "MSET %x %zu\n", keys, length);
+    if (header + length > MAX_DATAGRAM_SIZE) {
+        free(body);
+        return 1;
+    }
+    memcpy(message+header, body, length);
+    free(body);
+
+    puts("Trying to send message through shortcut");
+    if (udpsend(ni->udp_fd, message, header + length, ni->shcut_info) != 0) {
+        puts("\x1b[31m[!] Couldn't resend the message\033[m");
+        return -1;
+    }
+    return register_udp_message(ni, message, header + length, ni->shcut_info->ai_addr, ni->shcut_info->ai_addrlen, UDPMSG_CHORD) < 0 ? -1 : 0;
+}
+
+int send_batch_set(unsigned int keys, t_object *values, t_nodeinfo *ni)
+{
+    // Keys that go through the same neighbour share a message (bodies only go through UDP
+    // when a single datagram holds them, the others go round the ring)
+    unsigned int via_shortcut = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if ((keys & (1u << key)) && closer_to_shortcut(key, ni))
+            via_shortcut |= 1u << key;
+    }
+    if (via_shortcut != 0 && send_batch_datagram(via_shortcut, values, ni) == 0)
+        keys &= ~via_shortcut;
+    if (keys == 0)
+        return 0;
+
+    size_t length;
+    char *body = encode_batch(keys, values, &length);
+    if (body == NULL)
+        return -1;
+    char message[64] = "";
+    sprintf(message, "MSET %x %zu\n", keys, length);
+    int result = sendall(ni->succ_fd, message, strlen(message)) != 0 || sendall(ni->succ_fd, body, length) != 0 ? -1 : 0;
+    free(body);
+    if (result != 0)
+        puts("\x1b[31m[!] Couldn't resend the message\033[m");
+    return result;
+}
+
+/**
+ * @brief Store the objects of a batch of SETs (MSET) that this node owns, and send the
+ * others on towards their owners
+ * 
+ * @param keys the objects' keys (a bitmask)
+ * @param values their values, indexed by key
+ * @param from_successor whether the batch came back from the successor (which hands
+ * every key back to this node)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int store_batch_set(unsigned int keys, t_object *values, int from_successor, t_nodeinfo *ni)
+{
+    unsigned int stored = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if (!(keys & (1u << key)) || !(ni->succ_fd == -1 || from_successor || is_owner(key, ni)))
+            continue;
+        // A SET replaces the object's time to live along with its value
+        cancel_expiry(key, ni);
+        if (store_object(key, values[key].value, values[key].length, ni) == -1)
             return -1;
+        stored |= 1u << key;
     }
+    if ((keys & ~stored) != 0)
+        return send_batch_set(keys & ~stored, values, ni);
     return 0;
 }
 
-int process_rsp_message(char *buffer, size_t buffer_size, t_nodeinfo *ni)
+int process_mset_message(char *buffer, int from_fd, t_conn_info *ci, int from_successor, t_nodeinfo *ni)
+{
+    unsigned int keys;
+    size_t length;
+    if (sscanf(buffer+5, "%x %zu", &keys, &length) != 2) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    char *body = read_body(ci, length);
+    if (body == NULL)
+        return -1;
+    t_object values[32];
+    if (decode_batch(body, length, keys, values) != 0) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        free(body);
+        return -1;
+    }
+    int result = store_batch_set(keys, values, from_successor, ni);
+    free(body);
+    return result;
+}
+
+/**
+ * @brief Process a batch of SETs that came through the shortcut (MSET), with its body in
+ * the same datagram
+ * 
+ * @param buffer the datagram
+ * @param size its size
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int process_mset_datagram(char *buffer, size_t size, t_nodeinfo *ni)
+{
+    unsigned int keys;
+    size_t length;
+    int header = 0;
+    t_object values[32];
+    if (sscanf(buffer+5, "%x %zu%n", &keys, &length, &header) != 2 || buffer[5+header] != '\n' || 6 + header + length != size
+            || decode_batch(buffer + 6 + header, length, keys, values) != 0) {
+        puts("\x1b[33m[!] Received malformatted \"MSET\" message\033[m");
+        return 0;
+    }
+    return store_batch_set(keys, values, 0, ni);
+}
+
+int send_batch_find(unsigned int keys, unsigned int n, unsigned int requester, t_nodeinfo *ni)
+{
+    // Heading for the nearest key can't skip the owner of any other one, since they
+    // all come after it
+    char message[64] = "";
+    sprintf(message, "MFND %x %u %u\n", keys, n, requester);
+    return send_to_closest(message, nearest_key(keys, ni->key), ni);
+}
+
+void gather_owners(unsigned int n, unsigned int keys, unsigned int owner, char *ipaddr, unsigned int port, t_nodeinfo *ni)
+{
+    t_batch *batch = n < MAX_REQUESTS ? ni->request_batch[n] : NULL;
+    if (batch == NULL) {
+        puts("\x1b[33m[!] Received \"MRSP\" message without requesting it\033[m");
+        return;
+    }
+    keys &= batch->missing;
+    if (keys == 0)
+        return;
+    reply_owners(ni->request_client[n], ni->request_tag[n], keys, owner, ipaddr, port, ni);
+    batch->missing &= ~keys;
+    if (batch->missing == 0)
+        drop_request(n, ni);
+}
+
+int process_mfnd_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int keys, n, requester;
+    if (sscanf(buffer+5, "%x %u %u", &keys, &n, &requester) != 3 || keys == 0 || requester > 31 || n >= MAX_REQUESTS) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    unsigned int owned = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if ((keys & (1u << key)) && is_owner(key, ni))
+            owned |= 1u << key;
+    }
+    if (owned != 0) {
+        puts("\x1b[33m[*] Found some of the keys!\033[m");
+        if (requester == ni->key)
+            gather_owners(n, owned, ni->key, ni->ipaddr, strtoui(ni->self_port), ni);
+        else {
+            char message[64] = "";
+            sprintf(message, "MRSP %u %u %x %u %s %s\n", requester, n, owned, ni->key, ni->ipaddr, ni->self_port);
+            if (send_to_closest(message, requester, ni) != 0)
+                return -1;
+        }
+    }
+    // The other keys go on towards their owners
+    if ((keys & ~owned) != 0 && send_batch_find(keys & ~owned, n, requester, ni) != 0)
+        return -1;
+    return 0;
+}
+
+int process_mrsp_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int requester, n, keys, owner, port;
+    char ipaddr[INET_ADDRSTRLEN] = "";
+    if (sscanf(buffer+5, "%u %u %x %u %15s %u", &requester, &n, &keys, &owner, ipaddr, &port) != 6
+            || requester > 31 || owner > 31 || port > 65535 || !isipaddr(ipaddr)) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    if (requester == ni->key)
+        gather_owners(n, keys, owner, ipaddr, port, ni);
+    else if (send_to_closest(buffer, requester, ni) != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Finish a range scan this node made, telling whoever asked where to continue from
+ * 
+ * @param n request sequence number
+ * @param cursor the key to continue from (32 if the range is over)
+ * @param ni necessary information about the node
+ */
+void finish_scan(unsigned int n, unsigned int cursor, t_nodeinfo *ni)
+{
+    t_batch *batch = n < MAX_REQUESTS ? ni->request_batch[n] : NULL;
+    if (batch == NULL || !batch->streaming) {
+        puts("\x1b[33m[!] Received \"SCEND\" message without requesting it\033[m");
+        return;
+    }
+    reply_cursor(ni->request_client[n], ni->request_tag[n], cursor, ni);
+    drop_request(n, ni);
+}
+
+int continue_scan(unsigned int from, unsigned int to, unsigned int count, unsigned int n, unsigned int requester, t_nodeinfo *ni)
+{
+    t_object values[32];
+    unsigned int keys = 0, key = from;
+    size_t size = 0;
+    int done = 0;
+    while (count > 0 && is_owner(key, ni)) {
+        t_object *object = get_object(key, ni);
+        if (object != NULL) {
+            if (keys != 0 && size + object->length > SCAN_BATCH_SIZE) {
+                // The objects go back in order, a batch at a time
+                if (requester == ni->key)
+                    gather_batch(n, keys, values, ni);
+                else if (send_batch_answer(keys, values, n, requester, ni) != 0)
+                    return -1;
+                keys = 0;
+                size = 0;
+            }
+            values[key].value = object->value;
+            values[key].length = object->length;
+            keys |= 1u << key;
+            size += object->length;
+            count--;
+        }
+        done = key == to;
+        key = (key + 1) % 32;
+        if (done)
+            break;
+    }
+    if (keys != 0) {
+        if (requester == ni->key)
+            gather_batch(n, keys, values, ni);
+        else if (send_batch_answer(keys, values, n, requester, ni) != 0)
+            return -1;
+    }
+
+    // The answers went through the successor, so the rest of the scan has to follow
+    // them (never the shortcut) to keep them in order
+    char message[64] = "";
+    if (done || count == 0) {
+        // The cursor is the key to continue from, or 32 if the range is over
+        unsigned int cursor = done ? 32 : key;
+        if (requester == ni->key) {
+            finish_scan(n, cursor, ni);
+            return 0;
+        }
+        sprintf(message, "SCEND %u %u %u\n", requester, n, cursor);
+    }
+    else
+        sprintf(message, "SCAN %u %u %u %u %u\n", key, to, count, n, requester);
+    if (sendall(ni->succ_fd, message, strlen(message)) != 0) {
+        puts("\x1b[31m[!] Couldn't resend the message\033[m");
+        return -1;
+    }
+    return 0;
+}
+
+int process_scan_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int from, to, count, n, requester;
+    if (sscanf(buffer+5, "%u %u %u %u %u", &from, &to, &count, &n, &requester) != 5 || from > 31 || to > 31
+            || count == 0 || n >= MAX_REQUESTS || requester > 31) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    if (!is_owner(from, ni)) {
+        // Still on its way to the start of the range
+        return send_to_closest(buffer, from, ni) < 0 ? -1 : 0;
+    }
+    return continue_scan(from, to, count, n, requester, ni);
+}
+
+int process_scend_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int requester, n, cursor;
+    if (sscanf(buffer+6, "%u %u %u", &requester, &n, &cursor) != 3 || requester > 31 || cursor > 32) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    if (requester == ni->key) {
+        finish_scan(n, cursor, ni);
+        return 0;
+    }
+    // Behind the scan's answers, like them
+    if (sendall(ni->succ_fd, buffer, strlen(buffer)) != 0) {
+        puts("\x1b[31m[!] Couldn't resend the message\033[m");
+        return -1;
+    }
+    return 0;
+}
+
+int process_watch_message(char *buffer, int handoff, t_nodeinfo *ni)
+{
+    unsigned int key, node, id, port;
+    char ipaddr[INET_ADDRSTRLEN] = "";
+    char *fields = strchr(buffer, ' ');
+    if (sscanf(fields+1, "%u %u %u %15s %u", &key, &node, &id, ipaddr, &port) != 5 || key > 31 || node > 31
+            || port > 65535 || !isipaddr(ipaddr)) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    if (!handoff && !is_owner(key, ni))
+        return send_to_closest(buffer, key, ni) < 0 ? -1 : 0;
+    t_watcher *w = add_watcher(key, node, id, ipaddr, port, ni);
+    if (w == NULL)
+        return -1;
+    // The watcher starts from the current value (a handed off one already has it)
+    return handoff ? 0 : send_notification(w, key, ni);
+}
+
+int process_unwatch_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int key, node, id;
+    if (sscanf(buffer+8, "%u %u %u", &key, &node, &id) != 3 || key > 31) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    if (!is_owner(key, ni))
+        return send_to_closest(buffer, key, ni) < 0 ? -1 : 0;
+    remove_watcher(key, node, id, ni);
+    return 0;
+}
+
+/**
+ * @brief Check whether a notification has reached the node it is meant for. If the
+ * node doesn't exist anymore, the notification is dropped and its watch cancelled
+ * 
+ * @param node the node the notification is meant for
+ * @param key the key it is about
+ * @param id the watch's identifier
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if it has (or if it was dropped), 0 if it has to go on
+ */
+int notification_arrived(unsigned int node, unsigned int key, unsigned int id, t_nodeinfo *ni)
+{
+    if (node == ni->key || !is_owner(node, ni))
+        return node == ni->key;
+    printf("\x1b[33m[!] Node %u is gone, cancelling its watch of key %u\033[m\n", node, key);
+    char message[64] = "";
+    sprintf(message, "UNWATCH %u %u %u\n", key, node, id);
+    send_to_closest(message, key, ni);
+    return 1;
+}
+
+int process_note_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int node, id, key;
+    unsigned long version;
+    char value[MAX_INLINE_VALUE+1] = "";
+    int fields = sscanf(buffer+5, "%u %u %u %lu %16[^\n]", &node, &id, &key, &version, value);
+    if (fields < 4 || key > 31 || node > 31) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    if (node != ni->key) {
+        if (notification_arrived(node, key, id, ni))
+            return 0;
+        return send_to_closest(buffer, node, ni) < 0 ? -1 : 0;
+    }
+    deliver_notification(id, key, version, fields == 5 ? value : NULL, strlen(value), ni);
+    return 0;
+}
+
+int process_bnote_message(char *buffer, int from_fd, t_conn_info *ci, t_nodeinfo *ni)
+{
+    unsigned int node, id, key;
+    unsigned long version;
+    size_t length;
+    if (sscanf(buffer+6, "%u %u %u %lu %zu", &node, &id, &key, &version, &length) != 5 || key > 31 || node > 31) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    // Notifications meant for other nodes were relayed by route_body as they arrived
+    char *value = read_body(ci, length);
+    if (value == NULL)
+        return -1;
+    deliver_notification(id, key, version, value, length, ni);
+    free(value);
+    return 0;
+}
+
+int process_found_key(unsigned int search_key, unsigned int n, char *ipaddr, unsigned int port, t_nodeinfo* ni)
+{
+    int request_key = get_associated_key(n, ni);
+    if (request_key == -1) {
+        puts("\x1b[33m[!] Received \"RSP\" message without requesting it\033[m");
+    }
+    else {
+        struct sockaddr sa;
+        socklen_t sa_len;
+        if (get_associated_addrinfo(n, &sa, &sa_len, ni) == 0) {
+            // Find request was initiated by an EFND message
+            char message[64] = "";
+            sprintf(message, "EPRED %u %s %u", search_key, ipaddr, port);
+
+            struct addrinfo ai;
+            ai.ai_addr = &sa;
+            ai.ai_addrlen = sa_len;
+            if (udpsend(ni->udp_fd, message, strlen(message), &ai) != 0) {
+                puts("\x1b[31m[!] Error sending EPRED message\033[m");
+            }
+            else {
+                if (register_udp_message(ni, message, strlen(message), &sa, sa_len, UDPMSG_ENTERING) == -1)
+                    return -1; 
+            }
+        }
+        else  // Find request was initiated by the user
+            reply_owner(ni->request_client[n], ni->request_tag[n], request_key, search_key, ipaddr, port, ni);
+
+        drop_request(n, ni);
+    }
+
+    return 0;
+}
+
+int process_incoming_connection(t_nodeinfo *ni)
+{
+    struct sockaddr addr;
+    socklen_t addrlen = sizeof(addr);
+    char ipaddr[INET_ADDRSTRLEN] = "";
+
+    // Accept the connection
+    int newfd = accept(ni->main_fd, &addr, &addrlen);
+    if (newfd == -1)
+        return -1;
+
+    ipaddr_from_sockaddr(&addr, ipaddr);    
+
+    if (ni->temp_fd >= 0) {
+        // We already have a connection being established, reject this one
+        printf("\x1b[33m[!] Rejected connection from %s\033[m\n", ipaddr);
+        close(newfd);
+        return 0;
+    }
+
+    printf("\x1b[32m[*] Accepted connection from %s\033[m\n", ipaddr);
+
+    // Save connection information in ni->temp and the socket fd in ni->temp_fd
+    ni->temp_fd = newfd;
+    if (ni->temp == NULL) {
+        ni->temp = new_conn_info(2048);
+        if (ni->temp == NULL)
+            return -1;
+    }
+    else {
+        if (set_conn_info(ni->temp, 2048) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reset buffer size, close and set fd to -1
+ * 
+ * @param buffer_size 
+ * @param fd 
+ */
+void reset_pmt(size_t *buffer_size, int *fd)
+{
+    if (*fd >= 0)
+        close(*fd);
+    *fd = -1;
+    *buffer_size = 0;
+}
+
+/**
+ * @brief Get the size of the body that follows a message's header
+ * 
+ * @param buffer the message's header
+ * @return [ @b long ] size of the body in bytes (0 if the message has none), or -1 if the
+ * header is malformatted or the body is larger than a node accepts
+ */
+long message_body_length(char *buffer)
+{
+    static const struct {
+        char *type;
+        // Which field of the header holds the body's size, and the largest size accepted
+        unsigned int field;
+        size_t max;
+    } bodies[] = {
+        { "BSET ", 4, MAX_VALUE_SIZE },
+        { "BRGET ", 4, MAX_VALUE_SIZE },
+        { "BLRGET ", 6, MAX_VALUE_SIZE },
+        { "BOP ", 6, MAX_VALUE_SIZE },
+        { "BROP ", 7, MAX_VALUE_SIZE },
+        { "BNOTE ", 5, MAX_VALUE_SIZE },
+        { "XSET ", 3, MAX_VALUE_SIZE },
+        { "REPL ", 4, MAX_VALUE_SIZE },
+        { "HCOPY ", 4, MAX_VALUE_SIZE },
+        { "FRSP ", 5, MAX_VALUE_SIZE },
+        { "MSET ", 2, MAX_BODY_SIZE },
+        { "MRGET ", 4, MAX_BODY_SIZE }
+    };
+
+    if (strncmp(buffer, "FRAG ", 5) == 0) {
+        // A single fragment, a k-th of the value
+        unsigned int k;
+        size_t length;
+        if (sscanf(buffer+5, "%*u %*u %*u %*u %u %*u %zu", &k, &length) != 2 || k < 1 || length > MAX_VALUE_SIZE)
+            return -1;
+        return (long) fragment_size(length, k);
+    }
+    for (size_t i = 0; i < sizeof(bodies) / sizeof(bodies[0]); i++) {
+        size_t type_length = strlen(bodies[i].type);
+        if (strncmp(buffer, bodies[i].type, type_length) != 0)
+            continue;
+        char *field = buffer + type_length;
+        for (unsigned int f = 1; f < bodies[i].field && field != NULL; f++) {
+            field = strchr(field, ' ');
+            if (field != NULL)
+                field++;
+        }
+        size_t length;
+        if (field == NULL || sscanf(field, "%zu", &length) != 1 || length > bodies[i].max)
+            return -1;
+        return (long) length;
+    }
+    return 0;
+}
+
+/**
+ * @brief Parse the header of a fragment of an object (FRAG)
+ * 
+ * @param buffer the message
+ * @param owner where to store the key of the object's owner
+ * @param hops where to store how many more successors the fragment goes through
+ * @param key where to store the object's key
+ * @param fragment where to store the fragment's description (without its data)
+ * @param ttl where to store how many milliseconds the object has left to live (0 if it
+ * has no TTL)
+ * @return [ @b int ] 0 if successfull, -1 if the message is malformatted
+ */
+int parse_frag_message(char *buffer, unsigned int *owner, unsigned int *hops, unsigned int *key, t_fragment *fragment, unsigned long *ttl)
+{
+    *ttl = 0;
+    if (sscanf(buffer+5, "%u %u %u %u %u %u %zu %zu %" SCNx64 " %lu", owner, hops, key, &fragment->index, &fragment->k, &fragment->m,
+            &fragment->length, &fragment->size, &fragment->hash, ttl) < 9 || *key > 31 || fragment->k < 1 || fragment->m < 1
+            || fragment->k + fragment->m > EC_MAX_FRAGMENTS || fragment->index >= fragment->k + fragment->m || *hops < 1
+            || *hops > fragment->k + fragment->m || fragment->length > MAX_VALUE_SIZE || fragment->size > MAX_VALUE_SIZE
+            || (fragment->size != 0 && fragment->length > fragment->size))
+        return -1;
+    if (*ttl > 0)
+        fragment->expires = seconds_from_now(*ttl / 1000.0);
+    else
+        memset(&fragment->expires, 0, sizeof(struct timeval));
+    return 0;
+}
+
+/**
+ * @brief Find out, as soon as a message's header has arrived, whether its body only passes
+ * through this node. If so, the header is sent on right away and the body follows it a
+ * chunk at a time as it arrives, so that only the node the body is meant for ever holds
+ * all of it
+ * 
+ * @param buffer the message's header
+ * @param length size of the body in bytes
+ * @param ci necessary information about the connection the body is arriving through
+ * @param ni necessary information about the node
+ * @return [ @b int ] socket to relay the body to, -1 to drop it, or -2 if this node needs
+ * the body itself (it is then buffered until all of it has arrived)
+ */
+int route_body(char *buffer, size_t length, t_conn_info *ci, t_nodeinfo *ni)
+{
+    unsigned int requester, n, key, search_key;
+    size_t size;
+    int to_fd = -2;
+    char *header = buffer;
+    char message[96] = "";
+    if (strncmp(buffer, "BSET ", 5) == 0) {
+        // Whatever comes from the successor is handed back to this node
+        if (get_bulk_message_info(buffer+5, &search_key, &n, &key, &size) == MI_SUCCESS && ci != ni->successor && ni->succ_fd != -1
+                && ring_distance(ni->key, search_key) > ring_distance(ni->succ_id, search_key))
+            to_fd = ni->succ_fd;
+    }
+    else if (strncmp(buffer, "BRGET ", 6) == 0) {
+        if (get_bulk_message_info(buffer+6, &requester, &n, &search_key, &size) == MI_SUCCESS && requester != ni->key)
+            to_fd = ni->succ_fd;
+    }
+    else if (strncmp(buffer, "BLRGET ", 7) == 0) {
+        // A value that may be cached here is kept whole anyway
+        if (sscanf(buffer+7, "%u", &requester) == 1 && requester != ni->key && (ni->cache.budget == 0 || length > ni->cache.budget))
+            to_fd = ni->succ_fd;
+    }
+    else if (strncmp(buffer, "BOP ", 4) == 0) {
+        if (sscanf(buffer+4, "%u", &key) == 1 && key <= 31 && !is_owner(key, ni))
+            to_fd = ni->succ_fd;
+    }
+    else if (strncmp(buffer, "BROP ", 5) == 0) {
+        if (sscanf(buffer+5, "%u", &requester) == 1 && requester != ni->key)
+            to_fd = ni->succ_fd;
+    }
+    else if (strncmp(buffer, "MRGET ", 6) == 0) {
+        if (sscanf(buffer+6, "%u", &requester) == 1 && requester != ni->key)
+            to_fd = ni->succ_fd;
+    }
+    else if (strncmp(buffer, "BNOTE ", 6) == 0) {
+        unsigned int id;
+        if (sscanf(buffer+6, "%u %u %u", &requester, &id, &key) == 3 && requester <= 31 && key <= 31 && requester != ni->key)
+            to_fd = notification_arrived(requester, key, id, ni) ? -1 : ni->succ_fd;
+    }
+    else if (strncmp(buffer, "FRSP ", 5) == 0) {
+        if (sscanf(buffer+5, "%u %u", &requester, &key) == 2 && key <= 31) {
+            t_rebuild *rebuild = ni->rebuilds[key];
+            if (requester != ni->key)
+                to_fd = ni->pred_fd;
+            else if (rebuild == NULL || length != fragment_size(rebuild->value.length, rebuild->value.k))
+                to_fd = -1;  // Late, the object isn't being rebuilt anymore
+        }
+    }
+    else if (strncmp(buffer, "FRAG ", 5) == 0) {
+        unsigned int owner, hops;
+        unsigned long ttl;
+        t_fragment fragment = { NULL, 0, 0, 0, 0, 0, 0, { 0, 0 } };
+        if (parse_frag_message(buffer, &owner, &hops, &key, &fragment, &ttl) == 0) {
+            if (owner == ni->key) {
+                // Back where it started: there aren't enough successors for every fragment
+                fragments_wrapped(key, ni);
+                to_fd = -1;
+            }
+            else if (is_owner(key, ni))
+                to_fd = -1;
+            else if (hops > 1) {
+                // Meant for a node further along the chain (the owner itself if the ring is
+                // too small)
+                sprintf(message, "FRAG %u %u %u %u %u %u %zu %zu %016" PRIx64 " %lu\n", owner, hops-1, key, fragment.index, fragment.k,
+                    fragment.m, fragment.length, fragment.size, fragment.hash, ttl);
+                header = message;
+                to_fd = ni->succ_fd;
+            }
+        }
+    }
+
+    if (to_fd >= 0 && sendall(to_fd, header, strlen(header)) != 0) {
+        puts("\x1b[31m[!] Couldn't resend the message\033[m");
+        to_fd = -1;
+    }
+    return to_fd;
+}
+
+/**
+ * @brief Process an incoming message and update internal buffers. A message followed by a
+ * body is only complete once the connection has buffered all of the body, which is read as
+ * it arrives instead of blocking the node. A body that only passes through this node is
+ * relayed as it arrives instead (see route_body), and its message never completes here
+ * 
+ * @param sfd socket file descriptor
+ * @param buffer buffer to store the received message in
+ * @param buffer_size current size of buffer
+ * @param max_buffer_size maximum possible buffer size
+ * @param ci necessary information about the connection
+ * @param ni necessary information about the node
+ * @return [ @b t_read_out ] structure describing the result (RO_PARTIAL while the body
+ * is still arriving, or is being relayed)
+ */
+t_read_out process_incoming(int *sfd, char *buffer, size_t *buffer_size, size_t max_buffer_size, t_conn_info *ci, t_nodeinfo *ni)
+{
+    t_read_out ro;
+    int to_fd;
+    if (relaying_body(ci)) {
+        // There's nothing to handle until the relayed body has gone on
+        ro = recv_relay(*sfd, ci);
+        if (ro.read_type == RO_SUCCESS)
+            ro.read_type = RO_PARTIAL;
+    }
+    else if (*buffer_size > 0 && buffer[*buffer_size-1] == '\n') {
+        // The header arrived earlier, keep waiting for its body
+        long body = message_body_length(buffer);
+        ro = recv_body(*sfd, body > 0 ? body : 0, ci);
+    }
+    else {
+        // Receive message (either from socket or internal buffers)
+        ro = recv_message(*sfd, buffer+(*buffer_size), '\n', max_buffer_size-(*buffer_size)-1, ci);
+        if (ro.read_type == RO_SUCCESS) {
+            // Successfully read, update buffer
+            *buffer_size += ro.read_bytes;
+            if (*buffer_size >= max_buffer_size-1 && buffer[max_buffer_size-1] != '\n') {
+                // This is already an invalid message (too big)
+                reset_pmt(buffer_size, sfd);
+                printf("-> %s\n", buffer);
+                puts("\x1b[31m[!] Received a message with invalid size\033[m");
+                ro.read_type = RO_DISCONNECT;
+                return ro;
+            }
+            // Make sure the buffer is a null terminated string
+            buffer[*buffer_size] = '\0';
+
+            if (buffer[*buffer_size-1] == '\n') {
+                // Whole header, start buffering its body (if it has one)
+                long body = message_body_length(buffer);
+                if (body < 0) {
+                    printf("\x1b[31m[!] Received a message with an invalid body size: '%s'\033[m\n", buffer);
+                    reset_pmt(buffer_size, sfd);
+                    ro.read_type = RO_DISCONNECT;
+                    return ro;
+                }
+                to_fd = body > 0 ? route_body(buffer, body, ci, ni) : -2;
+                if (to_fd == -2 && body > 0)
+                    ro = recv_body(*sfd, body, ci);
+                else if (to_fd != -2) {
+                    // Only passing through: the header went on already
+                    *buffer_size = 0;
+                    start_relay(ci, body, to_fd);
+                    ro = recv_relay(*sfd, ci);
+                    if (ro.read_type == RO_SUCCESS)
+                        ro.read_type = RO_PARTIAL;
+                }
+            }
+        }
+    }
+
+    if ((ro.read_type == RO_ERROR || ro.read_type == RO_DISCONNECT) && (to_fd = stop_relay(ci)) >= 0) {
+        // Whoever was getting the relayed body won't get the rest of it: cut the link short
+        // so it doesn't take the next messages for it
+        puts("\x1b[31m[!] A relayed message was cut short, dropping the link it was going through\033[m");
+        shutdown(to_fd, SHUT_RDWR);
+    }
+
+    if (ro.read_type == RO_ERROR && ro.error_code != ECONNRESET) {
+        // An error occurred while receiving
+        reset_pmt(buffer_size, sfd);
+        return ro;
+    }
+    else if (ro.read_type == RO_DISCONNECT || ro.read_type == RO_ERROR) {
+        // Client closed the connection (possibly without reading everything we sent)
+        ro.read_type = RO_DISCONNECT;
+        puts("[*] Client disconnected");
+        return ro;
+    }
+    return ro;
+}
+
+int process_fnd_message(char *buffer, size_t buffer_size, t_nodeinfo *ni)
+{
+    unsigned int search_key, n, key, port;
+    char ipaddr[INET_ADDRSTRLEN] = "";
+    t_msginfotype mi = get_fnd_or_rsp_or_get_message_info(buffer, &search_key, &n, &key, ipaddr, &port);
+    if (mi != MI_SUCCESS) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    // Calculate distance to self, successor, and shortcut
+    unsigned int distance_self = ring_distance(ni->key, search_key);
+    unsigned int distance_succ = ring_distance(ni->succ_id, search_key);
+    if (distance_self <= distance_succ) {
+        // Search key belongs to this node
+        puts("\x1b[33m[*] Found the key!\033[m");
+        char message[64] = "";
+        sprintf(message, "RSP %u %u %u %s %s\n", key, n, ni->key, ni->ipaddr, ni->self_port);
+        int result = send_to_closest(message, key, ni);
+        if (result != 0)
+            return -1;
+    }
+    else {
+        int result = send_to_closest(buffer, search_key, ni);
+        if (result < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int process_rsp_message(char *buffer, size_t buffer_size, t_nodeinfo *ni)
+{
+    unsigned int search_key, n, key, port;
+    char ipaddr[INET_ADDRSTRLEN] = "";
+    t_msginfotype mi = get_fnd_or_rsp_or_get_message_info(buffer, &key, &n, &search_key, ipaddr, &port);
+    if (mi != MI_SUCCESS) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    if (key == ni->key) {
+        // This message is meant for this node. Process it
+        if (process_found_key(search_key, n, ipaddr, port, ni) != 0)
+            return -1;
+    }
+    else {
+        // This message is not meant for this node. Forward it.
+        int result = send_to_closest(buffer, key, ni);
+        if (result < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int process_get_message(char *buffer, size_t buffer_size, t_nodeinfo *ni)
+{
+    unsigned int search_key, n, key, port;
+    char ipaddr[INET_ADDRSTRLEN] = "";
+    t_msginfotype mi = get_fnd_or_rsp_or_get_message_info(buffer, &search_key, &n, &key, ipaddr, &port);
+    if (mi != MI_SUCCESS) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    t_object *copy, *replica = ni->strong_reads ? NULL : get_replica(search_key, ni);
+    if (replica != NULL) {
+        // This node has a copy of this object; answer with it
+        puts("\x1b[33m[*] Found a replica of the object!\033[m");
+        int result = send_object_message(-1, "RGET", key, n, search_key, replica->value, replica->length, key, ni);
+        if (result < 0)
+            return -1;
+    }
+    else if (ring_distance(ni->key, search_key) <= ring_distance(ni->succ_id, search_key)) {
+        // This node has this object; forward its value
+        puts("\x1b[33m[*] Found the object!\033[m");
+        int result = send_leased_object(key, n, search_key, ni);
+        if (result < 0)
+            return -1;
+        count_hit(search_key, ni);
+        touch_object(search_key, ni);
+    }
+    else if ((copy = get_hot_copy(search_key, ni)) != NULL) {
+        // This node has a copy of this frequently read object, the owner doesn't need to be bothered
+        puts("\x1b[33m[*] Found a hot copy of the object!\033[m");
+        int result = send_object_message(-1, "RGET", key, n, search_key, copy->value, copy->length, key, ni);
+        if (result < 0)
+            return -1;
+        ni->hot_answers++;
+        count_hit(search_key, ni);
+    }
+    else if ((copy = get_cached(search_key, ni)) != NULL) {
+        // This node relayed the object recently, and its owner's lease still holds
+        puts("\x1b[33m[*] Found a cached copy of the object!\033[m");
+        int result = send_object_message(-1, "RGET", key, n, search_key, copy->value, copy->length, key, ni);
+        if (result < 0)
+            return -1;
+        ni->cache.hits++;
+    }
+    else {
+        // This message is not meant for this node. Forward it.
+        int result = send_to_closest(buffer, search_key, ni);
+        if (result < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int process_rget_message(char *buffer, size_t buffer_size, t_nodeinfo *ni)
+{
+    unsigned int search_key, n, key;
+    char value[24] = "";
+    t_msginfotype mi = get_rget_or_set_message_info(buffer+5, &key, &n, &search_key, value);
+    if (mi != MI_SUCCESS) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    if (key == ni->key) {
+        // This message is meant for this node. Process it
+        int key = get_associated_key(n, ni);
+        if (key == -1) {
+            puts("\x1b[33m[!] Received \"RSP\" message without requesting it\033[m");
+            return -1;
+        }
+        answer_get(n, key, strlen(value) ? value : NULL, strlen(value), ni);
+    }
+    else {
+        // This message is not meant for this node. Forward it.
+        int result = send_to_closest(buffer, key, ni);
+        if (result < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Answer the client that made a SET, now that the key's owner has applied it
+ * 
+ * @param n the request's sequence number
+ * @param key the object's key
+ * @param version the object's version after the write
+ * @param ni necessary information about the node
+ */
+void set_acknowledged(unsigned int n, unsigned int key, unsigned long version, t_nodeinfo *ni)
+{
+    // The request may have timed out already, and its slot been taken by another one
+    if (get_associated_key(n, ni) != (int) key || ni->request_deadline[n].tv_sec == 0) {
+        puts("\x1b[33m[!] Received \"SACK\" message without waiting for it\033[m");
+        return;
+    }
+    if (ni->request_client[n] == NO_CLIENT) {
+        double latency = SET_TIMEOUT - seconds_until(ni->request_deadline[n]);
+        printf("\x1b[33m[*] SET of key %u applied (version %lu, %.3f ms)\033[m\n", key, version, latency * 1000);
+    }
+    reply_status(ni->request_client[n], ni->request_tag[n], NULL, ni);
+    drop_request(n, ni);
+    ni->sets_acknowledged++;
+}
+
+int acknowledge_set(unsigned int requester, unsigned int n, unsigned int key, t_nodeinfo *ni)
+{
+    if (ni->leased_writes & (1u << key)) {
+        // Until the write is applied, a GET could still get the old value
+        t_pending_ack *ack = (t_pending_ack*) malloc(sizeof(t_pending_ack)), **last = &ni->leased_acks[key];
+        if (ack == NULL)
+            return -1;
+        ack->requester = requester;
+        ack->n = n;
+        ack->next = NULL;
+        while (*last != NULL)
+            last = &(*last)->next;
+        *last = ack;
+        return 0;
+    }
+    unsigned long version = ni->objects[key].version;
+    if (requester == ni->key) {
+        // The key moved to the node that sent the SET while it went around the ring
+        set_acknowledged(n, key, version, ni);
+        return 0;
+    }
+    char message[64] = "";
+    sprintf(message, "SACK %u %u %u %lu\n", requester, n, key, version);
+    return send_to_closest(message, requester, ni) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Process the acknowledgement of a SET (SACK)
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_sack_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int requester, n, key;
+    unsigned long version;
+    if (sscanf(buffer+5, "%u %u %u %lu", &requester, &n, &key, &version) != 4 || requester > 31 || n >= MAX_REQUESTS || key > 31) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    if (requester != ni->key) {
+        // This message is not meant for this node. Forward it.
+        return send_to_closest(buffer, requester, ni) < 0 ? -1 : 0;
+    }
+    set_acknowledged(n, key, version, ni);
+    return 0;
+}
+
+void expire_set_requests(t_nodeinfo *ni)
+{
+    for (unsigned int n = 0; n < MAX_REQUESTS; n++) {
+        if (ni->request_deadline[n].tv_sec == 0 || seconds_until(ni->request_deadline[n]) > 0)
+            continue;
+        printf("\x1b[31m[!] SET of key %d wasn't acknowledged in time\033[m\n", ni->requests[n]);
+        reply_status(ni->request_client[n], ni->request_tag[n], "The write wasn't acknowledged in time, it may not have been applied", ni);
+        drop_request(n, ni);
+        ni->sets_timed_out++;
+    }
+}
+
+int process_set_message(char *buffer, size_t buffer_size, int from_successor, t_nodeinfo *ni)
+{
+    unsigned int search_key, n, key;
+    char value[24] = "";
+    t_msginfotype mi = get_rget_or_set_message_info(buffer+4, &search_key, &n, &key, value);
+    if (mi != MI_SUCCESS) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    // printf("search_key=%u key=%u\n", search_key, key);
+    if (ni->succ_fd == -1 || from_successor || ring_distance(ni->key, search_key) <= ring_distance(ni->succ_id, search_key)) {
+        // This node has this object; set its value (a SET replaces its time to live too)
+        cancel_expiry(search_key, ni);
+        if (store_object(search_key, strlen(value) ? value : NULL, strlen(value), ni) == -1)
+            return -1;
+        return acknowledge_set(key, n, search_key, ni);
+    }
+    else {
+        // This message is not meant for this node. Forward it.
+        int result = send_to_closest(buffer, search_key, ni);
+        if (result < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int process_bset_message(char *buffer, int from_fd, t_conn_info *ci, int from_successor, t_nodeinfo *ni)
+{
+    unsigned int search_key, n, key;
+    size_t length;
+    t_msginfotype mi = get_bulk_message_info(buffer+5, &search_key, &n, &key, &length);
+    if (mi != MI_SUCCESS) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d: '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    // This node has this object (route_body relayed the others as they arrived); read the
+    // whole value and store it
+    char *value = read_body(ci, length);
+    if (value == NULL)
+        return -1;
+    cancel_expiry(search_key, ni);
+    int result = store_object(search_key, length ? value : NULL, length, ni);
+    free(value);
+    if (result == -1)
+        return -1;
+    return acknowledge_set(key, n, search_key, ni);
+}
+
+int process_brget_message(char *buffer, int from_fd, t_conn_info *ci, t_nodeinfo *ni)
+{
+    unsigned int search_key, n, key;
+    size_t length;
+    t_msginfotype mi = get_bulk_message_info(buffer+6, &key, &n, &search_key, &length);
+    if (mi != MI_SUCCESS) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d: '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    // This message is meant for this node (route_body relayed the others as they arrived)
+    char *value = read_body(ci, length);
+    if (value == NULL)
+        return -1;
+    int request_key = get_associated_key(n, ni);
+    if (request_key == -1)
+        puts("\x1b[33m[!] Received \"BRGET\" message without requesting it\033[m");
+    else {
+        answer_get(n, request_key, value, length, ni);
+    }
+    free(value);
+    return 0;
+}
+
+/**
+ * @brief Process an answer to a GET that comes with a lease on its value (LRGET)
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_lrget_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int requester, n, search_key;
+    unsigned long version, lease;
+    char value[24] = "";
+    if (sscanf(buffer+6, "%u %u %u %lu %lu %16[^\n]", &requester, &n, &search_key, &version, &lease, value) < 5
+            || requester > 31 || n >= MAX_REQUESTS || search_key > 31) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    cache_object(search_key, strlen(value) ? value : NULL, strlen(value), version, lease / 1000.0, ni);
+    if (requester == ni->key) {
+        // This message is meant for this node. Process it
+        int key = get_associated_key(n, ni);
+        if (key == -1) {
+            puts("\x1b[33m[!] Received \"LRGET\" message without requesting it\033[m");
+            return -1;
+        }
+        answer_get(n, key, strlen(value) ? value : NULL, strlen(value), ni);
+    }
+    else if (send_to_closest(buffer, requester, ni) < 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Process an answer to a GET that comes with a lease on its value, which follows
+ * the message (BLRGET)
+ * 
+ * @param buffer the message
+ * @param from_fd socket the body is arriving through
+ * @param ci necessary information about the connection the body is arriving through
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_blrget_message(char *buffer, int from_fd, t_conn_info *ci, t_nodeinfo *ni)
+{
+    unsigned int requester, n, search_key;
+    unsigned long version, lease;
+    size_t length;
+    if (sscanf(buffer+7, "%u %u %u %lu %lu %zu", &requester, &n, &search_key, &version, &lease, &length) != 6
+            || requester > 31 || n >= MAX_REQUESTS || search_key > 31) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    // The value is meant for this node or may be cached on its way, so it is kept whole
+    // (route_body relayed the other answers as they arrived)
+    char *value = read_body(ci, length);
+    if (value == NULL)
+        return -1;
+    if (requester != ni->key && (sendall(ni->succ_fd, buffer, strlen(buffer)) != 0 || sendall(ni->succ_fd, value, length) != 0))
+        puts("\x1b[31m[!] Couldn't resend the message\033[m");
+    cache_object(search_key, value, length, version, lease / 1000.0, ni);
+    if (requester == ni->key) {
+        int key = get_associated_key(n, ni);
+        if (key == -1)
+            puts("\x1b[33m[!] Received \"BLRGET\" message without requesting it\033[m");
+        else
+            answer_get(n, key, value, length, ni);
+    }
+    free(value);
+    return 0;
+}
+
+/**
+ * @brief Process the revocation of the leases on a key (LREV), which goes around the ring
+ * until it is back at the key's owner
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_lrev_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int origin, key, hops;
+    unsigned long version;
+    if (sscanf(buffer+5, "%u %u %lu %u", &origin, &key, &version, &hops) != 4 || origin > 31 || key > 31) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    if (origin == ni->key) {
+        // Every other node has forgotten the old value
+        return apply_leased_write(key, ni);
+    }
+    revoke_cached(key, version, ni);
+    if (hops > 1 && ni->succ_fd != -1) {
+        char message[64] = "";
+        sprintf(message, "LREV %u %u %lu %u\n", origin, key, version, hops-1);
+        if (sendall(ni->succ_fd, message, strlen(message)) != 0)
+            puts("\x1b[31m[!] Couldn't resend the message\033[m");
+    }
+    return 0;
+}
+
+/**
+ * @brief Execute an operation on an object this node owns and answer the node that asked
+ * for it
+ * 
+ * @param op the operation
+ * @param requester the node that asked
+ * @param n the request's sequence number
+ * @param key the object's key
+ * @param version the version CAS expects
+ * @param operand the operand
+ * @param length its size
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int answer_operation(t_operation op, unsigned int requester, unsigned int n, unsigned int key, unsigned long version, char *operand, size_t length, t_nodeinfo *ni)
+{
+    t_object result;
+    char text[OPERATION_TEXT_SIZE] = "";
+    t_operation_result code;
+    if (recall_operation(op, requester, n, key, &code, &result, ni)) {
+        // The request arrived again (e.g. resent through the successor): only answer it
+        printf("\x1b[33m[*] Request %u of node %u was already executed, answering it again\033[m\n", n, requester);
+        return send_operation_answer(op, requester, n, key, code, &result, ni);
+    }
+    code = execute_operation(op, key, version, operand, length, &result, text, ni);
+    remember_operation(op, requester, n, key, code, &result, ni);
+    return send_operation_answer(op, requester, n, key, code, &result, ni);
+}
+
+/**
+ * @brief Process a request to execute an operation at a key's owner (OP)
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_op_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int key, n, requester;
+    unsigned long version;
+    char name[8] = "", operand[24] = "";
+    t_operation op = OP_INVALID;
+    if (sscanf(buffer+3, "%u %u %u %7s %lu %16[^\n]", &key, &n, &requester, name, &version, operand) < 5
+            || key > 31 || n >= MAX_REQUESTS || requester > 31 || (op = operation_by_name(name)) == OP_INVALID) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    if (!is_owner(key, ni)) {
+        // This message is not meant for this node. Forward it.
+        return send_to_closest(buffer, key, ni) < 0 ? -1 : 0;
+    }
+    return answer_operation(op, requester, n, key, version, operand, strlen(operand), ni);
+}
+
+/**
+ * @brief Process a request to execute an operation at a key's owner, whose operand
+ * follows the message (BOP)
+ * 
+ * @param buffer the message
+ * @param from_fd socket the body is arriving through
+ * @param ci necessary information about the connection the body is arriving through
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_bop_message(char *buffer, int from_fd, t_conn_info *ci, t_nodeinfo *ni)
+{
+    unsigned int key, n, requester;
+    unsigned long version;
+    size_t length;
+    char name[8] = "";
+    t_operation op = OP_INVALID;
+    if (sscanf(buffer+4, "%u %u %u %7s %lu %zu", &key, &n, &requester, name, &version, &length) != 6
+            || key > 31 || n >= MAX_REQUESTS || requester > 31 || (op = operation_by_name(name)) == OP_INVALID) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    // This node owns the key (route_body relayed the other requests as they arrived)
+    char *operand = read_body(ci, length);
+    if (operand == NULL)
+        return -1;
+    int result = answer_operation(op, requester, n, key, version, operand, length, ni);
+    free(operand);
+    return result;
+}
+
+/**
+ * @brief Pass the answer of an operation on to the client that asked for it
+ * 
+ * @param n the request's sequence number
+ * @param op the operation
+ * @param code whether the operation was done
+ * @param version the object's version
+ * @param value the answer (NULL if there is none)
+ * @param length its size
+ * @param ni necessary information about the node
+ */
+void operation_answered(unsigned int n, t_operation op, int code, unsigned long version, char *value, size_t length, t_nodeinfo *ni)
+{
+    int key = get_associated_key(n, ni);
+    if (key == -1) {
+        puts("\x1b[33m[!] Received \"ROP\" message without requesting it\033[m");
+        return;
+    }
+    reply_operation(ni->request_client[n], ni->request_tag[n], key, op, code, version, value, length, ni);
+    drop_request(n, ni);
+}
+
+/**
+ * @brief Process the answer of an operation executed at a key's owner (ROP)
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_rop_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int requester, n, key;
+    unsigned long version;
+    int code;
+    char name[8] = "", value[24] = "";
+    t_operation op = OP_INVALID;
+    if (sscanf(buffer+4, "%u %u %u %7s %d %lu %16[^\n]", &requester, &n, &key, name, &code, &version, value) < 6
+            || requester > 31 || n >= MAX_REQUESTS || key > 31 || (op = operation_by_name(name)) == OP_INVALID) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    if (requester != ni->key) {
+        // This message is not meant for this node. Forward it.
+        return send_to_closest(buffer, requester, ni) < 0 ? -1 : 0;
+    }
+    operation_answered(n, op, code, version, strlen(value) ? value : NULL, strlen(value), ni);
+    return 0;
+}
+
+/**
+ * @brief Process the answer of an operation executed at a key's owner, which follows
+ * the message (BROP)
+ * 
+ * @param buffer the message
+ * @param from_fd socket the body is arriving through
+ * @param ci necessary information about the connection the body is arriving through
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_brop_message(char *buffer, int from_fd, t_conn_info *ci, t_nodeinfo *ni)
+{
+    unsigned int requester, n, key;
+    unsigned long version;
+    int code;
+    size_t length;
+    char name[8] = "";
+    t_operation op = OP_INVALID;
+    if (sscanf(buffer+5, "%u %u %u %7s %d %lu %zu", &requester, &n, &key, name, &code, &version, &length) != 7
+            || requester > 31 || n >= MAX_REQUESTS || key > 31 || (op = operation_by_name(name)) == OP_INVALID) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    // This message is meant for this node (route_body relayed the others as they arrived)
+    char *value = read_body(ci, length);
+    if (value == NULL)
+        return -1;
+    operation_answered(n, op, code, version, value, length, ni);
+    free(value);
+    return 0;
+}
+
+int send_handoff(int fd, unsigned int keys, t_nodeinfo *ni)
+{
+    // Writes held back by leases go along with their keys
+    for (unsigned int key = 0; key < 32; key++) {
+        if (keys & ni->leased_writes & (1u << key))
+            apply_leased_write(key, ni);
+    }
+
+    char *batch = (char*) malloc(HANDOFF_BATCH_SIZE);
+    if (batch == NULL)
+        return -1;
+    size_t batch_size = 0;
+
+    ni->handoff_n++;
+    ni->handoff_keys = keys;
+    gettimeofday(&ni->handoff_timestamp, NULL);
+
+    int result = 0;
+    unsigned int count = 0;
+    for (unsigned int key = 0; key < 32 && result == 0; key++) {
+        // The objects go as they are stored, compressed or not
+        t_object *object = get_stored_object(key, ni);
+        if (!(keys & (1u << key)) || object == NULL)
+            continue;
+
+        char header[64] = "";
+        size_t header_size = sprintf(header, "XSET %u %u %zu %lu %lu %zu\n", ni->handoff_n, key, object->length, object->version, ttl_ms(key, ni), object->size);
+        if (batch_size + header_size + object->length > HANDOFF_BATCH_SIZE && batch_size > 0) {
+            // Batch is full, send it
+            result = sendall(fd, batch, batch_size);
+            batch_size = 0;
+        }
+        if (header_size + object->length > HANDOFF_BATCH_SIZE) {
+            // Too big to be batched, send it by itself
+            if (result == 0)
+                result = sendall(fd, header, header_size);
+            if (result == 0)
+                result = sendall(fd, object->value, object->length);
+        }
+        else {
+            memcpy(batch+batch_size, header, header_size);
+            memcpy(batch+batch_size+header_size, object->value, object->length);
+            batch_size += header_size + object->length;
+        }
+        count++;
+    }
+
+    // The keys' watchers follow them (after their objects)
+    if (result == 0 && batch_size > 0) {
+        result = sendall(fd, batch, batch_size);
+        batch_size = 0;
+    }
+    if (result == 0)
+        result = send_watchers(fd, keys, ni);
+
+    // Let the neighbour know it should acknowledge the whole handoff
+    if (result == 0) {
+        batch_size += sprintf(batch+batch_size, "XEND %u %u\n", ni->handoff_n, count);
+        result = sendall(fd, batch, batch_size);
+    }
+    free(batch);
+
+    if (result != 0) {
+        puts("\x1b[31m[!] Couldn't hand off objects\033[m");
+        ni->handoff_keys = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int wait_for_handoff(t_nodeinfo *ni)
+{
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    while (ni->handoff_keys != 0 && ni->pred_fd != -1) {
+        gettimeofday(&now, NULL);
+        double time_left = HANDOFF_TIMEOUT - (now.tv_sec - start.tv_sec + 1e-6 * (now.tv_usec - start.tv_usec));
+        if (time_left <= 0)
+            break;
+
+        // Whatever is received until then is still handled as usual (the predecessor
+        // may be another virtual node in this process)
+        t_nodeinfo *source;
+        t_event e = select_event(ni, EVERY_WORKER, 0, &source);
+        if (process_background_event(e, source) != 0)
+            return -1;
+    }
+    if (finish_relays(ni) != 0)
+        return -1;
+
+    for (unsigned int key = 0; key < 32; key++) {
+        if (get_stored_object(key, ni) != NULL)
+            return -1;  // Objects are only deleted once the handoff is acknowledged
+    }
+    return 0;
+}
+
+int is_relaying(t_nodeinfo *ni)
+{
+    return (ni->pred_fd != -1 && relaying_body(ni->predecessor)) || (ni->succ_fd != -1 && relaying_body(ni->successor));
+}
+
+void expire_relays(t_nodeinfo *ni)
+{
+    // Both links the body was going through are dropped, as the rest of it is lost
+    if (ni->pred_fd != -1 && relay_idle_time(ni->predecessor) > RELAY_TIMEOUT) {
+        puts("\x1b[31m[!] A message relayed from the predecessor stopped arriving halfway\033[m");
+        int to_fd = stop_relay(ni->predecessor);
+        if (to_fd >= 0)
+            shutdown(to_fd, SHUT_RDWR);
+        shutdown(ni->pred_fd, SHUT_RDWR);
+    }
+    if (ni->succ_fd != -1 && relay_idle_time(ni->successor) > RELAY_TIMEOUT) {
+        puts("\x1b[31m[!] A message relayed from the successor stopped arriving halfway\033[m");
+        int to_fd = stop_relay(ni->successor);
+        if (to_fd >= 0)
+            shutdown(to_fd, SHUT_RDWR);
+        shutdown(ni->succ_fd, SHUT_RDWR);
+    }
+}
+
+int finish_relays(t_nodeinfo *ni)
+{
+    while (1) {
+        int relaying = 0;
+        for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+            expire_relays(vn);
+            relaying = relaying || is_relaying(vn);
+        }
+        if (!relaying)
+            return 0;
+
+        // Only the connections relaying a body are served meanwhile
+        t_nodeinfo *source;
+        t_event e = select_event(ni->first_vnode, EVERY_WORKER, 0, &source);
+        if (process_background_event(e, source) != 0)
+            return -1;
+    }
+}
+
+int process_xset_message(char *buffer, int from_fd, t_conn_info *ci, t_nodeinfo *ni)
+{
+    unsigned int n, key;
+    size_t length, size = 0;
+    unsigned long version = 0, ttl = 0;
+    // A compressed value is smaller than the value itself, which must fit in a message
+    if (sscanf(buffer+5, "%u %u %zu %lu %lu %zu", &n, &key, &length, &version, &ttl, &size) < 3 || key > 31
+            || size > MAX_VALUE_SIZE || (size != 0 && length > size)) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    char *value = read_body(ci, length);
+    if (value == NULL)
+        return -1;
+    // This node is now the object's owner, and its versions (and time to live) go on from
+    // the previous one's
+    if (ttl > 0)
+        schedule_expiry(key, ttl / 1000.0, ni);
+    else
+        cancel_expiry(key, ni);
+    int result = store_received_object(key, value, length, size, ni);
+    free(value);
+    if (result == -1)
+        return -1;
+    if (ni->objects[key].version < version)
+        ni->objects[key].version = version;
+
+    // The predecessor and the successor may be handing off objects at the same time
+    count_handoff_object(ci, n);
+    return 0;
+}
+
+int process_xend_message(char *buffer, int from_fd, t_conn_info *ci, t_nodeinfo *ni)
+{
+    unsigned int n, count;
+    if (sscanf(buffer+5, "%u %u", &n, &count) != 2) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    unsigned int received = take_handoff_count(ci, n);
+    if (received != count)
+        printf("\x1b[33m[!] Received %u out of %u handed off object(s)\033[m\n", received, count);
+    else
+        printf("\x1b[32m[*] Received %u handed off object(s)\033[m\n", received);
+
+    // Acknowledge what was actually stored
+    char message[64] = "";
+    sprintf(message, "XACK %u %u\n", n, received);
+    if (sendall(from_fd, message, strlen(message)) != 0)
+        return -1;
+    return 0;
+}
+
+int process_xack_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int n, count;
+    if (sscanf(buffer+5, "%u %u", &n, &count) != 2) {
+        printf("\x1b[31m[!] Received malformatted message: '%s'\033[m\n", buffer);
+        return -1;
+    }
+    if (n != ni->handoff_n || ni->handoff_keys == 0) {
+        puts("\x1b[33m[!] Received \"XACK\" message for an old handoff\033[m");
+        return 0;
+    }
+
+    unsigned int expected = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if ((ni->handoff_keys & (1u << key)) && get_stored_object(key, ni) != NULL)
+            expected++;
+    }
+    if (count != expected) {
+        // Keep our copies, they'll be handed off again when the ring changes
+        printf("\x1b[31m[!] Neighbour only acknowledged %u out of %u object(s)\033[m\n", count, expected);
+        ni->handoff_keys = 0;
+        return 0;
+    }
+
+    // The neighbour has everything, so our copies (and watchers) can go
+    for (unsigned int key = 0; key < 32; key++) {
+        if ((ni->handoff_keys & (1u << key)) && set_object(key, NULL, 0, ni) == -1)
+            return -1;
+    }
+    ni->fragmented &= ~ni->handoff_keys;
+    drop_watchers(ni->handoff_keys, ni);
+    ni->handoff_keys = 0;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    double time_taken = now.tv_sec - ni->handoff_timestamp.tv_sec + 1e-6 * (now.tv_usec - ni->handoff_timestamp.tv_usec);
+    printf("\x1b[32m[*] Handed off %u object(s) in %.3fms\033[m\n", count, time_taken * 1000);
+    return 0;
+}
+
+int process_repl_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int owner, hops, key;
+    size_t length, size = 0;
+    unsigned long ttl = 0;
+    if (sscanf(buffer+5, "%u %u %u %zu %lu %zu", &owner, &hops, &key, &length, &ttl, &size) < 4 || key > 31
+            || size > MAX_VALUE_SIZE || (size != 0 && length > size)) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    char *value = read_body(ni->predecessor, length);
+    if (value == NULL)
+        return -1;
+
+    if (owner != ni->key && !is_owner(key, ni)) {
+        // Keep a copy (instead of any fragment of it) and pass it along the chain
+        drop_fragment(key, ni);
+        if (set_replica(key, length ? value : NULL, length, size, ni) == -1) {
+            free(value);
+            return -1;
+        }
+        // The copy lives as long as the object (for ever if it no longer has a TTL)
+        if (length > 0 && ttl > 0)
+            ni->replica_expires[key] = seconds_from_now(ttl / 1000.0);
+        else
+            memset(&ni->replica_expires[key], 0, sizeof(struct timeval));
+        send_replica(owner, hops-1, key, length ? value : NULL, length, size, ttl, ni);
+    }
+    free(value);
+    return 0;
+}
+
+/**
+ * @brief Process a copy of a frequently read object given by the successor (HCOPY)
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_hcopy_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int key;
+    unsigned long version, lifetime;
+    size_t length;
+    if (sscanf(buffer+6, "%u %lu %lu %zu", &key, &version, &lifetime, &length) != 4 || key > 31) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (successor): '%s'\033[m\n", ni->succ_ip, ni->succ_port, buffer);
+        return -1;
+    }
+    char *value = read_body(ni->successor, length);
+    if (value == NULL)
+        return -1;
+    if (!is_owner(key, ni) && set_hot_copy(key, length ? value : NULL, length, version, lifetime / 1000.0, ni) != 0)
+        puts("\x1b[31m[!] Couldn't store the copy of a hot object\033[m");
+    free(value);
+    return 0;
+}
+
+/**
+ * @brief Process the news that an object has changed from the successor (HINV), which
+ * makes the copy of it this node has (and the ones it gave away) out of date
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_hinv_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int key;
+    unsigned long version;
+    if (sscanf(buffer+5, "%u %lu", &key, &version) != 2 || key > 31) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (successor): '%s'\033[m\n", ni->succ_ip, ni->succ_port, buffer);
+        return -1;
+    }
+    if (ni->hot_copies[key].valid && ni->hot_copies[key].object.version < version)
+        drop_hot_copy(key, ni);
+    invalidate_hot_copies(key, version, ni);
+    return 0;
+}
+
+/**
+ * @brief Take over the objects owned by a predecessor that has failed, using
+ * the replicas this node holds
+ * 
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int promote_replicas(t_nodeinfo *ni)
+{
+    unsigned int count = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        t_object *replica = get_stored_replica(key, ni);
+        // Only the keys that belonged to the predecessor
+        if (replica == NULL || ring_distance(ni->pred_id, key) >= ring_distance(ni->pred_id, ni->key))
+            continue;
+        // The object lives as long as it would have at its previous owner
+        if (ni->replica_expires[key].tv_sec != 0)
+            schedule_expiry(key, seconds_until(ni->replica_expires[key]), ni);
+        if (store_received_object(key, replica->value, replica->length, replica->size, ni) == -1)
+            return -1;
+        count++;
+    }
+    if (count)
+        printf("\x1b[32m[*] Promoted %u replica(s) of the predecessor's objects\033[m\n", count);
+
+    // The objects kept as fragments have to be put back together first
+    for (unsigned int key = 0; key < 32; key++) {
+        if (ni->fragments[key].data != NULL && get_stored_replica(key, ni) == NULL
+                && ring_distance(ni->pred_id, key) < ring_distance(ni->pred_id, ni->key) && start_rebuild(key, ni) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Hand the objects this node doesn't own (e.g. promoted replicas) to its new predecessor
+ * 
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int return_objects(t_nodeinfo *ni)
+{
+    unsigned int keys = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if (get_stored_object(key, ni) != NULL && !is_owner(key, ni))
+            keys |= 1u << key;
+    }
+    if (keys == 0 || ni->pred_fd == -1 || ni->pred_id == ni->key)
+        return 0;  // Nothing to hand off (or this is the only node left in the ring)
+    return send_handoff(ni->pred_fd, keys, ni);
+}
+
+/**
+ * @brief Process a fragment of an object from the predecessor (FRAG) that is meant for this
+ * node, keeping it (route_body already passed the others along the chain)
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_frag_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int owner, hops, key;
+    unsigned long ttl;
+    t_fragment fragment = { NULL, 0, 0, 0, 0, 0, 0, { 0, 0 } };
+    if (parse_frag_message(buffer, &owner, &hops, &key, &fragment, &ttl) != 0) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    size_t size = fragment_size(fragment.length, fragment.k);
+    fragment.data = read_body(ni->predecessor, size);
+    if (fragment.data == NULL)
+        return -1;
+    int result = keep_fragment(key, &fragment, ni);
+    free(fragment.data);
+    return result;
+}
+
+/**
+ * @brief Process the news from the predecessor that an object is no longer kept as
+ * fragments (FDROP)
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_fdrop_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int owner, hops, key;
+    if (sscanf(buffer+6, "%u %u %u", &owner, &hops, &key) != 3 || key > 31) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    if (owner == ni->key || is_owner(key, ni))
+        return 0;
+    drop_fragment(key, ni);
+    if (hops <= 1 || ni->succ_fd == -1 || ni->succ_id == owner)
+        return 0;
+
+    char message[64] = "";
+    sprintf(message, "FDROP %u %u %u\n", owner, hops-1, key);
+    return sendall(ni->succ_fd, message, strlen(message)) != 0 ? -1 : 0;
+}
+
+/**
+ * @brief Process a request for the fragments of an object being rebuilt by a predecessor
+ * (FGET), answering it with the fragment held (FRSP, back through the predecessors) and
+ * passing it along the chain
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_fget_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int requester, hops, key;
+    uint64_t hash;
+    if (sscanf(buffer+5, "%u %u %u %" SCNx64, &requester, &hops, &key, &hash) != 4 || key > 31) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+        return -1;
+    }
+    if (requester == ni->key)
+        return 0;
+
+    // Pass it on first, so that the successors look for their fragments meanwhile
+    char message[64] = "";
+    if (hops > 1 && ni->succ_fd != -1 && ni->succ_id != requester) {
+        sprintf(message, "FGET %u %u %u %016" PRIx64 "\n", requester, hops-1, key, hash);
+        if (sendall(ni->succ_fd, message, strlen(message)) != 0)
+            puts("\x1b[31m[!] Couldn't resend the message\033[m");
+    }
+
+    t_fragment *fragment = &ni->fragments[key];
+    if (fragment->data == NULL || fragment->hash != hash || ni->pred_fd == -1)
+        return 0;
+    size_t size = fragment_size(fragment->length, fragment->k);
+    sprintf(message, "FRSP %u %u %u %016" PRIx64 " %zu\n", requester, key, fragment->index, hash, size);
+    if (sendall(ni->pred_fd, message, strlen(message)) != 0 || sendall(ni->pred_fd, fragment->data, size) != 0) {
+        puts("\x1b[31m[!] Couldn't send a fragment to the predecessor\033[m");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Process a fragment sent back by a successor (FRSP) that this node asked for,
+ * adding it to the object being rebuilt (route_body already passed the others on to the
+ * predecessor)
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_frsp_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int requester, key, index;
+    uint64_t hash;
+    size_t length;
+    if (sscanf(buffer+5, "%u %u %u %" SCNx64 " %zu", &requester, &key, &index, &hash, &length) != 5 || key > 31
+            || length > MAX_VALUE_SIZE) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (successor): '%s'\033[m\n", ni->succ_ip, ni->succ_port, buffer);
+        return -1;
+    }
+    // Only the fragments of an object still being rebuilt are worth keeping (the others are late)
+    t_rebuild *rebuild = ni->rebuilds[key];
+    if (rebuild == NULL || length != fragment_size(rebuild->value.length, rebuild->value.k))
+        return take_body(ni->successor, length, NULL);
+    char *data = read_body(ni->successor, length);
+    if (data == NULL)
+        return -1;
+    int result = add_fragment(key, index, hash, data, length, ni);
+    free(data);
+    // A new predecessor may have shown up while the object was being rebuilt
+    if (result == 1 && !is_owner(key, ni) && ni->handoff_keys == 0)
+        return return_objects(ni);
+    return result < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Send the successor the hashes of the largest subtrees (under a node of the Merkle
+ * tree) that only cover keys owned by this node
+ * 
+ * @param node index of the node of the Merkle tree
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int send_owned_subtrees(unsigned int node, t_nodeinfo *ni)
+{
+    unsigned int first = merkle_first_key(node), count = merkle_key_count(node), owned = 0;
+    for (unsigned int key = first; key < first+count; key++)
+        owned += is_owner(key, ni);
+    if (owned == 0)
+        return 0;
+    if (owned < count)
+        return send_owned_subtrees(2*node, ni) != 0 || send_owned_subtrees(2*node+1, ni) != 0 ? -1 : 0;
+
+    char message[64] = "";
+    sprintf(message, "MHASH %u %016" PRIx64 "\n", node, ni->object_tree.nodes[node]);
+    return sendall(ni->succ_fd, message, strlen(message)) != 0 ? -1 : 0;
+}
+
+/**
+ * @brief Tell the successors past the end of this node's replication chain to drop the
+ * replicas they still have of its objects (RTRIM): nodes that joined the ring push the
+ * ones further along out of the chain, and nothing else would update their copies
+ * 
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int trim_replicas(t_nodeinfo *ni)
+{
+    unsigned int keys = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if (is_owner(key, ni))
+            keys |= 1u << key;
+    }
+
+    char message[64] = "";
+    sprintf(message, "RTRIM %u %u %x\n", ni->key, ni->replication, keys);
+    return sendall(ni->succ_fd, message, strlen(message)) != 0 ? -1 : 0;
+}
+
+int run_anti_entropy(t_nodeinfo *ni)
 {
-    unsigned int search_key, n, key, port;
-    char ipaddr[INET_ADDRSTRLEN] = "";
-    t_msginfotype mi = get_fnd_or_rsp_or_get_message_info(buffer, &key, &n, &search_key, ipaddr, &port);
-    if (mi != MI_SUCCESS) {
-        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+    if (ni->replication == 0 || ni->succ_fd == -1 || ni->succ_id == ni->key)
+        return 0;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    double time_taken = now.tv_sec - ni->sync_timestamp.tv_sec + 1e-6 * (now.tv_usec - ni->sync_timestamp.tv_usec);
+    if (time_taken < ANTI_ENTROPY_INTERVAL)
+        return 0;
+    ni->sync_timestamp = now;
+
+    // The successor compares these with its replicas and asks for whatever differs
+    if (send_owned_subtrees(1, ni) != 0)
         return -1;
-    }
-    if (key == ni->key) {
-        // This message is meant for this node. Process it
-        if (process_found_key(search_key, n, ipaddr, port, ni) != 0)
-            return -1;
-    }
-    else {
-        // This message is not meant for this node. Forward it.
-        int result = send_to_closest(buffer, key, ni);
-        if (result < 0)
-            return -1;
-    }
-    return 0;
+    return trim_replicas(ni);
 }
 
-int process_get_message(char *buffer, size_t buffer_size, t_nodeinfo *ni)
+int process_mhash_message(char *buffer, t_nodeinfo *ni)
 {
-    unsigned int search_key, n, key, port;
-    char ipaddr[INET_ADDRSTRLEN] = "";
-    t_msginfotype mi = get_fnd_or_rsp_or_get_message_info(buffer, &search_key, &n, &key, ipaddr, &port);
-    if (mi != MI_SUCCESS) {
+    unsigned int node;
+    uint64_t hash;
+    if (sscanf(buffer+6, "%u %" SCNx64, &node, &hash) != 2 || node < 1 || node > 63) {
         printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
         return -1;
     }
-    if (ring_distance(ni->key, search_key) <= ring_distance(ni->succ_id, search_key)) {
-        // This node has this object; forward its value
-        char message[64] = "";
-        char *object = get_object(search_key, ni);
+    if (ni->replica_tree.nodes[node] == hash)
+        return 0;  // Replicas are up to date
 
-        puts("\x1b[33m[*] Found the object!\033[m");
-        sprintf(message, "RGET %u %u %u %s\n", key, n, search_key, object != NULL ? object : "");
-        int result = send_to_closest(message, key, ni);
-        if (result < 0)
-            return -1;
-    }
-    else {
-        // This message is not meant for this node. Forward it.
-        int result = send_to_closest(buffer, search_key, ni);
-        if (result < 0)
-            return -1;
+    char message[64] = "";
+    if (node >= 32) {
+        // Ask for the object itself
+        if (is_owner(node-32, ni))
+            return 0;
+        sprintf(message, "MPULL %u\n", node-32);
     }
-    return 0;
+    else
+        // Narrow the difference down
+        sprintf(message, "MDIFF %u\n", node);
+    return sendall(ni->pred_fd, message, strlen(message)) != 0 ? -1 : 0;
 }
 
-int process_rget_message(char *buffer, size_t buffer_size, t_nodeinfo *ni)
+/**
+ * @brief Process a RTRIM message: the nodes in the owner's replication chain pass it on,
+ * and the ones past its end drop their (stale) replicas of the owner's objects, passing
+ * it on as long as they had any
+ * 
+ * @param buffer the message
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_rtrim_message(char *buffer, t_nodeinfo *ni)
 {
-    unsigned int search_key, n, key;
-    char value[24] = "";
-    t_msginfotype mi = get_rget_or_set_message_info(buffer+5, &key, &n, &search_key, value);
-    if (mi != MI_SUCCESS) {
+    unsigned int owner, hops, keys;
+    if (sscanf(buffer+6, "%u %u %x", &owner, &hops, &keys) != 3 || owner > 31) {
         printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
         return -1;
     }
-    if (key == ni->key) {
-        // This message is meant for this node. Process it
-        int key = get_associated_key(n, ni);
-        if (key == -1) {
-            puts("\x1b[33m[!] Received \"RSP\" message without requesting it\033[m");
-            return -1;
+    if (owner == ni->key)
+        return 0;  // Went around the whole ring
+
+    if (hops == 0) {
+        // This node is no longer among the owner's successors
+        unsigned int dropped = 0;
+        for (unsigned int key = 0; key < 32; key++) {
+            if ((keys & (1u << key)) == 0 || is_owner(key, ni) || ni->replicas[key].value == NULL)
+                continue;
+            set_replica(key, NULL, 0, 0, ni);
+            dropped++;
         }
-        if (strlen(value) == 0)
-            printf("%d -> NULL\n", key);
-        else
-            printf("%d -> \"%s\"\n", key, value);
-        drop_request(n, ni);
+        if (dropped == 0)
+            return 0;  // The successors don't have any either
+        printf("\x1b[33m[*] Dropped %u stale replica(s) of node %u's objects\033[m\n", dropped, owner);
     }
-    else {
-        // This message is not meant for this node. Forward it.
-        int result = send_to_closest(buffer, key, ni);
-        if (result < 0)
-            return -1;
+    if (ni->succ_fd == -1 || ni->succ_id == owner)
+        return 0;
+
+    char message[64] = "";
+    sprintf(message, "RTRIM %u %u %x\n", owner, hops > 0 ? hops-1 : 0, keys);
+    return sendall(ni->succ_fd, message, strlen(message)) != 0 ? -1 : 0;
+}
+
+int process_mdiff_message(char *buffer, t_nodeinfo *ni)
+{
+    unsigned int node;
+    if (sscanf(buffer+6, "%u", &node) != 1 || node < 1 || node > 31) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (successor): '%s'\033[m\n", ni->succ_ip, ni->succ_port, buffer);
+        return -1;
     }
+    if (send_owned_subtrees(2*node, ni) != 0 || send_owned_subtrees(2*node+1, ni) != 0)
+        return -1;
     return 0;
 }
 
-int process_set_message(char *buffer, size_t buffer_size, int from_successor, t_nodeinfo *ni)
+int process_mpull_message(char *buffer, t_nodeinfo *ni)
 {
-    unsigned int search_key, n, key;
-    char value[24] = "";
-    t_msginfotype mi = get_rget_or_set_message_info(buffer+4, &search_key, &n, &key, value);
-    if (mi != MI_SUCCESS) {
-        printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
+    unsigned int key;
+    if (sscanf(buffer+6, "%u", &key) != 1 || key > 31) {
+        printf("\x1b[31m[!] Received malformatted message from %s:%d (successor): '%s'\033[m\n", ni->succ_ip, ni->succ_port, buffer);
         return -1;
     }
-    // printf("search_key=%u key=%u\n", search_key, key);
-    if (ni->succ_fd == -1 || from_successor || ring_distance(ni->key, search_key) <= ring_distance(ni->succ_id, search_key)) {
-        // This node has this object; set its value
-        if (strlen(value) == 0) {
-            if (set_object(search_key, NULL, ni) == -1)
-                return -1;
-        }
-        else {
-            if (set_object(search_key, value, ni) == -1)
-                return -1;
-        }
-    }
-    else {
-        // This message is not meant for this node. Forward it.
-        int result = send_to_closest(buffer, search_key, ni);
-        if (result < 0)
-            return -1;
-    }
-    return 0;
+    if (!is_owner(key, ni))
+        return 0;
+
+    printf("\x1b[33m[*] Repairing successor's replica of key %u\033[m\n", key);
+    return replicate_object(key, ni);
 }
 
 int redestribute_objects(t_nodeinfo *ni)
 {
-    char message[64] = "";
+    unsigned int keys = 0;
     for (unsigned int i = 0; i < 32; i++) {
-        if (ni->objects[i] != NULL && ring_distance(ni->key, i) > ring_distance(ni->succ_id, i)) {
-            sprintf(message, "SET %u %u %u %s\n", i, ni->find_n, ni->key, ni->objects[i]);
-            free(ni->objects[i]);
-            ni->objects[i] = NULL;
-            int result = send_to_closest(message, i, ni);
-            if (result < 0)
-                return result;
-            ni->find_n++;
-            ni->find_n %= 100;
-        }
+        if (get_stored_object(i, ni) != NULL && ring_distance(ni->key, i) > ring_distance(ni->succ_id, i))
+            keys |= 1u << i;
     }
-    return 0;
+    if (keys == 0)
+        return 0;
+
+    // These objects now belong to the new successor
+    return send_handoff(ni->succ_fd, keys, ni);
 }
 
 int process_message_successor(t_nodeinfo *ni)
 {
     // This is the internal buffer that keep track of what has been
     // sent through ni->succ_fd
-    static char buffer[64];
-    // This is the current size of the internal buffer
-    static size_t buffer_size = 0;
+    char *buffer = ni->succ_buffer;
 
-    t_read_out ro = process_incoming(&ni->succ_fd, buffer, &buffer_size, sizeof(buffer), ni->successor);
+    t_read_out ro = process_incoming(&ni->succ_fd, buffer, &ni->succ_buffer_size, sizeof(ni->succ_buffer), ni->successor, ni);
     if (ro.read_type == RO_ERROR)
         return ro.error_code;
     if (ro.read_type == RO_DISCONNECT) {
@@ -408,24 +2497,95 @@ int process_message_successor(t_nodeinfo *ni)
             // This is a two-node network
             ni->pred_fd = -1;
         }
-        reset_pmt(&buffer_size, &ni->succ_fd);
+        reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
         return 0;
     }
 
-    if (buffer[buffer_size-1] != '\n') {
+    if (ro.read_type == RO_PARTIAL) {
+        // The rest of the message's body is still on its way (or only passes through)
+        return 0;
+    }
+
+    if (buffer[ni->succ_buffer_size-1] != '\n') {
         // We might not have received the whole message yet
         return 0;
     }
 
     if (strncmp(buffer, "SET ", 4) == 0) {
-        if (process_set_message(buffer, buffer_size, 1, ni) != 0)
-            reset_pmt(&buffer_size, &ni->pred_fd);
-        buffer_size = 0;
+        if (process_set_message(buffer, ni->succ_buffer_size, 1, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->pred_fd);
+        ni->succ_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "BSET ", 5) == 0) {
+        if (process_bset_message(buffer, ni->succ_fd, ni->successor, 1, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
+        ni->succ_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "MSET ", 5) == 0) {
+        if (process_mset_message(buffer, ni->succ_fd, ni->successor, 1, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
+        ni->succ_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "XSET ", 5) == 0) {
+        if (process_xset_message(buffer, ni->succ_fd, ni->successor, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
+        ni->succ_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "XWATCH ", 7) == 0) {
+        if (process_watch_message(buffer, 1, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
+        ni->succ_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "XEND ", 5) == 0) {
+        if (process_xend_message(buffer, ni->succ_fd, ni->successor, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
+        ni->succ_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "XACK ", 5) == 0) {
+        if (process_xack_message(buffer, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
+        ni->succ_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "HCOPY ", 6) == 0) {
+        if (process_hcopy_message(buffer, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
+        ni->succ_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "HINV ", 5) == 0) {
+        if (process_hinv_message(buffer, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
+        ni->succ_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "MDIFF ", 6) == 0) {
+        if (process_mdiff_message(buffer, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
+        ni->succ_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "MPULL ", 6) == 0) {
+        if (process_mpull_message(buffer, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
+        ni->succ_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "FRSP ", 5) == 0) {
+        if (process_frsp_message(buffer, ni) != 0)
+            reset_pmt(&ni->succ_buffer_size, &ni->succ_fd);
+        ni->succ_buffer_size = 0;
         return 0;
     }
     else {
         // Message is invalid
-        reset_pmt(&buffer_size, &ni->pred_fd);
+        reset_pmt(&ni->succ_buffer_size, &ni->pred_fd);
         printf("\x1b[31m[!] Discarded message: length, termination or header ('%s')\033[m\n", buffer);
         return 0;
     }
@@ -437,11 +2597,9 @@ int process_message_predecessor(t_nodeinfo *ni)
 {
     // This is the internal buffer that keep track of what has been
     // sent through ni->pred_fd
-    static char buffer[64];
-    // This is the current size of the internal buffer
-    static size_t buffer_size = 0;
+    char *buffer = ni->pred_buffer;
 
-    t_read_out ro = process_incoming(&ni->pred_fd, buffer, &buffer_size, sizeof(buffer), ni->predecessor);
+    t_read_out ro = process_incoming(&ni->pred_fd, buffer, &ni->pred_buffer_size, sizeof(ni->pred_buffer), ni->predecessor, ni);
     if (ro.read_type == RO_ERROR)
         return ro.error_code;
     if (ro.read_type == RO_DISCONNECT) {
@@ -453,16 +2611,23 @@ int process_message_predecessor(t_nodeinfo *ni)
                 // This is a two-node network
                 ni->succ_fd = -1;
             }
-            reset_pmt(&buffer_size, &ni->pred_fd);
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+            if (promote_replicas(ni) != 0)
+                return -1;
         }
         else {
             puts("I disconnected");
-            reset_pmt(&buffer_size, &ni->pred_fd);
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
         }
         return 0;
     }
 
-    if (buffer[buffer_size-1] != '\n') {
+    if (ro.read_type == RO_PARTIAL) {
+        // The rest of the message's body is still on its way (or only passes through)
+        return 0;
+    }
+
+    if (buffer[ni->pred_buffer_size-1] != '\n') {
         // We might not have received the whole message yet
         return 0;
     }
@@ -473,7 +2638,7 @@ int process_message_predecessor(t_nodeinfo *ni)
         t_msginfotype mi = get_self_or_pred_message_info(buffer, &node_i, node_ip, &node_port);
         if (mi != MI_SUCCESS) {
             printf("\x1b[31m[!] Received malformatted message from %s:%d (predecessor): '%s'\033[m\n", ni->pred_ip, ni->pred_port, buffer);
-            reset_pmt(&buffer_size, &ni->temp_fd);
+            reset_pmt(&ni->pred_buffer_size, &ni->temp_fd);
             return 0;
         }
 
@@ -489,7 +2654,7 @@ int process_message_predecessor(t_nodeinfo *ni)
             return -1;
         }
 
-        buffer_size = 0;
+        ni->pred_buffer_size = 0;
         ni->pred_id = node_i;
 
         // Message to be sent
@@ -509,43 +2674,233 @@ int process_message_predecessor(t_nodeinfo *ni)
             // Client disconnected
             puts("\x1b[31m[!] New predecessor has disconnected abruptly (ring is broken)\033[m");
             if (ni->pred_fd >= 0)
-                reset_pmt(&buffer_size, &ni->pred_fd);
+                reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
             return 0;
         }
+
+        // Objects taken over from a failed predecessor belong to the new one
+        if (return_objects(ni) != 0)
+            return -1;
     }
     else if (strncmp(buffer, "FND ", 4) == 0) {
-        if (process_fnd_message(buffer, buffer_size, ni) != 0)
-            reset_pmt(&buffer_size, &ni->pred_fd);
-        buffer_size = 0;
+        if (process_fnd_message(buffer, ni->pred_buffer_size, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
         return 0;
     }
     else if (strncmp(buffer, "RSP ", 4) == 0) {
-        if (process_rsp_message(buffer, buffer_size, ni) != 0)
-            reset_pmt(&buffer_size, &ni->pred_fd);
-        buffer_size = 0;
+        if (process_rsp_message(buffer, ni->pred_buffer_size, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
         return 0;
     }
     else if (strncmp(buffer, "GET ", 4) == 0) {
-        if (process_get_message(buffer, buffer_size, ni) != 0)
-            reset_pmt(&buffer_size, &ni->pred_fd);
-        buffer_size = 0;
+        if (process_get_message(buffer, ni->pred_buffer_size, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
         return 0;
     }
     else if (strncmp(buffer, "SET ", 4) == 0) {
-        if (process_set_message(buffer, buffer_size, 0, ni) != 0)
-            reset_pmt(&buffer_size, &ni->pred_fd);
-        buffer_size = 0;
+        if (process_set_message(buffer, ni->pred_buffer_size, 0, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
         return 0;
     }
     else if (strncmp(buffer, "RGET ", 5) == 0) {
-        if (process_rget_message(buffer, buffer_size, ni) != 0)
-            reset_pmt(&buffer_size, &ni->pred_fd);
-        buffer_size = 0;
+        if (process_rget_message(buffer, ni->pred_buffer_size, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "BSET ", 5) == 0) {
+        if (process_bset_message(buffer, ni->pred_fd, ni->predecessor, 0, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "BRGET ", 6) == 0) {
+        if (process_brget_message(buffer, ni->pred_fd, ni->predecessor, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "LRGET ", 6) == 0) {
+        if (process_lrget_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "BLRGET ", 7) == 0) {
+        if (process_blrget_message(buffer, ni->pred_fd, ni->predecessor, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "LREV ", 5) == 0) {
+        if (process_lrev_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "OP ", 3) == 0) {
+        if (process_op_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "BOP ", 4) == 0) {
+        if (process_bop_message(buffer, ni->pred_fd, ni->predecessor, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "SACK ", 5) == 0) {
+        if (process_sack_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "ROP ", 4) == 0) {
+        if (process_rop_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "BROP ", 5) == 0) {
+        if (process_brop_message(buffer, ni->pred_fd, ni->predecessor, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "MGET ", 5) == 0) {
+        if (process_mget_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "MRGET ", 6) == 0) {
+        if (process_mrget_message(buffer, ni->pred_fd, ni->predecessor, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "MSET ", 5) == 0) {
+        if (process_mset_message(buffer, ni->pred_fd, ni->predecessor, 0, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "MFND ", 5) == 0) {
+        if (process_mfnd_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "SCAN ", 5) == 0) {
+        if (process_scan_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "SCEND ", 6) == 0) {
+        if (process_scend_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "WATCH ", 6) == 0) {
+        if (process_watch_message(buffer, 0, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "UNWATCH ", 8) == 0) {
+        if (process_unwatch_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "NOTE ", 5) == 0) {
+        if (process_note_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "BNOTE ", 6) == 0) {
+        if (process_bnote_message(buffer, ni->pred_fd, ni->predecessor, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "MRSP ", 5) == 0) {
+        if (process_mrsp_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "REPL ", 5) == 0) {
+        if (process_repl_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "MHASH ", 6) == 0) {
+        if (process_mhash_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "RTRIM ", 6) == 0) {
+        if (process_rtrim_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "FRAG ", 5) == 0) {
+        if (process_frag_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "FDROP ", 6) == 0) {
+        if (process_fdrop_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "FGET ", 5) == 0) {
+        if (process_fget_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "XSET ", 5) == 0) {
+        if (process_xset_message(buffer, ni->pred_fd, ni->predecessor, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "XWATCH ", 7) == 0) {
+        if (process_watch_message(buffer, 1, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "XEND ", 5) == 0) {
+        if (process_xend_message(buffer, ni->pred_fd, ni->predecessor, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
+        return 0;
+    }
+    else if (strncmp(buffer, "XACK ", 5) == 0) {
+        if (process_xack_message(buffer, ni) != 0)
+            reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
+        ni->pred_buffer_size = 0;
         return 0;
     }
     else {
         // Message is invalid
-        reset_pmt(&buffer_size, &ni->pred_fd);
+        reset_pmt(&ni->pred_buffer_size, &ni->pred_fd);
         printf("\x1b[31m[!] Discarded message: length, termination or header ('%s')\033[m\n", buffer);
         return 0;
     }
@@ -557,21 +2912,23 @@ int process_message_temp(t_nodeinfo *ni)
 {
     // This is the internal buffer that keep track of what has been
     // sent through ni->temp_fd
-    static char buffer[64];
-
-    // This is the current size of the internal buffer
-    static size_t buffer_size = 0;
+    char *buffer = ni->temp_buffer;
 
     // Receive message and update buffer
-    t_read_out ro = process_incoming(&ni->temp_fd, buffer, &buffer_size, sizeof(buffer), ni->temp);
+    t_read_out ro = process_incoming(&ni->temp_fd, buffer, &ni->temp_buffer_size, sizeof(ni->temp_buffer), ni->temp, ni);
     if (ro.read_type == RO_ERROR)
         return ro.error_code;
     if (ro.read_type == RO_DISCONNECT) {
-        reset_pmt(&buffer_size, &ni->temp_fd);
+        reset_pmt(&ni->temp_buffer_size, &ni->temp_fd);
+        return 0;
+    }
+
+    if (ro.read_type == RO_PARTIAL) {
+        // The rest of the message's body is still on its way
         return 0;
     }
 
-    if (buffer[buffer_size-1] != '\n') {
+    if (buffer[ni->temp_buffer_size-1] != '\n') {
         // We might not have received the whole message yet
         return 0;
     }
@@ -579,7 +2936,7 @@ int process_message_temp(t_nodeinfo *ni)
     // Message should be of the format <SELF i i.IP i.port\n>
     if (strncmp(buffer, "SELF ", 5) != 0) {
         // Message is invalid
-        reset_pmt(&buffer_size, &ni->temp_fd);
+        reset_pmt(&ni->temp_buffer_size, &ni->temp_fd);
         puts("\x1b[31m[!] Discarded message: length, termination or header\033[m");
         return 0;
     }
@@ -589,12 +2946,12 @@ int process_message_temp(t_nodeinfo *ni)
     t_msginfotype mi = get_self_or_pred_message_info(buffer, &node_i, node_ip, &node_port);
     if (mi != MI_SUCCESS) {
         puts("\x1b[31m[!] Received malformatted message\033[m");
-        reset_pmt(&buffer_size, &ni->temp_fd);
+        reset_pmt(&ni->temp_buffer_size, &ni->temp_fd);
         return 0;
     }
 
     printf("\x1b[32m[*] Received \"SELF\" message, setting node %d (%s:%d) as successor\033[m\n", node_i, node_ip, node_port);
-    buffer_size = 0;
+    ni->temp_buffer_size = 0;
 
     // Message to be sent
     char message[64] = "";
@@ -616,7 +2973,7 @@ int process_message_temp(t_nodeinfo *ni)
             if (ni->succ_fd >= 0)
                 close(ni->succ_fd);
             ni->succ_fd = -1;
-            reset_pmt(&buffer_size, &ni->temp_fd);
+            reset_pmt(&ni->temp_buffer_size, &ni->temp_fd);
             return -1;
         }
     }
@@ -637,7 +2994,7 @@ int process_message_temp(t_nodeinfo *ni)
                 // Error: couldn't establish connection
                 // This is still recoverable as there is only one node in the ring
                 printf("\x1b[33m[!] Couldn't establish connection to new predecessor\033[m\n");
-                reset_pmt(&buffer_size, &ni->temp_fd);
+                reset_pmt(&ni->temp_buffer_size, &ni->temp_fd);
                 return 0;
             }
             
@@ -653,7 +3010,7 @@ int process_message_temp(t_nodeinfo *ni)
                 if (ni->pred_fd >= 0)
                     close(ni->pred_fd);
                 ni->pred_fd = -1;
-                reset_pmt(&buffer_size, &ni->temp_fd);
+                reset_pmt(&ni->temp_buffer_size, &ni->temp_fd);
                 return 0;
             }
             else if (result > 0) {
@@ -661,7 +3018,7 @@ int process_message_temp(t_nodeinfo *ni)
                 if (ni->pred_fd >= 0)
                     close(ni->pred_fd);
                 ni->pred_fd = -1;
-                reset_pmt(&buffer_size, &ni->temp_fd);
+                reset_pmt(&ni->temp_buffer_size, &ni->temp_fd);
                 return -1;
             }
         }
@@ -686,6 +3043,10 @@ int process_message_temp(t_nodeinfo *ni)
 
     reset_conn_buffer(ni->temp);   
     ni->temp_fd = -1;
+    // The replication chain changed: sync (and trim) the replicas right away, and try
+    // erasure coding again
+    memset(&ni->sync_timestamp, 0, sizeof(struct timeval));
+    ni->ec_fallback = 0;
 
     if (redestribute_objects(ni) < 0)
         return -1;
@@ -693,25 +3054,45 @@ int process_message_temp(t_nodeinfo *ni)
     return 0;
 }
 
-int process_message_udp(t_nodeinfo *ni)
+int recv_datagram(int fd, t_datagram *dg)
 {
-    struct addrinfo sender;
-    struct sockaddr_in addr;
-    sender.ai_addr = (struct sockaddr*) &addr;
-    sender.ai_addrlen = sizeof(addr);
-
-    char buffer[64] = "";
-    
-    ssize_t recvd_bytes = recvfrom(ni->udp_fd, buffer, sizeof(buffer) - 1, 0, sender.ai_addr, &sender.ai_addrlen);
+    dg->sender_len = sizeof(dg->sender);
+    dg->acked = 0;
+    ssize_t recvd_bytes = recvfrom(fd, dg->body, MAX_DATAGRAM_SIZE + 1, 0, (struct sockaddr*) &dg->sender, &dg->sender_len);
     if (recvd_bytes == -1) {
         puts("\x1b[31m[!] Error in recvfrom\033[m");
         return -1;
     }
-    if (recvd_bytes >= 63) {
+    if (recvd_bytes > MAX_DATAGRAM_SIZE) {
         // Invalid message
         puts("\x1b[33m[!] Received invalid UDP message\033[m");
     }
-    buffer[recvd_bytes] = '\0';
+    dg->body[recvd_bytes] = '\0';
+    dg->length = recvd_bytes;
+    return 0;
+}
+
+int process_message_udp(t_nodeinfo *ni)
+{
+    t_datagram dg;
+    if (recv_datagram(ni->udp_fd, &dg) != 0)
+        return -1;
+
+    if (ni->workers != NULL && ni == ni->first_vnode) {
+        // This port is shared by every worker, the message may belong to another one's shard
+        return dispatch_datagram(&dg, ni->udp_fd, ni->worker, ni);
+    }
+    return process_datagram(&dg, ni);
+}
+
+int process_datagram(t_datagram *dg, t_nodeinfo *ni)
+{
+    struct addrinfo sender;
+    sender.ai_addr = (struct sockaddr*) &dg->sender;
+    sender.ai_addrlen = dg->sender_len;
+
+    char *buffer = dg->body;
+    ssize_t recvd_bytes = dg->length;
 
     if (strcmp(buffer, "ACK") == 0) {
         t_ongoing_udp_message *msg = pop_udp_message_from(ni, sender.ai_addr);
@@ -725,7 +3106,7 @@ int process_message_udp(t_nodeinfo *ni)
         return 0;
     }
     else {
-        if (udpsend(ni->udp_fd, "ACK", 3, &sender) != 0) {
+        if (!dg->acked && udpsend(ni->udp_fd, "ACK", 3, &sender) != 0) {
             puts("\x1b[33[!] Error acknowledging message\033[m");
             return 0;
         }
@@ -754,6 +3135,63 @@ int process_message_udp(t_nodeinfo *ni)
             process_rget_message(buffer, recvd_bytes+1, ni);
             return 0;
         }
+        else if (strncmp(buffer, "LRGET ", 6) == 0) {
+            strcat(buffer, "\n");
+            process_lrget_message(buffer, ni);
+            return 0;
+        }
+        else if (strncmp(buffer, "OP ", 3) == 0) {
+            strcat(buffer, "\n");
+            process_op_message(buffer, ni);
+            return 0;
+        }
+        else if (strncmp(buffer, "SACK ", 5) == 0) {
+            strcat(buffer, "\n");
+            process_sack_message(buffer, ni);
+            return 0;
+        }
+        else if (strncmp(buffer, "ROP ", 4) == 0) {
+            strcat(buffer, "\n");
+            process_rop_message(buffer, ni);
+            return 0;
+        }
+        else if (strncmp(buffer, "MGET ", 5) == 0) {
+            process_mget_message(buffer, ni);
+            return 0;
+        }
+        else if (strncmp(buffer, "MSET ", 5) == 0) {
+            process_mset_datagram(buffer, recvd_bytes, ni);
+            return 0;
+        }
+        else if (strncmp(buffer, "MFND ", 5) == 0) {
+            process_mfnd_message(buffer, ni);
+            return 0;
+        }
+        else if (strncmp(buffer, "SCAN ", 5) == 0) {
+            strcat(buffer, "\n");
+            process_scan_message(buffer, ni);
+            return 0;
+        }
+        else if (strncmp(buffer, "WATCH ", 6) == 0) {
+            strcat(buffer, "\n");
+            process_watch_message(buffer, 0, ni);
+            return 0;
+        }
+        else if (strncmp(buffer, "UNWATCH ", 8) == 0) {
+            strcat(buffer, "\n");
+            process_unwatch_message(buffer, ni);
+            return 0;
+        }
+        else if (strncmp(buffer, "NOTE ", 5) == 0) {
+            strcat(buffer, "\n");
+            process_note_message(buffer, ni);
+            return 0;
+        }
+        else if (strncmp(buffer, "MRSP ", 5) == 0) {
+            strcat(buffer, "\n");
+            process_mrsp_message(buffer, ni);
+            return 0;
+        }
         else if (strncmp(buffer, "EFND ", 5) == 0) {
             unsigned int key;
             if ((sscanf(buffer+5, "%u", &key) != 1) || key > 31) {
@@ -785,7 +3223,7 @@ int process_message_udp(t_nodeinfo *ni)
             }
 
             ni->find_n++;
-            ni->find_n %= 100;
+            ni->find_n %= MAX_REQUESTS;
             return 0;
         }
         else if (strncmp(buffer, "EPRED ", 6) == 0) {
@@ -804,4 +3242,71 @@ int process_message_udp(t_nodeinfo *ni)
     printf("\x1b[33m[!] Received invalid UDP message: '%s'\033[m\n", buffer);
 
     return 0;
-}
\ No newline at end of file
+}
+
+void check_for_lost_udp_messages(t_nodeinfo *ni)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    t_ongoing_udp_message *aux = ni->udp_message_list, *prev = NULL;
+    while (aux != NULL) {
+        double time_taken = now.tv_sec - aux->timestamp.tv_sec + 1e-6 * (now.tv_usec - aux->timestamp.tv_usec);
+        if (time_taken > 0.025) {
+            // Timeout
+            if (aux->nretries) {
+                aux->nretries--;
+                // Resend
+                // We can ignore the result of udpsend() since aux->nretries will eventually reach 0 
+                printf("\x1b[33m[*] Retrying to send message after %.3fms (%lu attempt(s) remaining)\033[m\n", time_taken * 1000, aux->nretries);
+                struct addrinfo sender;
+                sender.ai_addr = &aux->recipient;
+                sender.ai_addrlen = aux->recipient_size;
+                gettimeofday(&aux->timestamp, NULL);
+                udpsend(ni->udp_fd, aux->body, aux->length, &sender);
+            }
+            else {
+                // Expire
+
+                if (aux->type == UDPMSG_CHORD) {
+                    // Send message through successor instead
+                    puts("\x1b[33m[!] Failed to send UDP message through chord, trying the successor\033[m");
+                    // A batch of SETs carries its body, which doesn't end in a newline
+                    size_t length = aux->length;
+                    if (strncmp(aux->body, "MSET ", 5) != 0)
+                        aux->body[length++] = '\n';
+                    int result = sendall(ni->succ_fd, aux->body, length);
+                    if (result < 0) {
+                        close(ni->succ_fd);
+                        ni->succ_fd = -1;
+                    }
+                    else if (result > 0) {
+                        // An error occurred
+                        close(ni->succ_fd);
+                        ni->succ_fd = -1;
+                    }
+                }
+                else {
+                    // Nothing to do, drop the message
+                    puts("\x1b[33m[!] Failed to send UDP message to new node\033[m");
+                }
+
+                t_ongoing_udp_message *temp = aux->next;
+                if (prev != NULL)
+                    prev->next = aux->next;
+                else
+                    ni->udp_message_list = aux->next;
+
+                aux->next = NULL;
+                free_udp_message_list(aux);
+                aux = prev;
+                if (aux == NULL) {
+                    aux = temp;
+                    continue;
+                }
+            }
+        }
+        prev = aux;
+        aux = aux->next;
+    }
+}
@@ -3,6 +3,18 @@
 
 #include "common.h"
 
+// Largest amount of values a node sends back at once while scanning a range of keys
+#define SCAN_BATCH_SIZE 65536
+
+/**
+ * @brief Create a UDP socket bound to a port (on every interface)
+ * 
+ * @param port the port
+ * @param reuse_port whether other sockets may be bound to the same port (SO_REUSEPORT)
+ * @return [ @b int ] the socket file descriptor, or -1 in case of an error
+ */
+int open_udp_socket(char *port, int reuse_port);
+
 /**
  * @brief Creates a new server listening on the specified port
  * 
@@ -21,6 +33,243 @@ int init_server(t_nodeinfo *ni);
  */
 int send_to_closest(char *message, unsigned int key, t_nodeinfo *ni);
 
+/**
+ * @brief Send a message that carries an object's value (SET/RGET). Values that don't
+ * fit in a regular message are sent as a length-prefixed message (BSET/BRGET) followed
+ * by the value itself, which always goes through TCP
+ * 
+ * @param fd socket to send the message through (-1 to send it to whichever of successor or shortcut is closest to @b dest)
+ * @param type message type ("SET" or "RGET")
+ * @param a first message field
+ * @param b second message field
+ * @param c third message field
+ * @param value the value (NULL if there is none)
+ * @param length size of the value in bytes
+ * @param dest final message destination
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int send_object_message(int fd, char *type, unsigned int a, unsigned int b, unsigned int c, char *value, size_t length, unsigned int dest, t_nodeinfo *ni);
+
+/**
+ * @brief Get the values of the keys of a batch request (MGET) this node can answer for:
+ * the ones it owns, and the ones it has a copy of unless GETs are strong
+ * 
+ * @param keys the keys (a bitmask)
+ * @param values where to store the values, indexed by key (they point into the storage)
+ * @param ni necessary information about the node
+ * @return [ @b unsigned int ] the keys it answered for (a bitmask)
+ */
+unsigned int serve_batch(unsigned int keys, t_object *values, t_nodeinfo *ni);
+
+/**
+ * @brief Answer a GET request this node made, and every other one that waits for it,
+ * with the object's value
+ * 
+ * @param n request sequence number
+ * @param key the object's key
+ * @param value its value (NULL if it doesn't exist)
+ * @param length its size
+ * @param ni necessary information about the node
+ */
+void answer_get(unsigned int n, unsigned int key, char *value, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Send a batch request (MGET) on towards the owners of its keys: the keys are
+ * split by the neighbour (successor or shortcut) they go through, one message each.
+ * Every node on the way answers for its own keys with a single MRGET message
+ * 
+ * @param keys the keys (a bitmask)
+ * @param n request sequence number
+ * @param requester the node that made the request
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_batch_get(unsigned int keys, unsigned int n, unsigned int requester, t_nodeinfo *ni);
+
+/**
+ * @brief Add answers to a batch request this node made, and answer whoever asked once
+ * they have all arrived
+ * 
+ * @param n request sequence number
+ * @param keys the keys that were answered (a bitmask)
+ * @param values their values, indexed by key
+ * @param ni necessary information about the node
+ */
+void gather_batch(unsigned int n, unsigned int keys, t_object *values, t_nodeinfo *ni);
+
+/**
+ * @brief Send several objects towards their owners in MSET messages, which every node on
+ * the way takes the objects it owns out of. The ones closer to the shortcut go through
+ * it if their message fits in a datagram, the others through the successor
+ * 
+ * @param keys the objects' keys (a bitmask)
+ * @param values their values, indexed by key (NULL deletes the object)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_batch_set(unsigned int keys, t_object *values, t_nodeinfo *ni);
+
+/**
+ * @brief Send a batch find request (MFND) on towards the owners of its keys, as a
+ * single message that each owner takes its keys out of (and answers for them with one
+ * MRSP message)
+ * 
+ * @param keys the keys (a bitmask)
+ * @param n request sequence number
+ * @param requester the node that made the request
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_batch_find(unsigned int keys, unsigned int n, unsigned int requester, t_nodeinfo *ni);
+
+/**
+ * @brief Add an owner's answer to a batch find request this node made, answering
+ * whoever asked right away
+ * 
+ * @param n request sequence number
+ * @param keys the keys the node owns (a bitmask)
+ * @param owner the node
+ * @param ipaddr its IP address
+ * @param port its port
+ * @param ni necessary information about the node
+ */
+void gather_owners(unsigned int n, unsigned int keys, unsigned int owner, char *ipaddr, unsigned int port, t_nodeinfo *ni);
+
+/**
+ * @brief Scan the part of a range of keys this node owns, in order: its objects go
+ * back to the requester in MRGET messages of at most SCAN_BATCH_SIZE bytes, and then
+ * the scan goes on at the successor (SCAN), or ends with a SCEND message that tells
+ * the requester where to continue from
+ * 
+ * @param from first key of the range left to scan (owned by this node)
+ * @param to last key of the range
+ * @param count how many more objects to return at most
+ * @param n request sequence number
+ * @param requester the node that made the request
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int continue_scan(unsigned int from, unsigned int to, unsigned int count, unsigned int n, unsigned int requester, t_nodeinfo *ni);
+
+/**
+ * @brief Store an object this node owns and propagate the change to its replicas
+ * 
+ * @param key object's key
+ * @param value object's value (NULL to delete the object)
+ * @param length size of the value in bytes
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, 1 if the key is invalid and -1 in case of an error
+ */
+int store_object(unsigned int key, char *value, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Tell the node that sent a SET that its write was applied (SACK), once this node
+ * has stored it. A write held back by leases is only acknowledged when it is applied
+ * 
+ * @param requester the node that sent the SET
+ * @param n the request's sequence number
+ * @param key the object's key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int acknowledge_set(unsigned int requester, unsigned int n, unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Store an object this node owns in the form another node stored it (e.g. handed
+ * off or promoted from a replica), like store_object
+ * 
+ * @param key object's key
+ * @param value object's value, maybe compressed (NULL to delete the object)
+ * @param length size of the value in bytes
+ * @param size size of the value once decompressed (0 if it isn't compressed)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, 1 if the key is invalid and -1 in case of an error
+ */
+int store_received_object(unsigned int key, char *value, size_t length, size_t size, t_nodeinfo *ni);
+
+/**
+ * @brief Send a copy of an object to the successor (REPL), which keeps it and passes it
+ * further along until @b hops successors have it
+ * 
+ * @param owner key of the object's owner
+ * @param hops how many more successors should keep a copy
+ * @param key object's key
+ * @param value object's value as its owner stores it, maybe compressed (NULL if the
+ * object was deleted)
+ * @param length size of the value in bytes
+ * @param size size of the value once decompressed (0 if it isn't compressed)
+ * @param ttl how many milliseconds the object has left to live (0 if it has no TTL)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int send_replica(unsigned int owner, unsigned int hops, unsigned int key, char *value, size_t length, size_t size, unsigned long ttl, t_nodeinfo *ni);
+
+/**
+ * @brief Bring the successors up to date with an object this node owns, either as whole
+ * replicas or (for large objects, with erasure coding enabled) as fragments
+ *
+ * @param key object's key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int replicate_object(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Every so often, send the successor the Merkle tree hashes of the keys this node
+ * owns, so it can find (and ask for) the objects its replicas are missing
+ * 
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int run_anti_entropy(t_nodeinfo *ni);
+
+/**
+ * @brief Hand a set of objects over to a neighbour, in batches, through a TCP connection.
+ * Our copies are only deleted once the neighbour acknowledges the whole handoff
+ * 
+ * @param fd socket connected to the neighbour
+ * @param keys bitmask of the keys of the objects to hand off
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int send_handoff(int fd, unsigned int keys, t_nodeinfo *ni);
+
+/**
+ * @brief Block until the predecessor acknowledges the latest handoff (or a timeout expires),
+ * handling any other messages this process receives meanwhile
+ * 
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if every object was handed off, -1 otherwise 
+ */
+int wait_for_handoff(t_nodeinfo *ni);
+
+/**
+ * @brief Checks whether a body that only passes through the node is being relayed through
+ * one of its links (nothing else may be written into them meanwhile)
+ * 
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if true, 0 if false 
+ */
+int is_relaying(t_nodeinfo *ni);
+
+/**
+ * @brief Give up on the bodies relayed through the node that stopped arriving, dropping
+ * the links they came and went through
+ * 
+ * @param ni necessary information about the node
+ */
+void expire_relays(t_nodeinfo *ni);
+
+/**
+ * @brief Block until none of the virtual nodes is relaying a body, handling only the
+ * connections the bodies come through meanwhile (so the links can be written to again)
+ * 
+ * @param ni necessary information about the node (any of the virtual nodes)
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int finish_relays(t_nodeinfo *ni);
+
 /**
  * @brief Process an incoming connection
  * 
@@ -37,6 +286,15 @@ int process_incoming_connection(t_nodeinfo *ni);
  */
 int process_message_temp(t_nodeinfo *ni);
 
+/**
+ * @brief Receive a message through a UDP socket
+ * 
+ * @param fd socket file descriptor
+ * @param dg where to store the message
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int recv_datagram(int fd, t_datagram *dg);
+
 /**
  * @brief Process an incoming message from the UDP socket
  * 
@@ -45,6 +303,30 @@ int process_message_temp(t_nodeinfo *ni);
  */
 int process_message_udp(t_nodeinfo *ni);
 
+/**
+ * @brief Process a message received through UDP (acknowledging it, unless that was already done)
+ * 
+ * @param dg the message
+ * @param ni necessary information about the node 
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_datagram(t_datagram *dg, t_nodeinfo *ni);
+
+/**
+ * @brief Resend (or give up on) the UDP messages that weren't acknowledged in time
+ * 
+ * @param ni necessary information about the node 
+ */
+void check_for_lost_udp_messages(t_nodeinfo *ni);
+
+/**
+ * @brief Fail the SETs whose owners haven't acknowledged them in time (e.g. because the
+ * ring broke and the write was lost), telling their clients
+ * 
+ * @param ni necessary information about the node 
+ */
+void expire_set_requests(t_nodeinfo *ni);
+
 /**
  * @brief Process an incoming message from this node's successor
  * 
@@ -0,0 +1,421 @@
+#define _POSIX_C_SOURCE 200112L
+#include "storage.h"
+#include "expiry.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+// Size of a batch of log records after which it is written to disk
+#define GROUP_COMMIT_SIZE (64 * 1024)
+// Time (in seconds) after which a batch of log records is written to disk
+#define GROUP_COMMIT_INTERVAL 0.005
+// Size of the log after which it is compacted into a snapshot
+#define SNAPSHOT_LOG_SIZE (16 * 1024 * 1024)
+// Length of a record that marks a deleted object
+#define RECORD_DELETED UINT64_MAX
+// Flag of the key of a record that holds when the object expires (milliseconds since the
+// epoch, 0 if it doesn't) instead of its value
+#define RECORD_EXPIRY 0x80000000u
+
+static const char SNAPSHOT_MAGIC[8] = {'R', 'I', 'N', 'G', 'S', 'N', 'A', 'P'};
+
+typedef struct record_header {
+    uint32_t key;
+    uint32_t checksum;
+    uint64_t length;
+} t_record_header;
+
+struct storage {
+    // Directory where the files are kept
+    char dir[256];
+    // Path of the append-only log
+    char log_path[512];
+    // Path of the snapshot
+    char snapshot_path[512];
+    // Log file descriptor
+    int log_fd;
+    // Size of the log (including records that haven't been written yet)
+    size_t log_size;
+    // Whether some records were written but not yet flushed to the disk
+    int dirty;
+    // Records that haven't been written yet
+    char batch[GROUP_COMMIT_SIZE];
+    // Current size of the batch
+    size_t batch_size;
+    // When the oldest record that isn't on disk yet was appended
+    struct timeval batch_timestamp;
+};
+
+/**
+ * @brief Calculate a record's checksum (32-bit FNV-1a)
+ *
+ * @param key object's key
+ * @param length record's length field
+ * @param value object's value
+ * @return [ @b uint32_t ] the checksum
+ */
+uint32_t record_checksum(uint32_t key, uint64_t length, const char *value)
+{
+    uint32_t hash = 2166136261u;
+    const unsigned char *fields[] = { (unsigned char*) &key, (unsigned char*) &length };
+    const size_t sizes[] = { sizeof(key), sizeof(length) };
+    for (size_t f = 0; f < 2; f++) {
+        for (size_t i = 0; i < sizes[f]; i++)
+            hash = (hash ^ fields[f][i]) * 16777619u;
+    }
+    if (length != RECORD_DELETED) {
+        for (uint64_t i = 0; i < length; i++)
+            hash = (hash ^ (unsigned char) value[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Write an entire buffer to a file
+ *
+ * @param fd file descriptor
+ * @param data data to be written
+ * @param size size of the data in bytes
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int writeall(int fd, const char *data, size_t size)
+{
+    size_t written = 0;
+    while (written < size) {
+        ssize_t result = write(fd, data+written, size-written);
+        if (result <= 0)
+            return -1;
+        written += result;
+    }
+    return 0;
+}
+
+/**
+ * @brief Get when an object expires, as the log keeps it
+ *
+ * @param ttl its time to live in seconds (negative if it has none)
+ * @return [ @b uint64_t ] the deadline in milliseconds since the epoch (0 if there is none)
+ */
+uint64_t expiry_deadline(double ttl)
+{
+    if (ttl < 0)
+        return 0;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t) now.tv_sec * 1000 + now.tv_usec / 1000 + (uint64_t) (ttl * 1000) + 1;
+}
+
+/**
+ * @brief Make an object expire when a record says (it may have expired while the node
+ * was down, in which case it goes as soon as the node checks)
+ *
+ * @param key the object's key
+ * @param deadline when it expires, in milliseconds since the epoch (0 if it doesn't)
+ * @param ni necessary information about the node
+ */
+void restore_expiry(unsigned int key, uint64_t deadline, t_nodeinfo *ni)
+{
+    if (deadline == 0) {
+        cancel_expiry(key, ni);
+        return;
+    }
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    schedule_expiry(key, ((double) deadline - (now.tv_sec * 1000.0 + now.tv_usec / 1000.0)) / 1000, ni);
+}
+
+/**
+ * @brief Load every valid record in a memory region into the DB, stopping at the first
+ * one that is incomplete or corrupted
+ *
+ * @param data the records
+ * @param size size of the memory region
+ * @param count incremented for each loaded record
+ * @param ni necessary information about the node
+ * @return [ @b size_t ] how many bytes of valid records were found
+ */
+size_t load_records(const char *data, size_t size, size_t *count, t_nodeinfo *ni)
+{
+    size_t offset = 0;
+    while (size-offset >= sizeof(t_record_header)) {
+        t_record_header header;
+        memcpy(&header, data+offset, sizeof(header));
+        int deleted = header.length == RECORD_DELETED;
+        size_t length = deleted ? 0 : header.length;
+        if (!deleted && header.length > size-offset-sizeof(header))
+            break;  // Torn write
+
+        const char *value = data+offset+sizeof(header);
+        if (header.checksum != record_checksum(header.key, header.length, value))
+            break;
+        if (header.key & RECORD_EXPIRY) {
+            uint64_t deadline;
+            if ((header.key & ~RECORD_EXPIRY) > 31 || length != sizeof(deadline))
+                break;
+            memcpy(&deadline, value, sizeof(deadline));
+            restore_expiry(header.key & ~RECORD_EXPIRY, deadline, ni);
+        }
+        else if (set_object(header.key, deleted ? NULL : (char*) value, length, ni) != 0)
+            break;
+
+        offset += sizeof(header) + length;
+        (*count)++;
+    }
+    return offset;
+}
+
+/**
+ * @brief Map a whole file into memory (read-only)
+ *
+ * @param fd file descriptor
+ * @param size where to store the size of the file
+ * @return [ @b char* ] the mapped file, or NULL if it is empty or can't be mapped
+ */
+char *map_file(int fd, size_t *size)
+{
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size == 0)
+        return NULL;
+    char *data = (char*) mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return NULL;
+    *size = sb.st_size;
+    return data;
+}
+
+t_storage *new_storage(const char *dir, t_nodeinfo *ni)
+{
+    t_storage *st = (t_storage*) calloc(1, sizeof(t_storage));
+    if (st == NULL)
+        return NULL;
+    snprintf(st->dir, sizeof(st->dir), "%s", dir);
+    snprintf(st->log_path, sizeof(st->log_path), "%s/ring-%u.log", dir, ni->key);
+    snprintf(st->snapshot_path, sizeof(st->snapshot_path), "%s/ring-%u.snap", dir, ni->key);
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    size_t count = 0, size;
+
+    // Load the latest snapshot
+    int fd = open(st->snapshot_path, O_RDONLY);
+    if (fd >= 0) {
+        char *data = map_file(fd, &size);
+        if (data != NULL) {
+            if (size >= sizeof(SNAPSHOT_MAGIC) && memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0)
+                load_records(data+sizeof(SNAPSHOT_MAGIC), size-sizeof(SNAPSHOT_MAGIC), &count, ni);
+            else
+                printf("\x1b[33m[!] Ignoring invalid snapshot '%s'\033[m\n", st->snapshot_path);
+            munmap(data, size);
+        }
+        close(fd);
+    }
+
+    // Replay whatever happened after it
+    st->log_fd = open(st->log_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (st->log_fd < 0) {
+        printf("\x1b[31m[!] Couldn't open '%s'\033[m\n", st->log_path);
+        free(st);
+        return NULL;
+    }
+    char *data = map_file(st->log_fd, &size);
+    if (data != NULL) {
+        st->log_size = load_records(data, size, &count, ni);
+        munmap(data, size);
+        if (st->log_size < size) {
+            // Drop the incomplete record left behind by a crash
+            printf("\x1b[33m[!] Discarding %zu bytes at the end of '%s'\033[m\n", size-st->log_size, st->log_path);
+            if (ftruncate(st->log_fd, st->log_size) != 0) {
+                close(st->log_fd);
+                free(st);
+                return NULL;
+            }
+        }
+    }
+
+    gettimeofday(&end, NULL);
+    double time_taken = end.tv_sec - start.tv_sec + 1e-6 * (end.tv_usec - start.tv_usec);
+    printf("\x1b[32m[*] Recovered %zu record(s) from '%s' in %.3fms\033[m\n", count, dir, time_taken * 1000);
+    return st;
+}
+
+/**
+ * @brief Write the current batch of records to the log (without flushing it to the disk)
+ *
+ * @param st the t_storage object
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int write_batch(t_storage *st)
+{
+    if (st->batch_size == 0)
+        return 0;
+    if (writeall(st->log_fd, st->batch, st->batch_size) != 0) {
+        puts("\x1b[31m[!] Error writing to the log\033[m");
+        return -1;
+    }
+    st->batch_size = 0;
+    st->dirty = 1;
+    return 0;
+}
+
+/**
+ * @brief Append a record to the log (see log_object())
+ *
+ * @param st the t_storage object
+ * @param key the record's key field
+ * @param value its contents (NULL for a deleted object)
+ * @param length their size in bytes
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int append_record(t_storage *st, uint32_t key, char *value, size_t length)
+{
+    if (st->batch_size == 0 && !st->dirty)
+        gettimeofday(&st->batch_timestamp, NULL);
+
+    t_record_header header;
+    header.key = key;
+    header.length = value != NULL ? length : RECORD_DELETED;
+    header.checksum = record_checksum(header.key, header.length, value);
+    if (value == NULL)
+        length = 0;
+
+    size_t record_size = sizeof(header) + length;
+    if (st->batch_size + record_size > sizeof(st->batch) && write_batch(st) != 0)
+        return -1;
+    st->log_size += record_size;
+
+    if (record_size > sizeof(st->batch)) {
+        // Too big to be batched, write it straight away
+        if (writeall(st->log_fd, (char*) &header, sizeof(header)) != 0 || writeall(st->log_fd, value, length) != 0) {
+            puts("\x1b[31m[!] Error writing to the log\033[m");
+            return -1;
+        }
+        st->dirty = 1;
+        return 0;
+    }
+
+    memcpy(st->batch+st->batch_size, &header, sizeof(header));
+    if (length)
+        memcpy(st->batch+st->batch_size+sizeof(header), value, length);
+    st->batch_size += record_size;
+    return 0;
+}
+
+int log_object(t_storage *st, unsigned int key, char *value, size_t length)
+{
+    return append_record(st, key, value, length);
+}
+
+int log_expiry(t_storage *st, unsigned int key, double ttl)
+{
+    uint64_t deadline = expiry_deadline(ttl);
+    return append_record(st, key | RECORD_EXPIRY, (char*) &deadline, sizeof(deadline));
+}
+
+/**
+ * @brief Replace the log with a snapshot of the DB
+ *
+ * @param st the t_storage object
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int write_snapshot(t_storage *st, t_nodeinfo *ni)
+{
+    char temp_path[sizeof(st->snapshot_path) + 4];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", st->snapshot_path);
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    int result = writeall(fd, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    for (unsigned int key = 0; key < 32 && result == 0; key++) {
+        t_object *object = get_object(key, ni);
+        if (object == NULL)
+            continue;
+        t_record_header header;
+        header.key = key;
+        header.length = object->length;
+        header.checksum = record_checksum(key, header.length, object->value);
+        result = writeall(fd, (char*) &header, sizeof(header));
+        if (result == 0)
+            result = writeall(fd, object->value, object->length);
+        if (result != 0 || time_to_live(key, ni) < 0)
+            continue;
+
+        // Followed by when it expires
+        uint64_t deadline = expiry_deadline(time_to_live(key, ni));
+        header.key = key | RECORD_EXPIRY;
+        header.length = sizeof(deadline);
+        header.checksum = record_checksum(header.key, header.length, (char*) &deadline);
+        result = writeall(fd, (char*) &header, sizeof(header));
+        if (result == 0)
+            result = writeall(fd, (char*) &deadline, sizeof(deadline));
+    }
+    if (result == 0)
+        result = fdatasync(fd);
+    close(fd);
+    if (result != 0 || rename(temp_path, st->snapshot_path) != 0) {
+        unlink(temp_path);
+        return -1;
+    }
+
+    // Make sure the rename itself is on disk before throwing the log away
+    int dir_fd = open(st->dir, O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    // Everything in the log is now part of the snapshot
+    st->batch_size = 0;
+    if (ftruncate(st->log_fd, 0) != 0 || fdatasync(st->log_fd) != 0)
+        return -1;
+    st->log_size = 0;
+    st->dirty = 0;
+    return 0;
+}
+
+int sync_storage(t_storage *st, int force, t_nodeinfo *ni)
+{
+    if (st->batch_size == 0 && !st->dirty)
+        return 0;
+
+    if (!force && st->batch_size < sizeof(st->batch)) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        double time_taken = now.tv_sec - st->batch_timestamp.tv_sec + 1e-6 * (now.tv_usec - st->batch_timestamp.tv_usec);
+        if (time_taken < GROUP_COMMIT_INTERVAL)
+            return 0;
+    }
+
+    // Commit every record appended since the last flush at once
+    if (write_batch(st) != 0)
+        return -1;
+    if (fdatasync(st->log_fd) != 0) {
+        puts("\x1b[31m[!] Error flushing the log\033[m");
+        return -1;
+    }
+    st->dirty = 0;
+
+    if (ni != NULL && st->log_size > SNAPSHOT_LOG_SIZE) {
+        if (write_snapshot(st, ni) != 0) {
+            puts("\x1b[31m[!] Error writing snapshot\033[m");
+            return -1;
+        }
+        puts("\x1b[32m[*] Compacted the log into a snapshot\033[m");
+    }
+    return 0;
+}
+
+void free_storage(t_storage *st)
+{
+    if (st) {
+        sync_storage(st, 1, NULL);
+        close(st->log_fd);
+        free(st);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "common.h"
+
+/**
+ * @brief Open (or create) the append-only log and snapshot kept in a directory
+ * and load the objects they hold into the node's DB
+ *
+ * @param dir directory where the files are kept
+ * @param ni necessary information about the node
+ * @return [ @b t_storage* ] the t_storage object, or NULL in case of an error
+ */
+t_storage *new_storage(const char *dir, t_nodeinfo *ni);
+
+/**
+ * @brief Append a SET operation to the log. Records are batched, so they are only
+ * guaranteed to be on disk after the next call to sync_storage() that writes them
+ *
+ * @param st the t_storage object
+ * @param key object's key
+ * @param value object's value (NULL if the object was deleted)
+ * @param length size of the value in bytes
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int log_object(t_storage *st, unsigned int key, char *value, size_t length);
+
+/**
+ * @brief Append a change of an object's time to live to the log, as the moment it expires
+ * (so that it still does after a restart). Batched like log_object()
+ *
+ * @param st the t_storage object
+ * @param key object's key
+ * @param ttl its time to live in seconds (negative if it no longer has one)
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int log_expiry(t_storage *st, unsigned int key, double ttl);
+
+/**
+ * @brief Write the current batch of records to disk (if it is big or old enough) and
+ * replace the log with a snapshot of the DB once it grows too large
+ *
+ * @param st the t_storage object
+ * @param force whether to write the current batch regardless of its size and age
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int sync_storage(t_storage *st, int force, t_nodeinfo *ni);
+
+/**
+ * @brief Write any pending records to disk and free a t_storage object
+ *
+ * @param st the t_storage object
+ */
+void free_storage(t_storage *st);
+
+#endif
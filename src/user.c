@@ -1,17 +1,47 @@
-#define _POSIX_C_SOURCE 200112L
+#define _POSIX_C_SOURCE 200809L
 #include "user.h"
 #include "server.h"
 #include "client.h"
 #include "utils.h"
+#include "event.h"
+#include "console.h"
+#include "control.h"
+#include "watch.h"
+#include "hot.h"
+#include "lease.h"
+#include "expiry.h"
+#include "memory.h"
+#include "erasure.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <string.h>
+#include <sys/time.h>
+
+// How long (in seconds) a virtual node may take to join the ring
+#define VNODE_JOIN_TIMEOUT 3.0
+// How long (in seconds) to wait for the ring to be fixed after a virtual node leaves it
+#define VNODE_LEAVE_TIMEOUT 1.0
+// How long (in seconds) a GET in flight can be waited for by other GETs of the same key
+#define COALESCE_TIMEOUT 1.0
 
 int process_command_new(t_nodeinfo *ni) {
     return create_ring(ni);
 }
 
+/**
+ * @brief Let the other virtual nodes join the ring after the first one
+ * 
+ * @param ni necessary information about the node
+ */
+void queue_vnode_joins(t_nodeinfo *ni)
+{
+    for (t_nodeinfo *vn = ni->first_vnode->next_vnode; vn != NULL; vn = vn->next_vnode) {
+        vn->pending_join = vn->main_fd == -1;
+        publish_routing(vn);
+    }
+}
+
 int process_command_pentry(int pred, int port, char *ipaddr, t_nodeinfo *ni)
 {
     if (pred > 31 || pred < 0) {
@@ -137,8 +167,13 @@ int process_command_show(t_nodeinfo *ni)
     putchar('{');
     int any = 0;
     for (unsigned int key = 0; key < 32; key++) {
-        if (ni->objects[key] != NULL) {
-            printf("\n\t%u -> \"%s\",", key, ni->objects[key]);
+        t_object *object = get_object(key, ni);
+        if (object != NULL) {
+            // Don't flood the terminal with large values
+            if (object->length > 32)
+                printf("\n\t%u -> \"%.32s...\" (%zu bytes),", key, object->value, object->length);
+            else
+                printf("\n\t%u -> \"%s\",", key, object->value);
             any = 1;
         }
     }
@@ -146,6 +181,168 @@ int process_command_show(t_nodeinfo *ni)
         putchar('\n');
     puts("}");
 
+    // Large objects are copied whole when the ring is too small for their fragments
+    if (ni->replication > 0 || ni->ec_k > 0) {
+        printf("Replicas: {");
+        any = 0;
+        for (unsigned int key = 0; key < 32; key++) {
+            t_object *replica = get_replica(key, ni);
+            if (replica != NULL) {
+                if (replica->length > 32)
+                    printf("\n\t%u -> \"%.32s...\" (%zu bytes),", key, replica->value, replica->length);
+                else
+                    printf("\n\t%u -> \"%s\",", key, replica->value);
+                any = 1;
+            }
+        }
+        if (any)
+            putchar('\n');
+        puts("}");
+    }
+
+    return 0;
+}
+
+int process_command_stats(t_nodeinfo *ni)
+{
+    unsigned int vnodes = 0, active = 0, total_keys = 0, total_objects = 0, max_keys = 0, max_objects = 0;
+    size_t total_bytes = 0;
+    puts("  Node    Port     Keys owned     Share   Objects      Bytes");
+    for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        vnodes++;
+        if (vn->main_fd == -1 || vn->pending_join) {
+            printf("  %4u   %5s     \x1b[31mnot in the ring\033[m\n", vn->key, vn->self_port);
+            continue;
+        }
+
+        // This node owns every key from its own up to its successor's
+        unsigned int keys = vn->succ_id == vn->key ? 32 : ring_distance(vn->key, vn->succ_id);
+        unsigned int objects = 0;
+        size_t bytes = 0;
+        for (unsigned int key = 0; key < 32; key++) {
+            t_object *object = get_object(key, vn);
+            if (object != NULL) {
+                objects++;
+                bytes += object->length;
+            }
+        }
+
+        char range[16] = "";
+        sprintf(range, "%u-%u", vn->key, (vn->key + keys - 1) % 32);
+        printf("  %4u   %5s   %7s (%2u)   %5.1f%%   %7u   %8zu\n", vn->key, vn->self_port, range, keys, 100.0 * keys / 32, objects, bytes);
+
+        active++;
+        total_keys += keys;
+        total_objects += objects;
+        total_bytes += bytes;
+        max_keys = keys > max_keys ? keys : max_keys;
+        max_objects = objects > max_objects ? objects : max_objects;
+    }
+    printf("Total: %u virtual node(s), %u key(s) (%.1f%% of the ring), %u object(s), %zu byte(s)\n", vnodes, total_keys, 100.0 * total_keys / 32, total_objects, total_bytes);
+
+    // How far the most loaded virtual node is from an even spread (1.00 is perfectly even)
+    if (total_keys > 0)
+        printf("Load spread (max/mean): %.2f for keys", (double) max_keys * active / total_keys);
+    if (total_objects > 0)
+        printf(", %.2f for objects", (double) max_objects * active / total_objects);
+    if (total_keys > 0)
+        putchar('\n');
+
+    unsigned long forwarded = 0, coalesced = 0;
+    for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        forwarded += vn->gets_forwarded;
+        coalesced += vn->gets_coalesced;
+    }
+    printf("GETs sent to owners: %lu, joined one already in flight: %lu", forwarded, coalesced);
+    if (forwarded + coalesced > 0)
+        printf(" (%.1f%% of the forwards saved)", 100.0 * coalesced / (forwarded + coalesced));
+    putchar('\n');
+
+    unsigned long hot_answers = 0, hot_copies = 0;
+    for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        hot_answers += vn->hot_answers;
+        for (unsigned int key = 0; key < 32; key++)
+            hot_copies += get_hot_copy(key, vn) != NULL;
+    }
+    printf("Copies of hot objects held: %lu, GETs from other nodes answered with them: %lu\n", hot_copies, hot_answers);
+
+    unsigned long sets_acknowledged = 0, sets_timed_out = 0;
+    for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        sets_acknowledged += vn->sets_acknowledged;
+        sets_timed_out += vn->sets_timed_out;
+    }
+    printf("SETs sent to other nodes: %lu acknowledged, %lu timed out\n", sets_acknowledged, sets_timed_out);
+
+    unsigned long expiring = 0, expired = 0;
+    for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        expiring += vn->expiry.count;
+        expired += vn->objects_expired;
+    }
+    printf("Objects with a time to live: %lu, expired: %lu\n", expiring, expired);
+
+    if (ni->cache.budget > 0) {
+        unsigned long hits = 0, evictions = 0;
+        size_t bytes = 0, budget = 0;
+        for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+            hits += vn->cache.hits;
+            evictions += vn->cache.evictions;
+            bytes += vn->cache.bytes;
+            budget += vn->cache.budget;
+        }
+        printf("Lease cache: %zu of %zu byte(s) used, %lu GET(s) answered from it, %lu eviction(s)\n", bytes, budget, hits, evictions);
+    }
+
+    if (ni->memory_budget > 0) {
+        unsigned long evictions = 0;
+        size_t bytes = 0, budget = 0;
+        for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+            evictions += vn->object_evictions;
+            bytes += vn->object_bytes;
+            budget += vn->memory_budget;
+        }
+        printf("Object memory: %zu of %zu byte(s) used, %lu eviction(s)\n", bytes, budget, evictions);
+    }
+
+    if (ni->compress_threshold > 0) {
+        unsigned long compressed = 0, compressions = 0, decompressions = 0;
+        size_t stored = 0, original = 0;
+        double compress_seconds = 0, decompress_seconds = 0;
+        for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+            for (unsigned int key = 0; key < 32; key++) {
+                t_object *object = get_stored_object(key, vn);
+                if (object != NULL && object->size != 0) {
+                    compressed++;
+                    stored += object->length;
+                    original += object->size;
+                }
+            }
+            compressions += vn->values_compressed;
+            decompressions += vn->values_decompressed;
+            compress_seconds += vn->compress_seconds;
+            decompress_seconds += vn->decompress_seconds;
+        }
+        printf("Compressed objects: %lu, %zu byte(s) kept for %zu", compressed, stored, original);
+        if (original > 0)
+            printf(" (%.1f%% saved)", 100.0 * (original - stored) / original);
+        printf("\nCompression: %lu value(s) in %.3fms, decompression: %lu value(s) in %.3fms\n", compressions, compress_seconds * 1000,
+            decompressions, decompress_seconds * 1000);
+    }
+
+    if (ni->ec_k > 0) {
+        unsigned long held = 0, rebuilt = 0;
+        size_t bytes = 0;
+        for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+            for (unsigned int key = 0; key < 32; key++) {
+                t_fragment *fragment = &vn->fragments[key];
+                if (fragment->data != NULL) {
+                    held++;
+                    bytes += fragment_size(fragment->length, fragment->k);
+                }
+            }
+            rebuilt += vn->objects_rebuilt;
+        }
+        printf("Erasure coding: %u+%u, fragments held: %lu (%zu byte(s)), objects rebuilt: %lu\n", ni->ec_k, ni->ec_m, held, bytes, rebuilt);
+    }
     return 0;
 }
 
@@ -156,17 +353,15 @@ int process_command_leave(t_nodeinfo *ni)
         char message[64] = "";
 
         if (ni->pred_fd != -1) {
+            unsigned int keys = 0;
             for (unsigned int i = 0; i < 32; i++) {
-                if (ni->objects[i] != NULL) {
-                    sprintf(message, "SET %u %u %u %s\n", i, ni->find_n, ni->key, ni->objects[i]);
-                    free(ni->objects[i]);
-                    ni->objects[i] = NULL;
-                    int result = sendall(ni->pred_fd, message, strlen(message));
-                    if (result < 0)
-                        return result;
-                    ni->find_n++;
-                    ni->find_n %= 100;
-                }
+                if (get_stored_object(i, ni) != NULL)
+                    keys |= 1u << i;
+            }
+            // Our objects now belong to the predecessor
+            if (keys != 0 && (send_handoff(ni->pred_fd, keys, ni) != 0 || wait_for_handoff(ni) != 0)) {
+                puts("\x1b[31m[!] Predecessor didn't acknowledge the handoff, not leaving the ring\033[m");
+                return 0;
             }
         }
 
@@ -191,44 +386,89 @@ int process_command_leave(t_nodeinfo *ni)
 
     close(ni->udp_fd);
     ni->udp_fd = -1;
+    publish_routing(ni);
+
+    ni->pred_buffer_size = 0;
+    ni->succ_buffer_size = 0;
 
     puts("\x1b[32m[*] Node successfully left the ring\033[m");
 
     return 0;
 }
 
-int process_command_exit(t_nodeinfo *ni)
+/**
+ * @brief Handle messages until none of the virtual nodes in the ring has a node that
+ * just left it as its neighbour (or a timeout expires), so they can leave one at a time
+ * 
+ * @param key key of the node that left
+ * @param ni necessary information about the node (any of the virtual nodes)
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int wait_for_neighbours(unsigned int key, t_nodeinfo *ni)
 {
-    if (ni->main_fd == -1)
-        return 1;
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    while (1) {
+        int settled = 1;
+        for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+            if (vn->main_fd != -1 && vn->key != key && (vn->pred_id == key || vn->succ_id == key || vn->pred_fd == -1 || vn->succ_fd == -1))
+                settled = 0;
+        }
+        gettimeofday(&now, NULL);
+        if (settled || now.tv_sec - start.tv_sec + 1e-6 * (now.tv_usec - start.tv_usec) > VNODE_LEAVE_TIMEOUT)
+            return finish_relays(ni);
+
+        t_nodeinfo *source;
+        t_event e = select_event(ni, EVERY_WORKER, 0, &source);
+        if (process_background_event(e, source) != 0)
+            return -1;
+    }
+}
 
-    int result = process_command_leave(ni);
-    if (result != 0)
-        return result;
+int process_command_exit(t_nodeinfo *ni)
+{
+    for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        vn->pending_join = 0;
+        publish_routing(vn);
+        if (vn->main_fd == -1)
+            continue;
+        int result = process_command_leave(vn);
+        if (result != 0)
+            return result;
+        if (wait_for_neighbours(vn->key, ni) != 0)
+            return -1;
+    }
     return 1;
 }
 
 int process_command_find(unsigned int key, t_nodeinfo *ni)
 {
-    if ((ni->succ_id == ni->key && ni->pred_id == ni->key) || (ni->succ_id && ring_distance(ni->key, key) <= ring_distance(ni->key, ni->succ_id))) {
-        printf("Key %u belongs to node %u (%s:%s)\n", key, ni->key, ni->ipaddr, ni->self_port);
+    int client = current_client(ni->first_vnode->control);
+    unsigned long tag = current_tag(ni->first_vnode->control);
+    if (is_owner(key, ni)) {
+        reply_owner(client, tag, key, ni->key, ni->ipaddr, strtoui(ni->self_port), ni);
         return 0;
     }
 
     if (register_request(ni->find_n, key, NULL, ni) < 0) {
-        puts("Find request queue is full, try again later");
+        reply_status(client, tag, "Find request queue is full, try again later", ni);
         return 0;
     }
+    ni->request_client[ni->find_n] = client;
+    ni->request_tag[ni->find_n] = tag;
 
     char message[64] = "";
     sprintf(message, "FND %u %u %u %s %s\n", key, ni->find_n, ni->key, ni->ipaddr, ni->self_port);
     
     int result = send_to_closest(message, key, ni);
-    if (result < 0)
+    if (result < 0) {
+        drop_request(ni->find_n, ni);
+        reply_status(client, tag, "Couldn't send the request", ni);
         return 0;
+    }
 
     ni->find_n++;
-    ni->find_n %= 100;
+    ni->find_n %= MAX_REQUESTS;
     return 0;
 }
 
@@ -262,66 +502,402 @@ int process_command_echord(t_nodeinfo *ni)
 
 int process_command_get(unsigned int key, t_nodeinfo *ni)
 {
-    if ((ni->succ_id == ni->key && ni->pred_id == ni->key) || (ni->succ_id && ring_distance(ni->key, key) <= ring_distance(ni->key, ni->succ_id))) {
-        char *object = get_object(key, ni);
-        if (object == NULL)
-            printf("%u -> NULL\n", key);
-        else
-            printf("%u -> \"%s\"\n", key, object);
+    int client = current_client(ni->first_vnode->control);
+    unsigned long tag = current_tag(ni->first_vnode->control);
+    t_object *replica = ni->strong_reads ? NULL : get_replica(key, ni);
+    if (replica != NULL) {
+        // This node has a copy of the object, no need to ask its owner
+        reply_object(client, tag, key, replica->value, replica->length, ni);
+        return 0;
+    }
+    if (is_owner(key, ni)) {
+        t_object *object = get_object(key, ni);
+        touch_object(key, ni);
+        reply_object(client, tag, key, object != NULL ? object->value : NULL, object != NULL ? object->length : 0, ni);
+        return 0;
+    }
+    t_object *copy = get_hot_copy(key, ni);
+    if (copy != NULL) {
+        // The object is read often enough that its owner gave this node a copy
+        reply_object(client, tag, key, copy->value, copy->length, ni);
+        return 0;
+    }
+    copy = get_cached(key, ni);
+    if (copy != NULL) {
+        // The value went through this node recently, and its owner's lease still holds
+        reply_object(client, tag, key, copy->value, copy->length, ni);
+        ni->cache.hits++;
         return 0;
     }
 
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int pending = ni->pending_get[key];
+    if (pending != -1) {
+        // A GET for this key is already on its way, and its answer will do for this one
+        // too (unless it is so old that it may have been lost)
+        double age = now.tv_sec - ni->pending_get_timestamp[key].tv_sec + 1e-6 * (now.tv_usec - ni->pending_get_timestamp[key].tv_usec);
+        if (age < COALESCE_TIMEOUT && add_waiter(pending, client, tag, ni) == 0) {
+            ni->gets_coalesced++;
+            return 0;
+        }
+    }
+
     if (register_request(ni->find_n, key, NULL, ni) < 0) {
-        puts("Get request queue is full, try again later");
+        reply_status(client, tag, "Get request queue is full, try again later", ni);
         return 0;
     }
+    ni->request_client[ni->find_n] = client;
+    ni->request_tag[ni->find_n] = tag;
 
     char message[64] = "";
     sprintf(message, "GET %u %u %u %s %s\n", key, ni->find_n, ni->key, ni->ipaddr, ni->self_port);
     
     int result = send_to_closest(message, key, ni);
-    if (result < 0)
+    if (result < 0) {
+        drop_request(ni->find_n, ni);
+        reply_status(client, tag, "Couldn't send the request", ni);
         return 0;
+    }
+    ni->pending_get[key] = ni->find_n;
+    ni->pending_get_timestamp[key] = now;
+    ni->gets_forwarded++;
 
     ni->find_n++;
-    ni->find_n %= 100;
+    ni->find_n %= MAX_REQUESTS;
     return 0;
 }
 
-int process_command_set(unsigned int key, char *value, t_nodeinfo *ni)
+int process_command_set(unsigned int key, char *value, size_t length, t_nodeinfo *ni)
 {
-    if ((ni->succ_id == ni->key && ni->pred_id == ni->key) || (ni->succ_id && ring_distance(ni->key, key) <= ring_distance(ni->key, ni->succ_id))) {
-        if (strlen(value) == 0) {
-            if (set_object(key, NULL, ni) == -1)
-                return -1;
-        }
-        else {
-            if (set_object(key, value, ni) == -1)
-                return -1;
+    int client = current_client(ni->first_vnode->control);
+    unsigned long tag = current_tag(ni->first_vnode->control);
+    if (is_owner(key, ni)) {
+        // A SET replaces the object's time to live along with its value
+        cancel_expiry(key, ni);
+        if (store_object(key, length ? value : NULL, length, ni) == -1)
+            return -1;
+        reply_status(client, tag, NULL, ni);
+        return 0;
+    }
+
+    // The GET in flight may not see this change, so later GETs can't wait for it (nor use
+    // the copy of the object this node may have)
+    ni->pending_get[key] = -1;
+    drop_hot_copy(key, ni);
+    uncache(key, ni);
+    // The client gets its answer when the owner acknowledges the write (or the request
+    // times out)
+    if (register_request(ni->find_n, key, NULL, ni) < 0) {
+        reply_status(client, tag, "Request queue is full, try again later", ni);
+        return 0;
+    }
+    ni->request_client[ni->find_n] = client;
+    ni->request_tag[ni->find_n] = tag;
+    ni->request_deadline[ni->find_n] = seconds_from_now(SET_TIMEOUT);
+
+    int result = send_object_message(-1, "SET", key, ni->find_n, ni->key, value, length, key, ni);
+    if (result < 0) {
+        drop_request(ni->find_n, ni);
+        reply_status(client, tag, "Couldn't send the request", ni);
+        return 0;
+    }
+
+    ni->find_n++;
+    ni->find_n %= MAX_REQUESTS;
+    return 0;
+}
+
+int process_command_mget(unsigned int keys, t_nodeinfo *ni)
+{
+    int client = current_client(ni->first_vnode->control);
+    unsigned long tag = current_tag(ni->first_vnode->control);
+    t_batch *batch = (t_batch*) calloc(1, sizeof(t_batch));
+    if (batch == NULL)
+        return -1;
+    batch->keys = batch->missing = keys;
+
+    if (register_request(ni->find_n, first_key(keys), NULL, ni) < 0) {
+        free_batch(batch);
+        reply_status(client, tag, "Get request queue is full, try again later", ni);
+        return 0;
+    }
+    unsigned int n = ni->find_n;
+    ni->request_client[n] = client;
+    ni->request_tag[n] = tag;
+    ni->request_batch[n] = batch;
+    ni->find_n++;
+    ni->find_n %= MAX_REQUESTS;
+
+    // The objects this node has need no messages at all
+    t_object values[32];
+    unsigned int served = serve_batch(keys, values, ni);
+    if ((keys & ~served) != 0 && send_batch_get(keys & ~served, n, ni->key, ni) != 0) {
+        drop_request(n, ni);
+        reply_status(client, tag, "Couldn't send the request", ni);
+        return 0;
+    }
+    gather_batch(n, served, values, ni);
+    return 0;
+}
+
+int process_command_mset(unsigned int keys, t_object *values, t_nodeinfo *ni)
+{
+    int client = current_client(ni->first_vnode->control);
+    unsigned long tag = current_tag(ni->first_vnode->control);
+    unsigned int stored = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if (!(keys & (1u << key)) || !is_owner(key, ni))
+            continue;
+        cancel_expiry(key, ni);
+        if (store_object(key, values[key].length ? values[key].value : NULL, values[key].length, ni) == -1)
+            return -1;
+        stored |= 1u << key;
+    }
+    for (unsigned int key = 0; key < 32; key++) {
+        if (keys & ~stored & (1u << key)) {
+            // See process_command_set()
+            ni->pending_get[key] = -1;
+            drop_hot_copy(key, ni);
+            uncache(key, ni);
         }
+    }
+    if ((keys & ~stored) != 0 && send_batch_set(keys & ~stored, values, ni) != 0) {
+        reply_status(client, tag, "Couldn't send the request", ni);
         return 0;
     }
+    reply_status(client, tag, NULL, ni);
+    return 0;
+}
 
-    char message[64] = "";
-    sprintf(message, "SET %u %u %u %s\n", key, ni->find_n, ni->key, value != NULL ? value : "");
-    
-    int result = send_to_closest(message, key, ni);
-    if (result < 0)
+int process_command_mfind(unsigned int keys, t_nodeinfo *ni)
+{
+    int client = current_client(ni->first_vnode->control);
+    unsigned long tag = current_tag(ni->first_vnode->control);
+    t_batch *batch = (t_batch*) calloc(1, sizeof(t_batch));
+    if (batch == NULL)
+        return -1;
+    batch->keys = batch->missing = keys;
+
+    if (register_request(ni->find_n, first_key(keys), NULL, ni) < 0) {
+        free_batch(batch);
+        reply_status(client, tag, "Find request queue is full, try again later", ni);
+        return 0;
+    }
+    unsigned int n = ni->find_n;
+    ni->request_client[n] = client;
+    ni->request_tag[n] = tag;
+    ni->request_batch[n] = batch;
+    ni->find_n++;
+    ni->find_n %= MAX_REQUESTS;
+
+    unsigned int owned = 0;
+    for (unsigned int key = 0; key < 32; key++) {
+        if ((keys & (1u << key)) && is_owner(key, ni))
+            owned |= 1u << key;
+    }
+    if ((keys & ~owned) != 0 && send_batch_find(keys & ~owned, n, ni->key, ni) != 0) {
+        drop_request(n, ni);
+        reply_status(client, tag, "Couldn't send the request", ni);
         return 0;
+    }
+    gather_owners(n, owned, ni->key, ni->ipaddr, strtoui(ni->self_port), ni);
+    return 0;
+}
+
+int process_command_scan(unsigned int from, unsigned int to, unsigned int count, t_nodeinfo *ni)
+{
+    int client = current_client(ni->first_vnode->control);
+    unsigned long tag = current_tag(ni->first_vnode->control);
+    t_batch *batch = (t_batch*) calloc(1, sizeof(t_batch));
+    if (batch == NULL)
+        return -1;
+    batch->streaming = 1;
 
+    if (register_request(ni->find_n, from, NULL, ni) < 0) {
+        free_batch(batch);
+        reply_status(client, tag, "Scan request queue is full, try again later", ni);
+        return 0;
+    }
+    unsigned int n = ni->find_n;
+    ni->request_client[n] = client;
+    ni->request_tag[n] = tag;
+    ni->request_batch[n] = batch;
     ni->find_n++;
-    ni->find_n %= 100;
+    ni->find_n %= MAX_REQUESTS;
+
+    int result;
+    if (is_owner(from, ni))
+        result = continue_scan(from, to, count, n, ni->key, ni);
+    else {
+        char message[64] = "";
+        sprintf(message, "SCAN %u %u %u %u %u\n", from, to, count, n, ni->key);
+        result = send_to_closest(message, from, ni);
+    }
+    if (result < 0 && ni->request_batch[n] == batch) {
+        drop_request(n, ni);
+        reply_status(client, tag, "Couldn't send the request", ni);
+    }
     return 0;
 }
 
+int process_command_operation(t_operation op, unsigned int key, unsigned long version, char *operand, size_t length, t_nodeinfo *ni)
+{
+    int client = current_client(ni->first_vnode->control);
+    unsigned long tag = current_tag(ni->first_vnode->control);
+    if (op == OP_INCR && !parse_delta(operand, length, NULL)) {
+        reply_status(client, tag, "Invalid number", ni);
+        return 0;
+    }
+    if (is_owner(key, ni)) {
+        t_object result;
+        char text[OPERATION_TEXT_SIZE] = "";
+        t_operation_result code = execute_operation(op, key, version, operand, length, &result, text, ni);
+        reply_operation(client, tag, key, op, code, result.version, result.value, result.length, ni);
+        return 0;
+    }
+
+    if (op != OP_VERSION) {
+        // See process_command_set()
+        ni->pending_get[key] = -1;
+        drop_hot_copy(key, ni);
+        uncache(key, ni);
+    }
+    if (register_request(ni->find_n, key, NULL, ni) < 0) {
+        reply_status(client, tag, "Request queue is full, try again later", ni);
+        return 0;
+    }
+    ni->request_client[ni->find_n] = client;
+    ni->request_tag[ni->find_n] = tag;
+
+    if (send_operation(op, key, ni->find_n, version, operand, length, ni) != 0) {
+        drop_request(ni->find_n, ni);
+        reply_status(client, tag, "Couldn't send the request", ni);
+        return 0;
+    }
+
+    ni->find_n++;
+    ni->find_n %= MAX_REQUESTS;
+    return 0;
+}
+
+int process_command_watch(unsigned int key, t_nodeinfo *ni)
+{
+    int client = current_client(ni->first_vnode->control);
+    unsigned long tag = current_tag(ni->first_vnode->control);
+    // The first notification (with the current value) answers the request
+    if (add_watch(key, client, tag, ni) != 0)
+        reply_status(client, tag, "Couldn't send the request", ni);
+    return 0;
+}
+
+int process_command_unwatch(unsigned int key, t_nodeinfo *ni)
+{
+    int client = current_client(ni->first_vnode->control);
+    unsigned long tag = current_tag(ni->first_vnode->control);
+    if (remove_watches(client, key, ni) == 0)
+        reply_status(client, tag, "Key isn't being watched", ni);
+    else
+        reply_status(client, tag, NULL, ni);
+    return 0;
+}
+
+int parse_batch(char *args, int with_values, unsigned int *keys, t_object *values)
+{
+    *keys = 0;
+    while (1) {
+        args += strspn(args, " ");
+        if (*args == '\n' || *args == '\0')
+            break;
+        unsigned int key;
+        int used = 0;
+        if (sscanf(args, "%u%n", &key, &used) != 1)
+            return -1;
+        if (key > 31)
+            return 1;
+        args += used;
+        if (*args != ' ' && *args != '\n' && *args != '\0')
+            return -1;
+        *keys |= 1u << key;
+        if (!with_values)
+            continue;
+
+        args += strspn(args, " ");
+        size_t length = strcspn(args, " \n");
+        if (length == 0)
+            return -1;
+        values[key].value = args;
+        values[key].length = length;
+        args += length;
+    }
+    return *keys != 0 ? 0 : -1;
+}
+
+void join_pending_vnodes(t_nodeinfo *ni)
+{
+    t_nodeinfo *first = ni->first_vnode;
+    // The first virtual node may still be joining the ring itself (after bentry)
+    if (first->main_fd == -1 || first->pred_fd == -1 || first->succ_fd == -1)
+        return;
+
+    for (t_nodeinfo *vn = first->next_vnode; vn != NULL; vn = vn->next_vnode) {
+        if (!vn->pending_join)
+            continue;
+
+        if (vn->main_fd == -1) {
+            // Join through the first virtual node, one at a time so the ring is never
+            // changed by two of them at once
+            printf("\x1b[32m[*] Virtual node %u is joining the ring\033[m\n", vn->key);
+            gettimeofday(&vn->join_timestamp, NULL);
+            unsigned int port;
+            sscanf(first->self_port, "%u", &port);
+            if (process_command_bentry(first->key, port, first->ipaddr, vn) == 0 && vn->main_fd != -1)
+                return;
+            printf("\x1b[31m[!] Virtual node %u couldn't join the ring\033[m\n", vn->key);
+            vn->pending_join = 0;
+            close_sockets(vn);
+            continue;
+        }
+        if (vn->pred_fd != -1 && vn->succ_fd != -1) {
+            vn->pending_join = 0;
+            publish_routing(vn);
+            continue;
+        }
+
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        double time_taken = now.tv_sec - vn->join_timestamp.tv_sec + 1e-6 * (now.tv_usec - vn->join_timestamp.tv_usec);
+        if (time_taken > VNODE_JOIN_TIMEOUT) {
+            printf("\x1b[31m[!] Virtual node %u couldn't join the ring\033[m\n", vn->key);
+            vn->pending_join = 0;
+            close_sockets(vn);
+            continue;
+        }
+        return;
+    }
+}
+
 int process_user_message(t_nodeinfo *ni)
 {
-    char buffer[128] = "";
-    char *result = fgets(buffer, sizeof(buffer), stdin);
-    if (buffer != result) {
-        puts("\x1b[31m[!] Error calling fgets()\033[m");
+    // Lines can be arbitrarily long (they may carry a value)
+    char *buffer;
+    int status = next_command(ni->console, &buffer);
+    if (status < 0) {
+        puts("\x1b[31m[!] The console's input was closed\033[m");
         return -1;
     }
+    if (status == 0)
+        return 0;
+
+    int result = process_command_line(buffer, ni);
+    // Let the console show the prompt again once the command's output is out
+    fflush(stdout);
+    command_done(ni->console, buffer, result);
+    return result;
+}
+
+int process_command_line(char *buffer, t_nodeinfo *ni)
+{
     if (strcmp(buffer, "new\n") == 0 || strcmp(buffer, "n\n") == 0) {
         if (ni->main_fd != -1) {
             // Server is already running
@@ -331,6 +907,7 @@ int process_user_message(t_nodeinfo *ni)
         if (process_command_new(ni) != 0)
             return -1;
         puts("\x1b[32m[*] Created new ring\033[m");
+        queue_vnode_joins(ni);
         return 0;
     }
     if (strncmp(buffer, "bentry", 6) == 0 || strncmp(buffer, "b ", 2) == 0 || strncmp(buffer, "b\n", 2) == 0) {
@@ -344,7 +921,10 @@ int process_user_message(t_nodeinfo *ni)
         char *start_pos = strchr(buffer, ' ');
         if (start_pos && sscanf(start_pos+1, "%u %15s %u\n", &boot, ipaddr, &port) == 3) {
             ipaddr[15] = '\0';            
-            return process_command_bentry(boot, port, ipaddr, ni);
+            int result = process_command_bentry(boot, port, ipaddr, ni);
+            if (result == 0 && ni->main_fd != -1)
+                queue_vnode_joins(ni);
+            return result;
         }
         else {
             puts("Invalid format.\nUsage: \x1b[4mb\033[mentry boot boot.IP boot.port");
@@ -362,7 +942,10 @@ int process_user_message(t_nodeinfo *ni)
         char *start_pos = strchr(buffer, ' ');
         if (start_pos && sscanf(start_pos+1, "%u %15s %u\n", &pred, ipaddr, &port) == 3) {
             ipaddr[15] = '\0';            
-            return process_command_pentry(pred, port, ipaddr, ni);
+            int result = process_command_pentry(pred, port, ipaddr, ni);
+            if (result == 0 && ni->main_fd != -1)
+                queue_vnode_joins(ni);
+            return result;
         }
         else {
             puts("Invalid format.\nUsage: \x1b[4mp\033[mentry pred pred.IP pred.port");
@@ -370,13 +953,30 @@ int process_user_message(t_nodeinfo *ni)
         return 0;
     }
     if (strcmp(buffer, "show\n") == 0 || strcmp(buffer, "s\n") == 0) {
-        return process_command_show(ni);
+        for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+            if (ni->first_vnode->next_vnode != NULL)
+                printf("\x1b[1mVirtual node %u\033[m\n", vn->key);
+            if (process_command_show(vn) != 0)
+                return -1;
+        }
+        return 0;
     }    
+    if (strcmp(buffer, "stats\n") == 0 || strcmp(buffer, "st\n") == 0) {
+        return process_command_stats(ni);
+    }
     if (strcmp(buffer, "leave\n") == 0 || strcmp(buffer, "l\n") == 0) {
         if (ni->main_fd == -1) {
             puts("Node is not a member of any ring");
         }
-        return process_command_leave(ni);
+        for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+            vn->pending_join = 0;
+            publish_routing(vn);
+            if (vn->main_fd == -1 && vn != ni)
+                continue;
+            if (process_command_leave(vn) != 0 || wait_for_neighbours(vn->key, ni) != 0)
+                return -1;
+        }
+        return 0;
     }
     if (strcmp(buffer, "exit\n") == 0 || strcmp(buffer, "ex\n") == 0) {
         return process_command_exit(ni);
@@ -392,11 +992,12 @@ int process_user_message(t_nodeinfo *ni)
             puts("Invalid key (maximum is 31)");
             return 0;
         }
-        if (ni->main_fd == -1) {
+        t_nodeinfo *vn = closest_vnode(key, ni);
+        if (vn == NULL) {
             puts("Node is not in a ring");
             return 0;
         }
-        return process_command_find(key, ni);
+        return process_command_find(key, vn);
     }
     if (strncmp(buffer, "get", 3) == 0 || strncmp(buffer, "g ", 2) == 0 || strncmp(buffer, "g\n", 2) == 0) {
         unsigned int key;
@@ -409,33 +1010,173 @@ int process_user_message(t_nodeinfo *ni)
             puts("Invalid key (maximum is 31)");
             return 0;
         }
-        if (ni->main_fd == -1) {
+        t_nodeinfo *vn = closest_vnode(key, ni);
+        if (vn == NULL) {
             puts("Node is not in a ring");
             return 0;
         }
-        return process_command_get(key, ni);
+        return process_command_get(key, vn);
     }
-    if (strncmp(buffer, "set", 3) == 0 || strncmp(buffer, "se ", 3) == 0 || strncmp(buffer, "se\n", 3) == 0) {
+    if ((strncmp(buffer, "set", 3) == 0 && strncmp(buffer, "setex", 5) != 0) || strncmp(buffer, "se ", 3) == 0 || strncmp(buffer, "se\n", 3) == 0) {
         unsigned int key = 0;
-        char value[24] = "";
+        int key_end = 0;
+        char *start_pos = strchr(buffer, ' ');
+        if (!start_pos || strlen(buffer) < 4 || sscanf(start_pos+1, "%u%n", &key, &key_end) != 1) {
+            puts("Invalid format.\nUsage: \x1b[4ms\033[met k [value]");
+            return 0;
+        }
+        // The value is everything after the key (up to the end of the line)
+        char *value = start_pos+1+key_end;
+        if (*value == ' ')
+            value++;
+        size_t length = strcspn(value, "\n");
+        if (key > 31) {
+            puts("Invalid key (maximum is 31)");
+            return 0;
+        }
+        t_nodeinfo *vn = closest_vnode(key, ni);
+        if (vn == NULL) {
+            puts("Node is not in a ring");
+            return 0;
+        }
+        return process_command_set(key, value, length, vn);
+    }
+    if (strncmp(buffer, "mget", 4) == 0 || strncmp(buffer, "mg ", 3) == 0 || strncmp(buffer, "mg\n", 3) == 0
+            || strncmp(buffer, "mset", 4) == 0 || strncmp(buffer, "ms ", 3) == 0 || strncmp(buffer, "ms\n", 3) == 0) {
+        int set = buffer[1] == 's';
+        unsigned int keys = 0;
+        t_object values[32];
+        char *start_pos = strchr(buffer, ' ');
+        int result = start_pos != NULL ? parse_batch(start_pos, set, &keys, values) : -1;
+        if (result < 0) {
+            puts(set ? "Invalid format.\nUsage: \x1b[4mms\033[met k1 value1 [k2 value2 ...]" : "Invalid format.\nUsage: \x1b[4mmg\033[met k1 [k2 ...]");
+            return 0;
+        }
+        if (result > 0) {
+            puts("Invalid key (maximum is 31)");
+            return 0;
+        }
+        t_nodeinfo *vn = closest_vnode(first_key(keys), ni);
+        if (vn == NULL) {
+            puts("Node is not in a ring");
+            return 0;
+        }
+        return set ? process_command_mset(keys, values, vn) : process_command_mget(keys, vn);
+    }
+    if (strncmp(buffer, "scan", 4) == 0 || strncmp(buffer, "sc ", 3) == 0 || strncmp(buffer, "sc\n", 3) == 0) {
+        unsigned int from, to, count = 32;
+        char *start_pos = strchr(buffer, ' ');
+        if (!start_pos || sscanf(start_pos+1, "%u %u %u", &from, &to, &count) < 2 || count == 0) {
+            puts("Invalid format.\nUsage: \x1b[4msc\033[man a b [count]");
+            return 0;
+        }
+        if (from > 31 || to > 31) {
+            puts("Invalid key (maximum is 31)");
+            return 0;
+        }
+        t_nodeinfo *vn = closest_vnode(from, ni);
+        if (vn == NULL) {
+            puts("Node is not in a ring");
+            return 0;
+        }
+        return process_command_scan(from, to, count, vn);
+    }
+    if (strncmp(buffer, "watch", 5) == 0 || strncmp(buffer, "wa ", 3) == 0 || strncmp(buffer, "wa\n", 3) == 0
+            || strncmp(buffer, "unwatch", 7) == 0 || strncmp(buffer, "uw ", 3) == 0 || strncmp(buffer, "uw\n", 3) == 0) {
+        int watch = buffer[0] == 'w';
+        unsigned int key;
+        char *start_pos = strchr(buffer, ' ');
+        if (!start_pos || sscanf(start_pos+1, "%u", &key) != 1) {
+            puts(watch ? "Invalid format.\nUsage: \x1b[4mwa\033[mtch k" : "Invalid format.\nUsage: \x1b[4mu\033[mn\x1b[4mw\033[match k");
+            return 0;
+        }
+        if (key > 31) {
+            puts("Invalid key (maximum is 31)");
+            return 0;
+        }
+        t_nodeinfo *vn = closest_vnode(key, ni);
+        if (vn == NULL) {
+            puts("Node is not in a ring");
+            return 0;
+        }
+        return watch ? process_command_watch(key, vn) : process_command_unwatch(key, ni);
+    }
+    if (strncmp(buffer, "mfind", 5) == 0 || strncmp(buffer, "mf ", 3) == 0 || strncmp(buffer, "mf\n", 3) == 0) {
+        unsigned int keys = 0;
+        char *start_pos = strchr(buffer, ' ');
+        int result = start_pos != NULL ? parse_batch(start_pos, 0, &keys, NULL) : -1;
+        if (result < 0) {
+            puts("Invalid format.\nUsage: \x1b[4mmf\033[mind k1 [k2 ...]");
+            return 0;
+        }
+        if (result > 0) {
+            puts("Invalid key (maximum is 31)");
+            return 0;
+        }
+        t_nodeinfo *vn = closest_vnode(first_key(keys), ni);
+        if (vn == NULL) {
+            puts("Node is not in a ring");
+            return 0;
+        }
+        return process_command_mfind(keys, vn);
+    }
+    if (strncmp(buffer, "cas ", 4) == 0 || strncmp(buffer, "cas\n", 4) == 0 || strncmp(buffer, "incr", 4) == 0
+            || strncmp(buffer, "i ", 2) == 0 || strncmp(buffer, "i\n", 2) == 0 || strncmp(buffer, "append", 6) == 0
+            || strncmp(buffer, "ap ", 3) == 0 || strncmp(buffer, "ap\n", 3) == 0 || strncmp(buffer, "version", 7) == 0
+            || strncmp(buffer, "v ", 2) == 0 || strncmp(buffer, "v\n", 2) == 0 || strncmp(buffer, "setex", 5) == 0
+            || strncmp(buffer, "expire", 6) == 0 || strncmp(buffer, "ttl", 3) == 0) {
+        t_operation op = buffer[0] == 'c' ? OP_CAS : buffer[0] == 'i' ? OP_INCR : buffer[0] == 'a' ? OP_APPEND
+            : buffer[0] == 's' ? OP_SETEX : buffer[0] == 'e' ? OP_EXPIRE : buffer[0] == 't' ? OP_TTL : OP_VERSION;
+        char *usage[] = {
+            "Invalid format.\nUsage: cas k version [value]",
+            "Invalid format.\nUsage: \x1b[4mi\033[mncr k [number]",
+            "Invalid format.\nUsage: \x1b[4map\033[mpend k value",
+            "Invalid format.\nUsage: \x1b[4mv\033[mersion k",
+            "Invalid format.\nUsage: setex k seconds value",
+            "Invalid format.\nUsage: expire k seconds",
+            "Invalid format.\nUsage: ttl k"
+        };
+        unsigned int key;
+        unsigned long version = 0;
+        double seconds = 0;
+        int end = 0;
         char *start_pos = strchr(buffer, ' ');
-        if (!start_pos || sscanf(start_pos+1, "%u %16[^\n]", &key, value) != 2) {
-            if (!start_pos || strlen(buffer) < 4 || sscanf(start_pos+1, "%u", &key) != 1) {
-                puts("Invalid format.\nUsage: \x1b[4ms\033[met k [value]");
+        if (!start_pos || (op == OP_CAS ? sscanf(start_pos+1, "%u %lu%n", &key, &version, &end) != 2
+                : op == OP_SETEX || op == OP_EXPIRE ? sscanf(start_pos+1, "%u %lf%n", &key, &seconds, &end) != 2
+                : sscanf(start_pos+1, "%u%n", &key, &end) != 1)) {
+            puts(usage[op]);
+            return 0;
+        }
+        if (op == OP_SETEX || op == OP_EXPIRE) {
+            // The time to live goes where CAS's version does, in milliseconds
+            version = seconds > 0 ? (unsigned long) (seconds * 1000 + 0.5) : 0;
+            if (seconds < 0 || seconds > 1e9 || (op == OP_SETEX && version == 0)) {
+                puts("Invalid time to live");
                 return 0;
             }
-            else
-                value[0] = '\0';
         }
         if (key > 31) {
             puts("Invalid key (maximum is 31)");
             return 0;
         }
-        if (ni->main_fd == -1) {
+        char *operand = start_pos+1+end;
+        if (*operand == ' ')
+            operand++;
+        size_t length = strcspn(operand, "\n");
+        if (op == OP_INCR && length == 0) {
+            operand = "1";
+            length = 1;
+        }
+        else if (op == OP_APPEND && length == 0) {
+            puts(usage[op]);
+            return 0;
+        }
+        t_nodeinfo *vn = closest_vnode(key, ni);
+        if (vn == NULL) {
             puts("Node is not in a ring");
             return 0;
         }
-        return process_command_set(key, value, ni);
+        return process_command_operation(op, key, version, operand, length, vn);
     }
     if (strncmp(buffer, "chord", 5) == 0 || strncmp(buffer, "c ", 2) == 0 || strncmp(buffer, "c\n", 2) == 0) {
         unsigned int shcut_id, shcut_port;
@@ -483,12 +1224,26 @@ int process_user_message(t_nodeinfo *ni)
     puts("\t\x1b[4mex\033[mit                          -> exit application");
     puts("\t\x1b[4mf\033[mind \x1b[3mk\033[m                        -> find the the owner of key/object \x1b[3mk\033[m");
     puts("\t\x1b[4ml\033[meave                         -> leave the ring");
+    puts("\t\x1b[4mmf\033[mind \x1b[3mk1 k2 ...\033[m               -> find the owners of several keys at once");
     puts("\t\x1b[4mn\033[mew                           -> create new ring");
     puts("\t\x1b[4mp\033[mentry \x1b[3mpred pred.IP pred.port\033[m -> join a ring and set \x1b[3mpred\033[m as predecessor");
     puts("\t\x1b[4ms\033[mhow                          -> show current node state");
+    puts("\t\x1b[4mst\033[mats                         -> show how the keys are spread over the virtual nodes");
     puts("");
     puts("\t\x1b[4mg\033[met \x1b[3mk\033[m                         -> get value associated with key \x1b[3mk\033[m");
     puts("\t\x1b[4mse\033[mt \x1b[3mk\033[m \x1b[3mvalue\033[m                   -> set key \x1b[3mk\033[m's value to \x1b[3mvalue\033[m");
+    puts("\t\x1b[4msc\033[man \x1b[3ma b\033[m [\x1b[3mcount\033[m]              -> get the objects from key \x1b[3ma\033[m to key \x1b[3mb\033[m");
+    puts("\t\x1b[4mwa\033[mtch \x1b[3mk\033[m                       -> get told whenever key \x1b[3mk\033[m changes");
+    puts("\t\x1b[4mu\033[mn\x1b[4mw\033[match \x1b[3mk\033[m                     -> stop watching key \x1b[3mk\033[m");
+    puts("\t\x1b[4mv\033[mersion \x1b[3mk\033[m                     -> get key \x1b[3mk\033[m's value and version");
+    puts("\tcas \x1b[3mk version\033[m [\x1b[3mvalue\033[m]         -> set key \x1b[3mk\033[m's value if it is still at \x1b[3mversion\033[m");
+    puts("\t\x1b[4mi\033[mncr \x1b[3mk\033[m [\x1b[3mnumber\033[m]              -> add \x1b[3mnumber\033[m (1 by default) to key \x1b[3mk\033[m's value");
+    puts("\t\x1b[4map\033[mpend \x1b[3mk value\033[m                -> add \x1b[3mvalue\033[m to the end of key \x1b[3mk\033[m's value");
+    puts("\tsetex \x1b[3mk seconds value\033[m         -> set key \x1b[3mk\033[m's value for \x1b[3mseconds\033[m, then delete it");
+    puts("\texpire \x1b[3mk seconds\033[m              -> delete key \x1b[3mk\033[m's object after \x1b[3mseconds\033[m (0 to keep it)");
+    puts("\tttl \x1b[3mk\033[m                         -> get how long key \x1b[3mk\033[m's object has left to live");
+    puts("\t\x1b[4mmg\033[met \x1b[3mk1 k2 ...\033[m              -> get several values at once");
+    puts("\t\x1b[4mms\033[met \x1b[3mk1 value1 k2 value2 ...\033[m -> set several values at once (values without spaces)");
 
     return 0;
 }
\ No newline at end of file
@@ -2,13 +2,155 @@
 #define USER_H
 
 #include "common.h"
+#include "atomic.h"
 
 /**
- * @brief Process a user-sent message
+ * @brief Process the next command queued by the console
  * 
  * @param ni necessary information about the node
- * @return [ @b int ] 0 if successfull, -1 otherwise 
+ * @return [ @b int ] 0 if successfull, 1 if the application should exit and -1 otherwise 
  */
 int process_user_message(t_nodeinfo *ni);
 
+/**
+ * @brief Process a command typed by the user
+ * 
+ * @param buffer the command (a line ending in '\n')
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, 1 if the application should exit and -1 otherwise 
+ */
+int process_command_line(char *buffer, t_nodeinfo *ni);
+
+/**
+ * @brief Look for the node a key belongs to (the answer goes to whoever made the
+ * request: the console or a client)
+ * 
+ * @param key the key
+ * @param ni the virtual node that sends the request
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_command_find(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Get an object's value (the answer goes to whoever made the request)
+ * 
+ * @param key the object's key
+ * @param ni the virtual node that sends the request
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_command_get(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Set an object's value
+ * 
+ * @param key the object's key
+ * @param value the value
+ * @param length size of the value (0 deletes the object)
+ * @param ni the virtual node that sends the request
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_command_set(unsigned int key, char *value, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Get several objects' values at once: the request travels as one message per
+ * neighbour, and every owner answers for all of its keys together (the answers go to
+ * whoever made the request once they have all arrived)
+ * 
+ * @param keys the objects' keys (a bitmask)
+ * @param ni the virtual node that sends the request
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_command_mget(unsigned int keys, t_nodeinfo *ni);
+
+/**
+ * @brief Set several objects' values at once, with a single message that travels
+ * around the ring and leaves each object at its owner
+ * 
+ * @param keys the objects' keys (a bitmask)
+ * @param values their values, indexed by key (NULL deletes the object)
+ * @param ni the virtual node that sends the request
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_command_mset(unsigned int keys, t_object *values, t_nodeinfo *ni);
+
+/**
+ * @brief Find the owners of several keys at once, with a single message that travels
+ * around the ring and leaves each key at its owner. Every owner answers for all of its
+ * keys together, and the answers go to whoever made the request as they arrive
+ * 
+ * @param keys the keys (a bitmask)
+ * @param ni the virtual node that sends the request
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_command_mfind(unsigned int keys, t_nodeinfo *ni);
+
+/**
+ * @brief Get the objects from one key to another (clockwise), in order: the request
+ * goes to the owner of the first key and walks the successors from there, each owner
+ * sending its objects back in batches that go to whoever made the request as they
+ * arrive. The scan stops early once it has found @b count objects, and then tells
+ * where to continue from
+ * 
+ * @param from first key of the range
+ * @param to last key of the range
+ * @param count how many objects to return at most
+ * @param ni the virtual node that sends the request
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_command_scan(unsigned int from, unsigned int to, unsigned int count, t_nodeinfo *ni);
+
+/**
+ * @brief Have a key's owner execute an operation on it as a single step (the answer goes
+ * to whoever made the request)
+ * 
+ * @param op the operation
+ * @param key the object's key
+ * @param version the version CAS expects
+ * @param operand CAS's new value (empty to delete the object), INCR's number or the bytes
+ * APPEND adds
+ * @param length the operand's size
+ * @param ni the virtual node that sends the request
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_command_operation(t_operation op, unsigned int key, unsigned long version, char *operand, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Watch a key: its owner sends the current value and version right away, and
+ * again whenever the key changes (the notifications go to whoever made the request)
+ * 
+ * @param key the key
+ * @param ni the virtual node that sends the request
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_command_watch(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Stop watching a key (every watch of whoever made the request on it)
+ * 
+ * @param key the key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise 
+ */
+int process_command_unwatch(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Parse the arguments of a batch command: a list of keys ("k1 k2 ...") or of
+ * keys and values ("k1 v1 k2 v2 ...", where values can't contain spaces)
+ * 
+ * @param args the arguments (ending in '\n' or '\0')
+ * @param with_values whether each key is followed by a value
+ * @param keys where to store the keys (a bitmask)
+ * @param values where to store the values, indexed by key (they point into the arguments)
+ * @return [ @b int ] 0 if successfull, 1 if a key is invalid and -1 if the format is wrong
+ */
+int parse_batch(char *args, int with_values, unsigned int *keys, t_object *values);
+
+/**
+ * @brief Make the next virtual node that is waiting to join the ring join it (through
+ * the first virtual node), once the previous one has finished joining
+ * 
+ * @param ni necessary information about the node (any of the virtual nodes)
+ */
+void join_pending_vnodes(t_nodeinfo *ni);
+
 #endif
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <netdb.h>
+#include <ctype.h>
+#include <sys/time.h>
 
 unsigned int strtoui(const char *str)
 {
@@ -83,7 +85,7 @@ t_msginfotype get_fnd_or_rsp_or_get_message_info(char *message, unsigned int *k,
         return MI_INVALID_K;
     }
 
-    if (*n > 99) {
+    if (*n >= MAX_REQUESTS) {
         // Serial number is invalid
         return MI_INVALID_N;
     }
@@ -122,7 +124,7 @@ t_msginfotype get_rget_or_set_message_info(char *message, unsigned int *k, unsig
         return MI_INVALID_K;
     }
 
-    if (*n > 99) {
+    if (*n >= MAX_REQUESTS) {
         // Serial number is invalid
         return MI_INVALID_N;
     }
@@ -135,12 +137,58 @@ t_msginfotype get_rget_or_set_message_info(char *message, unsigned int *k, unsig
     return MI_SUCCESS;
 }
 
+t_msginfotype get_bulk_message_info(char *message, unsigned int *k, unsigned int *n, unsigned int *node_i, size_t *length)
+{
+    if (sscanf(message, "%u %u %u %zu", k, n, node_i, length) != 4) {
+        // Invalid message
+        return MI_INVALID;
+    }
+
+    if (*k > 32) {
+        // Search key / result is invalid
+        return MI_INVALID_K;
+    }
+
+    if (*n >= MAX_REQUESTS) {
+        // Serial number is invalid
+        return MI_INVALID_N;
+    }
+
+    if (*node_i > 32) {
+        // Node key is invalid
+        return MI_INVALID_ID;
+    }
+
+    return MI_SUCCESS;
+}
+
+int fits_inline(char *value, size_t length)
+{
+    if (length > MAX_INLINE_VALUE)
+        return 0;
+    // sscanf() would skip leading whitespace
+    if (length > 0 && isspace((unsigned char) value[0]))
+        return 0;
+    return memchr(value, '\n', length) == NULL && memchr(value, '\0', length) == NULL;
+}
+
 void ipaddr_from_sockaddr(struct sockaddr *sa, char *dest)
 {
     struct in_addr addr = ((struct sockaddr_in*)sa)->sin_addr;
     inet_ntop(AF_INET, &addr, dest, INET_ADDRSTRLEN);
 }
 
+void print_object(unsigned int key, char *value, size_t length)
+{
+    if (value == NULL) {
+        printf("%u -> NULL\n", key);
+        return;
+    }
+    printf("%u -> \"", key);
+    fwrite(value, sizeof(char), length, stdout);
+    puts("\"");
+}
+
 unsigned int ring_distance(unsigned int key1, unsigned int key2)
 {
     // This works because both key1 and key2 are unsigned integers, so 
@@ -148,6 +196,42 @@ unsigned int ring_distance(unsigned int key1, unsigned int key2)
     return (key2 - key1) % 32;
 }
 
+int is_owner(unsigned int key, t_nodeinfo *ni)
+{
+    return ring_distance(ni->key, key) <= ring_distance(ni->succ_id, key);
+}
+
+int first_key(unsigned int keys)
+{
+    for (int key = 0; key < 32; key++) {
+        if (keys & (1u << key))
+            return key;
+    }
+    return -1;
+}
+
+int nearest_key(unsigned int keys, unsigned int from)
+{
+    for (unsigned int i = 0; i < 32; i++) {
+        unsigned int key = (from + i) % 32;
+        if (keys & (1u << key))
+            return key;
+    }
+    return -1;
+}
+
+t_nodeinfo *closest_vnode(unsigned int key, t_nodeinfo *ni)
+{
+    t_nodeinfo *closest = NULL;
+    for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        if (!__atomic_load_n(&vn->routable, __ATOMIC_ACQUIRE))
+            continue;
+        if (closest == NULL || ring_distance(vn->key, key) < ring_distance(closest->key, key))
+            closest = vn;
+    }
+    return closest;
+}
+
 int create_ring(t_nodeinfo *ni)
 {
     // Create server
@@ -219,4 +303,21 @@ int cmp_addr(struct sockaddr *a1, struct sockaddr *a2)
     struct sockaddr_in *addr1 = (struct sockaddr_in*) a1, *addr2 = (struct sockaddr_in*) a2;
     return addr1->sin_addr.s_addr == addr2->sin_addr.s_addr
         && addr1->sin_port == addr2->sin_port;
-}
\ No newline at end of file
+}
+
+double seconds_until(struct timeval until)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return until.tv_sec - now.tv_sec + 1e-6 * (until.tv_usec - now.tv_usec);
+}
+
+struct timeval seconds_from_now(double seconds)
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    long usec = t.tv_usec + (long) (seconds * 1e6);
+    t.tv_sec += usec / 1000000;
+    t.tv_usec = usec % 1000000;
+    return t;
+}
@@ -1,12 +1,17 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#ifndef _POSIX_C_SOURCE
 #define _POSIX_C_SOURCE 200112L
+#endif
 #include "common.h"
 #include <stddef.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 
+// Largest value that can be carried by a regular SET/RGET message
+#define MAX_INLINE_VALUE 16
+
 typedef enum msginfotype {
     MI_SUCCESS,
     MI_INVALID_PORT,
@@ -87,6 +92,27 @@ t_msginfotype get_fnd_or_rsp_or_get_message_info(char *message, unsigned int *k,
  */
 t_msginfotype get_rget_or_set_message_info(char *message, unsigned int *k, unsigned int *n, unsigned int *node_i, char *value);
 
+/**
+ * @brief Get the search key/result, serial number, node identifier and body length from a BSET/BRGET message
+ * 
+ * @param message the message containing the information
+ * @param k where to store the search key/result
+ * @param n where to store the search serial number
+ * @param node_i where to store the node identifier
+ * @param length where to store the length of the body that follows the message
+ * @return [ @b t_msginfotype ] type of result
+ */
+t_msginfotype get_bulk_message_info(char *message, unsigned int *k, unsigned int *n, unsigned int *node_i, size_t *length);
+
+/**
+ * @brief Checks whether a value can be sent inside a regular SET/RGET message
+ * 
+ * @param value the value
+ * @param length size of the value in bytes
+ * @return [ @b int ] 1 if true, 0 if false 
+ */
+int fits_inline(char *value, size_t length);
+
 /**
  * @brief Fills @b dest with the IP address contained in @b sa
  * 
@@ -95,6 +121,15 @@ t_msginfotype get_rget_or_set_message_info(char *message, unsigned int *k, unsig
  */
 void ipaddr_from_sockaddr(struct sockaddr *sa, char *dest);
 
+/**
+ * @brief Print an object's key and value
+ * 
+ * @param key object's key
+ * @param value object's value (NULL if there is none)
+ * @param length size of the value in bytes
+ */
+void print_object(unsigned int key, char *value, size_t length);
+
 /**
  * @brief Calculates the ring distance between key1 and key2
  * 
@@ -103,6 +138,43 @@ void ipaddr_from_sockaddr(struct sockaddr *sa, char *dest);
  */
 unsigned int ring_distance(unsigned int key1, unsigned int key2);
 
+/**
+ * @brief Checks whether this node owns a key (i.e. the key lies between this node and its successor)
+ * 
+ * @param key the key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 1 if true, 0 if false 
+ */
+int is_owner(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Get the lowest key in a set of keys
+ * 
+ * @param keys the keys (a bitmask)
+ * @return [ @b int ] the key, or -1 if the set is empty
+ */
+int first_key(unsigned int keys);
+
+/**
+ * @brief Get the first key of a set of keys that comes after a given one (clockwise,
+ * the given one included)
+ * 
+ * @param keys the keys (a bitmask)
+ * @param from where to start looking
+ * @return [ @b int ] the key, or -1 if the set is empty
+ */
+int nearest_key(unsigned int keys, unsigned int from);
+
+/**
+ * @brief Find the virtual node (of those in the ring) that is the closest to a key,
+ * so requests take as few hops as possible
+ * 
+ * @param key the key
+ * @param ni necessary information about the node
+ * @return [ @b t_nodeinfo* ] the virtual node, or NULL if none of them is in a ring
+ */
+t_nodeinfo *closest_vnode(unsigned int key, t_nodeinfo *ni);
+
 /**
  * @brief Create a new ring
  * 
@@ -131,4 +203,20 @@ int join_ring(unsigned int pred_key, char *pred_ipaddr, unsigned int pred_port,
  */
 int cmp_addr(struct sockaddr *a1, struct sockaddr *a2);
 
+/**
+ * @brief Get how many seconds are left until a moment
+ * 
+ * @param until the moment
+ * @return [ @b double ] the seconds left (negative if the moment has passed)
+ */
+double seconds_until(struct timeval until);
+
+/**
+ * @brief Get the moment a number of seconds from now
+ * 
+ * @param seconds the seconds
+ * @return [ @b struct timeval ] the moment
+ */
+struct timeval seconds_from_now(double seconds);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,232 @@
+#define _POSIX_C_SOURCE 200112L
+#include "watch.h"
+#include "server.h"
+#include "utils.h"
+#include "control.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+
+struct watcher {
+    // Node that asked to be told about the changes, and the watch's identifier there
+    unsigned int node, id;
+    char ipaddr[INET_ADDRSTRLEN];
+    unsigned int port;
+    // Where the node's UDP messages go
+    struct addrinfo *info;
+    struct watcher *next;
+};
+
+struct watch {
+    unsigned int id, key;
+    // Client the notifications go to, and the identifier of its request
+    int client;
+    unsigned long tag;
+    struct watch *next;
+};
+
+t_watcher *add_watcher(unsigned int key, unsigned int node, unsigned int id, char *ipaddr, unsigned int port, t_nodeinfo *ni)
+{
+    if (key > 31)
+        return NULL;
+    for (t_watcher *w = ni->watchers[key]; w != NULL; w = w->next) {
+        if (w->node == node && w->id == id)
+            return w;
+    }
+    t_watcher *w = (t_watcher*) calloc(1, sizeof(t_watcher));
+    if (w == NULL)
+        return NULL;
+    if (generate_udp_addrinfo(ipaddr, port, &w->info) != 0) {
+        free(w);
+        return NULL;
+    }
+    w->node = node;
+    w->id = id;
+    strcpy(w->ipaddr, ipaddr);
+    w->port = port;
+    w->next = ni->watchers[key];
+    ni->watchers[key] = w;
+    return w;
+}
+
+/**
+ * @brief Free a watcher
+ *
+ * @param w the watcher
+ */
+void free_watcher(t_watcher *w)
+{
+    freeaddrinfo(w->info);
+    free(w);
+}
+
+void remove_watcher(unsigned int key, unsigned int node, unsigned int id, t_nodeinfo *ni)
+{
+    if (key > 31)
+        return;
+    for (t_watcher **w = &ni->watchers[key]; *w != NULL; w = &(*w)->next) {
+        if ((*w)->node == node && (*w)->id == id) {
+            t_watcher *removed = *w;
+            *w = removed->next;
+            free_watcher(removed);
+            return;
+        }
+    }
+}
+
+int send_notification(t_watcher *w, unsigned int key, t_nodeinfo *ni)
+{
+    t_object *object = get_object(key, ni);
+    unsigned long version = ni->objects[key].version;
+    if (w->node == ni->key) {
+        deliver_notification(w->id, key, version, object != NULL ? object->value : NULL, object != NULL ? object->length : 0, ni);
+        return 0;
+    }
+
+    char message[64] = "";
+    if (object != NULL && !fits_inline(object->value, object->length)) {
+        sprintf(message, "BNOTE %u %u %u %lu %zu\n", w->node, w->id, key, version, object->length);
+        if (sendall(ni->succ_fd, message, strlen(message)) != 0 || sendall(ni->succ_fd, object->value, object->length) != 0) {
+            puts("\x1b[31m[!] Couldn't send notification\033[m");
+            return -1;
+        }
+        return 0;
+    }
+
+    int size = sprintf(message, "NOTE %u %u %u %lu", w->node, w->id, key, version);
+    if (object != NULL)
+        size += sprintf(message+size, " %s", object->value);
+    // Straight to the watching node, unless a message to it is still waiting for its
+    // ACK (if this one gets lost, it goes through the successor instead)
+    if (find_udp_message_from(ni, w->info->ai_addr) == NULL && udpsend(ni->udp_fd, message, size, w->info) == 0)
+        return register_udp_message(ni, message, size, w->info->ai_addr, w->info->ai_addrlen, UDPMSG_CHORD);
+    strcat(message, "\n");
+    if (sendall(ni->succ_fd, message, size+1) != 0) {
+        puts("\x1b[31m[!] Couldn't send notification\033[m");
+        return -1;
+    }
+    return 0;
+}
+
+void notify_watchers(unsigned int key, t_nodeinfo *ni)
+{
+    if (key > 31)
+        return;
+    // Sending may remove the watcher (when it is this node's and its client is gone)
+    t_watcher *next;
+    for (t_watcher *w = ni->watchers[key]; w != NULL; w = next) {
+        next = w->next;
+        send_notification(w, key, ni);
+    }
+}
+
+int send_watchers(int fd, unsigned int keys, t_nodeinfo *ni)
+{
+    for (unsigned int key = 0; key < 32; key++) {
+        if (!(keys & (1u << key)))
+            continue;
+        for (t_watcher *w = ni->watchers[key]; w != NULL; w = w->next) {
+            char message[64] = "";
+            sprintf(message, "XWATCH %u %u %u %s %u\n", key, w->node, w->id, w->ipaddr, w->port);
+            if (sendall(fd, message, strlen(message)) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+void drop_watchers(unsigned int keys, t_nodeinfo *ni)
+{
+    for (unsigned int key = 0; key < 32; key++) {
+        if (!(keys & (1u << key)))
+            continue;
+        while (ni->watchers[key] != NULL) {
+            t_watcher *next = ni->watchers[key]->next;
+            free_watcher(ni->watchers[key]);
+            ni->watchers[key] = next;
+        }
+    }
+}
+
+int add_watch(unsigned int key, int client, unsigned long tag, t_nodeinfo *ni)
+{
+    t_watch *watch = (t_watch*) calloc(1, sizeof(t_watch));
+    if (watch == NULL)
+        return -1;
+    watch->id = ni->watch_n++;
+    watch->key = key;
+    watch->client = client;
+    watch->tag = tag;
+    watch->next = ni->watches;
+    ni->watches = watch;
+
+    if (is_owner(key, ni)) {
+        t_watcher *w = add_watcher(key, ni->key, watch->id, ni->ipaddr, strtoui(ni->self_port), ni);
+        return w != NULL ? send_notification(w, key, ni) : -1;
+    }
+    char message[64] = "";
+    sprintf(message, "WATCH %u %u %u %s %s\n", key, ni->key, watch->id, ni->ipaddr, ni->self_port);
+    return send_to_closest(message, key, ni) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Tell a key's owner to stop sending notifications for a watch
+ *
+ * @param key the key
+ * @param id the watch's identifier
+ * @param ni the virtual node that registered the watch
+ */
+void send_unwatch(unsigned int key, unsigned int id, t_nodeinfo *ni)
+{
+    if (is_owner(key, ni)) {
+        remove_watcher(key, ni->key, id, ni);
+        return;
+    }
+    char message[64] = "";
+    sprintf(message, "UNWATCH %u %u %u\n", key, ni->key, id);
+    send_to_closest(message, key, ni);
+}
+
+int remove_watches(int client, int key, t_nodeinfo *ni)
+{
+    int count = 0;
+    for (t_nodeinfo *vn = ni->first_vnode; vn != NULL; vn = vn->next_vnode) {
+        t_watch **watch = &vn->watches;
+        while (*watch != NULL) {
+            if ((*watch)->client != client || (key != -1 && (*watch)->key != (unsigned int) key)) {
+                watch = &(*watch)->next;
+                continue;
+            }
+            t_watch *removed = *watch;
+            *watch = removed->next;
+            if (vn->main_fd != -1)
+                send_unwatch(removed->key, removed->id, vn);
+            free(removed);
+            count++;
+        }
+    }
+    return count;
+}
+
+void deliver_notification(unsigned int id, unsigned int key, unsigned long version, char *value, size_t length, t_nodeinfo *ni)
+{
+    for (t_watch *watch = ni->watches; watch != NULL; watch = watch->next) {
+        if (watch->id == id && watch->key == key) {
+            reply_change(watch->client, watch->tag, key, version, value, length, ni);
+            return;
+        }
+    }
+    // Nobody is interested anymore
+    send_unwatch(key, id, ni);
+}
+
+void free_watches(t_nodeinfo *ni)
+{
+    drop_watchers(0xffffffff, ni);
+    while (ni->watches != NULL) {
+        t_watch *next = ni->watches->next;
+        free(ni->watches);
+        ni->watches = next;
+    }
+}
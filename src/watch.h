@@ -0,0 +1,112 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "common.h"
+
+/**
+ * @brief Start telling a node about the changes of a key this node owns (nothing
+ * happens if it is already being told)
+ *
+ * @param key the key
+ * @param node the node that asked
+ * @param id the watch's identifier at that node
+ * @param ipaddr the node's IP address
+ * @param port the node's port
+ * @param ni necessary information about the node
+ * @return [ @b t_watcher* ] the watcher, or NULL in case of an error
+ */
+t_watcher *add_watcher(unsigned int key, unsigned int node, unsigned int id, char *ipaddr, unsigned int port, t_nodeinfo *ni);
+
+/**
+ * @brief Stop telling a node about the changes of a key
+ *
+ * @param key the key
+ * @param node the node
+ * @param id the watch's identifier at that node
+ * @param ni necessary information about the node
+ */
+void remove_watcher(unsigned int key, unsigned int node, unsigned int id, t_nodeinfo *ni);
+
+/**
+ * @brief Tell a watcher about the current value and version of a key. Small values
+ * go straight to the watching node over UDP (NOTE), the others (and the ones whose UDP
+ * messages get lost) through the successors over TCP (NOTE or BNOTE)
+ *
+ * @param w the watcher
+ * @param key the key
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_notification(t_watcher *w, unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Tell every watcher of a key that it has changed
+ *
+ * @param key the key
+ * @param ni necessary information about the node
+ */
+void notify_watchers(unsigned int key, t_nodeinfo *ni);
+
+/**
+ * @brief Hand the watchers of some keys over to a neighbour (XWATCH), along with the
+ * keys' objects
+ *
+ * @param fd socket connected to the neighbour
+ * @param keys the keys (a bitmask)
+ * @param ni necessary information about the node
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int send_watchers(int fd, unsigned int keys, t_nodeinfo *ni);
+
+/**
+ * @brief Forget the watchers of some keys (once they belong to another node)
+ *
+ * @param keys the keys (a bitmask)
+ * @param ni necessary information about the node
+ */
+void drop_watchers(unsigned int keys, t_nodeinfo *ni);
+
+/**
+ * @brief Register a watch on behalf of whoever is making the current request, and ask
+ * the key's owner for notifications (WATCH)
+ *
+ * @param key the key
+ * @param client the client (NO_CLIENT for the console)
+ * @param tag the request's identifier, which the notifications carry
+ * @param ni the virtual node that sends the request
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int add_watch(unsigned int key, int client, unsigned long tag, t_nodeinfo *ni);
+
+/**
+ * @brief Remove a client's watches (on one key or all of them), in every virtual node,
+ * and tell the keys' owners (UNWATCH)
+ *
+ * @param client the client (NO_CLIENT for the console)
+ * @param key the key (-1 for every key)
+ * @param ni necessary information about the node
+ * @return [ @b int ] how many watches were removed
+ */
+int remove_watches(int client, int key, t_nodeinfo *ni);
+
+/**
+ * @brief Pass a notification on to the client that asked for it (if it is gone, the
+ * owner is told to stop sending them)
+ *
+ * @param id the watch's identifier
+ * @param key the key
+ * @param version the key's version
+ * @param value its value (NULL if it was deleted)
+ * @param length its size
+ * @param ni necessary information about the node
+ */
+void deliver_notification(unsigned int id, unsigned int key, unsigned long version, char *value, size_t length, t_nodeinfo *ni);
+
+/**
+ * @brief Free every watcher and watch of a node
+ *
+ * @param ni necessary information about the node
+ */
+void free_watches(t_nodeinfo *ni);
+
+#endif
@@ -0,0 +1,351 @@
+#define _POSIX_C_SOURCE 200112L
+#include "worker.h"
+#include "server.h"
+#include "event.h"
+#include "utils.h"
+#include "storage.h"
+#include "lease.h"
+#include "expiry.h"
+#include "erasure.h"
+#include "queue.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <time.h>
+
+// How many messages can be waiting to be handed from one worker thread to another
+#define QUEUE_SIZE 256
+
+typedef struct queue_slot {
+    t_datagram dg;
+    // Virtual node that should process the message
+    t_nodeinfo *target;
+} t_queue_slot;
+
+typedef struct worker {
+    pthread_t thread;
+    // Whether the thread was started
+    int running;
+    unsigned int index;
+    struct workers *workers;
+    // Held by the thread while it handles an event (and by pause_workers())
+    pthread_mutex_t lock;
+    // Socket bound to the first virtual node's port (-1 if there is none)
+    int udp_fd;
+    // Written to whenever a message is handed to this thread (read end, write end)
+    int wakeup[2];
+    // Messages handed to this thread, one queue (of t_queue_slot) per producer
+    t_spsc_queue **inbox;
+} t_worker;
+
+struct workers {
+    t_worker *threads;
+    unsigned int count;
+    t_nodeinfo *first;
+    // Set while the main thread is accessing the virtual nodes
+    int paused;
+    // Set when the threads should exit
+    int stop;
+    // Set when one of the threads stopped because of an error
+    int failed;
+};
+
+t_workers *new_workers(unsigned int count, t_nodeinfo *ni)
+{
+    t_workers *w = (t_workers*) calloc(1, sizeof(t_workers));
+    if (w == NULL)
+        return NULL;
+    w->threads = (t_worker*) calloc(count, sizeof(t_worker));
+    if (w->threads == NULL) {
+        free(w);
+        return NULL;
+    }
+    w->count = count;
+    w->first = ni->first_vnode;
+
+    for (unsigned int i = 0; i < count; i++) {
+        t_worker *t = &w->threads[i];
+        t->index = i;
+        t->workers = w;
+        t->udp_fd = -1;
+        t->wakeup[0] = t->wakeup[1] = -1;
+        pthread_mutex_init(&t->lock, NULL);
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        t_worker *t = &w->threads[i];
+        t->inbox = (t_spsc_queue**) calloc(count, sizeof(t_spsc_queue*));
+        if (t->inbox == NULL || pipe(t->wakeup) != 0) {
+            free_workers(w);
+            return NULL;
+        }
+        for (unsigned int j = 0; j < count; j++) {
+            if ((t->inbox[j] = new_queue(QUEUE_SIZE, sizeof(t_queue_slot))) == NULL) {
+                free_workers(w);
+                return NULL;
+            }
+        }
+        fcntl(t->wakeup[0], F_SETFL, O_NONBLOCK);
+        fcntl(t->wakeup[1], F_SETFL, O_NONBLOCK);
+    }
+
+    // Each thread runs every count-th virtual node
+    unsigned int i = 0;
+    for (t_nodeinfo *vn = w->first; vn != NULL; vn = vn->next_vnode, i++) {
+        vn->workers = w;
+        vn->worker = i % count;
+    }
+    return w;
+}
+
+/**
+ * @brief Find the virtual node a message received through the shared port concerns
+ *
+ * @param dg the message
+ * @param first the first virtual node
+ * @return [ @b t_nodeinfo* ] the virtual node
+ */
+t_nodeinfo *datagram_target(t_datagram *dg, t_nodeinfo *first)
+{
+    unsigned int key;
+    char *fields = strchr(dg->body, ' ');
+    if (strncmp(dg->body, "RSP ", 4) == 0 || strncmp(dg->body, "RGET ", 5) == 0 || strncmp(dg->body, "MRSP ", 5) == 0
+            || strncmp(dg->body, "NOTE ", 5) == 0 || strncmp(dg->body, "LRGET ", 6) == 0 || strncmp(dg->body, "ROP ", 4) == 0
+            || strncmp(dg->body, "SACK ", 5) == 0) {
+        // Answers go to the virtual node that asked
+        if (sscanf(fields+1, "%u", &key) == 1) {
+            for (t_nodeinfo *vn = first; vn != NULL; vn = vn->next_vnode) {
+                if (vn->key == key)
+                    return vn;
+            }
+        }
+        return first;
+    }
+    unsigned int keys;
+    if ((strncmp(dg->body, "MGET ", 5) == 0 || strncmp(dg->body, "MSET ", 5) == 0 || strncmp(dg->body, "MFND ", 5) == 0)
+            && sscanf(fields+1, "%x", &keys) == 1 && keys != 0) {
+        // Batch requests go where their first key would
+        t_nodeinfo *closest = closest_vnode(first_key(keys), first);
+        return closest != NULL ? closest : first;
+    }
+    if (fields == NULL || sscanf(fields+1, "%u", &key) != 1 || (strncmp(dg->body, "FND ", 4) != 0
+            && strncmp(dg->body, "GET ", 4) != 0 && strncmp(dg->body, "SET ", 4) != 0 && strncmp(dg->body, "EFND ", 5) != 0
+            && strncmp(dg->body, "SCAN ", 5) != 0 && strncmp(dg->body, "WATCH ", 6) != 0
+            && strncmp(dg->body, "UNWATCH ", 8) != 0 && strncmp(dg->body, "OP ", 3) != 0))
+        // Acknowledgements and answers to the first virtual node's own requests
+        return first;
+
+    // Requests go to whichever virtual node (in the ring) is the closest to the key
+    t_nodeinfo *closest = closest_vnode(key, first);
+    return closest != NULL ? closest : first;
+}
+
+int dispatch_datagram(t_datagram *dg, int fd, unsigned int worker, t_nodeinfo *ni)
+{
+    t_workers *w = ni->workers;
+    t_queue_slot slot;
+    slot.target = datagram_target(dg, w->first);
+    int ack = strcmp(dg->body, "ACK") != 0 && !dg->acked;
+    dg->acked = 1;
+    slot.dg = *dg;
+
+    if (slot.target->worker != worker) {
+        t_worker *t = &w->threads[slot.target->worker];
+        if (queue_push(t->inbox[worker], &slot) != 0) {
+            // Don't acknowledge it, so the sender tries again
+            puts("\x1b[33m[!] Worker queue is full, dropping UDP message\033[m");
+            return 0;
+        }
+        if (write(t->wakeup[1], "", 1) == -1) {
+            // The pipe is full, so the thread will wake up anyway
+        }
+    }
+
+    if (ack) {
+        struct addrinfo sender;
+        sender.ai_addr = (struct sockaddr*) &dg->sender;
+        sender.ai_addrlen = dg->sender_len;
+        if (udpsend(fd, "ACK", 3, &sender) != 0)
+            puts("\x1b[33m[!] Error acknowledging message\033[m");
+    }
+
+    if (slot.target->worker == worker)
+        return process_datagram(&slot.dg, slot.target);
+    return 0;
+}
+
+/**
+ * @brief Wait for an event in the virtual nodes run by a worker thread (or in the
+ * shared port or its queues) and handle it
+ *
+ * @param t the worker thread
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int run_worker_once(t_worker *t)
+{
+    t_workers *w = t->workers;
+
+    // Share the first virtual node's port while it is in a ring (the thread that
+    // runs it uses its socket)
+    if (t->index != w->first->worker) {
+        int routable = __atomic_load_n(&w->first->routable, __ATOMIC_ACQUIRE);
+        if (routable && t->udp_fd == -1)
+            t->udp_fd = open_udp_socket(w->first->self_port, 1);
+        else if (!routable && t->udp_fd != -1) {
+            close(t->udp_fd);
+            t->udp_fd = -1;
+        }
+    }
+
+    t_nodeinfo *source;
+    t_event e = select_event(w->first, t->index, 0, &source);
+
+    for (t_nodeinfo *vn = w->first; vn != NULL; vn = vn->next_vnode) {
+        if (vn->worker != t->index)
+            continue;
+        // Nothing else may be written into the links while a body is relayed through them
+        // (unless it stopped arriving)
+        expire_relays(vn);
+        if (is_relaying(vn))
+            continue;
+
+        // First of all, check for lost UDP messages
+        check_for_lost_udp_messages(vn);
+
+        // Look for differences between the objects and the successor's replicas
+        run_anti_entropy(vn);
+
+        // Apply the writes whose leases have run out
+        expire_leases(vn);
+
+        // Give up on the SETs that weren't acknowledged
+        expire_set_requests(vn);
+
+        // Delete the objects whose time to live has run out
+        expire_objects(vn);
+
+        // Give up on the objects whose fragments didn't all come back
+        expire_rebuilds(vn);
+
+        // Drop the values decompressed while handling the previous event
+        release_unpacked(vn);
+
+        // Commit the latest batch of logged objects
+        if (vn->storage != NULL && sync_storage(vn->storage, 0, vn) != 0)
+            return -1;
+    }
+
+    if (e == E_MESSAGE_SHARED) {
+        t_datagram dg;
+        if (recv_datagram(t->udp_fd, &dg) != 0)
+            return -1;
+        return dispatch_datagram(&dg, t->udp_fd, t->index, w->first);
+    }
+    if (e == E_MESSAGE_QUEUE) {
+        char discard[64];
+        while (read(t->wakeup[0], discard, sizeof(discard)) > 0)
+            continue;
+        t_queue_slot slot;
+        for (unsigned int i = 0; i < w->count; i++) {
+            while (queue_pop(t->inbox[i], &slot)) {
+                if (process_datagram(&slot.dg, slot.target) != 0)
+                    return -1;
+            }
+        }
+        return 0;
+    }
+    return process_event(e, source);
+}
+
+/**
+ * @brief Body of a worker thread
+ *
+ * @param arg the t_worker object
+ */
+void *run_worker(void *arg)
+{
+    t_worker *t = (t_worker*) arg;
+    t_workers *w = t->workers;
+    while (!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+        if (__atomic_load_n(&w->paused, __ATOMIC_ACQUIRE)) {
+            // Let the main thread take the lock
+            struct timespec delay = { .tv_sec = 0, .tv_nsec = 100000 };
+            nanosleep(&delay, NULL);
+            continue;
+        }
+        pthread_mutex_lock(&t->lock);
+        int result = run_worker_once(t);
+        pthread_mutex_unlock(&t->lock);
+        if (result != 0) {
+            printf("\x1b[31m[!] Worker thread %u has stopped because of an error\033[m\n", t->index);
+            __atomic_store_n(&w->failed, 1, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    return NULL;
+}
+
+int start_workers(t_workers *w)
+{
+    for (unsigned int i = 0; i < w->count; i++) {
+        if (pthread_create(&w->threads[i].thread, NULL, run_worker, &w->threads[i]) != 0)
+            return -1;
+        w->threads[i].running = 1;
+    }
+    return 0;
+}
+
+void pause_workers(t_workers *w)
+{
+    if (w == NULL)
+        return;
+    __atomic_store_n(&w->paused, 1, __ATOMIC_RELEASE);
+    for (unsigned int i = 0; i < w->count; i++)
+        pthread_mutex_lock(&w->threads[i].lock);
+}
+
+void resume_workers(t_workers *w)
+{
+    if (w == NULL)
+        return;
+    for (unsigned int i = 0; i < w->count; i++)
+        pthread_mutex_unlock(&w->threads[i].lock);
+    __atomic_store_n(&w->paused, 0, __ATOMIC_RELEASE);
+}
+
+int workers_failed(t_workers *w)
+{
+    return __atomic_load_n(&w->failed, __ATOMIC_ACQUIRE);
+}
+
+void get_worker_fds(t_workers *w, unsigned int worker, int *udp_fd, int *wakeup_fd)
+{
+    *udp_fd = w->threads[worker].udp_fd;
+    *wakeup_fd = w->threads[worker].wakeup[0];
+}
+
+void free_workers(t_workers *w)
+{
+    if (w == NULL)
+        return;
+    __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+    for (unsigned int i = 0; i < w->count; i++) {
+        t_worker *t = &w->threads[i];
+        if (t->running)
+            pthread_join(t->thread, NULL);
+        if (t->udp_fd >= 0)
+            close(t->udp_fd);
+        if (t->wakeup[0] >= 0)
+            close(t->wakeup[0]);
+        if (t->wakeup[1] >= 0)
+            close(t->wakeup[1]);
+        pthread_mutex_destroy(&t->lock);
+        for (unsigned int j = 0; t->inbox != NULL && j < w->count; j++)
+            free_queue(t->inbox[j]);
+        free(t->inbox);
+    }
+    free(w->threads);
+    free(w);
+}
@@ -0,0 +1,78 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "common.h"
+
+/**
+ * @brief Create the worker threads (without starting them) and split the virtual
+ * nodes among them, so that each one owns a shard of the key space
+ *
+ * @param count number of worker threads
+ * @param ni necessary information about the node (the first virtual node)
+ * @return [ @b t_workers* ] the t_workers object, or NULL in case of an error
+ */
+t_workers *new_workers(unsigned int count, t_nodeinfo *ni);
+
+/**
+ * @brief Start running the virtual nodes on the worker threads
+ *
+ * @param w the t_workers object
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int start_workers(t_workers *w);
+
+/**
+ * @brief Block until every worker thread is idle and keep them that way, so the
+ * calling thread can safely access every virtual node
+ *
+ * @param w the t_workers object (nothing happens if it is NULL)
+ */
+void pause_workers(t_workers *w);
+
+/**
+ * @brief Let the worker threads run again after pause_workers()
+ *
+ * @param w the t_workers object (nothing happens if it is NULL)
+ */
+void resume_workers(t_workers *w);
+
+/**
+ * @brief Checks whether any of the worker threads has stopped because of an error
+ *
+ * @param w the t_workers object
+ * @return [ @b int ] 1 if true, 0 if false
+ */
+int workers_failed(t_workers *w);
+
+/**
+ * @brief Get the file descriptors a worker thread waits on besides its virtual nodes'
+ *
+ * @param w the t_workers object
+ * @param worker index of the worker thread
+ * @param udp_fd where to store its socket bound to the shared port (-1 if there is none)
+ * @param wakeup_fd where to store the file descriptor that becomes readable when other
+ * worker threads hand it messages
+ */
+void get_worker_fds(t_workers *w, unsigned int worker, int *udp_fd, int *wakeup_fd);
+
+/**
+ * @brief Acknowledge a message received through the shared port and have it processed
+ * by the virtual node it concerns, handing it to the worker thread that runs that
+ * virtual node if it is not the current one
+ *
+ * @param dg the message
+ * @param fd socket the message was received through
+ * @param worker index of the current worker thread
+ * @param ni necessary information about the node (any of the virtual nodes)
+ * @return [ @b int ] 0 if successfull, -1 otherwise
+ */
+int dispatch_datagram(t_datagram *dg, int fd, unsigned int worker, t_nodeinfo *ni);
+
+/**
+ * @brief Stop the worker threads, wait for them to finish and free the t_workers object
+ *
+ * @param w the t_workers object
+ */
+void free_workers(t_workers *w);
+
+#endif